@@ -12,6 +12,8 @@
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 
 namespace zamt {
 
@@ -26,10 +28,20 @@ class Core : public Module {
   const static int kExitCodeSIGTERM = 101;
   const static int kExitCodeSIGINT = 102;
   const static int kExitCodeAudioProblem = 200;
+  const static int kExitCodeIPCProblem = 201;
 
   const static char* kModuleLabel;
   const static char* kHelpParamStr;
   const static char* kThreadsParamStr;
+  const static char* kVirtualTimeParamStr;
+  const static char* kAdaptiveWorkersParamStr;
+  const static char* kTraceParamStr;
+  const static char* kWatchdogParamStr;
+  const static char* kShutdownTimeoutParamStr;
+  const static int kDefaultShutdownTimeoutInMs = 1000;
+  const static int kDefaultWatchdogIntervalInMs = 1000;
+  const static int kPoolWarningPercent = 90;  // of packets in use
+  const static char* kDefaultTracePath;
 
 #ifdef TEST
   /// For testing purposes, simulate if the process only starts now
@@ -44,12 +56,23 @@ class Core : public Module {
   /// Initiate normal shutdown of the system.
   void Quit(int exit_code);
   /// Blocks execution until someone calls Quit(), returns the exit code.
+  /// SIGTERM and SIGINT only leave a flag for this thread to call Quit().
   int WaitForQuit();
   /// The given function is called immediately when quit is called before
-  /// core thread starts the shutdown process. Objects should not rely on
-  /// other objects existence after this point.
+  /// core thread starts the shutdown process, on the waiting thread after a
+  /// signal. Objects should not rely on other objects existence after this
+  /// point.
   void RegisterForQuitEvent(OnQuitCallback on_quit_callback);
 
+  /**
+   * Modules stopping asynchronously (e.g. sources on their own threads) get
+   * an ID here and report with it when they stopped after the quit event.
+   * Shutdown waits for them, then lets the scheduler finish the tasks
+   * submitted, both bounded by the shutdown timeout.
+   */
+  int AddShutdownParticipant(const char* label);
+  void ReportReadyForShutdown(int participant_id);
+
   /// Get CLIParameters
   CLIParameters& cli() { return cli_; }
   /// Get the main Scheduler working in the system
@@ -57,8 +80,14 @@ class Core : public Module {
 
  private:
   const static int kNoExitCode = -999999;
+  const static int kSignalCheckIntervalInMs = 50;
+
+  struct HealthState;
 
   void PrintHelp();
+  bool AreParticipantsReady() const;
+  /// Samples the scheduler, logs problems found and a health line.
+  void CheckHealth();
 
   // These are system wide and shut every instance down in the current process.
   static std::atomic<int> exit_code_;
@@ -69,7 +98,15 @@ class Core : public Module {
   std::unique_ptr<Log> log_;
   CLIParameters cli_;
   std::unique_ptr<Scheduler> scheduler_;
+  int shutdown_timeout_in_ms_ = kDefaultShutdownTimeoutInMs;
+  // Guarded by mutex_
+  std::vector<const char*> participant_labels_;
+  std::vector<bool> participants_ready_;
+  std::mutex callbacks_mutex_;
   std::deque<OnQuitCallback> on_quit_callbacks_;
+  std::string trace_path_;  // empty if not tracing
+  int watchdog_interval_in_ms_ = 0;  // 0 if there is no watchdog
+  std::unique_ptr<HealthState> health_;  // used by the core thread only
 };
 
 }  // namespace zamt
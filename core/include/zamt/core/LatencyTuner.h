@@ -0,0 +1,53 @@
+#ifndef ZAMT_CORE_LATENCYTUNER_H_
+#define ZAMT_CORE_LATENCYTUNER_H_
+
+/// Picks the lowest latency a source can keep up with, from its pool load.
+/**
+ * The source samples the statistics of its packet pool once in every
+ * period and asks the tuner which latency to use. A period is bad if
+ * packets were lost or if packets were kept by the sinks (queueing and
+ * processing) for longer than a part of the time a packet covers: the
+ * latency is doubled then. After a number of good periods in a row the
+ * latency is halved, but never to a latency that was bad recently. The bad
+ * one is tried again only after a long good run, so a load spike does not
+ * keep the latency high forever, and probing does not cause losses often.
+ */
+
+#include "zamt/core/Scheduler.h"
+
+#include <cstdint>
+
+namespace zamt {
+
+class LatencyTuner {
+ public:
+  const static int kGoodPeriodsBeforeDecrease = 8;
+  const static int kGoodPeriodsBeforeRetry = 120;
+  const static int kMaxTurnaroundPercent = 50;  // of the packet duration
+
+  /// Latencies are in samples, from min_latency up to max_latency.
+  LatencyTuner(int min_latency, int max_latency, int start_latency);
+
+  /**
+   * Takes the pool statistics sampled at the end of a period and the time
+   * one packet covers at the current latency. Returns the latency to use
+   * from now on, it is the current one if nothing should change.
+   */
+  int Update(const Scheduler::PoolStats& stats,
+             Scheduler::Time packet_duration_in_us);
+
+  int latency() const { return latency_; }
+
+ private:
+  int min_latency_;
+  int max_latency_;
+  int latency_;
+  int bad_latency_ = 0;  // the highest bad one below latency_ (0 if none)
+  int good_periods_ = 0;
+  bool has_previous_ = false;
+  Scheduler::PoolStats previous_;
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_CORE_LATENCYTUNER_H_
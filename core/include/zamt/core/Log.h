@@ -4,12 +4,26 @@
 #include "zamt/core/CLIParameters.h"
 
 /// Very simple handling of output to console.
+/**
+ * Log messages never wait for the console: they are copied into a ring of
+ * the calling thread and a background thread formats and writes them in
+ * the order they were logged. Numbers are formatted only there. If a ring
+ * is full, the message is dropped and the drops are reported later.
+ * A message repeated too often is written only a few times per second,
+ * followed by the number of its suppressed repetitions.
+ */
 
 namespace zamt {
 
 class Log {
  public:
   const static char* kVerboseParamStr;
+  const static char* kLogFileParamStr;
+  const static int kRingMessages = 256;  // per thread
+  const static int kMaxMessageLength = 192;
+  const static int kFlushIntervalInMs = 20;
+  const static int kRateLimitWindowInMs = 1000;
+  const static int kRateLimitMessages = 10;  // same message in a window
 
   /// Label is prefixed to every log message. Set verbose mode.
   Log(const char* label, const CLIParameters& cli);
@@ -18,6 +32,8 @@ class Log {
   static void Print(const char* messa);
   /// Print help for verbose handling.
   static void PrintHelp4Verbose();
+  /// Wait until the messages logged before are written out.
+  static void Flush();
 
   /// Log only if verbose mode is on, output message in nice log format.
   void LogMessage(const char* msg);
@@ -6,9 +6,17 @@
 namespace zamt {
 
 class ModuleCenter;
+class ModuleDependencies;
 
 class Module {
  public:
+  /// Descendants name themselves for logging.
+  const static char* kModuleLabel;
+
+  /// Descendants add the modules they use during their construction or
+  /// initialization, those are started before and stopped after them.
+  static void DeclareDependencies(ModuleDependencies&) {}
+
   /// Constructor in descendants is used to pass runtime configuration data.
   Module(/*int argc, const char* const* argv*/) {}
   ~Module() {}
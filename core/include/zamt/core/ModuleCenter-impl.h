@@ -7,12 +7,17 @@
 
 namespace zamt {
 
+template <class ModuleClass>
+void ModuleDependencies::Add() {
+  ids_.push_back(ModuleCenter::GetId<ModuleClass>());
+}
+
 template <class ModuleClass>
 ModuleClass& ModuleCenter::Get() const {
-  size_t key = ModuleStub<ModuleClass>::GetId();
-  auto instanceIter = module_instances_.find(key);
-  assert(instanceIter != module_instances_.end());
-  return *static_cast<ModuleClass*>(instanceIter->second);
+  // Using the bootstrap also registers the module
+  int index = ModuleStub<ModuleClass>::bootstrap_.index;
+  assert(index >= 0 && index < module_num_ && instances_[index]);
+  return *static_cast<ModuleClass*>(instances_[index]);
 }
 
 template <class ModuleClass>
@@ -21,10 +26,13 @@ size_t ModuleCenter::GetId() {
 }
 
 template <class ModuleClass>
-ModuleCenter::ModuleBootstrap<ModuleClass>::ModuleBootstrap() : dummy(0) {
+ModuleCenter::ModuleBootstrap<ModuleClass>::ModuleBootstrap()
+    : index(module_num_) {
   assert(module_num_ < kMaxModulesNum);
   ModuleInitRecord& rec = module_inits_[module_num_];
   rec.key = ModuleStub<ModuleClass>::GetId();
+  rec.label = ModuleClass::kModuleLabel;
+  rec.declare_function = &ModuleClass::DeclareDependencies;
   rec.create_function = &ModuleStub<ModuleClass>::Create;
   rec.init_function = &ModuleStub<ModuleClass>::Init;
   rec.destroy_function = &ModuleStub<ModuleClass>::Destroy;
@@ -4,27 +4,54 @@
 /// Does all job dispatching and scheduling in system.
 /**
  * The main thread is used as the UI thread, dedicated to do certain tasks.
+ * A main loop can act as the UI thread instead: it gets notified when UI
+ * tasks arrive and carries them out in batches (DoUITasks()).
  * Other worker threads are created according to the number of CPUs.
  * Sources produce packets which are submitted to subscribed sinks.
+ * Sources get their IDs from the scheduler when registered, so one module
+ * can have any number of them (per device, file, band...). IDs are not
+ * reused soon after a source is unregistered, and sources can be looked up
+ * by their unique names.
  * A packet submission means a work unit for each sink.
  * Scheduling priority takes earliest packets 1st to minimize latency.
- * One source always produces fixed size packets for efficiency.
+ * One source always produces fixed size packets for efficiency. A running
+ * source can change its packet size after its old packets are drained
+ * (ReconfigureSource()).
  * The scheduler labels all work units by the sample (time) they belong to.
  * All buffers between sources and sinks contain a fixed number of packets
  * which are allocated at configuration time (RegisterSource()).
  * It is a scaling problem when the number of packets in any queue is too low.
- * If a sink needs to get packets in order, it has to wait with yield() for
- * earlier jobs to finish.
+ * Elastic pools (SetElasticPool()) grow by segments of the initial size when
+ * most of their packets are used and give back their last segment when it
+ * is not needed any more. Packets never move in memory. Segments are
+ * allocated and freed outside of the lock of the source.
+ * Sources choose what happens when all their packets are in use (drop the
+ * new data, wait for a sink to release one or take back the oldest packet
+ * no sink has started yet) and can watch the pressure on their pool.
+ * Sinks on the workers may get the packets of a source in parallel. If a
+ * sink needs them in order, it subscribes with SubscribeInOrder(): a task
+ * of it waits with yield() for the earlier one to finish.
+ * Only as many idle workers are woken up as many new tasks arrive. In
+ * adaptive mode an idle worker spins a bit before sleeping, and workers are
+ * parked when utilization stays low (and brought back on load).
+ * Work units having the same timestamp are handed out in submission order.
+ *
+ * The clock of the scheduler is the wall clock by default. In virtual time
+ * mode sources drive the clock (e.g. by the number of samples produced), so
+ * offline processing runs as fast as the cores allow and gives the same
+ * timestamps and latencies on every run.
  */
 
 #include <atomic>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -37,9 +64,22 @@ class Scheduler {
   using Time = uint64_t;
   using SinkCallback = std::function<void(SourceId source_id,
                                           const Byte* packet, Time timestamp)>;
+  using LowWatermarkCallback =
+      std::function<void(SourceId source_id, int free_packets)>;
+  using UITaskNotifier = std::function<void()>;
+
+  /// Never given to a registered source.
+  const static SourceId kInvalidSourceId = 0;
+
+  /// What GetPacketForSubmission() does if all packets of a source are used.
+  enum class BackpressurePolicy {
+    kDropNewest,        // returns nullptr, the new data is lost
+    kBlockWithTimeout,  // waits for a sink to release a packet
+    kOverwriteOldest    // takes back the oldest packet no sink started yet
+  };
 
   /// Launches all worker threads. (worker_threads == 0 means autodetect)
-  Scheduler(int worker_threads = 0);
+  Scheduler(int worker_threads = 0, bool virtual_time = false);
 
   /// Waits all threads to finish before destruction.
   ~Scheduler();
@@ -55,17 +95,139 @@ class Scheduler {
    */
   int GetNumberOfWorkers() const;
 
+  /**
+   * Turns adaptive worker management on or off (off by default).
+   * It can be called any time.
+   */
+  void SetAdaptiveWorkers(bool adaptive);
+
+  /// Returns how many workers are not parked by adaptive mode.
+  int GetNumberOfActiveWorkers() const;
+
+  /// Returns true if the clock is driven by sources instead of wall clock.
+  bool IsVirtualTime() const { return virtual_time_; }
+
+  /**
+   * Returns the current time of the scheduler clock in microseconds.
+   * Sources should timestamp their packets and sinks should measure latency
+   * using this clock. In virtual time mode it returns the latest time
+   * the sources advanced the clock to.
+   */
+  Time GetCurrentTime() const;
+
+  /**
+   * Moves the virtual clock forward to the given time (never backward).
+   * Submitting a packet also advances the clock to its timestamp.
+   * It has no effect when the wall clock is used.
+   */
+  void AdvanceVirtualTime(Time time);
+
+  /// Converts a sample count to time for sources counting their samples.
+  static Time SamplesToTime(uint64_t samples, int sample_rate);
+
   /**
    * Sources register the fixed packet size they produce
    * and the queue size used to transmit work units to sinks.
+   * The policy tells what to do when the queue is full, the timeout is only
+   * used when blocking.
+   * The name has to be unique, sinks can find the source by it.
+   * Returns the ID given to the source.
    * It is a slow operation done in configuration time.
    */
-  void RegisterSource(SourceId source_id, int packet_size,
-                      int packets_in_queue);
+  SourceId RegisterSource(
+      const char* name, int packet_size, int packets_in_queue,
+      BackpressurePolicy policy = BackpressurePolicy::kDropNewest,
+      int block_timeout_in_us = 0);
+
+  /**
+   * Removes a source while the scheduler is running. The source has to be
+   * stopped, its sinks unsubscribed and done with all of its packets (see
+   * WaitForIdle()). The ID must not be used afterwards. Calls on the source
+   * already started on other threads (e.g. reading its statistics) are
+   * waited for. It is a slow operation done in configuration time.
+   */
+  void UnregisterSource(SourceId source_id);
+
+  /// Returns the ID of the source having the name or kInvalidSourceId.
+  SourceId FindSource(const char* name);
+
+  /// Returns the name of a source, empty if it is not registered (any more).
+  std::string GetSourceName(SourceId source_id);
 
-  /// Returns the fixed packet size a source is using.
+  /// Returns the packet size a source is using now.
   int GetPacketSize(SourceId source_id);
 
+  /// Returns the size of a packet given to a sink. It is the packet size
+  /// of the source at the time the packet was handed out, so sinks of
+  /// reconfigured sources should use it instead of a size stored earlier.
+  static int GetSizeOfPacket(const Byte* packet);
+
+  /**
+   * Changes the packet size and the queue size of a registered source while
+   * it is running. The old packets are drained first: it waits until the
+   * sinks released all of them or the timeout (in microseconds) passes.
+   * Returns false on timeout, the source is not changed then. Only the
+   * source may call it and it must not hold a packet. The pool is not
+   * elastic afterwards, the policy, the watermark callback and the
+   * subscriptions are kept.
+   */
+  bool ReconfigureSource(SourceId source_id, int packet_size,
+                         int packets_in_queue, Time timeout_in_us);
+
+  /// Returns the number of packets in the queue of a source.
+  int GetNumberOfPackets(SourceId source_id);
+
+  /**
+   * Lets the packet pool of a source grow up to the given number of packets.
+   * It is a slow operation done in configuration time.
+   */
+  void SetElasticPool(SourceId source_id, int max_packets_in_queue);
+
+  struct PoolStats {
+    int capacity;           // packets allocated now
+    int max_capacity;       // packets the pool can grow to
+    int in_use;             // packets at the source or at sinks
+    int high_water;         // most packets in use at once
+    int grows;              // segments added
+    uint64_t drops;         // same as GetLostPackets()
+    uint64_t released;      // packets given back by all of their sinks
+    Time turnaround_in_us;  // sum from submission to the last release
+  };
+
+  /**
+   * Returns usage statistics of the packet pool of a source. The counters
+   * only grow, the load of a period is the difference of two samples:
+   * the turnaround covers both queueing and the work of the sinks.
+   */
+  PoolStats GetPoolStats(SourceId source_id);
+
+  struct SourcePoolStats {
+    SourceId source_id;
+    PoolStats stats;
+  };
+
+  /// Samples the pool statistics of all registered sources at once, so it
+  /// can be used while other threads register and unregister sources.
+  void GetAllPoolStats(std::vector<SourcePoolStats>& pool_stats);
+
+  /// Returns the IDs of all registered sources in increasing order.
+  std::vector<SourceId> GetSourceIds();
+
+  /// Returns how many packets a source can get without backpressure now.
+  int GetFreePackets(SourceId source_id);
+
+  /// Returns how many packets were dropped, timed out or overwritten so far.
+  uint64_t GetLostPackets(SourceId source_id);
+
+  /**
+   * The callback is called from GetPacketForSubmission() when the number of
+   * free packets of the source falls to the watermark. It is called again
+   * only after the pool recovered above the watermark.
+   * It is a slow operation done in configuration time.
+   */
+  void SetLowWatermarkCallback(SourceId source_id, int free_packets,
+                               LowWatermarkCallback callback);
+
   /**
    * A sink registers itself via a callback into its code to get all
    * data packets produced by a source.
@@ -76,6 +238,14 @@ class Scheduler {
   void Subscribe(SourceId source_id, SinkCallback sink_callback, bool on_UI,
                  int& subscription_id);
 
+  /**
+   * Like Subscribe() on the workers, but the sink gets the packets of the
+   * source one after the other in submission order. Timestamps of the
+   * source have to grow monotonically, so the tasks are started in order.
+   */
+  void SubscribeInOrder(SourceId source_id, SinkCallback sink_callback,
+                        int& subscription_id);
+
   /**
    * A sink no longer wants to get packets from a source.
    * It is a slow operation done in configuration time.
@@ -83,9 +253,15 @@ class Scheduler {
    */
   void Unsubscribe(SourceId source_id, int subscription_id);
 
-  /// Caller source acquires a packet which can be loaded with data.
+  /**
+   * Caller source acquires a packet which can be loaded with data.
+   * Returns nullptr if there is no packet to use (see BackpressurePolicy).
+   */
   Byte* GetPacketForSubmission(SourceId source_id);
 
+  /// The source gives back a packet it got but could not fill.
+  void CancelPacket(SourceId source_id, Byte* packet);
+
   /// Packet is put into queue, all subscribed sinks will be assigned a task.
   void SubmitPacket(SourceId source_id, Byte* packet, Time timestamp);
 
@@ -96,18 +272,69 @@ class Scheduler {
   /// or after one task was carried out. It never blocks.
   void DoUITaskStep();
 
+  /**
+   * Call from the UI thread! Carries out UI tasks until there are no more
+   * or the time budget (in microseconds) is used up. At least one task is
+   * done if there is any. Returns true if tasks are left in the queue.
+   */
+  bool DoUITasks(Time budget);
+
+  /**
+   * The notifier is called when the UI task queue gets its first task after
+   * being empty, so a main loop can wake up to call DoUITasks().
+   * It is called from the submitting thread and should be short.
+   * Giving nullptr turns notifications off.
+   */
+  void SetUITaskNotifier(UITaskNotifier notifier);
+
+  /**
+   * Blocks until all tasks submitted so far are processed by the sinks.
+   * Call from main thread! UI tasks are carried out while waiting, so no
+   * main loop should be doing them at the same time.
+   * It is used to run batches of offline work and in benchmarks.
+   */
+  void WaitForIdle();
+
+  /// What a thread dispatching tasks is doing, seen by a watchdog.
+  struct ThreadActivity {
+    uint64_t tasks_started;
+    uint64_t tasks_done;  // a task is running if less than tasks_started
+    SourceId source_id;   // of the task started last
+  };
+
+  /**
+   * Samples the activity of the UI thread (first) and the workers (in the
+   * order of their index). Threads only count their tasks into their own
+   * cache line, so sampling does not slow them down. Comparing two samples
+   * tells which task runs longer than the time in between.
+   */
+  void GetThreadActivities(std::vector<ThreadActivity>& activities) const;
+
+  /// Returns the number of tasks queued or running.
+  int GetPendingTasks() const;
+
   /// Tells all threads to stop working and quit. Destructor waits for them.
+  /// Tasks still queued are cancelled.
   void Shutdown();
 
+  /**
+   * Graceful version of Shutdown(): waits until the tasks submitted so far
+   * are done or the timeout (in microseconds) passes, then stops the threads
+   * and cancels the tasks left, releasing their packets. UI tasks are only
+   * waited for while a main loop is notified of them. Sources should have
+   * stopped submitting before. Returns the number of tasks cancelled.
+   */
+  int DrainAndShutdown(Time timeout_in_us);
+
  protected:
   /// Returns only on shutdown.
-  void DoWorkerTasks();
+  void DoWorkerTasks(int worker_index);
 
   /**
    * The general task dispatcher of the scheduler where scheduling is done.
    * Only one UI thread can be present.
    */
-  void DispatchTasks(bool UI_thread_mode = true);
+  void DispatchTasks(bool UI_thread_mode = true, int worker_index = -1);
 
  private:
   struct Subscription {
@@ -115,24 +342,63 @@ class Scheduler {
 
     SinkCallback sink_callback;
     bool on_UI;
+    std::shared_ptr<std::atomic<uint64_t>> turn;  // nullptr if not in order
+    uint64_t next_turn;
+  };
+
+  // Stored right before the data of every packet
+  struct PacketHeader {
+    int packet_num;
+    int size;
   };
+  const static size_t kPacketAlignment = 16;
+  const static size_t kPacketHeaderSize = kPacketAlignment;
+  const static int kGrowAtUsagePercent = 75;
+  const static int kDrainPollIntervalInUs = 1000;
+  const static int kShrinkAtUsagePercent = 25;
 
   struct Source {
     std::atomic_flag source_mtx_;
+    std::string name;
     int packet_size;
-    std::vector<int> free_packets;    // packet number
+    std::deque<int> free_packets;     // packet number
     std::vector<bool> packet_usages;  // true if used
     std::vector<int> packet_refcounts;
-    std::vector<Byte> packet_buffer;  // concatenated packets
+    std::vector<std::unique_ptr<Byte[]>> segments;  // packets with headers
+    int segment_packets;
+    size_t packet_stride;
+    int max_packets;
+    int high_water;
+    int grows;
     std::vector<Subscription> subscriptions;
+    BackpressurePolicy policy;
+    int block_timeout_in_us;
+    uint64_t lost_packets;
+    // Overwriting needs to know which packets are not touched by sinks yet
+    std::vector<uint32_t> packet_generations;  // tasks of old ones are stale
+    std::vector<int> packet_queued_tasks;      // tasks not started yet
+    std::vector<uint64_t> packet_submit_order;
+    std::vector<Time> packet_submit_times;  // steady clock
+    uint64_t released_packets;
+    Time turnaround_in_us;
+    uint64_t submitted_packets;
+    int stale_tasks;  // segments can not be freed while these are queued
+    // Blocking sources wait for a release
+    std::atomic<int> packet_waiters;
+    std::atomic<int> users;  // calls working on it without the sources lock
+    std::mutex release_mtx;
+    std::condition_variable release_cv;
+    int low_watermark;
+    bool low_watermark_armed;
+    LowWatermarkCallback low_watermark_callback;
   };
 
-  struct SourceRef {
-    SourceRef(SourceId _source_id);
-    SourceRef(SourceId _source_id, int packet_size, int packets_in_queue);
-    bool operator<(const SourceRef& o) const;
+  // IDs have the generation of their slot above the slot index
+  const static int kSourceSlotBits = (int)sizeof(SourceId) * 4;
+  const static SourceId kSourceSlotMask = ((SourceId)1 << kSourceSlotBits) - 1;
 
-    SourceId source_id;
+  struct SourceSlot {
+    SourceId generation = 1;  // changed when the source is unregistered
     std::unique_ptr<Source> ptr;
   };
 
@@ -140,18 +406,109 @@ class Scheduler {
     SourceId source_id;
     SinkCallback sink_callback;
     Byte* packet;
+    Source* overwritable_source;  // nullptr if packets are never taken back
+    uint32_t generation;
+    std::shared_ptr<std::atomic<uint64_t>> turn;  // of an in order sink
+    uint64_t my_turn;
   };
 
   struct TaskRef {
-    TaskRef(Time _timestamp, SourceId source_id, SinkCallback sink_callback,
-            Byte* packet);
+    TaskRef(Time _timestamp, uint64_t _sequence, SourceId source_id,
+            Subscription& subscription, Byte* packet,
+            Source* overwritable_source, uint32_t generation);
     bool operator<(const TaskRef& o) const;
 
     Time timestamp;
+    uint64_t sequence;  // tie breaker keeping submission order
     std::unique_ptr<Task> ptr;
   };
 
-  Source& GetSourceById(SourceId source_id);
+  /// Finds a source and keeps it from being deleted until destroyed, so
+  /// a call can work on it without holding the lock of the sources.
+  class SourceUse {
+   public:
+    SourceUse(Scheduler& scheduler, SourceId source_id);
+    ~SourceUse();
+    SourceUse(const SourceUse&) = delete;
+    SourceUse& operator=(const SourceUse&) = delete;
+
+    Source& source() const { return *src_; }
+
+   private:
+    Source* src_;
+  };
+
+  // Sources container has to be locked
+  Source* FindSourceById(SourceId source_id);  // nullptr if not found
+  size_t FindSlotByName(const char* name);     // sources_.size() if not found
+  static Source* CreateSource(const char* name, int packet_size,
+                              int packets_in_queue, BackpressurePolicy policy,
+                              int block_timeout_in_us);
+  static SourceId MakeSourceId(size_t slot, SourceId generation);
+
+  // A segment of packets prepared without holding the lock of the source
+  struct Segment {
+    std::unique_ptr<Byte[]> memory;
+    int first_packet;
+    int packets;
+    int packet_size;
+    size_t packet_stride;
+  };
+
+  // Packet pool handling, source has to be locked
+  static void SetupPool(Source& src, int packet_size, int packets_in_queue);
+  static PoolStats SamplePoolStats(Source& src);
+  int AcquirePacket(Source& src);
+  int TakeBackOldestPacket(Source& src);
+  // An idle segment given back is freed by the caller after unlocking
+  void FreePacket(Source& src, int packet_num,
+                  std::unique_ptr<Byte[]>& idle_segment);
+  static bool CanGrowPool(Source& src);
+  // Gives back the rest of the idle segments, source is not locked
+  static void FreeIdleSegments(Source& src,
+                               std::unique_ptr<Byte[]>& idle_segment);
+  // Tells the segment to allocate if the pool is used enough to grow
+  static bool IsGrowthDue(Source& src, Segment& segment);
+  static void PlanSegment(Source& src, Segment& segment);
+  static void AllocateSegment(Segment& segment);  // source is not locked
+  // Returns false if the pool changed since the segment was planned
+  static bool GrowPool(Source& src, Segment& segment);
+  // Gives back at most one segment, the caller frees it after unlocking
+  static void ShrinkPool(Source& src, std::unique_ptr<Byte[]>& idle_segment);
+  static Byte* GetPacket(Source& src, int packet_num);
+  static int GetPacketNum(const Byte* packet);
+
+  /// Waits for a release until the timeout, returns -1 if no packet came.
+  int WaitForPacket(Source& src);
+  static void NotifyPacketWaiters(Source& src);
+
+  int AddSubscription(SourceId source_id, SinkCallback sink_callback,
+                      bool on_UI, bool in_order);
+  /// Waits with yield() until the earlier task of an in order sink is done.
+  void WaitForTurn(const std::atomic<uint64_t>& turn, uint64_t my_turn);
+
+  /// Returns false if the packet of the task was taken back by its source.
+  static bool StartTask(Source& src, const Byte* packet, uint32_t generation);
+  /// Drops the queued tasks after shutdown, returns their number.
+  int CancelQueuedTasks();
+
+  // Worker management, the lock is on worker_queue_mtx_
+  void WaitForWorkerTask(std::unique_lock<std::mutex>& lock,
+                         int worker_index);
+  void SpinForWorkerTask();
+  void UnparkWorker();
+  void AccountWorkerTime(Time busy_time);
+  static Time GetSteadyTime();
+
+  bool HasUITasks();
+
+  // Written by one dispatching thread, read by the watchdog
+  struct ActivitySlot {
+    std::atomic<uint64_t> tasks_started{0};
+    std::atomic<uint64_t> tasks_done{0};
+    std::atomic<SourceId> source_id{0};
+    char padding[64 - 2 * sizeof(uint64_t) - sizeof(SourceId)];
+  };
 
   // Locking of sources_ container
   void WriteLockSources();
@@ -163,17 +520,38 @@ class Scheduler {
   static void LockSource(Source& src);
   static void UnlockSource(Source& src);
 
-  std::vector<SourceRef> sources_;
+  std::vector<SourceSlot> sources_;
+  std::vector<size_t> free_source_slots_;
   std::priority_queue<TaskRef> tasks_for_workers_;
   std::priority_queue<TaskRef> tasks_for_UI_;
   std::vector<std::thread> workers_;
+  std::unique_ptr<ActivitySlot[]> activities_;  // UI thread, then workers
 
+  const bool virtual_time_;
+  std::atomic<Time> virtual_clock_;
+  std::atomic<uint64_t> task_sequence_;
+  std::atomic<int> pending_tasks_;
   std::atomic<bool> shutdown_initiated_;
   std::atomic<int> sources_semaphore_;
   std::mutex worker_queue_mtx_;
   std::condition_variable worker_queue_cv_;
+  int waiting_workers_;   // on worker_queue_cv_
+  int spinning_workers_;  // checking for tasks without the lock
+  std::atomic<int> queued_worker_tasks_;
+  // Adaptive mode
+  const static int kSpinBeforeSleepInUs = 50;
+  const static int kMaxSpinningWorkers = 1;
+  const static int kUtilizationWindowInUs = 100000;
+  const static int kParkBelowUtilizationPercent = 25;
+  const static int kUnparkAboveUtilizationPercent = 75;
+  std::atomic<bool> adaptive_workers_;
+  std::atomic<int> active_workers_;  // workers with a higher index are parked
+  std::condition_variable parked_workers_cv_;
+  std::atomic<Time> busy_time_in_window_;
+  std::atomic<Time> window_start_;
   std::mutex UI_queue_mtx_;
   std::condition_variable UI_queue_cv_;
+  UITaskNotifier UI_task_notifier_;
   static int max_spin_cycles_before_yield;
 };
 
@@ -0,0 +1,121 @@
+#ifndef ZAMT_CORE_SOURCEMERGER_H_
+#define ZAMT_CORE_SOURCEMERGER_H_
+
+/// Merges sources of audio captured by separate clocks into one source.
+/**
+ * Inputs produce packets of interleaved 16 bit frames at the same nominal
+ * sample rate, timestamped on the common clock of the Scheduler. The
+ * merger is a sink of all of them and the source of packets having the
+ * channels of every input side by side, the channels of the first input
+ * first.
+ *
+ * Inputs are aligned by the timestamps of their first packets: frames
+ * captured before every input started are skipped. Device clocks drift
+ * apart afterwards, so the timestamps of every input are fitted (least
+ * squares over all packets) to get its real rate. Once the fit settled,
+ * every input follows the first one by dropping or repeating at most one
+ * frame per output packet. Packet timestamps have the jitter of the
+ * capture, the fit averages it out over time.
+ *
+ * An input falling too much behind (e.g. a stopped device) makes the
+ * merger start over with a new alignment.
+ */
+
+#include "zamt/core/Scheduler.h"
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace zamt {
+
+class SourceMerger {
+ public:
+  using Sample = int16_t;
+  const static int kDriftSettleInMs = 1000;
+  const static int kMaxBufferedInMs = 1000;
+
+  struct Input {
+    Scheduler::SourceId source_id;
+    int channels;
+  };
+
+  /**
+   * Registers the output source of the given name with packets of the given
+   * number of frames and subscribes to the inputs, which have to be
+   * registered already.
+   * It is a slow operation done in configuration time.
+   */
+  SourceMerger(Scheduler* scheduler, const std::vector<Input>& inputs,
+               int sample_rate, const char* name, int frames_per_packet,
+               int packets_in_queue);
+  ~SourceMerger();
+
+  /// Unsubscribes from the inputs. Call it on the quit event.
+  void Stop();
+
+  /// The source publishing the merged frames.
+  Scheduler::SourceId GetSourceId() const { return output_id_; }
+
+  /// Channels of an output frame.
+  int GetChannels() const { return channels_; }
+
+  /// Clock drift of an input compared to the first one in parts per
+  /// million, positive if it runs faster. It is 0 until the fit settled.
+  double GetDriftPpm(size_t input);
+
+  /// Frames of an input dropped (positive) or repeated (negative) so far.
+  int64_t GetCorrection(size_t input);
+
+ private:
+  struct InputState {
+    Scheduler::SourceId source_id;
+    int channels;
+    int subscription_id = -1;
+    std::vector<Sample> buffer;  // interleaved frames from head on
+    size_t head = 0;             // in samples
+    bool started = false;
+    Scheduler::Time first_timestamp = 0;
+    int64_t received_frames = 0;  // since the first packet
+    int64_t consumed_frames = 0;  // including the skipped ones
+    int64_t frames_to_skip = 0;
+    int64_t correction = 0;
+    // (first frame, timestamp) of the packets still in the buffer
+    std::deque<std::pair<int64_t, Scheduler::Time>> packet_times;
+    // Least squares fit of timestamps (us) over frames since the first packet
+    double fits = 0.0;
+    double sum_frames = 0.0;
+    double sum_times = 0.0;
+    double sum_frame_squares = 0.0;
+    double sum_frame_times = 0.0;
+  };
+
+  void OnPacket(size_t input, Scheduler::SourceId source_id,
+                const Scheduler::Byte* packet, Scheduler::Time timestamp);
+  void Append(InputState& state, const Sample* samples, int frames,
+              Scheduler::Time timestamp);
+  void Align();
+  void Restart();
+  static int64_t GetBufferedFrames(const InputState& state);
+  static void Consume(InputState& state, int64_t frames);
+  // Frames of the input per frame of the first input, 1.0 until settled
+  double GetRateRatio(const InputState& state) const;
+  Scheduler::Time GetFirstInputTime() const;
+  bool EmitPacket();
+
+  Scheduler* scheduler_;
+  const int sample_rate_;
+  Scheduler::SourceId output_id_;
+  const int frames_per_packet_;
+  int channels_ = 0;
+  std::mutex mutex_;  // inputs are processed by different workers
+  std::vector<InputState> inputs_;
+  bool aligned_ = false;
+  int64_t output_frames_ = 0;  // since the alignment
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_CORE_SOURCEMERGER_H_
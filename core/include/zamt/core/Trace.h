@@ -0,0 +1,95 @@
+#ifndef ZAMT_CORE_TRACE_H_
+#define ZAMT_CORE_TRACE_H_
+
+/// Recording of timed events to see where the time of packets goes.
+/**
+ * Trace points are compiled in only if ZAMT_TRACE is defined (USE_TRACE
+ * cmake option) and record only after Start(). Every thread records into
+ * its own buffer without locks, a full buffer drops further events.
+ * Events are exported as Chrome trace-event JSON, which can be opened in
+ * chrome://tracing or Perfetto.
+ *
+ * Events can carry the id of a source and the timestamp of a packet, so
+ * one packet can be followed across the threads.
+ */
+
+#include <atomic>
+#include <cstdint>
+
+namespace zamt {
+
+class Trace {
+ public:
+  const static int kEventsPerThread = 1 << 16;
+  const static int64_t kNoArgument = -1;
+
+  /// Starts recording, events before are not kept.
+  static void Start();
+  static bool IsRecording() {
+    return recording_.load(std::memory_order_relaxed);
+  }
+  static int64_t GetTimeInUs();
+
+  /// Records an event, a negative duration means an instant event.
+  static void Record(const char* name, int64_t start_in_us,
+                     int64_t duration_in_us, int64_t source = kNoArgument,
+                     int64_t packet = kNoArgument);
+
+  static void Instant(const char* name, int64_t source = kNoArgument,
+                      int64_t packet = kNoArgument) {
+    if (IsRecording()) Record(name, GetTimeInUs(), -1, source, packet);
+  }
+
+  /**
+   * Stops recording and writes the events recorded so far into a file.
+   * Threads still recording are not disturbed, their later events are
+   * left out. Returns false if the file cannot be written.
+   */
+  static bool ExportChromeJSON(const char* path);
+
+  /// Records the time spent in a scope.
+  class Scope {
+   public:
+    Scope(const char* name, int64_t source = kNoArgument,
+          int64_t packet = kNoArgument)
+        : name_(name), source_(source), packet_(packet) {
+      start_in_us_ = IsRecording() ? GetTimeInUs() : -1;
+    }
+    ~Scope() {
+      if (start_in_us_ < 0) return;
+      Record(name_, start_in_us_, GetTimeInUs() - start_in_us_, source_,
+             packet_);
+    }
+
+   private:
+    const char* name_;
+    int64_t source_;
+    int64_t packet_;
+    int64_t start_in_us_;
+  };
+
+ private:
+  static std::atomic<bool> recording_;
+};
+
+}  // namespace zamt
+
+#define ZAMT_TRACE_CONCAT_INNER(a, b) a##b
+#define ZAMT_TRACE_CONCAT(a, b) ZAMT_TRACE_CONCAT_INNER(a, b)
+
+#ifdef ZAMT_TRACE
+/// Records the rest of the enclosing scope. Arguments: the name and
+/// optionally the source id and the packet timestamp.
+#define ZAMT_TRACE_SCOPE(...)                                       \
+  zamt::Trace::Scope ZAMT_TRACE_CONCAT(zamt_trace_scope_, __LINE__)( \
+      __VA_ARGS__)
+/// Records a point in time, same arguments as ZAMT_TRACE_SCOPE.
+#define ZAMT_TRACE_INSTANT(...) zamt::Trace::Instant(__VA_ARGS__)
+#else
+#define ZAMT_TRACE_SCOPE(...)
+#define ZAMT_TRACE_INSTANT(...) \
+  do {                          \
+  } while (false)
+#endif
+
+#endif  // ZAMT_CORE_TRACE_H_
@@ -1,11 +1,14 @@
 set(module_cpps
   CLIParameters.cpp
   Core.cpp
+  LatencyTuner.cpp
   Log.cpp
   main.cpp
   ModuleCenter.cpp
   Scheduler.cpp
+  SourceMerger.cpp
   TestSuite.cpp
+  Trace.cpp
 )
 
 
@@ -2,23 +2,37 @@
 
 #include "zamt/core/Log.h"
 #include "zamt/core/Scheduler.h"
+#include "zamt/core/Trace.h"
 
 #include <signal.h>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
+#include <map>
+#include <string>
+#include <vector>
 
 namespace {
 
-zamt::Core* g_core = nullptr;
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "signal handler needs a lock-free atomic");
 
+// The last quit signal not handled yet, 0 if none
+std::atomic<int> g_quit_signal(0);
+
+// Locks, logging and callbacks are not async-signal-safe: leave them to
+// WaitForQuit()
 void quit_signaled(int signal_number) {
-  int exit_code = -1;
-  if (signal_number == SIGTERM)
-    exit_code = zamt::Core::kExitCodeSIGTERM;
-  else if (signal_number == SIGINT)
-    exit_code = zamt::Core::kExitCodeSIGINT;
-  assert(g_core);
-  g_core->Quit(exit_code);
+  g_quit_signal.store(signal_number, std::memory_order_release);
+}
+
+int get_signal_exit_code(int signal_number) {
+  if (signal_number == SIGTERM) return zamt::Core::kExitCodeSIGTERM;
+  if (signal_number == SIGINT) return zamt::Core::kExitCodeSIGINT;
+  return -1;
 }
 
 void handle_signal(int signal_number) {
@@ -37,10 +51,28 @@ namespace zamt {
 const char* Core::kModuleLabel = "core";
 const char* Core::kHelpParamStr = "-h";
 const char* Core::kThreadsParamStr = "-j";
+const char* Core::kVirtualTimeParamStr = "-offline";
+const char* Core::kAdaptiveWorkersParamStr = "-wa";
+const char* Core::kTraceParamStr = "-trace";
+const char* Core::kDefaultTracePath = "zamt_trace.json";
+const char* Core::kWatchdogParamStr = "-wd";
+const char* Core::kShutdownTimeoutParamStr = "-sd";
+
+/// What the watchdog saw at its previous check.
+struct Core::HealthState {
+  struct SourceHealth {
+    uint64_t lost_packets = 0;
+    bool starving = false;  // warned already
+  };
+  std::vector<Scheduler::ThreadActivity> activities;
+  std::vector<uint64_t> reported_stalls;  // tasks_started of stuck tasks
+  std::map<Scheduler::SourceId, SourceHealth> sources;
+};
 
 #ifdef TEST
 void Core::ReInitExitCode() {
   exit_code_.store(Core::kNoExitCode, std::memory_order_release);
+  g_quit_signal.store(0, std::memory_order_release);
 }
 #endif
 
@@ -50,8 +82,6 @@ Core::Core(int argc, const char* const* argv) : cli_(argc, argv) {
 
   handle_signal(SIGTERM);
   handle_signal(SIGINT);
-  // In case of multiple instances, it is enough to get only one
-  g_core = this;
 
   if (cli_.HasParam(kHelpParamStr)) {
     PrintHelp();
@@ -60,21 +90,67 @@ Core::Core(int argc, const char* const* argv) : cli_(argc, argv) {
     return;
   }
 
+  const char* trace_path = cli_.GetParam(kTraceParamStr);
+  if (trace_path) {
+#ifdef ZAMT_TRACE
+    trace_path_ = *trace_path ? trace_path : kDefaultTracePath;
+    Trace::Start();
+    log_->LogMessage("Recording trace...");
+#else
+    log_->LogMessage("Tracing is not compiled in, build with USE_TRACE.");
+#endif
+  }
+
   int workers = cli_.GetNumParam(kThreadsParamStr);
   if (workers == CLIParameters::kNotFound) workers = 0;
+  bool virtual_time = cli_.HasParam(kVirtualTimeParamStr);
   log_->LogMessage("Launching scheduler...");
-  scheduler_.reset(new Scheduler(workers));
+  scheduler_.reset(new Scheduler(workers, virtual_time));
+  if (virtual_time) log_->LogMessage("Scheduler runs on virtual time.");
   log_->LogMessage("Scheduler started with ", scheduler_->GetNumberOfWorkers(),
                    " threads.");
+  if (cli_.HasParam(kAdaptiveWorkersParamStr)) {
+    scheduler_->SetAdaptiveWorkers(true);
+    log_->LogMessage("Scheduler parks idle workers.");
+  }
+  int shutdown_timeout = cli_.GetNumParam(kShutdownTimeoutParamStr);
+  if (shutdown_timeout != CLIParameters::kNotFound && shutdown_timeout >= 0)
+    shutdown_timeout_in_ms_ = shutdown_timeout;
+  int watchdog_interval = cli_.GetNumParam(kWatchdogParamStr);
+  if (watchdog_interval != CLIParameters::kNotFound) {
+    watchdog_interval_in_ms_ = watchdog_interval > 0
+                                   ? watchdog_interval
+                                   : kDefaultWatchdogIntervalInMs;
+    health_.reset(new HealthState());
+    log_->LogMessage("Watchdog checks the scheduler in every ",
+                     watchdog_interval_in_ms_, " ms.");
+  }
 }
 
-Core::~Core() { log_->LogMessage("Stopping..."); }
+Core::~Core() {
+  log_->LogMessage("Stopping...");
+  if (trace_path_.empty()) return;
+  // Workers are stopped first, so their events are complete
+  scheduler_.reset();
+  char msg[256];
+  snprintf(msg, sizeof(msg),
+           Trace::ExportChromeJSON(trace_path_.c_str())
+               ? "Trace written to %s"
+               : "Cannot write trace file %s",
+           trace_path_.c_str());
+  log_->LogMessage(msg);
+}
 
 void Core::Initialize(const ModuleCenter* mc) { mc_ = mc; }
 
 void Core::Quit(int exit_code) {
   log_->LogMessage("Shutdown initiated with exit code ", exit_code);
-  for (const auto& quit_cb : on_quit_callbacks_) {
+  std::deque<OnQuitCallback> on_quit_callbacks;
+  {
+    std::lock_guard<std::mutex> lock(callbacks_mutex_);
+    on_quit_callbacks = on_quit_callbacks_;
+  }
+  for (const auto& quit_cb : on_quit_callbacks) {
     quit_cb(exit_code);
   }
   {
@@ -88,23 +164,87 @@ int Core::WaitForQuit() {
   log_->LogMessage("Ready, idling...");
   std::unique_lock<std::mutex> lock(mutex_);
   int exit_code = exit_code_.load(std::memory_order_acquire);
+  const std::chrono::milliseconds interval(watchdog_interval_in_ms_);
+  const std::chrono::milliseconds signal_interval(kSignalCheckIntervalInMs);
+  auto next_check = std::chrono::steady_clock::now() + interval;
   while (exit_code == kNoExitCode) {
-    // Loop can be used with wait_for for periodic health check and statistics
-    cond_var_.wait(lock);
+    int signal_number = g_quit_signal.exchange(0, std::memory_order_acq_rel);
+    if (signal_number != 0) {
+      // Quit() takes the lock itself
+      lock.unlock();
+      Quit(get_signal_exit_code(signal_number));
+      lock.lock();
+    } else {
+      // A signal handler cannot notify, so it is polled
+      auto now = std::chrono::steady_clock::now();
+      bool check_health = watchdog_interval_in_ms_ != 0 &&
+                          next_check <= now + signal_interval;
+      if (cond_var_.wait_until(
+              lock, check_health ? next_check : now + signal_interval) ==
+              std::cv_status::timeout &&
+          check_health) {
+        // Quit() should not wait for the check
+        lock.unlock();
+        CheckHealth();
+        lock.lock();
+        next_check += interval;
+      }
+    }
     exit_code = exit_code_.load(std::memory_order_acquire);
   }
   log_->LogMessage("Shutdown started with exit code ", exit_code);
-#ifdef TEST
-  const int wait_for_msecs = 0;
-#else
-  const int wait_for_msecs = 300;
-#endif
-  log_->LogMessage("Waiting ", wait_for_msecs, " ms...");
-  std::this_thread::sleep_for(std::chrono::milliseconds(wait_for_msecs));
+  if (!scheduler_) return exit_code;
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::milliseconds(shutdown_timeout_in_ms_);
+  if (!cond_var_.wait_until(lock, deadline,
+                            [this] { return AreParticipantsReady(); })) {
+    for (size_t i = 0; i < participants_ready_.size(); ++i) {
+      if (participants_ready_[i]) continue;
+      log_->LogMessage("Not stopped in time:");
+      log_->LogMessage(participant_labels_[i]);
+    }
+  }
+  lock.unlock();
+  // Sources are quiet, the tasks submitted so far get the rest of the time
+  auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+      deadline - std::chrono::steady_clock::now());
+  int cancelled = scheduler_->DrainAndShutdown(
+      (Scheduler::Time)std::max<int64_t>(remaining.count(), 0));
+  if (cancelled > 0) log_->LogMessage("Tasks cancelled: ", cancelled);
+  int shutdown_time =
+      (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+  log_->LogMessage("Quiescent after ", shutdown_time, " ms.");
   return exit_code;
 }
 
+int Core::AddShutdownParticipant(const char* label) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  participant_labels_.push_back(label);
+  participants_ready_.push_back(false);
+  return (int)participants_ready_.size() - 1;
+}
+
+void Core::ReportReadyForShutdown(int participant_id) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(participant_id >= 0 &&
+           participant_id < (int)participants_ready_.size());
+    participants_ready_[(size_t)participant_id] = true;
+  }
+  cond_var_.notify_all();
+}
+
+bool Core::AreParticipantsReady() const {
+  for (bool ready : participants_ready_)
+    if (!ready) return false;
+  return true;
+}
+
 void Core::RegisterForQuitEvent(OnQuitCallback on_quit_callback) {
+  // Modules are initialized in parallel
+  std::lock_guard<std::mutex> lock(callbacks_mutex_);
   on_quit_callbacks_.push_back(on_quit_callback);
 }
 
@@ -113,12 +253,105 @@ Scheduler& Core::scheduler() {
   return *scheduler_;
 }
 
+void Core::CheckHealth() {
+  assert(scheduler_ && health_);
+  HealthState& health = *health_;
+  std::vector<Scheduler::ThreadActivity> activities;
+  scheduler_->GetThreadActivities(activities);
+  health.activities.resize(activities.size(), Scheduler::ThreadActivity());
+  health.reported_stalls.resize(activities.size(), 0);
+  char msg[Log::kMaxMessageLength];
+  uint64_t tasks_done = 0;
+  int busy_threads = 0;
+  int stalled_threads = 0;
+  for (size_t i = 0; i < activities.size(); ++i) {
+    const Scheduler::ThreadActivity& now = activities[i];
+    const Scheduler::ThreadActivity& before = health.activities[i];
+    tasks_done += now.tasks_done - before.tasks_done;
+    if (now.tasks_started == now.tasks_done) continue;
+    busy_threads++;
+    // Still the same task as at the previous check: it exceeded the interval
+    if (now.tasks_started != before.tasks_started ||
+        now.tasks_done != before.tasks_done)
+      continue;
+    stalled_threads++;
+    if (health.reported_stalls[i] == now.tasks_started) continue;
+    health.reported_stalls[i] = now.tasks_started;
+    std::string source_name = scheduler_->GetSourceName(now.source_id);
+    if (i == 0) {
+      snprintf(msg, sizeof(msg),
+               "Watchdog: UI thread stuck in a sink of source %s for over"
+               " %d ms.",
+               source_name.c_str(), watchdog_interval_in_ms_);
+    } else {
+      snprintf(msg, sizeof(msg),
+               "Watchdog: worker %d stuck in a sink of source %s for over"
+               " %d ms.",
+               (int)i - 1, source_name.c_str(), watchdog_interval_in_ms_);
+    }
+    log_->LogMessage(msg);
+  }
+  health.activities.swap(activities);
+
+  uint64_t lost_packets = 0;
+  std::vector<Scheduler::SourcePoolStats> pool_stats;
+  scheduler_->GetAllPoolStats(pool_stats);
+  // Sources unregistered since the previous check are forgotten
+  std::map<Scheduler::SourceId, HealthState::SourceHealth> sources;
+  for (const Scheduler::SourcePoolStats& pool : pool_stats) {
+    const Scheduler::PoolStats& stats = pool.stats;
+    HealthState::SourceHealth& source = sources[pool.source_id];
+    source = health.sources[pool.source_id];
+    lost_packets += stats.drops - source.lost_packets;
+    source.lost_packets = stats.drops;
+    // Warned before the pool runs out, once until it recovers
+    bool starving =
+        stats.in_use * 100 >= stats.max_capacity * kPoolWarningPercent;
+    if (starving && !source.starving) {
+      snprintf(msg, sizeof(msg),
+               "Watchdog: pool of source %s nearly exhausted, %d of %d"
+               " packets in use.",
+               scheduler_->GetSourceName(pool.source_id).c_str(), stats.in_use,
+               stats.max_capacity);
+      log_->LogMessage(msg);
+    }
+    source.starving = starving;
+  }
+  health.sources.swap(sources);
+
+  snprintf(msg, sizeof(msg),
+           "Health: %llu tasks done, %d pending, %d of %d threads busy,"
+           " %d stalled, %d workers active, %llu packets lost.",
+           (unsigned long long)tasks_done, scheduler_->GetPendingTasks(),
+           busy_threads, (int)health.activities.size(), stalled_threads,
+           scheduler_->GetNumberOfActiveWorkers(),
+           (unsigned long long)lost_packets);
+  log_->LogMessage(msg);
+}
+
 void Core::PrintHelp() {
   Log::Print("ZAMT Core Module");
   Log::Print(" -h             Get help from all active modules and quit.");
   Log::Print(
       " -jNum          Set number of worker threads in scheduler."
       " 0 means autodetect (default).");
+  Log::Print(
+      " -offline       Run scheduler on virtual time driven by the sources"
+      " instead of the wall clock.");
+  Log::Print(
+      " -wa            Adaptive workers: spin a bit before sleeping and park"
+      " workers not needed under low load.");
+  Log::Print(
+      " -trace[Path]   Record a trace of packets and tasks into a Chrome"
+      " trace-event JSON file (default: zamt_trace.json). Needs a build with"
+      " USE_TRACE.");
+  Log::Print(
+      " -wd[Num]       Watchdog: check the scheduler in every Num ms"
+      " (default: 1000) for stuck sinks, starving packet pools and log"
+      " its health.");
+  Log::Print(
+      " -sdNum         Wait at most Num ms on shutdown for sources to stop"
+      " and for sinks to finish their tasks (default: 1000).");
 }
 
 std::atomic<int> Core::exit_code_(Core::kNoExitCode);
@@ -0,0 +1,51 @@
+#include "zamt/core/LatencyTuner.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace zamt {
+
+LatencyTuner::LatencyTuner(int min_latency, int max_latency,
+                           int start_latency)
+    : min_latency_(min_latency),
+      max_latency_(max_latency),
+      latency_(start_latency) {
+  assert(min_latency_ > 0 && min_latency_ <= max_latency_);
+  assert(latency_ >= min_latency_ && latency_ <= max_latency_);
+}
+
+int LatencyTuner::Update(const Scheduler::PoolStats& stats,
+                         Scheduler::Time packet_duration_in_us) {
+  // The period of a change is left out, it mixes the old and the new latency
+  if (!has_previous_) {
+    previous_ = stats;
+    has_previous_ = true;
+    return latency_;
+  }
+  uint64_t lost = stats.drops - previous_.drops;
+  uint64_t released = stats.released - previous_.released;
+  Scheduler::Time turnaround =
+      stats.turnaround_in_us - previous_.turnaround_in_us;
+  previous_ = stats;
+  bool slow = turnaround * 100 >
+              released * packet_duration_in_us * kMaxTurnaroundPercent;
+  int new_latency = latency_;
+  if (lost > 0 || slow) {
+    good_periods_ = 0;
+    bad_latency_ = latency_;
+    new_latency = std::min(latency_ * 2, max_latency_);
+  } else {
+    if (++good_periods_ >= kGoodPeriodsBeforeRetry) bad_latency_ = 0;
+    int lower = std::max(latency_ / 2, min_latency_);
+    if (good_periods_ >= kGoodPeriodsBeforeDecrease && lower > bad_latency_)
+      new_latency = lower;
+  }
+  if (new_latency != latency_) {
+    latency_ = new_latency;
+    good_periods_ = 0;
+    has_previous_ = false;
+  }
+  return latency_;
+}
+
+}  // namespace zamt
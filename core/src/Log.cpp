@@ -1,16 +1,366 @@
 #include "zamt/core/Log.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace zamt_log_internal {
+
+using zamt::Log;
+
+enum class ArgumentKind { kNone, kInt, kFloat };
+
+struct Record {
+  uint64_t sequence;
+  int64_t time_in_us;
+  const char* label;
+  ArgumentKind kind;
+  union {
+    int int_value;
+    float float_value;
+  };
+  int suffix_offset;  // in text
+  char text[Log::kMaxMessageLength];  // message and suffix, both terminated
+};
+
+const uint64_t kNotAppending = UINT64_MAX;
+
+/// Ring of one thread: only the owner writes, only the flusher reads.
+struct Ring {
+  Record records[Log::kRingMessages];
+  std::atomic<uint64_t> written{0};
+  // No earlier sequence than this is taken by the record being appended
+  std::atomic<uint64_t> appending{kNotAppending};
+  std::atomic<uint64_t> read{0};
+  std::atomic<uint32_t> dropped{0};
+  std::atomic<bool> owned{true};
+  Ring* next = nullptr;  // in the list of all rings, never removed
+};
+
+struct RateLimit {
+  int64_t window_start_in_us;
+  int messages_in_window;
+  int suppressed;
+};
+
+class Backend {
+ public:
+  ~Backend();
+  void Append(const char* label, const char* msg, ArgumentKind kind,
+              int int_value, float float_value, const char* suffix);
+  void SetOutputFile(const char* path);
+  void Flush();
+
+ private:
+  static int64_t GetTimeInUs();
+  Ring* GetRing();
+  void StartFlusher();
+  void RunFlusher();
+  void WriteOut();
+  void WriteOutUntil(uint64_t sequence);
+  bool PassRateLimit(const Record& record);
+  void WriteSuppressed(bool only_expired);
+
+  std::atomic<Ring*> rings_{nullptr};
+  std::atomic<uint64_t> next_sequence_{0};
+  std::once_flag flusher_started_;
+  std::unique_ptr<std::thread> flusher_;
+  std::mutex mutex_;  // flusher control and output, never taken by loggers
+  std::condition_variable cond_var_;
+  std::condition_variable flushed_cond_var_;
+  bool should_run_ = true;
+  uint64_t flushes_requested_ = 0;
+  uint64_t flushes_done_ = 0;
+  FILE* output_ = stdout;
+  std::string output_path_;
+  std::vector<Record> batch_;      // flusher only
+  uint64_t written_sequence_ = 0;  // earlier ones are written, flusher only
+  std::unordered_map<std::string, RateLimit> rate_limits_;
+};
+
+/// Gives back the ring of a thread when the thread exits.
+struct RingOwner {
+  ~RingOwner() {
+    if (ring) ring->owned.store(false, std::memory_order_release);
+  }
+  Ring* ring = nullptr;
+};
+
+thread_local RingOwner ring_owner;
+
+Backend& GetBackend() {
+  static Backend backend;
+  return backend;
+}
+
+Backend::~Backend() {
+  if (flusher_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      should_run_ = false;
+    }
+    cond_var_.notify_one();
+    flusher_->join();
+  }
+  if (output_ != stdout) fclose(output_);
+  // Rings of threads still running are left to the system
+  for (Ring* ring = rings_.load(); ring;) {
+    Ring* next = ring->next;
+    if (!ring->owned.load()) delete ring;
+    ring = next;
+  }
+}
+
+int64_t Backend::GetTimeInUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+Ring* Backend::GetRing() {
+  if (ring_owner.ring) return ring_owner.ring;
+  // Rings of finished threads are reused, they can still have messages
+  for (Ring* ring = rings_.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    bool owned = ring->owned.load(std::memory_order_relaxed);
+    if (!owned && ring->owned.compare_exchange_strong(owned, true)) {
+      ring_owner.ring = ring;
+      return ring;
+    }
+  }
+  Ring* ring = new Ring();
+  ring->next = rings_.load(std::memory_order_relaxed);
+  while (!rings_.compare_exchange_weak(ring->next, ring,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed))
+    ;
+  ring_owner.ring = ring;
+  return ring;
+}
+
+void Backend::Append(const char* label, const char* msg, ArgumentKind kind,
+                     int int_value, float float_value, const char* suffix) {
+  std::call_once(flusher_started_, &Backend::StartFlusher, this);
+  Ring* ring = GetRing();
+  uint64_t written = ring->written.load(std::memory_order_relaxed);
+  if (written - ring->read.load(std::memory_order_acquire) >=
+      (uint64_t)Log::kRingMessages) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  Record& record = ring->records[written % Log::kRingMessages];
+  // Later records of other threads are held back until this one is written
+  uint64_t sequence = next_sequence_.load();
+  do {
+    ring->appending.store(sequence);
+  } while (!next_sequence_.compare_exchange_weak(sequence, sequence + 1));
+  record.sequence = sequence;
+  record.time_in_us = GetTimeInUs();
+  record.label = label;
+  record.kind = kind;
+  if (kind == ArgumentKind::kFloat)
+    record.float_value = float_value;
+  else
+    record.int_value = int_value;
+  // Both strings are truncated to fit, the suffix is kept short
+  size_t suffix_length = std::min(strlen(suffix), sizeof(record.text) / 4);
+  size_t msg_length =
+      std::min(strlen(msg), sizeof(record.text) - suffix_length - 2);
+  memcpy(record.text, msg, msg_length);
+  record.text[msg_length] = '\0';
+  record.suffix_offset = (int)msg_length + 1;
+  memcpy(record.text + record.suffix_offset, suffix, suffix_length);
+  record.text[(size_t)record.suffix_offset + suffix_length] = '\0';
+  ring->written.store(written + 1, std::memory_order_release);
+  ring->appending.store(kNotAppending, std::memory_order_release);
+}
+
+void Backend::SetOutputFile(const char* path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (output_path_ == path) return;
+  FILE* output = fopen(path, "w");
+  if (!output) {
+    fprintf(stderr, "Cannot open log file %s\n", path);
+    return;
+  }
+  if (output_ != stdout) fclose(output_);
+  output_ = output;
+  output_path_ = path;
+}
+
+void Backend::Flush() {
+  std::call_once(flusher_started_, &Backend::StartFlusher, this);
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t flush = ++flushes_requested_;
+  cond_var_.notify_one();
+  flushed_cond_var_.wait(lock, [this, flush] {
+    return flushes_done_ >= flush || !should_run_;
+  });
+}
+
+void Backend::StartFlusher() {
+  flusher_.reset(new std::thread(&Backend::RunFlusher, this));
+}
+
+void Backend::RunFlusher() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cond_var_.wait_for(
+        lock, std::chrono::milliseconds(Log::kFlushIntervalInMs),
+        [this] { return flushes_requested_ > flushes_done_ || !should_run_; });
+    uint64_t flushes_requested = flushes_requested_;
+    // Covers all messages logged before the flush was requested
+    uint64_t flush_sequence = next_sequence_.load();
+    WriteOut();
+    if (!should_run_ || flushes_requested > flushes_done_)
+      WriteOutUntil(flush_sequence);
+    if (!should_run_) {
+      WriteSuppressed(false);
+      fflush(output_);
+      break;
+    }
+    if (flushes_requested > flushes_done_) {
+      WriteSuppressed(false);
+      fflush(output_);
+      flushes_done_ = flushes_requested;
+      flushed_cond_var_.notify_all();
+    }
+  }
+}
+
+void Backend::WriteOut() {
+  batch_.clear();
+  // Sequences below the limit are all published, later ones wait, so
+  // passes never write a record earlier than one written before
+  uint64_t limit = next_sequence_.load();
+  for (Ring* ring = rings_.load(std::memory_order_acquire); ring;
+       ring = ring->next)
+    limit = std::min(limit, ring->appending.load());
+  for (Ring* ring = rings_.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    uint64_t read = ring->read.load(std::memory_order_relaxed);
+    uint64_t written = ring->written.load(std::memory_order_acquire);
+    for (; read < written; ++read) {
+      const Record& record = ring->records[read % Log::kRingMessages];
+      if (record.sequence >= limit) break;
+      batch_.push_back(record);
+    }
+    ring->read.store(read, std::memory_order_release);
+    uint32_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+      fprintf(output_, "[log] %u messages dropped, ring was full\n", dropped);
+  }
+  // Threads are merged in the order of logging
+  std::sort(batch_.begin(), batch_.end(),
+            [](const Record& a, const Record& b) {
+              return a.sequence < b.sequence;
+            });
+  for (const Record& record : batch_) {
+    if (!PassRateLimit(record)) continue;
+    const char* suffix = record.text + record.suffix_offset;
+    switch (record.kind) {
+      case ArgumentKind::kNone:
+        fprintf(output_, "[%s] %s\n", record.label, record.text);
+        break;
+      case ArgumentKind::kInt:
+        fprintf(output_, "[%s] %s%d%s\n", record.label, record.text,
+                record.int_value, suffix);
+        break;
+      case ArgumentKind::kFloat:
+        fprintf(output_, "[%s] %s%f%s\n", record.label, record.text,
+                (double)record.float_value, suffix);
+        break;
+    }
+  }
+  WriteSuppressed(true);
+  if (!batch_.empty()) fflush(output_);
+  written_sequence_ = limit;
+}
+
+void Backend::WriteOutUntil(uint64_t sequence) {
+  // Threads stay only shortly in the middle of appending
+  while (written_sequence_ < sequence) {
+    std::this_thread::yield();
+    WriteOut();
+  }
+}
+
+bool Backend::PassRateLimit(const Record& record) {
+  // Only the same text with the same number is a repetition
+  char number[32] = "";
+  if (record.kind == ArgumentKind::kInt)
+    snprintf(number, sizeof(number), "%d", record.int_value);
+  else if (record.kind == ArgumentKind::kFloat)
+    snprintf(number, sizeof(number), "%a", (double)record.float_value);
+  std::string key(record.label);
+  key += '\n';
+  key += record.text;
+  key += '\n';
+  key += number;
+  key += '\n';
+  key += record.text + record.suffix_offset;
+  auto inserted = rate_limits_.emplace(key, RateLimit{record.time_in_us, 0, 0});
+  RateLimit& limit = inserted.first->second;
+  if (record.time_in_us - limit.window_start_in_us >=
+      (int64_t)Log::kRateLimitWindowInMs * 1000) {
+    if (limit.suppressed > 0)
+      fprintf(output_, "[%s] Previous message repeated %d more times\n",
+              record.label, limit.suppressed);
+    limit.window_start_in_us = record.time_in_us;
+    limit.messages_in_window = 0;
+    limit.suppressed = 0;
+  }
+  if (++limit.messages_in_window <= Log::kRateLimitMessages) return true;
+  limit.suppressed++;
+  return false;
+}
+
+void Backend::WriteSuppressed(bool only_expired) {
+  int64_t now = GetTimeInUs();
+  for (auto it = rate_limits_.begin(); it != rate_limits_.end();) {
+    RateLimit& limit = it->second;
+    bool expired = now - limit.window_start_in_us >=
+                   (int64_t)Log::kRateLimitWindowInMs * 1000;
+    if (limit.suppressed > 0 && (expired || !only_expired)) {
+      std::string label = it->first.substr(0, it->first.find('\n'));
+      fprintf(output_, "[%s] Previous message repeated %d more times\n",
+              label.c_str(), limit.suppressed);
+      limit.suppressed = 0;
+    }
+    // Forgotten after the window, so the map stays small
+    if (expired)
+      it = rate_limits_.erase(it);
+    else
+      ++it;
+  }
+}
+
+}  // namespace zamt_log_internal
 
 namespace zamt {
 
+using zamt_log_internal::ArgumentKind;
+using zamt_log_internal::GetBackend;
+
 const char* Log::kVerboseParamStr = "-v";
+const char* Log::kLogFileParamStr = "-lf";
+const int Log::kFlushIntervalInMs;
 
 Log::Log(const char* label, const CLIParameters& cli) {
   const int kParamBufLength = 32;
   label_ = label;
+  const char* log_file = cli.GetParam(kLogFileParamStr);
+  if (log_file && log_file[0] != '\0') GetBackend().SetOutputFile(log_file);
   if (cli.HasParam(kVerboseParamStr)) {
     verbose_ = true;
     return;
@@ -31,23 +381,28 @@ void Log::Print(const char* messa) { printf("%s\n", messa); }
 void Log::PrintHelp4Verbose() {
   Print(" -v             Set verbose status information mode globally.");
   Print(" -vModuleName   Set verbose mode only in ModuleName.");
+  Print(
+      " -lfPath        Write log messages into the file at Path instead of"
+      " the console.");
 }
 
+void Log::Flush() { GetBackend().Flush(); }
+
 void Log::LogMessage(const char* msg) {
   if (verbose_) {
-    printf("[%s] %s\n", label_, msg);
+    GetBackend().Append(label_, msg, ArgumentKind::kNone, 0, 0.0f, "");
   }
 }
 
 void Log::LogMessage(const char* msg, int num, const char* suffix) {
   if (verbose_) {
-    printf("[%s] %s%d%s\n", label_, msg, num, suffix);
+    GetBackend().Append(label_, msg, ArgumentKind::kInt, num, 0.0f, suffix);
   }
 }
 
 void Log::LogMessage(const char* msg, float num, const char* suffix) {
   if (verbose_) {
-    printf("[%s] %s%f%s\n", label_, msg, (double)num, suffix);
+    GetBackend().Append(label_, msg, ArgumentKind::kFloat, 0, num, suffix);
   }
 }
 
@@ -1,35 +1,146 @@
 #include "zamt/core/ModuleCenter.h"
 
+#include "zamt/core/CLIParameters.h"
+#include "zamt/core/Core.h"
+#include "zamt/core/Log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <tuple>
 
 namespace zamt {
 
+namespace {
+
+int64_t GetElapsedTimeInUs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+const char* Module::kModuleLabel = "module";
+const char* ModuleCenter::kModuleLabel = "modules";
+
 ModuleCenter::ModuleCenter(int argc, const char* const* argv) {
+  CLIParameters cli(argc, argv);
+  Log log(kModuleLabel, cli);
+  CollectDependencies();
+  // Help texts are printed during construction, they should not mix
+  int threads = 1;
+  if (!cli.HasParam(Core::kHelpParamStr)) {
+    threads = std::min((int)std::thread::hardware_concurrency(), module_num_);
+    threads = std::max(threads, 1);
+  }
+  auto start = std::chrono::steady_clock::now();
+
+  RunInDependencyOrder(
+      [&](int i) {
+        ModuleInitRecord& rec = module_inits_[i];
+        auto module_start = std::chrono::steady_clock::now();
+        instances_[i] = (*rec.create_function)(argc, argv);
+        char msg[Log::kMaxMessageLength];
+        snprintf(msg, sizeof(msg), "%s constructed in %d us", rec.label,
+                 (int)GetElapsedTimeInUs(module_start));
+        log.LogMessage(msg);
+      },
+      threads);
   for (int i = 0; i < module_num_; ++i) {
-    ModuleInitRecord& rec = module_inits_[i];
-    Module* instance = (*rec.create_function)(argc, argv);
     bool inserted;
     std::tie(std::ignore, inserted) =
-        module_instances_.emplace(rec.key, instance);
+        module_instances_.emplace(module_inits_[i].key, instances_[i]);
     assert(inserted);
   }
-  for (int i = 0; i < module_num_; ++i) {
+  destruction_order_ = RunInDependencyOrder(
+      [&](int i) {
+        ModuleInitRecord& rec = module_inits_[i];
+        auto module_start = std::chrono::steady_clock::now();
+        (*rec.init_function)(this, instances_[i]);
+        char msg[Log::kMaxMessageLength];
+        snprintf(msg, sizeof(msg), "%s initialized in %d us", rec.label,
+                 (int)GetElapsedTimeInUs(module_start));
+        log.LogMessage(msg);
+      },
+      threads);
+  std::reverse(destruction_order_.begin(), destruction_order_.end());
+
+  char msg[Log::kMaxMessageLength];
+  snprintf(msg, sizeof(msg), "%d modules started in %d us on %d threads",
+           module_num_, (int)GetElapsedTimeInUs(start), threads);
+  log.LogMessage(msg);
+}
+
+ModuleCenter::~ModuleCenter() {
+  // Dependents go first
+  for (int i : destruction_order_) {
     ModuleInitRecord& rec = module_inits_[i];
-    auto instanceIter = module_instances_.find(rec.key);
-    assert(instanceIter != module_instances_.end());
-    (*rec.init_function)(this, instanceIter->second);
+    (*rec.destroy_function)(instances_[i]);
   }
 }
 
-ModuleCenter::~ModuleCenter() {
+void ModuleCenter::CollectDependencies() {
+  dependents_.assign((size_t)module_num_, std::vector<int>());
+  dependency_counts_.assign((size_t)module_num_, 0);
   for (int i = 0; i < module_num_; ++i) {
-    ModuleInitRecord& rec = module_inits_[i];
-    auto instanceIter = module_instances_.find(rec.key);
-    assert(instanceIter != module_instances_.end());
-    (*rec.destroy_function)(instanceIter->second);
+    ModuleDependencies dependencies;
+    (*module_inits_[i].declare_function)(dependencies);
+    for (size_t id : dependencies.GetIds()) {
+      int dependency = 0;
+      while (dependency < module_num_ && module_inits_[dependency].key != id)
+        ++dependency;
+      assert(dependency < module_num_ && dependency != i);
+      dependents_[(size_t)dependency].push_back(i);
+      dependency_counts_[(size_t)i]++;
+    }
   }
 }
 
+std::vector<int> ModuleCenter::RunInDependencyOrder(
+    const std::function<void(int)>& step, int threads) {
+  std::vector<int> waiting_for = dependency_counts_;
+  std::deque<int> ready;  // registration order among the ready ones
+  for (int i = 0; i < module_num_; ++i)
+    if (waiting_for[(size_t)i] == 0) ready.push_back(i);
+  assert(module_num_ == 0 || !ready.empty());  // no circular dependencies
+  std::vector<int> finished;
+  std::mutex mutex;
+  std::condition_variable cond_var;
+  int running = 0;
+  auto work = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while ((int)finished.size() < module_num_) {
+      if (ready.empty()) {
+        // Nothing ready and nothing running means a circular dependency
+        assert(running > 0);
+        cond_var.wait(lock);
+        continue;
+      }
+      int i = ready.front();
+      ready.pop_front();
+      running++;
+      lock.unlock();
+      step(i);
+      lock.lock();
+      running--;
+      finished.push_back(i);
+      for (int dependent : dependents_[(size_t)i])
+        if (--waiting_for[(size_t)dependent] == 0) ready.push_back(dependent);
+      cond_var.notify_all();
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int t = 1; t < threads; ++t) pool.emplace_back(work);
+  work();
+  for (std::thread& thread : pool) thread.join();
+  return finished;
+}
+
 int ModuleCenter::module_num_ = 0;
 
 ModuleCenter::ModuleInitRecord
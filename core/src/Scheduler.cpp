@@ -1,22 +1,38 @@
 #include "zamt/core/Scheduler.h"
 
+#include "zamt/core/Trace.h"
+
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <system_error>
 
 namespace zamt {
 
-Scheduler::Scheduler(int worker_threads) : shutdown_initiated_(false) {
+Scheduler::Scheduler(int worker_threads, bool virtual_time)
+    : virtual_time_(virtual_time),
+      virtual_clock_(0),
+      task_sequence_(0),
+      pending_tasks_(0),
+      shutdown_initiated_(false),
+      waiting_workers_(0),
+      spinning_workers_(0),
+      queued_worker_tasks_(0),
+      adaptive_workers_(false),
+      busy_time_in_window_(0),
+      window_start_(GetSteadyTime()) {
   size_t workers = (size_t)worker_threads;
   if (workers == 0) workers = (size_t)std::thread::hardware_concurrency();
   if (workers == 0) workers = 1;
   sources_semaphore_.store((int)workers + 1, std::memory_order_release);
+  active_workers_.store((int)workers, std::memory_order_release);
   if (workers == 1) {
     max_spin_cycles_before_yield = 4;
   }
+  activities_.reset(new ActivitySlot[workers + 1]);
   workers_.reserve(workers);
-  while (workers-- > 0) {
-    workers_.emplace_back(&Scheduler::DoWorkerTasks, this);
+  for (size_t i = 0; i < workers; ++i) {
+    workers_.emplace_back(&Scheduler::DoWorkerTasks, this, (int)i);
   }
 }
 
@@ -30,28 +46,273 @@ Scheduler::~Scheduler() {
     } catch (const std::system_error& e) {
     }
   }
+  CancelQueuedTasks();
 }
 
 int Scheduler::GetNumberOfWorkers() const { return (int)workers_.size(); }
 
-void Scheduler::RegisterSource(SourceId source_id, int packet_size,
-                               int packets_in_queue) {
+void Scheduler::SetAdaptiveWorkers(bool adaptive) {
+  std::lock_guard<std::mutex> lock(worker_queue_mtx_);
+  adaptive_workers_.store(adaptive, std::memory_order_release);
+  if (!adaptive) {
+    active_workers_.store(GetNumberOfWorkers(), std::memory_order_release);
+    parked_workers_cv_.notify_all();
+  }
+}
+
+int Scheduler::GetNumberOfActiveWorkers() const {
+  return active_workers_.load(std::memory_order_acquire);
+}
+
+Scheduler::Time Scheduler::GetCurrentTime() const {
+  if (virtual_time_) return virtual_clock_.load(std::memory_order_acquire);
+  return (Time)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::high_resolution_clock::now().time_since_epoch())
+      .count();
+}
+
+void Scheduler::AdvanceVirtualTime(Time time) {
+  if (!virtual_time_) return;
+  Time current = virtual_clock_.load(std::memory_order_acquire);
+  while (current < time) {
+    if (virtual_clock_.compare_exchange_weak(current, time,
+                                             std::memory_order_acq_rel))
+      break;
+  }
+}
+
+Scheduler::Time Scheduler::SamplesToTime(uint64_t samples, int sample_rate) {
+  assert(sample_rate > 0);
+  return (Time)(samples * 1000000u / (uint64_t)sample_rate);
+}
+
+Scheduler::SourceId Scheduler::RegisterSource(const char* name,
+                                              int packet_size,
+                                              int packets_in_queue,
+                                              BackpressurePolicy policy,
+                                              int block_timeout_in_us) {
+  assert(name && name[0] != '\0');
+  std::unique_ptr<Source> src(CreateSource(name, packet_size, packets_in_queue,
+                                           policy, block_timeout_in_us));
   WriteLockSources();
-  assert(std::is_sorted(sources_.begin(), sources_.end()));
-  assert(!std::binary_search(sources_.begin(), sources_.end(),
-                             SourceRef(source_id)));
-  sources_.emplace_back(source_id, packet_size, packets_in_queue);
-  std::sort(sources_.begin(), sources_.end());
+  assert(FindSlotByName(name) == sources_.size());
+  size_t slot;
+  if (free_source_slots_.empty()) {
+    slot = sources_.size();
+    assert(slot <= kSourceSlotMask);
+    sources_.emplace_back();
+  } else {
+    slot = free_source_slots_.back();
+    free_source_slots_.pop_back();
+  }
+  sources_[slot].ptr = std::move(src);
+  SourceId source_id = MakeSourceId(slot, sources_[slot].generation);
   WriteUnlockSources();
+  return source_id;
+}
+
+void Scheduler::UnregisterSource(SourceId source_id) {
+  WriteLockSources();
+  Source* src = FindSourceById(source_id);
+  assert(src);
+  // Nothing may point into the source any more
+  assert(src->free_packets.size() == src->packet_usages.size());
+  assert(src->stale_tasks == 0);
+  assert(std::none_of(
+      src->subscriptions.begin(), src->subscriptions.end(),
+      [](const Subscription& sub) { return (bool)sub.sink_callback; }));
+  (void)src;
+  SourceSlot& slot = sources_[source_id & kSourceSlotMask];
+  std::unique_ptr<Source> unregistered(std::move(slot.ptr));
+  slot.generation = slot.generation % kSourceSlotMask + 1;
+  free_source_slots_.push_back(source_id & kSourceSlotMask);
+  WriteUnlockSources();
+  // Calls found it before, new ones do not find it any more
+  int cycles_left = max_spin_cycles_before_yield;
+  while (unregistered->users.load(std::memory_order_acquire) > 0) {
+    if (--cycles_left == 0) {
+      std::this_thread::yield();
+      cycles_left = max_spin_cycles_before_yield;
+    }
+  }
+}
+
+Scheduler::SourceId Scheduler::FindSource(const char* name) {
+  SourceId source_id = kInvalidSourceId;
+  ReadLockSources();
+  size_t slot = FindSlotByName(name);
+  if (slot < sources_.size())
+    source_id = MakeSourceId(slot, sources_[slot].generation);
+  ReadUnlockSources();
+  return source_id;
+}
+
+std::string Scheduler::GetSourceName(SourceId source_id) {
+  std::string name;
+  ReadLockSources();
+  Source* src = FindSourceById(source_id);
+  if (src) name = src->name;
+  ReadUnlockSources();
+  return name;
 }
 
 int Scheduler::GetPacketSize(SourceId source_id) {
-  return GetSourceById(source_id).packet_size;
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  LockSource(src);
+  int packet_size = src.packet_size;
+  UnlockSource(src);
+  return packet_size;
+}
+
+int Scheduler::GetSizeOfPacket(const Byte* packet) {
+  return reinterpret_cast<const PacketHeader*>(packet - kPacketHeaderSize)
+      ->size;
+}
+
+bool Scheduler::ReconfigureSource(SourceId source_id, int packet_size,
+                                  int packets_in_queue, Time timeout_in_us) {
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  Time deadline = GetSteadyTime() + timeout_in_us;
+  while (true) {
+    LockSource(src);
+    // Stale tasks still point into the old segments
+    bool drained = src.free_packets.size() == src.packet_usages.size() &&
+                   src.stale_tasks == 0;
+    if (drained) {
+      SetupPool(src, packet_size, packets_in_queue);
+      src.low_watermark_armed =
+          (int)src.free_packets.size() > src.low_watermark;
+    }
+    UnlockSource(src);
+    if (drained) return true;
+    if (GetSteadyTime() >= deadline ||
+        shutdown_initiated_.load(std::memory_order_acquire))
+      return false;
+    std::this_thread::sleep_for(
+        std::chrono::microseconds(kDrainPollIntervalInUs));
+  }
+}
+
+int Scheduler::GetNumberOfPackets(SourceId source_id) {
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  LockSource(src);
+  int packets = (int)src.packet_usages.size();
+  UnlockSource(src);
+  return packets;
+}
+
+void Scheduler::SetElasticPool(SourceId source_id, int max_packets_in_queue) {
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  LockSource(src);
+  assert(max_packets_in_queue >= (int)src.packet_usages.size());
+  src.max_packets = max_packets_in_queue;
+  // Growing does not reallocate under the lock then
+  size_t max_packets = (size_t)max_packets_in_queue;
+  src.segments.reserve(max_packets / (size_t)src.segment_packets);
+  src.packet_usages.reserve(max_packets);
+  src.packet_refcounts.reserve(max_packets);
+  src.packet_generations.reserve(max_packets);
+  src.packet_queued_tasks.reserve(max_packets);
+  src.packet_submit_order.reserve(max_packets);
+  src.packet_submit_times.reserve(max_packets);
+  UnlockSource(src);
+}
+
+Scheduler::PoolStats Scheduler::GetPoolStats(SourceId source_id) {
+  SourceUse use(*this, source_id);
+  return SamplePoolStats(use.source());
+}
+
+void Scheduler::GetAllPoolStats(std::vector<SourcePoolStats>& pool_stats) {
+  pool_stats.clear();
+  // Sources can not be unregistered while they are sampled
+  ReadLockSources();
+  for (size_t slot = 0; slot < sources_.size(); ++slot) {
+    const SourceSlot& source_slot = sources_[slot];
+    if (!source_slot.ptr) continue;
+    pool_stats.push_back({MakeSourceId(slot, source_slot.generation),
+                          SamplePoolStats(*source_slot.ptr)});
+  }
+  ReadUnlockSources();
+}
+
+Scheduler::PoolStats Scheduler::SamplePoolStats(Source& src) {
+  PoolStats stats;
+  LockSource(src);
+  stats.capacity = (int)src.packet_usages.size();
+  stats.max_capacity =
+      std::max(stats.capacity,
+               src.max_packets / src.segment_packets * src.segment_packets);
+  stats.in_use = stats.capacity - (int)src.free_packets.size();
+  stats.high_water = src.high_water;
+  stats.grows = src.grows;
+  stats.drops = src.lost_packets;
+  stats.released = src.released_packets;
+  stats.turnaround_in_us = src.turnaround_in_us;
+  UnlockSource(src);
+  return stats;
+}
+
+std::vector<Scheduler::SourceId> Scheduler::GetSourceIds() {
+  std::vector<SourceId> source_ids;
+  ReadLockSources();
+  source_ids.reserve(sources_.size());
+  for (size_t slot = 0; slot < sources_.size(); ++slot) {
+    if (sources_[slot].ptr)
+      source_ids.push_back(MakeSourceId(slot, sources_[slot].generation));
+  }
+  ReadUnlockSources();
+  std::sort(source_ids.begin(), source_ids.end());
+  return source_ids;
+}
+
+int Scheduler::GetFreePackets(SourceId source_id) {
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  LockSource(src);
+  int free_packets = (int)src.free_packets.size();
+  UnlockSource(src);
+  return free_packets;
+}
+
+uint64_t Scheduler::GetLostPackets(SourceId source_id) {
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  LockSource(src);
+  uint64_t lost_packets = src.lost_packets;
+  UnlockSource(src);
+  return lost_packets;
+}
+
+void Scheduler::SetLowWatermarkCallback(SourceId source_id, int free_packets,
+                                        LowWatermarkCallback callback) {
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  LockSource(src);
+  src.low_watermark = callback ? free_packets : -1;
+  src.low_watermark_armed = (int)src.free_packets.size() > src.low_watermark;
+  src.low_watermark_callback = callback;
+  UnlockSource(src);
 }
 
 void Scheduler::Subscribe(SourceId source_id, SinkCallback sink_callback,
                           bool on_UI, int& subscription_id) {
-  Source& src = GetSourceById(source_id);
+  subscription_id = AddSubscription(source_id, sink_callback, on_UI, false);
+}
+
+void Scheduler::SubscribeInOrder(SourceId source_id, SinkCallback sink_callback,
+                                 int& subscription_id) {
+  subscription_id = AddSubscription(source_id, sink_callback, false, true);
+}
+
+int Scheduler::AddSubscription(SourceId source_id, SinkCallback sink_callback,
+                               bool on_UI, bool in_order) {
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
   LockSource(src);
   auto& subs = src.subscriptions;
   size_t id = 0;
@@ -64,12 +325,16 @@ void Scheduler::Subscribe(SourceId source_id, SinkCallback sink_callback,
     id++;
   }
   if (id == subs.size()) subs.emplace_back(sink_callback, on_UI);
+  // Tasks still queued for an earlier sink keep the old turn
+  subs[id].turn.reset(in_order ? new std::atomic<uint64_t>(0) : nullptr);
+  subs[id].next_turn = 0;
   UnlockSource(src);
-  subscription_id = (int)id;
+  return (int)id;
 }
 
 void Scheduler::Unsubscribe(SourceId source_id, int subscription_id) {
-  Source& src = GetSourceById(source_id);
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
   LockSource(src);
   auto& subs = src.subscriptions;
   assert(subscription_id >= 0 && subscription_id < (int)subs.size());
@@ -78,37 +343,68 @@ void Scheduler::Unsubscribe(SourceId source_id, int subscription_id) {
 }
 
 Scheduler::Byte* Scheduler::GetPacketForSubmission(SourceId source_id) {
-  Source& src = GetSourceById(source_id);
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  Segment segment;
   LockSource(src);
-  if (src.free_packets.empty()) {
+  int packet_num = AcquirePacket(src);
+  // Growing early, so a load spike still finds free packets
+  if (IsGrowthDue(src, segment)) {
     UnlockSource(src);
-    return nullptr;
+    AllocateSegment(segment);
+    LockSource(src);
+    GrowPool(src, segment);
+    if (packet_num < 0) packet_num = AcquirePacket(src);
   }
-  int packet_num = src.free_packets.back();
-  assert(src.packet_refcounts.size() == src.packet_usages.size());
-  assert(src.free_packets.size() <= src.packet_refcounts.size());
-  assert(packet_num >= 0 && packet_num < (int)src.packet_refcounts.size());
+  if (packet_num < 0 && src.policy == BackpressurePolicy::kBlockWithTimeout) {
+    UnlockSource(src);
+    packet_num = WaitForPacket(src);
+    LockSource(src);
+  }
+  if (packet_num < 0) src.lost_packets++;
+  int free_packets = (int)src.free_packets.size();
+  bool low_watermark_hit =
+      src.low_watermark_armed && free_packets <= src.low_watermark;
+  if (low_watermark_hit) src.low_watermark_armed = false;
+  UnlockSource(src);
+  if (low_watermark_hit) src.low_watermark_callback(source_id, free_packets);
+  if (packet_num < 0) return nullptr;
+  return GetPacket(src, packet_num);
+}
 
-  src.free_packets.pop_back();
-  assert(src.packet_usages[(size_t)packet_num] == false);
-  src.packet_usages[(size_t)packet_num] = true;
+void Scheduler::CancelPacket(SourceId source_id, Byte* packet) {
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  int packet_num = GetPacketNum(packet);
+  std::unique_ptr<Byte[]> idle_segment;
+  LockSource(src);
+  assert(packet_num >= 0 && packet_num < (int)src.packet_refcounts.size());
+  assert(src.packet_usages[(size_t)packet_num] == true);
   assert(src.packet_refcounts[(size_t)packet_num] == 0);
+  FreePacket(src, packet_num, idle_segment);
   UnlockSource(src);
-  return &src.packet_buffer[(size_t)packet_num * (size_t)src.packet_size];
+  if (idle_segment) FreeIdleSegments(src, idle_segment);
+  NotifyPacketWaiters(src);
 }
 
 void Scheduler::SubmitPacket(SourceId source_id, Byte* packet, Time timestamp) {
-  Source& src = GetSourceById(source_id);
-  int packet_num =
-      static_cast<int>(packet - &src.packet_buffer[0]) / src.packet_size;
+  ZAMT_TRACE_SCOPE("SubmitPacket", (int64_t)source_id, (int64_t)timestamp);
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  int packet_num = GetPacketNum(packet);
+  AdvanceVirtualTime(timestamp);
+  Time submit_time = GetSteadyTime();
+  std::unique_ptr<Byte[]> idle_segment;
+  LockSource(src);
   assert(src.packet_refcounts.size() == src.packet_usages.size());
   assert(src.free_packets.size() < src.packet_refcounts.size());
   assert(packet_num >= 0 && packet_num < (int)src.packet_refcounts.size());
   assert(src.packet_usages[(size_t)packet_num] == true);
   assert(src.packet_refcounts[(size_t)packet_num] == 0);
-
-  LockSource(src);
   src.packet_refcounts[(size_t)packet_num] = 0;
+  Source* overwritable_source =
+      src.policy == BackpressurePolicy::kOverwriteOldest ? &src : nullptr;
+  uint32_t generation = src.packet_generations[(size_t)packet_num];
   int UI_subscribers = 0;
   int normal_subscribers = 0;
   for (auto& subscription : src.subscriptions) {
@@ -119,81 +415,207 @@ void Scheduler::SubmitPacket(SourceId source_id, Byte* packet, Time timestamp) {
         normal_subscribers++;
     }
   }
+  pending_tasks_.fetch_add(UI_subscribers + normal_subscribers,
+                           std::memory_order_acq_rel);
   if (UI_subscribers) {
     std::lock_guard<std::mutex> lock(UI_queue_mtx_);
+    if (tasks_for_UI_.empty() && UI_task_notifier_) UI_task_notifier_();
     for (auto& subscription : src.subscriptions) {
       if (subscription.sink_callback && subscription.on_UI) {
-        tasks_for_UI_.emplace(timestamp, source_id, subscription.sink_callback,
-                              packet);
+        tasks_for_UI_.emplace(
+            timestamp, task_sequence_.fetch_add(1, std::memory_order_relaxed),
+            source_id, subscription, packet, overwritable_source, generation);
         ++src.packet_refcounts[(size_t)packet_num];
       }
     }
   }
+  int workers_to_wake = 0;
   if (normal_subscribers) {
     std::lock_guard<std::mutex> lock(worker_queue_mtx_);
     for (auto& subscription : src.subscriptions) {
       if (subscription.sink_callback && !subscription.on_UI) {
-        tasks_for_workers_.emplace(timestamp, source_id,
-                                   subscription.sink_callback, packet);
+        tasks_for_workers_.emplace(
+            timestamp, task_sequence_.fetch_add(1, std::memory_order_relaxed),
+            source_id, subscription, packet, overwritable_source, generation);
         ++src.packet_refcounts[(size_t)packet_num];
       }
     }
+    int queued = queued_worker_tasks_.fetch_add(normal_subscribers) +
+                 normal_subscribers;
+    // Spinning workers find the tasks without being woken up
+    workers_to_wake = std::min(normal_subscribers - spinning_workers_,
+                               waiting_workers_);
+    if (adaptive_workers_.load(std::memory_order_acquire) &&
+        queued > active_workers_.load(std::memory_order_acquire))
+      UnparkWorker();
   }
   if (UI_subscribers) UI_queue_cv_.notify_one();
-  while (normal_subscribers--) worker_queue_cv_.notify_one();
-  if (src.packet_refcounts[(size_t)packet_num] == 0) {
-    src.free_packets.push_back(packet_num);
-    src.packet_usages[(size_t)packet_num] = false;
-  }
+  while (workers_to_wake-- > 0) worker_queue_cv_.notify_one();
+  src.packet_queued_tasks[(size_t)packet_num] =
+      src.packet_refcounts[(size_t)packet_num];
+  src.packet_submit_order[(size_t)packet_num] = src.submitted_packets++;
+  src.packet_submit_times[(size_t)packet_num] = submit_time;
+  bool freed = src.packet_refcounts[(size_t)packet_num] == 0;
+  if (freed) FreePacket(src, packet_num, idle_segment);
   UnlockSource(src);
+  if (idle_segment) FreeIdleSegments(src, idle_segment);
+  if (freed) NotifyPacketWaiters(src);
 }
 
 void Scheduler::ReleasePacket(SourceId source_id, const Byte* packet) {
-  Source& src = GetSourceById(source_id);
-  int packet_num =
-      static_cast<int>(packet - &src.packet_buffer[0]) / src.packet_size;
+  SourceUse use(*this, source_id);
+  Source& src = use.source();
+  int packet_num = GetPacketNum(packet);
+  Time release_time = GetSteadyTime();
+  std::unique_ptr<Byte[]> idle_segment;
+  LockSource(src);
   assert(src.packet_refcounts.size() == src.packet_usages.size());
   assert(src.free_packets.size() < src.packet_refcounts.size());
   assert(packet_num >= 0 && packet_num < (int)src.packet_refcounts.size());
   assert(src.packet_usages[(size_t)packet_num] == true);
   assert(src.packet_refcounts[(size_t)packet_num] > 0);
-
-  LockSource(src);
-  if (--src.packet_refcounts[(size_t)packet_num] == 0) {
-    src.free_packets.push_back(packet_num);
-    src.packet_usages[(size_t)packet_num] = false;
+  bool freed = --src.packet_refcounts[(size_t)packet_num] == 0;
+  if (freed) {
+    src.released_packets++;
+    src.turnaround_in_us +=
+        release_time - src.packet_submit_times[(size_t)packet_num];
+    FreePacket(src, packet_num, idle_segment);
   }
   UnlockSource(src);
+  if (idle_segment) FreeIdleSegments(src, idle_segment);
+  if (freed) NotifyPacketWaiters(src);
 }
 
 void Scheduler::DoUITaskStep() { DispatchTasks(true); }
 
+bool Scheduler::DoUITasks(Time budget) {
+  Time deadline = GetSteadyTime() + budget;
+  do {
+    DispatchTasks(true);
+  } while (HasUITasks() && GetSteadyTime() < deadline &&
+           !shutdown_initiated_.load(std::memory_order_acquire));
+  return HasUITasks() && !shutdown_initiated_.load(std::memory_order_acquire);
+}
+
+void Scheduler::SetUITaskNotifier(UITaskNotifier notifier) {
+  std::lock_guard<std::mutex> lock(UI_queue_mtx_);
+  UI_task_notifier_ = notifier;
+}
+
+bool Scheduler::HasUITasks() {
+  std::lock_guard<std::mutex> lock(UI_queue_mtx_);
+  return !tasks_for_UI_.empty();
+}
+
+void Scheduler::WaitForIdle() {
+  while (pending_tasks_.load(std::memory_order_acquire) > 0 &&
+         !shutdown_initiated_.load(std::memory_order_acquire)) {
+    DoUITaskStep();
+    std::this_thread::yield();
+  }
+}
+
 void Scheduler::Shutdown() {
   {
     std::lock_guard<std::mutex> lock(worker_queue_mtx_);
     shutdown_initiated_.store(true, std::memory_order_release);
   }
   worker_queue_cv_.notify_all();
+  parked_workers_cv_.notify_all();
   UI_queue_cv_.notify_all();
+  ReadLockSources();
+  for (SourceSlot& source_slot : sources_) {
+    if (!source_slot.ptr) continue;
+    Source& src = *source_slot.ptr;
+    { std::lock_guard<std::mutex> lock(src.release_mtx); }
+    src.release_cv.notify_all();
+  }
+  ReadUnlockSources();
 }
 
-void Scheduler::DoWorkerTasks() { DispatchTasks(false); }
+int Scheduler::DrainAndShutdown(Time timeout_in_us) {
+  Time deadline = GetSteadyTime() + timeout_in_us;
+  while (!shutdown_initiated_.load(std::memory_order_acquire)) {
+    int pending = pending_tasks_.load(std::memory_order_acquire);
+    {
+      std::lock_guard<std::mutex> lock(UI_queue_mtx_);
+      // Nobody will do UI tasks without a main loop
+      if (!UI_task_notifier_) pending -= (int)tasks_for_UI_.size();
+    }
+    if (pending <= 0 || GetSteadyTime() >= deadline) break;
+    std::this_thread::sleep_for(
+        std::chrono::microseconds(kDrainPollIntervalInUs));
+  }
+  Shutdown();
+  return CancelQueuedTasks();
+}
+
+int Scheduler::CancelQueuedTasks() {
+  assert(shutdown_initiated_.load(std::memory_order_acquire));
+  int cancelled = 0;
+  for (int UI_queue = 0; UI_queue < 2; ++UI_queue) {
+    auto& tasks = UI_queue ? tasks_for_UI_ : tasks_for_workers_;
+    auto& mutex = UI_queue ? UI_queue_mtx_ : worker_queue_mtx_;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!tasks.empty()) {
+      const Task& task = *tasks.top().ptr;
+      SourceId source_id = task.source_id;
+      Byte* packet = task.packet;
+      Source* overwritable_source = task.overwritable_source;
+      uint32_t generation = task.generation;
+      tasks.pop();
+      if (!UI_queue) queued_worker_tasks_.fetch_sub(1);
+      lock.unlock();
+      // A packet taken back by its source is not held by the task
+      if (!overwritable_source ||
+          StartTask(*overwritable_source, packet, generation))
+        ReleasePacket(source_id, packet);
+      pending_tasks_.fetch_sub(1, std::memory_order_acq_rel);
+      cancelled++;
+      lock.lock();
+    }
+  }
+  return cancelled;
+}
+
+void Scheduler::GetThreadActivities(
+    std::vector<ThreadActivity>& activities) const {
+  activities.resize(workers_.size() + 1);
+  for (size_t i = 0; i < activities.size(); ++i) {
+    const ActivitySlot& slot = activities_[i];
+    ThreadActivity& activity = activities[i];
+    // Done first, so a task finished in between is not seen running
+    activity.tasks_done = slot.tasks_done.load(std::memory_order_acquire);
+    // Started before the source, which is stored before the start is counted
+    activity.tasks_started = slot.tasks_started.load(std::memory_order_acquire);
+    activity.source_id = slot.source_id.load(std::memory_order_relaxed);
+  }
+}
+
+int Scheduler::GetPendingTasks() const {
+  return pending_tasks_.load(std::memory_order_acquire);
+}
+
+void Scheduler::DoWorkerTasks(int worker_index) {
+  DispatchTasks(false, worker_index);
+}
 
-void Scheduler::DispatchTasks(bool UI_thread_mode) {
+void Scheduler::DispatchTasks(bool UI_thread_mode, int worker_index) {
   auto& tasks = UI_thread_mode ? tasks_for_UI_ : tasks_for_workers_;
   auto& mutex = UI_thread_mode ? UI_queue_mtx_ : worker_queue_mtx_;
-  auto& cond_var = UI_thread_mode ? UI_queue_cv_ : worker_queue_cv_;
+  ActivitySlot& activity = activities_[(size_t)(worker_index + 1)];
   while (!shutdown_initiated_.load(std::memory_order_acquire)) {
     SinkCallback sink_callback;
-    SourceId source_id;
-    Byte* packet;
-    Time timestamp;
+    SourceId source_id = kInvalidSourceId;
+    Byte* packet = nullptr;
+    Time timestamp = 0;
+    Source* overwritable_source = nullptr;
+    uint32_t generation = 0;
+    std::shared_ptr<std::atomic<uint64_t>> turn;
+    uint64_t my_turn = 0;
     {
       std::unique_lock<std::mutex> lock(mutex);
-      while (!UI_thread_mode && tasks.empty() &&
-             !shutdown_initiated_.load(std::memory_order_acquire)) {
-        cond_var.wait(lock);
-      }
+      if (!UI_thread_mode) WaitForWorkerTask(lock, worker_index);
       if (!tasks.empty() &&
           !shutdown_initiated_.load(std::memory_order_acquire)) {
         const TaskRef& task_ref = tasks.top();
@@ -204,66 +626,458 @@ void Scheduler::DispatchTasks(bool UI_thread_mode) {
         source_id = task.source_id;
         packet = task.packet;
         timestamp = task_ref.timestamp;
+        overwritable_source = task.overwritable_source;
+        generation = task.generation;
+        turn = std::move(task.turn);
+        my_turn = task.my_turn;
         tasks.pop();
+        if (!UI_thread_mode) queued_worker_tasks_.fetch_sub(1);
       }
     }
     if (sink_callback) {
-      sink_callback(source_id, packet, timestamp);
+      ZAMT_TRACE_INSTANT("Dequeue", (int64_t)source_id, (int64_t)timestamp);
+    }
+    // The packet can still be taken back while waiting
+    if (turn) WaitForTurn(*turn, my_turn);
+    if (overwritable_source &&
+        !StartTask(*overwritable_source, packet, generation)) {
+      // The source took the packet back before any sink started it
+      sink_callback = nullptr;
+      pending_tasks_.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    if (sink_callback) {
+      bool measure =
+          !UI_thread_mode && adaptive_workers_.load(std::memory_order_acquire);
+      Time start = measure ? GetSteadyTime() : 0;
+      activity.source_id.store(source_id, std::memory_order_relaxed);
+      // Only this thread writes its slot, no read-modify-write is needed
+      activity.tasks_started.store(
+          activity.tasks_started.load(std::memory_order_relaxed) + 1,
+          std::memory_order_release);
+      {
+        ZAMT_TRACE_SCOPE("Sink", (int64_t)source_id, (int64_t)timestamp);
+        sink_callback(source_id, packet, timestamp);
+      }
+      activity.tasks_done.store(
+          activity.tasks_done.load(std::memory_order_relaxed) + 1,
+          std::memory_order_release);
+      pending_tasks_.fetch_sub(1, std::memory_order_acq_rel);
+      if (measure) AccountWorkerTime(GetSteadyTime() - start);
     }
+    // A task of a taken back packet passes the turn on too
+    if (turn) turn->store(my_turn + 1, std::memory_order_release);
     if (UI_thread_mode) return;
   }
 }
 
+void Scheduler::WaitForWorkerTask(std::unique_lock<std::mutex>& lock,
+                                  int worker_index) {
+  bool spun = false;
+  while (!shutdown_initiated_.load(std::memory_order_acquire)) {
+    bool adaptive = adaptive_workers_.load(std::memory_order_acquire);
+    if (adaptive &&
+        worker_index >= active_workers_.load(std::memory_order_acquire)) {
+      // The wakeup this worker got may belong to an active one
+      if (!tasks_for_workers_.empty()) worker_queue_cv_.notify_one();
+      parked_workers_cv_.wait(lock);
+      continue;
+    }
+    if (!tasks_for_workers_.empty()) return;
+    if (adaptive && !spun && spinning_workers_ < kMaxSpinningWorkers) {
+      // Tasks may come while spinning without a wakeup, so check again
+      spinning_workers_++;
+      lock.unlock();
+      SpinForWorkerTask();
+      lock.lock();
+      spinning_workers_--;
+      spun = true;
+      continue;
+    }
+    waiting_workers_++;
+    worker_queue_cv_.wait(lock);
+    waiting_workers_--;
+    spun = false;
+  }
+}
+
+void Scheduler::WaitForTurn(const std::atomic<uint64_t>& turn,
+                            uint64_t my_turn) {
+  int cycles_left = max_spin_cycles_before_yield;
+  // The earlier task may never run after a shutdown
+  while (turn.load(std::memory_order_acquire) != my_turn &&
+         !shutdown_initiated_.load(std::memory_order_acquire)) {
+    if (--cycles_left == 0) {
+      std::this_thread::yield();
+      cycles_left = max_spin_cycles_before_yield;
+    }
+  }
+}
+
+void Scheduler::SpinForWorkerTask() {
+  Time deadline = GetSteadyTime() + kSpinBeforeSleepInUs;
+  do {
+    if (queued_worker_tasks_.load(std::memory_order_acquire) > 0) return;
+    std::this_thread::yield();
+  } while (GetSteadyTime() < deadline &&
+           !shutdown_initiated_.load(std::memory_order_acquire));
+}
+
+void Scheduler::UnparkWorker() {
+  int active = active_workers_.load(std::memory_order_acquire);
+  while (active < GetNumberOfWorkers()) {
+    if (active_workers_.compare_exchange_weak(active, active + 1,
+                                              std::memory_order_acq_rel)) {
+      parked_workers_cv_.notify_all();
+      return;
+    }
+  }
+}
+
+void Scheduler::AccountWorkerTime(Time busy_time) {
+  busy_time_in_window_.fetch_add(busy_time, std::memory_order_relaxed);
+  Time now = GetSteadyTime();
+  Time start = window_start_.load(std::memory_order_acquire);
+  if (now - start < (Time)kUtilizationWindowInUs ||
+      !window_start_.compare_exchange_strong(start, now,
+                                             std::memory_order_acq_rel))
+    return;
+  // Only one worker gets here for every window
+  Time busy = busy_time_in_window_.exchange(0, std::memory_order_relaxed);
+  int active = active_workers_.load(std::memory_order_acquire);
+  Time utilization = busy * 100 / ((now - start) * (Time)active);
+  if (utilization < (Time)kParkBelowUtilizationPercent && active > 1) {
+    active_workers_.compare_exchange_strong(active, active - 1,
+                                            std::memory_order_acq_rel);
+  } else if (utilization > (Time)kUnparkAboveUtilizationPercent) {
+    std::lock_guard<std::mutex> lock(worker_queue_mtx_);
+    UnparkWorker();
+  }
+}
+
+Scheduler::Time Scheduler::GetSteadyTime() {
+  return (Time)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 Scheduler::Subscription::Subscription(SinkCallback _sink_callback,
                                       bool _on_UI) {
   sink_callback = _sink_callback;
   on_UI = _on_UI;
+  next_turn = 0;
 }
 
-Scheduler::SourceRef::SourceRef(SourceId _source_id) : source_id(_source_id) {}
-
-Scheduler::SourceRef::SourceRef(SourceId _source_id, int packet_size,
-                                int packets_in_queue)
-    : SourceRef(_source_id) {
-  assert(packet_size >= 0);
-  assert(packets_in_queue > 0);
-  ptr.reset(new Source());
-  ptr->source_mtx_.clear(std::memory_order_release);
-  ptr->packet_size = packet_size;
-  ptr->free_packets.reserve((size_t)packets_in_queue);
-  ptr->packet_usages.resize((size_t)packets_in_queue, false);
-  ptr->packet_refcounts.resize((size_t)packets_in_queue, 0);
-  ptr->packet_buffer.resize((size_t)packets_in_queue * (size_t)packet_size, 0);
-  for (int i = packets_in_queue - 1; i >= 0; --i) {
-    ptr->free_packets.push_back(i);
-  }
+Scheduler::Source* Scheduler::CreateSource(const char* name, int packet_size,
+                                           int packets_in_queue,
+                                           BackpressurePolicy policy,
+                                           int block_timeout_in_us) {
+  assert(block_timeout_in_us >= 0);
+  Source* src = new Source();
+  src->source_mtx_.clear(std::memory_order_release);
+  src->name = name;
+  src->policy = policy;
+  src->block_timeout_in_us = block_timeout_in_us;
+  src->lost_packets = 0;
+  src->submitted_packets = 0;
+  src->released_packets = 0;
+  src->turnaround_in_us = 0;
+  src->stale_tasks = 0;
+  src->packet_waiters.store(0, std::memory_order_release);
+  src->users.store(0, std::memory_order_release);
+  src->low_watermark = -1;
+  src->low_watermark_armed = false;
+  SetupPool(*src, packet_size, packets_in_queue);
+  return src;
 }
 
-bool Scheduler::SourceRef::operator<(const SourceRef& o) const {
-  return source_id < o.source_id;
+Scheduler::SourceId Scheduler::MakeSourceId(size_t slot, SourceId generation) {
+  assert(generation > 0 && generation <= kSourceSlotMask);
+  return generation << kSourceSlotBits | (SourceId)slot;
 }
 
-Scheduler::TaskRef::TaskRef(Time _timestamp, SourceId source_id,
-                            SinkCallback sink_callback, Byte* packet) {
+Scheduler::TaskRef::TaskRef(Time _timestamp, uint64_t _sequence,
+                            SourceId source_id, Subscription& subscription,
+                            Byte* packet, Source* overwritable_source,
+                            uint32_t generation) {
   timestamp = _timestamp;
+  sequence = _sequence;
   ptr.reset(new Task());
   ptr->source_id = source_id;
-  ptr->sink_callback = sink_callback;
+  ptr->sink_callback = subscription.sink_callback;
   ptr->packet = packet;
+  ptr->overwritable_source = overwritable_source;
+  ptr->generation = generation;
+  ptr->turn = subscription.turn;
+  ptr->my_turn = subscription.turn ? subscription.next_turn++ : 0;
 }
 
 bool Scheduler::TaskRef::operator<(const TaskRef& o) const {
-  return timestamp > o.timestamp;  // finish the earliest job first
+  if (timestamp != o.timestamp)
+    return timestamp > o.timestamp;  // finish the earliest job first
+  return sequence > o.sequence;
 }
 
-Scheduler::Source& Scheduler::GetSourceById(SourceId source_id) {
-  ReadLockSources();
-  auto src_it =
-      std::lower_bound(sources_.begin(), sources_.end(), SourceRef(source_id));
-  assert(src_it != sources_.end() && src_it->source_id == source_id);
-  Source& src = *src_it->ptr;
-  ReadUnlockSources();
-  return src;
+Scheduler::SourceUse::SourceUse(Scheduler& scheduler, SourceId source_id) {
+  scheduler.ReadLockSources();
+  src_ = scheduler.FindSourceById(source_id);
+  assert(src_);
+  src_->users.fetch_add(1, std::memory_order_acq_rel);
+  scheduler.ReadUnlockSources();
+}
+
+Scheduler::SourceUse::~SourceUse() {
+  src_->users.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+Scheduler::Source* Scheduler::FindSourceById(SourceId source_id) {
+  size_t slot = source_id & kSourceSlotMask;
+  if (slot >= sources_.size()) return nullptr;
+  const SourceSlot& source_slot = sources_[slot];
+  if (!source_slot.ptr ||
+      MakeSourceId(slot, source_slot.generation) != source_id)
+    return nullptr;
+  return source_slot.ptr.get();
+}
+
+size_t Scheduler::FindSlotByName(const char* name) {
+  size_t slot = 0;
+  while (slot < sources_.size() &&
+         !(sources_[slot].ptr && sources_[slot].ptr->name == name))
+    slot++;
+  return slot;
+}
+
+void Scheduler::SetupPool(Source& src, int packet_size, int packets_in_queue) {
+  assert(packet_size >= 0);
+  assert(packets_in_queue > 0);
+  src.free_packets.clear();
+  src.packet_usages.clear();
+  src.packet_refcounts.clear();
+  src.packet_generations.clear();
+  src.packet_queued_tasks.clear();
+  src.packet_submit_order.clear();
+  src.packet_submit_times.clear();
+  src.segments.clear();
+  src.packet_size = packet_size;
+  src.segment_packets = packets_in_queue;
+  src.packet_stride =
+      kPacketHeaderSize + ((size_t)packet_size + kPacketAlignment - 1) /
+                              kPacketAlignment * kPacketAlignment;
+  src.max_packets = packets_in_queue;
+  src.high_water = 0;
+  Segment segment;
+  PlanSegment(src, segment);
+  AllocateSegment(segment);
+  bool grown = GrowPool(src, segment);
+  assert(grown);
+  (void)grown;
+  src.grows = 0;
+}
+
+int Scheduler::AcquirePacket(Source& src) {
+  if (src.free_packets.empty()) {
+    // Growing comes first, the caller does it without the lock
+    if (src.policy == BackpressurePolicy::kOverwriteOldest &&
+        !CanGrowPool(src))
+      return TakeBackOldestPacket(src);
+    return -1;
+  }
+  int packet_num = src.free_packets.back();
+  assert(src.packet_refcounts.size() == src.packet_usages.size());
+  assert(src.free_packets.size() <= src.packet_refcounts.size());
+  assert(packet_num >= 0 && packet_num < (int)src.packet_refcounts.size());
+
+  src.free_packets.pop_back();
+  assert(src.packet_usages[(size_t)packet_num] == false);
+  src.packet_usages[(size_t)packet_num] = true;
+  assert(src.packet_refcounts[(size_t)packet_num] == 0);
+  int capacity = (int)src.packet_usages.size();
+  int in_use = capacity - (int)src.free_packets.size();
+  if (in_use > src.high_water) src.high_water = in_use;
+  return packet_num;
+}
+
+int Scheduler::TakeBackOldestPacket(Source& src) {
+  int oldest = -1;
+  for (size_t i = 0; i < src.packet_usages.size(); ++i) {
+    // Packets being filled by the source or read by a sink are not touched
+    if (!src.packet_usages[i] || src.packet_refcounts[i] == 0 ||
+        src.packet_queued_tasks[i] != src.packet_refcounts[i])
+      continue;
+    if (oldest < 0 || src.packet_submit_order[i] <
+                          src.packet_submit_order[(size_t)oldest])
+      oldest = (int)i;
+  }
+  if (oldest < 0) return -1;
+  // Its queued tasks become stale and are skipped by the dispatcher
+  src.packet_generations[(size_t)oldest]++;
+  src.stale_tasks += src.packet_queued_tasks[(size_t)oldest];
+  src.packet_refcounts[(size_t)oldest] = 0;
+  src.packet_queued_tasks[(size_t)oldest] = 0;
+  src.lost_packets++;
+  return oldest;
+}
+
+void Scheduler::FreePacket(Source& src, int packet_num,
+                           std::unique_ptr<Byte[]>& idle_segment) {
+  // Packets of grown segments are handed out last, so they can get idle
+  if (packet_num < src.segment_packets)
+    src.free_packets.push_back(packet_num);
+  else
+    src.free_packets.push_front(packet_num);
+  src.packet_usages[(size_t)packet_num] = false;
+  if ((int)src.free_packets.size() > src.low_watermark)
+    src.low_watermark_armed = true;
+  ShrinkPool(src, idle_segment);
+}
+
+void Scheduler::FreeIdleSegments(Source& src,
+                                 std::unique_ptr<Byte[]>& idle_segment) {
+  while (idle_segment) {
+    idle_segment.reset();
+    LockSource(src);
+    ShrinkPool(src, idle_segment);
+    UnlockSource(src);
+  }
+}
+
+bool Scheduler::CanGrowPool(Source& src) {
+  return (int)src.packet_usages.size() + src.segment_packets <=
+         src.max_packets;
+}
+
+bool Scheduler::IsGrowthDue(Source& src, Segment& segment) {
+  int capacity = (int)src.packet_usages.size();
+  int in_use = capacity - (int)src.free_packets.size();
+  if (in_use * 100 < capacity * kGrowAtUsagePercent || !CanGrowPool(src))
+    return false;
+  PlanSegment(src, segment);
+  return true;
+}
+
+void Scheduler::PlanSegment(Source& src, Segment& segment) {
+  segment.first_packet = (int)src.packet_usages.size();
+  segment.packets = src.segment_packets;
+  segment.packet_size = src.packet_size;
+  segment.packet_stride = src.packet_stride;
+}
+
+void Scheduler::AllocateSegment(Segment& segment) {
+  // Not zeroed, the pages of the data are touched by the source first
+  segment.memory.reset(
+      new Byte[segment.packet_stride * (size_t)segment.packets]);
+  for (int i = 0; i < segment.packets; ++i) {
+    PacketHeader* header = reinterpret_cast<PacketHeader*>(
+        &segment.memory[(size_t)i * segment.packet_stride]);
+    header->packet_num = segment.first_packet + i;
+    header->size = segment.packet_size;
+  }
+}
+
+bool Scheduler::GrowPool(Source& src, Segment& segment) {
+  int capacity = (int)src.packet_usages.size();
+  if (!segment.memory || segment.first_packet != capacity ||
+      segment.packets != src.segment_packets ||
+      segment.packet_size != src.packet_size ||
+      segment.packet_stride != src.packet_stride || !CanGrowPool(src))
+    return false;
+  src.segments.push_back(std::move(segment.memory));
+  size_t new_capacity = (size_t)(capacity + src.segment_packets);
+  src.packet_usages.resize(new_capacity, false);
+  src.packet_refcounts.resize(new_capacity, 0);
+  src.packet_generations.resize(new_capacity, 0);
+  src.packet_queued_tasks.resize(new_capacity, 0);
+  src.packet_submit_order.resize(new_capacity, 0);
+  src.packet_submit_times.resize(new_capacity, 0);
+  // Lower packet numbers are handed out first, so the last segment gets idle
+  for (int packet_num = capacity; packet_num < (int)new_capacity; ++packet_num)
+    src.free_packets.push_front(packet_num);
+  src.grows++;
+  return true;
+}
+
+void Scheduler::ShrinkPool(Source& src,
+                           std::unique_ptr<Byte[]>& idle_segment) {
+  if (src.segments.size() <= 1 || src.stale_tasks != 0 || idle_segment)
+    return;
+  int capacity = (int)src.packet_usages.size();
+  int in_use = capacity - (int)src.free_packets.size();
+  if (in_use * 100 > capacity * kShrinkAtUsagePercent) return;
+  int first_of_last = capacity - src.segment_packets;
+  for (int i = first_of_last; i < capacity; ++i) {
+    if (src.packet_usages[(size_t)i]) return;
+  }
+  src.free_packets.erase(
+      std::remove_if(src.free_packets.begin(), src.free_packets.end(),
+                     [first_of_last](int packet_num) {
+                       return packet_num >= first_of_last;
+                     }),
+      src.free_packets.end());
+  src.packet_usages.resize((size_t)first_of_last);
+  src.packet_refcounts.resize((size_t)first_of_last);
+  src.packet_generations.resize((size_t)first_of_last);
+  src.packet_queued_tasks.resize((size_t)first_of_last);
+  src.packet_submit_order.resize((size_t)first_of_last);
+  src.packet_submit_times.resize((size_t)first_of_last);
+  idle_segment = std::move(src.segments.back());
+  src.segments.pop_back();
+}
+
+Scheduler::Byte* Scheduler::GetPacket(Source& src, int packet_num) {
+  size_t segment = (size_t)(packet_num / src.segment_packets);
+  size_t index = (size_t)(packet_num % src.segment_packets);
+  assert(segment < src.segments.size());
+  return &src.segments[segment][index * src.packet_stride + kPacketHeaderSize];
+}
+
+int Scheduler::GetPacketNum(const Byte* packet) {
+  return reinterpret_cast<const PacketHeader*>(packet - kPacketHeaderSize)
+      ->packet_num;
+}
+
+int Scheduler::WaitForPacket(Source& src) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::microseconds(src.block_timeout_in_us);
+  std::unique_lock<std::mutex> lock(src.release_mtx);
+  src.packet_waiters.fetch_add(1, std::memory_order_acq_rel);
+  int packet_num;
+  do {
+    LockSource(src);
+    packet_num = AcquirePacket(src);
+    UnlockSource(src);
+  } while (packet_num < 0 &&
+           !shutdown_initiated_.load(std::memory_order_acquire) &&
+           src.release_cv.wait_until(lock, deadline) !=
+               std::cv_status::timeout);
+  if (packet_num < 0) {
+    // A release may have come right at the timeout
+    LockSource(src);
+    packet_num = AcquirePacket(src);
+    UnlockSource(src);
+  }
+  src.packet_waiters.fetch_sub(1, std::memory_order_acq_rel);
+  return packet_num;
+}
+
+void Scheduler::NotifyPacketWaiters(Source& src) {
+  if (src.packet_waiters.load(std::memory_order_acquire) == 0) return;
+  { std::lock_guard<std::mutex> lock(src.release_mtx); }
+  src.release_cv.notify_one();
+}
+
+bool Scheduler::StartTask(Source& src, const Byte* packet,
+                          uint32_t generation) {
+  size_t packet_num = (size_t)GetPacketNum(packet);
+  LockSource(src);
+  bool current = src.packet_generations[packet_num] == generation;
+  if (current) {
+    assert(src.packet_queued_tasks[packet_num] > 0);
+    src.packet_queued_tasks[packet_num]--;
+  } else {
+    src.stale_tasks--;
+  }
+  UnlockSource(src);
+  return current;
 }
 
 void Scheduler::WriteLockSources() {
@@ -321,6 +1135,8 @@ void Scheduler::UnlockSource(Source& src) {
   src.source_mtx_.clear(std::memory_order_release);
 }
 
+const Scheduler::SourceId Scheduler::kInvalidSourceId;
+const int Scheduler::kDrainPollIntervalInUs;
 int Scheduler::max_spin_cycles_before_yield = 256;
 
 }  // namespace zamt
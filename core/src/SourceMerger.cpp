@@ -0,0 +1,216 @@
+#include "zamt/core/SourceMerger.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace zamt {
+
+SourceMerger::SourceMerger(Scheduler* scheduler,
+                           const std::vector<Input>& inputs, int sample_rate,
+                           const char* name, int frames_per_packet,
+                           int packets_in_queue)
+    : scheduler_(scheduler),
+      sample_rate_(sample_rate),
+      frames_per_packet_(frames_per_packet) {
+  assert(scheduler_ && !inputs.empty());
+  assert(sample_rate_ > 0 && frames_per_packet_ > 0);
+  inputs_.resize(inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    assert(inputs[i].channels > 0);
+    inputs_[i].source_id = inputs[i].source_id;
+    inputs_[i].channels = inputs[i].channels;
+    channels_ += inputs[i].channels;
+  }
+  output_id_ = scheduler_->RegisterSource(
+      name, frames_per_packet_ * channels_ * (int)sizeof(Sample),
+      packets_in_queue);
+  // The samples and the drift fit of an input need its packets in order
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    scheduler_->SubscribeInOrder(
+        inputs_[i].source_id,
+        std::bind(&SourceMerger::OnPacket, this, i, std::placeholders::_1,
+                  std::placeholders::_2, std::placeholders::_3),
+        inputs_[i].subscription_id);
+  }
+}
+
+SourceMerger::~SourceMerger() {
+  for (InputState& state : inputs_) {
+    assert(state.subscription_id < 0);
+    (void)state;
+  }
+}
+
+void SourceMerger::Stop() {
+  for (InputState& state : inputs_) {
+    if (state.subscription_id < 0) continue;
+    scheduler_->Unsubscribe(state.source_id, state.subscription_id);
+    state.subscription_id = -1;
+  }
+}
+
+double SourceMerger::GetDriftPpm(size_t input) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  assert(input < inputs_.size());
+  return (GetRateRatio(inputs_[input]) - 1.0) * 1000000.0;
+}
+
+int64_t SourceMerger::GetCorrection(size_t input) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  assert(input < inputs_.size());
+  return inputs_[input].correction;
+}
+
+void SourceMerger::OnPacket(size_t input, Scheduler::SourceId source_id,
+                            const Scheduler::Byte* packet,
+                            Scheduler::Time timestamp) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  InputState& state = inputs_[input];
+  int frames = Scheduler::GetSizeOfPacket(packet) /
+               (state.channels * (int)sizeof(Sample));
+  Append(state, (const Sample*)packet, frames, timestamp);
+  scheduler_->ReleasePacket(source_id, packet);
+  int64_t max_buffered = (int64_t)sample_rate_ * kMaxBufferedInMs / 1000;
+  if (GetBufferedFrames(state) > max_buffered) {
+    Restart();
+    return;
+  }
+  if (!aligned_) Align();
+  while (aligned_ && EmitPacket()) {
+  }
+}
+
+void SourceMerger::Append(InputState& state, const Sample* samples, int frames,
+                          Scheduler::Time timestamp) {
+  if (!state.started) {
+    state.started = true;
+    state.first_timestamp = timestamp;
+  }
+  double frame = (double)state.received_frames;
+  double time = (double)timestamp - (double)state.first_timestamp;
+  state.fits += 1.0;
+  state.sum_frames += frame;
+  state.sum_times += time;
+  state.sum_frame_squares += frame * frame;
+  state.sum_frame_times += frame * time;
+  state.packet_times.emplace_back(state.received_frames, timestamp);
+  state.received_frames += frames;
+  // The consumed part is given back once it is the bigger part
+  if (state.head > state.buffer.size() / 2) {
+    state.buffer.erase(state.buffer.begin(),
+                       state.buffer.begin() + (ptrdiff_t)state.head);
+    state.head = 0;
+  }
+  state.buffer.insert(state.buffer.end(), samples,
+                      samples + (size_t)frames * (size_t)state.channels);
+}
+
+void SourceMerger::Align() {
+  Scheduler::Time start = 0;
+  for (const InputState& state : inputs_) {
+    if (!state.started) return;
+    if (state.first_timestamp > start) start = state.first_timestamp;
+  }
+  for (InputState& state : inputs_) {
+    Scheduler::Time late = start - state.first_timestamp;
+    state.frames_to_skip =
+        (int64_t)(late * (Scheduler::Time)sample_rate_ / 1000000u);
+  }
+  aligned_ = true;
+  output_frames_ = 0;
+}
+
+void SourceMerger::Restart() {
+  for (InputState& state : inputs_) {
+    InputState fresh;
+    fresh.source_id = state.source_id;
+    fresh.channels = state.channels;
+    fresh.subscription_id = state.subscription_id;
+    state = std::move(fresh);
+  }
+  aligned_ = false;
+}
+
+int64_t SourceMerger::GetBufferedFrames(const InputState& state) {
+  return (int64_t)(state.buffer.size() - state.head) / state.channels;
+}
+
+void SourceMerger::Consume(InputState& state, int64_t frames) {
+  assert(frames <= GetBufferedFrames(state));
+  state.head += (size_t)frames * (size_t)state.channels;
+  state.consumed_frames += frames;
+  while (state.packet_times.size() > 1 &&
+         state.packet_times[1].first <= state.consumed_frames)
+    state.packet_times.pop_front();
+}
+
+double SourceMerger::GetRateRatio(const InputState& state) const {
+  const InputState& first = inputs_[0];
+  int64_t settle_frames = (int64_t)sample_rate_ * kDriftSettleInMs / 1000;
+  if (&state == &first || first.received_frames < settle_frames ||
+      state.received_frames < settle_frames)
+    return 1.0;
+  auto get_slope = [](const InputState& s) {
+    double divisor = s.fits * s.sum_frame_squares - s.sum_frames * s.sum_frames;
+    return (s.fits * s.sum_frame_times - s.sum_frames * s.sum_times) / divisor;
+  };
+  // Microseconds per frame, a faster clock gives more frames in a second
+  return get_slope(first) / get_slope(state);
+}
+
+Scheduler::Time SourceMerger::GetFirstInputTime() const {
+  const InputState& first = inputs_[0];
+  assert(!first.packet_times.empty());
+  const std::pair<int64_t, Scheduler::Time>& packet =
+      first.packet_times.front();
+  return packet.second + (Scheduler::Time)(first.consumed_frames -
+                                           packet.first) *
+                             1000000u / (Scheduler::Time)sample_rate_;
+}
+
+bool SourceMerger::EmitPacket() {
+  for (InputState& state : inputs_) {
+    int64_t skip = std::min(state.frames_to_skip, GetBufferedFrames(state));
+    Consume(state, skip);
+    state.frames_to_skip -= skip;
+    // One more frame may be dropped
+    if (state.frames_to_skip > 0 ||
+        GetBufferedFrames(state) < frames_per_packet_ + 1)
+      return false;
+  }
+  Sample* packet = (Sample*)scheduler_->GetPacketForSubmission(output_id_);
+  Scheduler::Time timestamp = GetFirstInputTime();
+  int offset = 0;
+  for (InputState& state : inputs_) {
+    double target =
+        std::round((double)output_frames_ * (GetRateRatio(state) - 1.0));
+    int repeat = 0;
+    if ((double)state.correction < target) {
+      Consume(state, 1);
+      state.correction++;
+    } else if ((double)state.correction > target) {
+      repeat = 1;
+      state.correction--;
+    }
+    if (packet) {
+      const Sample* frames = &state.buffer[state.head];
+      for (int frame = 0; frame < frames_per_packet_; ++frame) {
+        const Sample* source = frames + (size_t)std::max(frame - repeat, 0) *
+                                            (size_t)state.channels;
+        memcpy(packet + (size_t)frame * (size_t)channels_ + (size_t)offset,
+               source, (size_t)state.channels * sizeof(Sample));
+      }
+    }
+    Consume(state, frames_per_packet_ - repeat);
+    offset += state.channels;
+  }
+  output_frames_ += frames_per_packet_;
+  // A lost output packet still moves the inputs on
+  if (packet)
+    scheduler_->SubmitPacket(output_id_, (Scheduler::Byte*)packet, timestamp);
+  return true;
+}
+
+}  // namespace zamt
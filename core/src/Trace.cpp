@@ -0,0 +1,142 @@
+#include "zamt/core/Trace.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+namespace zamt {
+
+namespace {
+
+struct Event {
+  const char* name;
+  int64_t start_in_us;
+  int64_t duration_in_us;
+  int64_t source;
+  int64_t packet;
+};
+
+/// Events of one thread: only the owner writes, it rewinds the buffer at
+/// its first event of a new recording.
+struct Buffer {
+  Event events[Trace::kEventsPerThread];
+  std::atomic<int> written{0};
+  std::atomic<int> dropped{0};
+  std::atomic<int> recording{0};  // the events are of this one
+  int thread_index = 0;
+  Buffer* next = nullptr;  // in the list of all buffers, never removed
+};
+
+std::atomic<Buffer*> buffers{nullptr};
+std::atomic<int> next_thread_index{0};
+std::atomic<int64_t> recording_start_in_us{0};
+std::atomic<int> current_recording{0};
+thread_local Buffer* thread_buffer = nullptr;
+
+Buffer* GetBuffer() {
+  if (thread_buffer) return thread_buffer;
+  // Buffers stay reachable from the list, their events are exported even
+  // after their threads exited
+  Buffer* buffer = new Buffer();
+  buffer->thread_index = next_thread_index.fetch_add(1) + 1;
+  buffer->next = buffers.load(std::memory_order_relaxed);
+  while (!buffers.compare_exchange_weak(buffer->next, buffer,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed))
+    ;
+  thread_buffer = buffer;
+  return buffer;
+}
+
+}  // namespace
+
+std::atomic<bool> Trace::recording_{false};
+const int Trace::kEventsPerThread;
+const int64_t Trace::kNoArgument;
+
+void Trace::Start() {
+  recording_start_in_us.store(GetTimeInUs());
+  // Buffers of the previous recording are rewound by their threads
+  current_recording.fetch_add(1);
+  recording_.store(true);
+}
+
+int64_t Trace::GetTimeInUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Trace::Record(const char* name, int64_t start_in_us,
+                   int64_t duration_in_us, int64_t source, int64_t packet) {
+  Buffer* buffer = GetBuffer();
+  int recording = current_recording.load(std::memory_order_relaxed);
+  if (buffer->recording.load(std::memory_order_relaxed) != recording) {
+    buffer->written.store(0, std::memory_order_relaxed);
+    buffer->dropped.store(0, std::memory_order_relaxed);
+    // Exporting sees the rewound counters once it sees the new recording
+    buffer->recording.store(recording, std::memory_order_release);
+  }
+  int written = buffer->written.load(std::memory_order_relaxed);
+  if (written >= kEventsPerThread) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  Event& event = buffer->events[written];
+  event.name = name;
+  event.start_in_us = start_in_us;
+  event.duration_in_us = duration_in_us;
+  event.source = source;
+  event.packet = packet;
+  buffer->written.store(written + 1, std::memory_order_release);
+}
+
+bool Trace::ExportChromeJSON(const char* path) {
+  recording_.store(false);
+  FILE* file = fopen(path, "w");
+  if (!file) return false;
+  int64_t start_in_us = recording_start_in_us.load();
+  int recording = current_recording.load();
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  const char* separator = "\n";
+  for (Buffer* buffer = buffers.load(std::memory_order_acquire); buffer;
+       buffer = buffer->next) {
+    // Threads not recording since Start() hold older events only
+    if (buffer->recording.load(std::memory_order_acquire) != recording)
+      continue;
+    int written = buffer->written.load(std::memory_order_acquire);
+    for (int i = 0; i < written; ++i) {
+      const Event& event = buffer->events[i];
+      // Events of an earlier recording are left out
+      if (event.start_in_us < start_in_us) continue;
+      fprintf(file, "%s{\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%" PRId64,
+              separator, event.name, buffer->thread_index,
+              event.start_in_us - start_in_us);
+      if (event.duration_in_us < 0) {
+        fprintf(file, ",\"ph\":\"i\",\"s\":\"t\"");
+      } else {
+        fprintf(file, ",\"ph\":\"X\",\"dur\":%" PRId64, event.duration_in_us);
+      }
+      fprintf(file, ",\"args\":{");
+      if (event.source != kNoArgument)
+        fprintf(file, "\"source\":%" PRId64, event.source);
+      if (event.packet != kNoArgument)
+        fprintf(file, "%s\"packet\":%" PRId64,
+                event.source != kNoArgument ? "," : "", event.packet);
+      fprintf(file, "}}");
+      separator = ",\n";
+    }
+    int dropped = buffer->dropped.load(std::memory_order_relaxed);
+    if (dropped > 0) {
+      fprintf(file,
+              "%s{\"name\":\"dropped events\",\"pid\":1,\"tid\":%d,"
+              "\"ts\":0,\"ph\":\"i\",\"s\":\"t\",\"args\":{\"count\":%d}}",
+              separator, buffer->thread_index, dropped);
+      separator = ",\n";
+    }
+  }
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
+
+}  // namespace zamt
@@ -1,9 +1,14 @@
 #include "zamt/core/Core.h"
+#include "zamt/core/Log.h"
 #include "zamt/core/ModuleCenter.h"
+#include "zamt/core/Scheduler.h"
 #include "zamt/core/TestSuite.h"
 
 #include <signal.h>
 #include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
 #include <thread>
 
 using namespace zamt;
@@ -52,6 +57,20 @@ void ShutsDownForSignal(int signal_number) {
   thr.join();
 }
 
+void SignalRunsQuitCallbacksOnWaitingThread() {
+  ModuleCenter mc(sizeof(params) / sizeof(char*), params);
+  Core& core = mc.Get<zamt::Core>();
+  Core::ReInitExitCode();
+  std::thread::id callback_thread;
+  core.RegisterForQuitEvent([&callback_thread](int) {
+    callback_thread = std::this_thread::get_id();
+  });
+  std::thread thr(Signal, SIGINT);
+  EXPECT(core.WaitForQuit() == Core::kExitCodeSIGINT);
+  thr.join();
+  EXPECT(callback_thread == std::this_thread::get_id());
+}
+
 int g_lambda_sets_to_exit_code = 0;
 
 struct QuitClient {
@@ -75,11 +94,97 @@ void CanRegisterMemberFunction() {
   thr.join();
 }
 
+void SlowSink(Scheduler* sch, Scheduler::SourceId source_id,
+              const Scheduler::Byte* packet, Scheduler::Time) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  sch->ReleasePacket(source_id, packet);
+}
+
+void CallQuitLater(Core* core) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  core->Quit(97);
+}
+
+void WatchdogReportsStuckSinkAndStarvingPool() {
+  const char* wd_params[] = {"exec", "-wd50", "-vcore",
+                             "-lf/tmp/zamt_coretest_watchdog.log"};
+  ModuleCenter mc(sizeof(wd_params) / sizeof(char*), wd_params);
+  Core& core = mc.Get<zamt::Core>();
+  Core::ReInitExitCode();
+  Scheduler& sch = core.scheduler();
+  Scheduler::SourceId source_id = sch.RegisterSource("slow", 16, 4);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&SlowSink, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                false, subscription_id);
+  for (int i = 0; i < 4; ++i)
+    sch.SubmitPacket(source_id, sch.GetPacketForSubmission(source_id), 0);
+  std::thread thr(CallQuitLater, &core);
+  EXPECT(core.WaitForQuit() == 97);
+  thr.join();
+  Log::Flush();
+  bool stuck = false;
+  bool starving = false;
+  bool health = false;
+  FILE* file = fopen("/tmp/zamt_coretest_watchdog.log", "r");
+  ASSERT(file);
+  char line[512];
+  while (fgets(line, sizeof(line), file)) {
+    std::string text(line);
+    stuck |= text.find("stuck in a sink of source slow") != std::string::npos;
+    starving |= text.find("pool of source slow nearly exhausted, 4 of 4") !=
+                std::string::npos;
+    health |= text.find("[core] Health: ") != std::string::npos;
+  }
+  fclose(file);
+  EXPECT(stuck);
+  EXPECT(starving);
+  EXPECT(health);
+}
+
+void ReportReadyLater(Core* core, int participant_id) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  core->ReportReadyForShutdown(participant_id);
+}
+
+void ShutdownWaitsForParticipants() {
+  ModuleCenter mc(sizeof(params) / sizeof(char*), params);
+  Core& core = mc.Get<zamt::Core>();
+  Core::ReInitExitCode();
+  int participant_id = core.AddShutdownParticipant("test");
+  core.Quit(96);
+  auto start = std::chrono::steady_clock::now();
+  std::thread thr(ReportReadyLater, &core, participant_id);
+  EXPECT(core.WaitForQuit() == 96);
+  EXPECT(std::chrono::steady_clock::now() - start >=
+         std::chrono::milliseconds(50));
+  thr.join();
+}
+
+void ShutdownDoesNotWaitLongerThanTimeout() {
+  const char* sd_params[] = {"exec", "-sd100"};
+  ModuleCenter mc(sizeof(sd_params) / sizeof(char*), sd_params);
+  Core& core = mc.Get<zamt::Core>();
+  Core::ReInitExitCode();
+  core.AddShutdownParticipant("never ready");
+  core.Quit(95);
+  auto start = std::chrono::steady_clock::now();
+  EXPECT(core.WaitForQuit() == 95);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT(elapsed >= std::chrono::milliseconds(100));
+  EXPECT(elapsed < std::chrono::milliseconds(1000));
+}
+
 TEST_BEGIN() {
   ShutsDownFromOtherThread();
   ShutsDownFromOtherThreadImmediately();
   ShutsDownForSignal(SIGINT);
   ShutsDownForSignal(SIGTERM);
+  SignalRunsQuitCallbacksOnWaitingThread();
   CanRegisterMemberFunction();
+  WatchdogReportsStuckSinkAndStarvingPool();
+  ShutdownWaitsForParticipants();
+  ShutdownDoesNotWaitLongerThanTimeout();
 }
 TEST_END()
@@ -0,0 +1,72 @@
+#include "zamt/core/LatencyTuner.h"
+#include "zamt/core/TestSuite.h"
+
+using namespace zamt;
+
+static const Scheduler::Time packet_duration = 1000;
+
+// Cumulative statistics of a source, periods add to them
+struct Load {
+  Scheduler::PoolStats stats = Scheduler::PoolStats();
+
+  const Scheduler::PoolStats& AddPeriod(uint64_t drops, uint64_t released,
+                                        Scheduler::Time turnaround) {
+    stats.drops += drops;
+    stats.released += released;
+    stats.turnaround_in_us += turnaround;
+    return stats;
+  }
+};
+
+int RunGoodPeriods(LatencyTuner& tuner, Load& load, int periods) {
+  int latency = tuner.latency();
+  for (int i = 0; i < periods; ++i)
+    latency = tuner.Update(load.AddPeriod(0, 10, 10 * 100), packet_duration);
+  return latency;
+}
+
+void LatencyDecreasesWhileSinksKeepUp() {
+  LatencyTuner tuner(64, 4096, 1024);
+  Load load;
+  // The first sample is only the base of the next period
+  EXPECT(RunGoodPeriods(tuner, load, 1) == 1024);
+  EXPECT(RunGoodPeriods(tuner, load,
+                        LatencyTuner::kGoodPeriodsBeforeDecrease - 1) == 1024);
+  EXPECT(RunGoodPeriods(tuner, load, 1) == 512);
+  for (int i = 0; i < 10; ++i)
+    RunGoodPeriods(tuner, load, LatencyTuner::kGoodPeriodsBeforeDecrease + 1);
+  EXPECT(tuner.latency() == 64);
+}
+
+void LossBacksOffAndBadLatencyIsAvoided() {
+  LatencyTuner tuner(64, 4096, 1024);
+  Load load;
+  RunGoodPeriods(tuner, load, LatencyTuner::kGoodPeriodsBeforeDecrease + 1);
+  EXPECT(tuner.latency() == 512);
+  tuner.Update(load.AddPeriod(0, 10, 10 * 100), packet_duration);
+  EXPECT(tuner.Update(load.AddPeriod(2, 10, 10 * 100), packet_duration) ==
+         1024);
+  EXPECT(RunGoodPeriods(tuner, load,
+                        LatencyTuner::kGoodPeriodsBeforeRetry - 1) == 1024);
+  // Tried again after a long good run
+  EXPECT(RunGoodPeriods(tuner, load, 2) == 512);
+}
+
+void SlowSinksCountAsOverload() {
+  LatencyTuner tuner(64, 4096, 4000);
+  Load load;
+  tuner.Update(load.stats, packet_duration);
+  // Packets are kept for 60% of their duration on average
+  EXPECT(tuner.Update(load.AddPeriod(0, 10, 10 * 600), packet_duration) ==
+         4096);
+  tuner.Update(load.stats, packet_duration);
+  EXPECT(tuner.Update(load.AddPeriod(0, 10, 10 * 600), packet_duration) ==
+         4096);
+}
+
+TEST_BEGIN() {
+  LatencyDecreasesWhileSinksKeepUp();
+  LossBacksOffAndBadLatencyIsAvoided();
+  SlowSinksCountAsOverload();
+}
+TEST_END()
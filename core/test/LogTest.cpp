@@ -0,0 +1,96 @@
+#include "zamt/core/CLIParameters.h"
+#include "zamt/core/Log.h"
+#include "zamt/core/TestSuite.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace zamt;
+
+std::vector<std::string> ReadLines(const char* path) {
+  std::vector<std::string> lines;
+  FILE* file = fopen(path, "r");
+  if (!file) return lines;
+  char line[512];
+  while (fgets(line, sizeof(line), file)) {
+    size_t length = strlen(line);
+    if (length > 0 && line[length - 1] == '\n') line[length - 1] = '\0';
+    lines.push_back(line);
+  }
+  fclose(file);
+  return lines;
+}
+
+void LogNumbers(Log* log, int count) {
+  for (int i = 0; i < count; ++i) log->LogMessage("number ", i, " logged");
+}
+
+void MessagesOfAllThreadsAreWrittenInOrder() {
+  const int kThreads = 4;
+  const int kMessages = 50;  // all fit into one ring if it is reused
+  const char* params[] = {"exec", "-lf/tmp/zamt_logtest_order.log",
+                          "-vlogtest"};
+  CLIParameters cli(sizeof(params) / sizeof(char*), params);
+  Log log("logtest", cli);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; ++i)
+    threads.emplace_back(LogNumbers, &log, kMessages);
+  for (std::thread& thread : threads) thread.join();
+  log.LogMessage("float ", 0.5f, " logged");
+  Log::Flush();
+  std::vector<std::string> lines = ReadLines("/tmp/zamt_logtest_order.log");
+  ASSERT(lines.size() == kThreads * kMessages + 1);
+  // Numbers of one thread are increasing, so every thread goes 0, 1, 2...
+  std::vector<int> next_numbers(kThreads, 0);
+  for (int i = 0; i < kThreads * kMessages; ++i) {
+    int number = -1;
+    EXPECT(sscanf(lines[(size_t)i].c_str(), "[logtest] number %d logged",
+                  &number) == 1);
+    bool expected = false;
+    for (int& next : next_numbers) {
+      if (next == number) {
+        next++;
+        expected = true;
+        break;
+      }
+    }
+    EXPECT(expected);
+  }
+  EXPECT(lines.back() == "[logtest] float 0.500000 logged");
+}
+
+void RepeatedMessageIsRateLimited() {
+  const int kRepeats = 200;
+  const char* params[] = {"exec", "-lf/tmp/zamt_logtest_rate.log", "-v"};
+  CLIParameters cli(sizeof(params) / sizeof(char*), params);
+  Log log("logtest", cli);
+  for (int i = 0; i < kRepeats; ++i) {
+    log.LogMessage("Buffer overrun");
+    if (i % 64 == 63) Log::Flush();  // rings are smaller than the repeats
+  }
+  Log::Flush();
+  std::vector<std::string> lines = ReadLines("/tmp/zamt_logtest_rate.log");
+  int written = 0;
+  int suppressed = 0;
+  for (const std::string& line : lines) {
+    int repeated = 0;
+    if (line == "[logtest] Buffer overrun") {
+      written++;
+    } else if (sscanf(line.c_str(),
+                      "[logtest] Previous message repeated %d more times",
+                      &repeated) == 1) {
+      suppressed += repeated;
+    }
+  }
+  EXPECT(written >= Log::kRateLimitMessages && written < kRepeats);
+  EXPECT(written + suppressed == kRepeats);
+}
+
+TEST_BEGIN() {
+  MessagesOfAllThreadsAreWrittenInOrder();
+  RepeatedMessageIsRateLimited();
+}
+TEST_END()
@@ -3,6 +3,8 @@
 
 using namespace zamt;
 
+class ModuleTwo;
+
 class ModuleOne : public Module {
  public:
   ModuleOne(int, const char* const*) {
@@ -10,30 +12,47 @@ class ModuleOne : public Module {
     data = 1;
     mcenter = nullptr;
   }
-  ~ModuleOne() { count--; }
+  ~ModuleOne();
   void Initialize(const ModuleCenter* mc) { mcenter = mc; }
 
   static int count;
+  static bool destroyed_before_dependent;
   int data;
   const ModuleCenter* mcenter;
 };
 
 class ModuleTwo : public Module {
  public:
+  static void DeclareDependencies(ModuleDependencies& dependencies) {
+    dependencies.Add<ModuleOne>();
+  }
+
   ModuleTwo(int, const char* const*) {
     count++;
     data = 2;
     mcenter = nullptr;
+    dependency_initialized = false;
   }
   ~ModuleTwo() { count--; }
-  void Initialize(const ModuleCenter* mc) { mcenter = mc; }
+  void Initialize(const ModuleCenter* mc) {
+    mcenter = mc;
+    dependency_initialized = mc->Get<ModuleOne>().mcenter == mc;
+  }
 
   static int count;
   int data;
   const ModuleCenter* mcenter;
+  bool dependency_initialized;
 };
 
+ModuleOne::~ModuleOne() {
+  // Every ModuleTwo depends on a ModuleOne, so there are less of them
+  if (ModuleTwo::count >= count) destroyed_before_dependent = true;
+  count--;
+}
+
 int ModuleOne::count = 0;
+bool ModuleOne::destroyed_before_dependent = false;
 int ModuleTwo::count = 0;
 
 void RegisteredModuleNumberIsCorrect() {
@@ -91,10 +110,20 @@ void MultipleModulesCanLiveTogether() {
   EXPECT(ModuleTwo::count == 0);
 }
 
+void DependenciesAreStartedFirstAndStoppedLast() {
+  ModuleOne::destroyed_before_dependent = false;
+  {
+    ModuleCenter mc(0, nullptr);
+    EXPECT(mc.Get<ModuleTwo>().dependency_initialized);
+  }
+  EXPECT(!ModuleOne::destroyed_before_dependent);
+}
+
 TEST_BEGIN() {
   RegisteredModuleNumberIsCorrect();
   ModuleIdsAreUnique();
   AllModulesAreStartedAndStopped();
   MultipleModulesCanLiveTogether();
+  DependenciesAreStartedFirstAndStoppedLast();
 }
 TEST_END()
@@ -1,6 +1,12 @@
 #include "zamt/core/Scheduler.h"
 #include "zamt/core/TestSuite.h"
 
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
 using namespace zamt;
 
 static const int packets_to_arrive = (int)sizeof(long) * 8 - 2;
@@ -24,11 +30,11 @@ void ImmediateShutdownIsOk() {
 
 void SourceWithoutSinks() {
   Scheduler sch;
-  sch.RegisterSource(1, 1024, 4);
-  EXPECT(sch.GetPacketSize(1) == 1024);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 1024, 4);
+  EXPECT(sch.GetPacketSize(source_id) == 1024);
   for (int i = 0; i < 3; ++i) std::this_thread::yield();
-  uint8_t* p = sch.GetPacketForSubmission(1);
-  sch.SubmitPacket(1, p, 0);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
+  sch.SubmitPacket(source_id, p, 0);
   for (int i = 0; i < 3; ++i) std::this_thread::yield();
   sch.Shutdown();
 }
@@ -43,79 +49,95 @@ struct Slacker {
 
 void QueueWorksAfterUnsubscribe() {
   Scheduler sch;
-  sch.RegisterSource(1, 1024, 4);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 1024, 4);
   int subscription_id;
-  sch.Subscribe(1, &NeverCalled, false, subscription_id);
-  sch.Unsubscribe(1, subscription_id);
-  uint8_t* p = sch.GetPacketForSubmission(1);
-  sch.SubmitPacket(1, p, 0);
+  sch.Subscribe(source_id, &NeverCalled, false, subscription_id);
+  sch.Unsubscribe(source_id, subscription_id);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
+  sch.SubmitPacket(source_id, p, 0);
   for (int i = 0; i < 9; ++i) std::this_thread::yield();
   sch.Shutdown();
 }
 
 void QueueWorksAfterResubscribe() {
   Scheduler sch;
-  sch.RegisterSource(1, 1024, 4);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 1024, 4);
   int subscription_id1, subscription_id2;
-  sch.Subscribe(1, &NeverCalled, false, subscription_id1);
-  sch.Subscribe(1, &NeverCalled, false, subscription_id2);
-  sch.Unsubscribe(1, subscription_id1);
-  sch.Unsubscribe(1, subscription_id2);
+  sch.Subscribe(source_id, &NeverCalled, false, subscription_id1);
+  sch.Subscribe(source_id, &NeverCalled, false, subscription_id2);
+  sch.Unsubscribe(source_id, subscription_id1);
+  sch.Unsubscribe(source_id, subscription_id2);
   Slacker slacker;
-  sch.Subscribe(1,
+  sch.Subscribe(source_id,
                 std::bind(&Slacker::EmptyJob, &slacker, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id1);
-  uint8_t* p = sch.GetPacketForSubmission(1);
-  sch.SubmitPacket(1, p, 0);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
+  sch.SubmitPacket(source_id, p, 0);
   for (int i = 0; i < 9; ++i) std::this_thread::yield();
   sch.Shutdown();
 }
 
 void OutOfBufferGivesNull() {
   Scheduler sch;
-  sch.RegisterSource(1, 1024, 1);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 1024, 1);
   int subscription_id;
   Slacker slacker;
-  sch.Subscribe(1,
+  sch.Subscribe(source_id,
                 std::bind(&Slacker::EmptyJob, &slacker, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id);
-  uint8_t* p = sch.GetPacketForSubmission(1);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
   EXPECT(p);
-  uint8_t* pp = sch.GetPacketForSubmission(1);
-  sch.SubmitPacket(1, p, 0);
+  uint8_t* pp = sch.GetPacketForSubmission(source_id);
+  sch.SubmitPacket(source_id, p, 0);
   ASSERT(!pp);
   sch.Shutdown();
 }
 
+void CancelledPacketIsFreeAgain() {
+  Scheduler sch;
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 2);
+  uint8_t* p1 = sch.GetPacketForSubmission(source_id);
+  uint8_t* p2 = sch.GetPacketForSubmission(source_id);
+  EXPECT(p1 && p2 && sch.GetFreePackets(source_id) == 0);
+  sch.CancelPacket(source_id, p1);
+  EXPECT(sch.GetFreePackets(source_id) == 1);
+  EXPECT(sch.GetPacketForSubmission(source_id) == p1);
+  EXPECT(sch.GetLostPackets(source_id) == 0);
+  sch.Shutdown();
+}
+
 static std::atomic<long> packets_arrived;
+static Scheduler::SourceId checked_source_id;
 
 void CheckPackets(void* schp, Scheduler::SourceId source_id,
                   const Scheduler::Byte* packet, Scheduler::Time timestamp) {
   Scheduler& sch = *static_cast<Scheduler*>(schp);
-  EXPECT(source_id == 1);
+  EXPECT(source_id == checked_source_id);
   int num = (int)packet[0];
   EXPECT(timestamp == (Scheduler::Time)num * 1000);
   long status = packets_arrived.fetch_or(1l << num);
   // printf("Arrived: %d, prev status is %lx\n", num, status);
   EXPECT(!(status & (1l << num)));
-  sch.ReleasePacket(1, packet);
+  sch.ReleasePacket(source_id, packet);
 }
 
 void SinkGetsAllPacketsSent() {
   packets_arrived = 0;
   Scheduler sch;
-  sch.RegisterSource(1, 1024, packets_to_arrive);
+  Scheduler::SourceId source_id =
+      sch.RegisterSource("test", 1024, packets_to_arrive);
+  checked_source_id = source_id;
   int subscription_id;
-  sch.Subscribe(1,
+  sch.Subscribe(source_id,
                 std::bind(&CheckPackets, &sch, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id);
   for (int i = 0; i < packets_to_arrive; ++i) {
-    uint8_t* p = sch.GetPacketForSubmission(1);
+    uint8_t* p = sch.GetPacketForSubmission(source_id);
     p[0] = (uint8_t)i;
-    sch.SubmitPacket(1, p, (Scheduler::Time)i * 1000);
+    sch.SubmitPacket(source_id, p, (Scheduler::Time)i * 1000);
   }
   while (packets_arrived != (1l << packets_to_arrive) - 1)
     std::this_thread::yield();
@@ -127,16 +149,18 @@ void SinkGetsAllPacketsSent() {
 void SinkGetsAllPacketsSentOnUIThread() {
   packets_arrived = 0;
   Scheduler sch;
-  sch.RegisterSource(1, 1024, packets_to_arrive);
+  Scheduler::SourceId source_id =
+      sch.RegisterSource("test", 1024, packets_to_arrive);
+  checked_source_id = source_id;
   int subscription_id;
-  sch.Subscribe(1,
+  sch.Subscribe(source_id,
                 std::bind(&CheckPackets, &sch, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 true, subscription_id);
   for (int i = 0; i < packets_to_arrive; ++i) {
-    uint8_t* p = sch.GetPacketForSubmission(1);
+    uint8_t* p = sch.GetPacketForSubmission(source_id);
     p[0] = (uint8_t)i;
-    sch.SubmitPacket(1, p, (Scheduler::Time)i * 1000);
+    sch.SubmitPacket(source_id, p, (Scheduler::Time)i * 1000);
   }
   while (packets_arrived != (1l << packets_to_arrive) - 1) sch.DoUITaskStep();
   // do some empty runs
@@ -151,33 +175,35 @@ static std::atomic<long> packets_arrived2;
 void CheckPackets2(void* schp, Scheduler::SourceId source_id,
                    const Scheduler::Byte* packet, Scheduler::Time timestamp) {
   Scheduler& sch = *static_cast<Scheduler*>(schp);
-  EXPECT(source_id == 1);
+  EXPECT(source_id == checked_source_id);
   int num = (int)packet[0];
   EXPECT(timestamp == (Scheduler::Time)num * 1000);
   long status = packets_arrived2.fetch_or(1l << num);
   // printf("Arrived: %d, prev status is %lx\n", num, status);
   EXPECT(!(status & (1l << num)));
-  sch.ReleasePacket(1, packet);
+  sch.ReleasePacket(source_id, packet);
 }
 
 void AllSinksGetAllPackets() {
   packets_arrived = 0;
   packets_arrived2 = 0;
   Scheduler sch;
-  sch.RegisterSource(1, 1024, packets_to_arrive);
+  Scheduler::SourceId source_id =
+      sch.RegisterSource("test", 1024, packets_to_arrive);
+  checked_source_id = source_id;
   int subscription_id1, subscription_id2;
-  sch.Subscribe(1,
+  sch.Subscribe(source_id,
                 std::bind(&CheckPackets, &sch, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id1);
-  sch.Subscribe(1,
+  sch.Subscribe(source_id,
                 std::bind(&CheckPackets2, &sch, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id2);
   for (int i = 0; i < packets_to_arrive; ++i) {
-    uint8_t* p = sch.GetPacketForSubmission(1);
+    uint8_t* p = sch.GetPacketForSubmission(source_id);
     p[0] = (uint8_t)i;
-    sch.SubmitPacket(1, p, (Scheduler::Time)i * 1000);
+    sch.SubmitPacket(source_id, p, (Scheduler::Time)i * 1000);
   }
   while (packets_arrived != (1l << packets_to_arrive) - 1 ||
          packets_arrived2 != (1l << packets_to_arrive) - 1)
@@ -188,13 +214,16 @@ void AllSinksGetAllPackets() {
   ASSERT(packets_arrived2 == (1l << packets_to_arrive) - 1);
 }
 
+// Indexed by the number of the source written into its packets
+static Scheduler::SourceId chain_source_ids[4];
+
 void CheckPackets12(void* schp, Scheduler::SourceId source_id,
                     const Scheduler::Byte* packet, Scheduler::Time timestamp) {
   Scheduler& sch = *static_cast<Scheduler*>(schp);
   int num = (int)packet[0];
   Scheduler::SourceId source = (Scheduler::SourceId)packet[1];
   ASSERT(source == 1 || source == 2);
-  ASSERT(source_id == source);
+  ASSERT(source_id == chain_source_ids[source]);
   ASSERT(timestamp == (Scheduler::Time)num * 1000);
   auto& packs_arrived = (source == 1) ? packets_arrived : packets_arrived2;
   long status = packs_arrived.fetch_or(1l << num);
@@ -208,26 +237,26 @@ void MultipleSourcesWithOneSink() {
   packets_arrived = 0;
   packets_arrived2 = 0;
   Scheduler sch;
-  sch.RegisterSource(1, 1024, packets_to_arrive);
-  sch.RegisterSource(2, 1024, packets_to_arrive);
+  chain_source_ids[1] = sch.RegisterSource("source1", 1024, packets_to_arrive);
+  chain_source_ids[2] = sch.RegisterSource("source2", 1024, packets_to_arrive);
   int subscription_id1, subscription_id2;
-  sch.Subscribe(1,
+  sch.Subscribe(chain_source_ids[1],
                 std::bind(&CheckPackets12, &sch, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id1);
-  sch.Subscribe(2,
+  sch.Subscribe(chain_source_ids[2],
                 std::bind(&CheckPackets12, &sch, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id2);
   for (int i = 0; i < packets_to_arrive; ++i) {
-    uint8_t* p = sch.GetPacketForSubmission(1);
+    uint8_t* p = sch.GetPacketForSubmission(chain_source_ids[1]);
     p[0] = (uint8_t)i;
     p[1] = 1;
-    sch.SubmitPacket(1, p, (Scheduler::Time)i * 1000);
-    p = sch.GetPacketForSubmission(2);
+    sch.SubmitPacket(chain_source_ids[1], p, (Scheduler::Time)i * 1000);
+    p = sch.GetPacketForSubmission(chain_source_ids[2]);
     p[0] = (uint8_t)i;
     p[1] = 2;
-    sch.SubmitPacket(2, p, (Scheduler::Time)i * 1000);
+    sch.SubmitPacket(chain_source_ids[2], p, (Scheduler::Time)i * 1000);
   }
   while (packets_arrived != (1l << packets_to_arrive) - 1 ||
          packets_arrived2 != (1l << packets_to_arrive) - 1)
@@ -246,7 +275,7 @@ void CheckPackets123(void* schp, Scheduler::SourceId source_id,
   int num = (int)packet[0];
   Scheduler::SourceId source = (Scheduler::SourceId)packet[1];
   ASSERT(source == 1 || source == 2 || source == 3);
-  ASSERT(source_id == source);
+  ASSERT(source_id == chain_source_ids[source]);
   ASSERT(timestamp == (Scheduler::Time)num * 1000);
   auto& packs_arrived =
       (source == 1) ? packets_arrived
@@ -256,10 +285,11 @@ void CheckPackets123(void* schp, Scheduler::SourceId source_id,
   // %lx\n",source,num,status);
   ASSERT(!(status & (1l << num)));
   if (source < 3) {
-    uint8_t* p = sch.GetPacketForSubmission(source + 1);
+    Scheduler::SourceId next_source_id = chain_source_ids[source + 1];
+    uint8_t* p = sch.GetPacketForSubmission(next_source_id);
     p[0] = (uint8_t)num;
     p[1] = (uint8_t)(source + 1);
-    sch.SubmitPacket(source + 1, p, timestamp);
+    sch.SubmitPacket(next_source_id, p, timestamp);
   }
   sch.ReleasePacket(source_id, packet);
 }
@@ -269,27 +299,27 @@ void SourceSinkChainWorks() {
   packets_arrived2 = 0;
   packets_arrived3 = 0;
   Scheduler sch;
-  sch.RegisterSource(1, 1024, packets_to_arrive);
-  sch.RegisterSource(2, 1024, packets_to_arrive);
-  sch.RegisterSource(3, 1024, packets_to_arrive);
+  chain_source_ids[1] = sch.RegisterSource("source1", 1024, packets_to_arrive);
+  chain_source_ids[2] = sch.RegisterSource("source2", 1024, packets_to_arrive);
+  chain_source_ids[3] = sch.RegisterSource("source3", 1024, packets_to_arrive);
   int subscription_id1, subscription_id2, subscription_id3;
-  sch.Subscribe(1,
+  sch.Subscribe(chain_source_ids[1],
                 std::bind(&CheckPackets123, &sch, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id1);
-  sch.Subscribe(2,
+  sch.Subscribe(chain_source_ids[2],
                 std::bind(&CheckPackets123, &sch, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id2);
-  sch.Subscribe(3,
+  sch.Subscribe(chain_source_ids[3],
                 std::bind(&CheckPackets123, &sch, std::placeholders::_1,
                           std::placeholders::_2, std::placeholders::_3),
                 false, subscription_id3);
   for (int i = 0; i < packets_to_arrive; ++i) {
-    uint8_t* p = sch.GetPacketForSubmission(1);
+    uint8_t* p = sch.GetPacketForSubmission(chain_source_ids[1]);
     p[0] = (uint8_t)i;
     p[1] = 1;
-    sch.SubmitPacket(1, p, (Scheduler::Time)i * 1000);
+    sch.SubmitPacket(chain_source_ids[1], p, (Scheduler::Time)i * 1000);
   }
   while (packets_arrived3 != (1l << packets_to_arrive) - 1)
     std::this_thread::yield();
@@ -300,6 +330,558 @@ void SourceSinkChainWorks() {
   ASSERT(packets_arrived3 == (1l << packets_to_arrive) - 1);
 }
 
+void VirtualClockIsDrivenBySources() {
+  Scheduler sch(1, true);
+  EXPECT(sch.IsVirtualTime());
+  EXPECT(sch.GetCurrentTime() == 0);
+  sch.AdvanceVirtualTime(1000);
+  EXPECT(sch.GetCurrentTime() == 1000);
+  sch.AdvanceVirtualTime(500);
+  EXPECT(sch.GetCurrentTime() == 1000);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 1024, 4);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
+  sch.SubmitPacket(source_id, p, 5000);
+  EXPECT(sch.GetCurrentTime() == 5000);
+  EXPECT(Scheduler::SamplesToTime(44100, 44100) == 1000000);
+  EXPECT(Scheduler::SamplesToTime(441, 44100) == 10000);
+  sch.Shutdown();
+}
+
+void WallClockIsNotAdvanced() {
+  Scheduler sch(1);
+  EXPECT(!sch.IsVirtualTime());
+  Scheduler::Time now = sch.GetCurrentTime();
+  EXPECT(now > 0);
+  sch.AdvanceVirtualTime(now + 1000000000);
+  EXPECT(sch.GetCurrentTime() < now + 1000000000);
+  sch.Shutdown();
+}
+
+static std::vector<int> arrival_order;
+
+void RecordOrder(void* schp, Scheduler::SourceId source_id,
+                 const Scheduler::Byte* packet, Scheduler::Time) {
+  Scheduler& sch = *static_cast<Scheduler*>(schp);
+  arrival_order.push_back((int)packet[0]);
+  sch.ReleasePacket(source_id, packet);
+}
+
+void SameTimestampsKeepSubmissionOrder() {
+  arrival_order.clear();
+  Scheduler sch(1, true);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 8);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&RecordOrder, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                true, subscription_id);
+  for (int i = 0; i < 6; ++i) {
+    uint8_t* p = sch.GetPacketForSubmission(source_id);
+    p[0] = (uint8_t)i;
+    sch.SubmitPacket(source_id, p, (Scheduler::Time)(i / 3) * 1000);
+  }
+  sch.WaitForIdle();
+  ASSERT(arrival_order.size() == 6);
+  for (int i = 0; i < 6; ++i) EXPECT(arrival_order[(size_t)i] == i);
+  sch.Shutdown();
+}
+
+void RecordOrderSlowly(void* schp, Scheduler::SourceId source_id,
+                       const Scheduler::Byte* packet,
+                       Scheduler::Time timestamp) {
+  if (packet[0] % 3 == 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  RecordOrder(schp, source_id, packet, timestamp);
+}
+
+void InOrderSinkGetsPacketsInOrder() {
+  arrival_order.clear();
+  Scheduler sch(4);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 32);
+  int subscription_id;
+  sch.SubscribeInOrder(source_id,
+                       std::bind(&RecordOrderSlowly, &sch,
+                                 std::placeholders::_1, std::placeholders::_2,
+                                 std::placeholders::_3),
+                       subscription_id);
+  // A burst, so more workers have tasks of the sink at once
+  for (int i = 0; i < 30; ++i) {
+    uint8_t* p = sch.GetPacketForSubmission(source_id);
+    ASSERT(p);
+    p[0] = (uint8_t)i;
+    sch.SubmitPacket(source_id, p, (Scheduler::Time)i * 1000);
+  }
+  sch.WaitForIdle();
+  ASSERT(arrival_order.size() == 30);
+  for (int i = 0; i < 30; ++i) EXPECT(arrival_order[(size_t)i] == i);
+  sch.Shutdown();
+}
+
+void InOrderSinkSkipsTakenBackPackets() {
+  arrival_order.clear();
+  Scheduler sch(4);
+  Scheduler::SourceId source_id = sch.RegisterSource(
+      "test", 16, 4, Scheduler::BackpressurePolicy::kOverwriteOldest);
+  int subscription_id;
+  sch.SubscribeInOrder(source_id,
+                       std::bind(&RecordOrderSlowly, &sch,
+                                 std::placeholders::_1, std::placeholders::_2,
+                                 std::placeholders::_3),
+                       subscription_id);
+  for (int i = 0; i < 60; ++i) {
+    uint8_t* p = sch.GetPacketForSubmission(source_id);
+    if (!p) continue;
+    p[0] = (uint8_t)i;
+    sch.SubmitPacket(source_id, p, (Scheduler::Time)i * 1000);
+  }
+  sch.WaitForIdle();
+  ASSERT(!arrival_order.empty());
+  EXPECT(arrival_order.back() == 59);
+  for (size_t i = 1; i < arrival_order.size(); ++i)
+    EXPECT(arrival_order[i - 1] < arrival_order[i]);
+  EXPECT(sch.GetFreePackets(source_id) == 4);
+  sch.Shutdown();
+}
+
+void WaitForIdleFinishesAllTasks() {
+  packets_arrived = 0;
+  Scheduler sch(0, true);
+  Scheduler::SourceId source_id =
+      sch.RegisterSource("test", 1024, packets_to_arrive);
+  checked_source_id = source_id;
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&CheckPackets, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                false, subscription_id);
+  for (int i = 0; i < packets_to_arrive; ++i) {
+    uint8_t* p = sch.GetPacketForSubmission(source_id);
+    p[0] = (uint8_t)i;
+    sch.SubmitPacket(source_id, p, (Scheduler::Time)i * 1000);
+  }
+  sch.WaitForIdle();
+  ASSERT(packets_arrived == (1l << packets_to_arrive) - 1);
+  EXPECT(sch.GetCurrentTime() ==
+         (Scheduler::Time)(packets_to_arrive - 1) * 1000);
+  sch.Shutdown();
+}
+
+void ReleaseLater(void* schp, Scheduler::SourceId source_id,
+                  const Scheduler::Byte* packet, Scheduler::Time) {
+  Scheduler& sch = *static_cast<Scheduler*>(schp);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  sch.ReleasePacket(source_id, packet);
+}
+
+void BlockingSourceWaitsForRelease() {
+  Scheduler sch(1);
+  Scheduler::SourceId source_id = sch.RegisterSource(
+      "test", 16, 1, Scheduler::BackpressurePolicy::kBlockWithTimeout,
+      10000000);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&ReleaseLater, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                false, subscription_id);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
+  sch.SubmitPacket(source_id, p, 0);
+  p = sch.GetPacketForSubmission(source_id);
+  EXPECT(p);
+  EXPECT(sch.GetLostPackets(source_id) == 0);
+  sch.Shutdown();
+}
+
+void BlockingSourceTimesOut() {
+  Scheduler sch(1);
+  Scheduler::SourceId source_id = sch.RegisterSource(
+      "test", 16, 1, Scheduler::BackpressurePolicy::kBlockWithTimeout, 1000);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
+  EXPECT(p);
+  EXPECT(!sch.GetPacketForSubmission(source_id));
+  EXPECT(sch.GetLostPackets(source_id) == 1);
+  sch.Shutdown();
+}
+
+void OverwriteTakesBackOldestPacket() {
+  arrival_order.clear();
+  Scheduler sch(1, true);
+  Scheduler::SourceId source_id = sch.RegisterSource(
+      "test", 16, 2, Scheduler::BackpressurePolicy::kOverwriteOldest);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&RecordOrder, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                true, subscription_id);
+  // UI tasks are not carried out until WaitForIdle(), so the pool fills up
+  for (int i = 0; i < 5; ++i) {
+    uint8_t* p = sch.GetPacketForSubmission(source_id);
+    ASSERT(p);
+    p[0] = (uint8_t)i;
+    sch.SubmitPacket(source_id, p, (Scheduler::Time)i * 1000);
+  }
+  EXPECT(sch.GetLostPackets(source_id) == 3);
+  sch.WaitForIdle();
+  ASSERT(arrival_order.size() == 2);
+  EXPECT(arrival_order[0] == 3);
+  EXPECT(arrival_order[1] == 4);
+  EXPECT(sch.GetFreePackets(source_id) == 2);
+  sch.Shutdown();
+}
+
+static int low_watermark_calls;
+
+void CountLowWatermark(Scheduler::SourceId source_id, int free_packets) {
+  EXPECT(source_id == checked_source_id);
+  EXPECT(free_packets == 1);
+  low_watermark_calls++;
+}
+
+void LowWatermarkIsSignaledOnce() {
+  low_watermark_calls = 0;
+  Scheduler sch(1);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 4);
+  checked_source_id = source_id;
+  EXPECT(sch.GetNumberOfPackets(source_id) == 4);
+  sch.SetLowWatermarkCallback(source_id, 1, &CountLowWatermark);
+  for (int round = 1; round <= 2; ++round) {
+    uint8_t* p[3];
+    for (int i = 0; i < 3; ++i) p[i] = sch.GetPacketForSubmission(source_id);
+    EXPECT(sch.GetFreePackets(source_id) == 1);
+    EXPECT(low_watermark_calls == round);
+    uint8_t* last = sch.GetPacketForSubmission(source_id);
+    EXPECT(low_watermark_calls == round);
+    sch.SubmitPacket(source_id, last, 0);
+    for (int i = 0; i < 3; ++i) sch.SubmitPacket(source_id, p[i], 0);
+    EXPECT(sch.GetFreePackets(source_id) == 4);
+  }
+  sch.Shutdown();
+}
+
+void ElasticPoolGrowsAndShrinks() {
+  Scheduler sch(1);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 100, 4);
+  sch.SetElasticPool(source_id, 12);
+  std::vector<uint8_t*> packets;
+  for (int i = 0; i < 10; ++i) {
+    uint8_t* p = sch.GetPacketForSubmission(source_id);
+    ASSERT(p);
+    EXPECT((uintptr_t)p % 16 == 0);
+    memset(p, i, 100);
+    packets.push_back(p);
+  }
+  Scheduler::PoolStats stats = sch.GetPoolStats(source_id);
+  EXPECT(stats.capacity == 12);
+  EXPECT(stats.max_capacity == 12);
+  EXPECT(stats.in_use == 10);
+  EXPECT(stats.high_water == 10);
+  EXPECT(stats.grows == 2);
+  packets.push_back(sch.GetPacketForSubmission(source_id));
+  packets.push_back(sch.GetPacketForSubmission(source_id));
+  EXPECT(!sch.GetPacketForSubmission(source_id));
+  EXPECT(sch.GetPoolStats(source_id).drops == 1);
+  // growing did not move the packets
+  for (int i = 0; i < 10; ++i) {
+    EXPECT(packets[(size_t)i][0] == i && packets[(size_t)i][99] == i);
+  }
+  for (uint8_t* p : packets) sch.SubmitPacket(source_id, p, 0);
+  stats = sch.GetPoolStats(source_id);
+  EXPECT(stats.capacity == 4);
+  EXPECT(stats.in_use == 0);
+  EXPECT(stats.high_water == 12);
+  sch.Shutdown();
+}
+
+static std::atomic<int> slow_packets_arrived;
+
+void SlowJob(void* schp, Scheduler::SourceId source_id,
+             const Scheduler::Byte* packet, Scheduler::Time) {
+  Scheduler& sch = *static_cast<Scheduler*>(schp);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  slow_packets_arrived++;
+  sch.ReleasePacket(source_id, packet);
+}
+
+void AdaptiveWorkersParkAndComeBack() {
+  slow_packets_arrived = 0;
+  Scheduler sch(4);
+  sch.SetAdaptiveWorkers(true);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 64);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&SlowJob, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                false, subscription_id);
+  // low utilization parks workers
+  int sent = 0;
+  for (int i = 0; i < 25; ++i) {
+    sch.SubmitPacket(source_id, sch.GetPacketForSubmission(source_id), 0);
+    sent++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  EXPECT(sch.GetNumberOfActiveWorkers() == 1);
+  // a burst brings them back
+  for (int i = 0; i < 60; ++i) {
+    sch.SubmitPacket(source_id, sch.GetPacketForSubmission(source_id), 0);
+    sent++;
+  }
+  EXPECT(sch.GetNumberOfActiveWorkers() > 1);
+  while (slow_packets_arrived < sent) std::this_thread::yield();
+  sch.SetAdaptiveWorkers(false);
+  EXPECT(sch.GetNumberOfActiveWorkers() == 4);
+  sch.Shutdown();
+}
+
+static int UI_notifications;
+
+void CountUINotification() { UI_notifications++; }
+
+void UITasksAreNotifiedAndDrained() {
+  arrival_order.clear();
+  UI_notifications = 0;
+  Scheduler sch(1);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 8);
+  sch.SetUITaskNotifier(&CountUINotification);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&RecordOrder, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                true, subscription_id);
+  for (int round = 1; round <= 2; ++round) {
+    for (int i = 0; i < 3; ++i) {
+      uint8_t* p = sch.GetPacketForSubmission(source_id);
+      p[0] = (uint8_t)i;
+      sch.SubmitPacket(source_id, p, (Scheduler::Time)i);
+    }
+    EXPECT(UI_notifications == round);
+    EXPECT(!sch.DoUITasks(1000000));
+    EXPECT(arrival_order.size() == (size_t)round * 3);
+  }
+  sch.SetUITaskNotifier(nullptr);
+  sch.Shutdown();
+}
+
+void SlowUIJob(void* schp, Scheduler::SourceId source_id,
+               const Scheduler::Byte* packet, Scheduler::Time) {
+  Scheduler& sch = *static_cast<Scheduler*>(schp);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  sch.ReleasePacket(source_id, packet);
+}
+
+void UITaskBudgetIsKept() {
+  Scheduler sch(1);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 8);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&SlowUIJob, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                true, subscription_id);
+  for (int i = 0; i < 8; ++i) {
+    sch.SubmitPacket(source_id, sch.GetPacketForSubmission(source_id), 0);
+  }
+  EXPECT(sch.DoUITasks(1000));
+  EXPECT(sch.GetFreePackets(source_id) == 1);
+  while (sch.DoUITasks(1000))
+    ;
+  EXPECT(sch.GetFreePackets(source_id) == 8);
+  sch.Shutdown();
+}
+
+static std::atomic<bool> blocked_job_may_finish;
+
+void BlockedJob(Scheduler* sch, Scheduler::SourceId source_id,
+                const Scheduler::Byte* packet, Scheduler::Time) {
+  while (!blocked_job_may_finish.load()) std::this_thread::yield();
+  sch->ReleasePacket(source_id, packet);
+}
+
+bool IsAnyTaskRunning(const std::vector<Scheduler::ThreadActivity>& acts) {
+  for (const Scheduler::ThreadActivity& activity : acts)
+    if (activity.tasks_started != activity.tasks_done) return true;
+  return false;
+}
+
+void ThreadActivitiesShowRunningTask() {
+  blocked_job_may_finish = false;
+  Scheduler sch(2);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 2);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&BlockedJob, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                false, subscription_id);
+  std::vector<Scheduler::ThreadActivity> activities;
+  sch.GetThreadActivities(activities);
+  EXPECT(activities.size() == 3);  // UI thread and the workers
+  EXPECT(!IsAnyTaskRunning(activities));
+  sch.SubmitPacket(source_id, sch.GetPacketForSubmission(source_id), 0);
+  while (!IsAnyTaskRunning(activities)) sch.GetThreadActivities(activities);
+  EXPECT(activities[0].tasks_started == 0);
+  EXPECT(sch.GetPendingTasks() == 1);
+  for (size_t i = 1; i < activities.size(); ++i) {
+    if (activities[i].tasks_started == activities[i].tasks_done) continue;
+    EXPECT(activities[i].tasks_started == 1);
+    EXPECT(activities[i].source_id == source_id);
+  }
+  blocked_job_may_finish = true;
+  sch.WaitForIdle();
+  sch.GetThreadActivities(activities);
+  EXPECT(!IsAnyTaskRunning(activities));
+  EXPECT(activities[1].tasks_done + activities[2].tasks_done == 1);
+  std::vector<Scheduler::SourceId> source_ids = sch.GetSourceIds();
+  EXPECT(source_ids.size() == 1 && source_ids[0] == source_id);
+  sch.Shutdown();
+}
+
+void DrainFinishesSubmittedTasks() {
+  blocked_job_may_finish = true;
+  Scheduler sch(2);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 4);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&BlockedJob, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                false, subscription_id);
+  for (int i = 0; i < 4; ++i)
+    sch.SubmitPacket(source_id, sch.GetPacketForSubmission(source_id), 0);
+  EXPECT(sch.DrainAndShutdown(10000000) == 0);
+  EXPECT(sch.GetPendingTasks() == 0);
+  EXPECT(sch.GetFreePackets(source_id) == 4);
+}
+
+void DrainCancelsTasksAfterTimeout() {
+  blocked_job_may_finish = false;
+  Scheduler sch(1);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 4);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&BlockedJob, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                false, subscription_id);
+  sch.Subscribe(source_id,
+                std::bind(&BlockedJob, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                true, subscription_id);
+  for (int i = 0; i < 3; ++i)
+    sch.SubmitPacket(source_id, sch.GetPacketForSubmission(source_id), 0);
+  std::vector<Scheduler::ThreadActivity> activities;
+  while (!IsAnyTaskRunning(activities)) sch.GetThreadActivities(activities);
+  // One worker task runs, two are queued and no main loop does UI tasks
+  EXPECT(sch.DrainAndShutdown(20000) == 5);
+  EXPECT(sch.GetPendingTasks() == 1);
+  EXPECT(sch.GetFreePackets(source_id) == 3);
+  blocked_job_may_finish = true;
+  while (sch.GetFreePackets(source_id) < 4) std::this_thread::yield();
+}
+
+void ReconfigureWaitsForOldPackets() {
+  blocked_job_may_finish = false;
+  Scheduler sch(1);
+  Scheduler::SourceId source_id = sch.RegisterSource("test", 16, 2);
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&BlockedJob, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                false, subscription_id);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
+  EXPECT(Scheduler::GetSizeOfPacket(p) == 16);
+  sch.SubmitPacket(source_id, p, 0);
+  // The sink still holds the old packet
+  EXPECT(!sch.ReconfigureSource(source_id, 100, 3, 20000));
+  EXPECT(sch.GetPacketSize(source_id) == 16);
+  EXPECT(sch.GetNumberOfPackets(source_id) == 2);
+  blocked_job_may_finish = true;
+  EXPECT(sch.ReconfigureSource(source_id, 100, 3, 10000000));
+  EXPECT(sch.GetPacketSize(source_id) == 100);
+  EXPECT(sch.GetNumberOfPackets(source_id) == 3);
+  p = sch.GetPacketForSubmission(source_id);
+  ASSERT(p);
+  EXPECT(Scheduler::GetSizeOfPacket(p) == 100);
+  memset(p, 0, 100);
+  sch.SubmitPacket(source_id, p, 1000);
+  sch.WaitForIdle();
+  EXPECT(sch.GetFreePackets(source_id) == 3);
+  // Counters of the pool survive reconfiguration
+  Scheduler::PoolStats stats = sch.GetPoolStats(source_id);
+  EXPECT(stats.released == 2);
+  EXPECT(stats.turnaround_in_us >= 20000);
+  sch.Shutdown();
+}
+
+void SourcesGetIdsAndNames() {
+  Scheduler sch(1);
+  Scheduler::SourceId first = sch.RegisterSource("first", 16, 2);
+  Scheduler::SourceId second = sch.RegisterSource("second", 32, 2);
+  EXPECT(first != Scheduler::kInvalidSourceId);
+  EXPECT(second != Scheduler::kInvalidSourceId && second != first);
+  EXPECT(sch.FindSource("first") == first);
+  EXPECT(sch.FindSource("second") == second);
+  EXPECT(sch.FindSource("third") == Scheduler::kInvalidSourceId);
+  EXPECT(sch.GetSourceName(second) == "second");
+  std::vector<Scheduler::SourcePoolStats> pool_stats;
+  sch.GetAllPoolStats(pool_stats);
+  EXPECT(pool_stats.size() == 2);
+  sch.UnregisterSource(first);
+  EXPECT(sch.FindSource("first") == Scheduler::kInvalidSourceId);
+  EXPECT(sch.GetSourceName(first).empty());
+  EXPECT(sch.GetSourceIds().size() == 1);
+  // The slot is used again, but not the ID
+  Scheduler::SourceId third = sch.RegisterSource("first", 64, 2);
+  EXPECT(third != first && third != second);
+  EXPECT(sch.GetPacketSize(third) == 64);
+  EXPECT(sch.GetPacketSize(second) == 32);
+  sch.GetAllPoolStats(pool_stats);
+  ASSERT(pool_stats.size() == 2);
+  EXPECT(pool_stats[0].source_id == third);
+  EXPECT(pool_stats[1].source_id == second);
+  sch.Shutdown();
+}
+
+void SourceIsUnregisteredAfterItsPackets() {
+  packets_arrived = 0;
+  Scheduler sch(2);
+  std::vector<Scheduler::SourceId> source_ids;
+  // Many sources of one owner, e.g. one per analysis band
+  for (int band = 0; band < 32; ++band) {
+    char name[16];
+    snprintf(name, sizeof(name), "band%d", band);
+    source_ids.push_back(sch.RegisterSource(name, 16, 2));
+  }
+  Scheduler::SourceId source_id = source_ids[7];
+  checked_source_id = source_id;
+  int subscription_id;
+  sch.Subscribe(source_id,
+                std::bind(&CheckPackets, &sch, std::placeholders::_1,
+                          std::placeholders::_2, std::placeholders::_3),
+                false, subscription_id);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
+  p[0] = 0;
+  sch.SubmitPacket(source_id, p, 0);
+  sch.WaitForIdle();
+  EXPECT(packets_arrived == 1);
+  sch.Unsubscribe(source_id, subscription_id);
+  for (Scheduler::SourceId id : source_ids) sch.UnregisterSource(id);
+  EXPECT(sch.GetSourceIds().empty());
+  sch.Shutdown();
+}
+
+void ReconfigureUntilDrained(Scheduler* sch, Scheduler::SourceId source_id) {
+  EXPECT(sch->ReconfigureSource(source_id, 32, 2, 1000000));
+}
+
+void UnregisterWaitsForCallsInFlight() {
+  Scheduler sch(1);
+  Scheduler::SourceId source_id = sch.RegisterSource("reconfigured", 16, 2);
+  uint8_t* p = sch.GetPacketForSubmission(source_id);
+  // Polls for the packet to come back, it is not done when it comes
+  std::thread thr(ReconfigureUntilDrained, &sch, source_id);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  sch.CancelPacket(source_id, p);
+  sch.UnregisterSource(source_id);
+  EXPECT(sch.GetSourceIds().empty());
+  thr.join();
+  sch.Shutdown();
+}
+
 TEST_BEGIN() {
   RunsWellEmpty();
   RunsWellWithoutShutdown();
@@ -307,10 +889,32 @@ TEST_BEGIN() {
   SourceWithoutSinks();
   QueueWorksAfterUnsubscribe();
   OutOfBufferGivesNull();
+  CancelledPacketIsFreeAgain();
   SinkGetsAllPacketsSent();
   SinkGetsAllPacketsSentOnUIThread();
   AllSinksGetAllPackets();
   MultipleSourcesWithOneSink();
   SourceSinkChainWorks();
+  VirtualClockIsDrivenBySources();
+  WallClockIsNotAdvanced();
+  SameTimestampsKeepSubmissionOrder();
+  InOrderSinkGetsPacketsInOrder();
+  InOrderSinkSkipsTakenBackPackets();
+  WaitForIdleFinishesAllTasks();
+  BlockingSourceWaitsForRelease();
+  BlockingSourceTimesOut();
+  OverwriteTakesBackOldestPacket();
+  LowWatermarkIsSignaledOnce();
+  ElasticPoolGrowsAndShrinks();
+  AdaptiveWorkersParkAndComeBack();
+  UITasksAreNotifiedAndDrained();
+  UITaskBudgetIsKept();
+  ThreadActivitiesShowRunningTask();
+  DrainFinishesSubmittedTasks();
+  DrainCancelsTasksAfterTimeout();
+  ReconfigureWaitsForOldPackets();
+  SourcesGetIdsAndNames();
+  SourceIsUnregisteredAfterItsPackets();
+  UnregisterWaitsForCallsInFlight();
 }
 TEST_END()
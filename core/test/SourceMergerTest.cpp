@@ -0,0 +1,154 @@
+#include "zamt/core/SourceMerger.h"
+#include "zamt/core/TestSuite.h"
+
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+using namespace zamt;
+
+static const int sample_rate = 1000;  // a frame in every millisecond
+
+struct Collector {
+  std::mutex mutex;
+  std::vector<SourceMerger::Sample> samples;
+  std::vector<Scheduler::Time> timestamps;
+
+  void OnPacket(Scheduler* sch, Scheduler::SourceId source_id,
+                const Scheduler::Byte* packet, Scheduler::Time timestamp) {
+    const SourceMerger::Sample* data = (const SourceMerger::Sample*)packet;
+    size_t size = (size_t)Scheduler::GetSizeOfPacket(packet) /
+                  sizeof(SourceMerger::Sample);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      samples.insert(samples.end(), data, data + size);
+      timestamps.push_back(timestamp);
+    }
+    sch->ReleasePacket(source_id, packet);
+  }
+};
+
+// Frames carry their index in every channel
+void SubmitFrames(Scheduler& sch, Scheduler::SourceId source_id, int channels,
+                  int first_frame, int frames, Scheduler::Time timestamp) {
+  Scheduler::Byte* packet = sch.GetPacketForSubmission(source_id);
+  ASSERT(packet);
+  ASSERT(Scheduler::GetSizeOfPacket(packet) ==
+         frames * channels * (int)sizeof(SourceMerger::Sample));
+  SourceMerger::Sample* samples = (SourceMerger::Sample*)packet;
+  for (int frame = 0; frame < frames; ++frame)
+    for (int channel = 0; channel < channels; ++channel)
+      samples[frame * channels + channel] =
+          (SourceMerger::Sample)(first_frame + frame);
+  sch.SubmitPacket(source_id, packet, timestamp);
+}
+
+void InputsAreAlignedByTimestamp() {
+  Scheduler sch(2);
+  Scheduler::SourceId mono = sch.RegisterSource("mono", 10 * 1 * 2, 8);
+  Scheduler::SourceId stereo = sch.RegisterSource("stereo", 10 * 2 * 2, 8);
+  SourceMerger merger(&sch, {{mono, 1}, {stereo, 2}}, sample_rate, "merged",
+                      10, 8);
+  EXPECT(merger.GetChannels() == 3);
+  EXPECT(sch.FindSource("merged") == merger.GetSourceId());
+  EXPECT(sch.GetPacketSize(merger.GetSourceId()) == 10 * 3 * 2);
+  Collector collector;
+  int subscription_id;
+  sch.Subscribe(merger.GetSourceId(),
+                std::bind(&Collector::OnPacket, &collector, &sch,
+                          std::placeholders::_1, std::placeholders::_2,
+                          std::placeholders::_3),
+                false, subscription_id);
+  // The second input starts 5 frames later
+  for (int i = 0; i < 6; ++i) {
+    SubmitFrames(sch, mono, 1, i * 10, 10, (Scheduler::Time)i * 10000);
+    sch.WaitForIdle();
+    SubmitFrames(sch, stereo, 2, i * 10, 10,
+                 (Scheduler::Time)i * 10000 + 5000);
+    sch.WaitForIdle();
+  }
+  ASSERT(!collector.samples.empty());
+  EXPECT(collector.timestamps[0] == 5000);
+  EXPECT(collector.timestamps[1] == 15000);
+  for (size_t frame = 0; frame < collector.samples.size() / 3; ++frame) {
+    const SourceMerger::Sample* samples = &collector.samples[frame * 3];
+    EXPECT(samples[0] == (SourceMerger::Sample)(frame + 5));
+    EXPECT(samples[1] == (SourceMerger::Sample)frame);
+    EXPECT(samples[2] == (SourceMerger::Sample)frame);
+  }
+  EXPECT(merger.GetCorrection(1) == 0);
+  merger.Stop();
+  sch.Shutdown();
+}
+
+void DriftIsFollowed() {
+  Scheduler sch(2);
+  Scheduler::SourceId first = sch.RegisterSource("first", 100 * 2, 8);
+  Scheduler::SourceId second = sch.RegisterSource("second", 101 * 2, 8);
+  SourceMerger merger(&sch, {{first, 1}, {second, 1}}, sample_rate, "merged",
+                      10, 64);
+  Collector collector;
+  int subscription_id;
+  sch.Subscribe(merger.GetSourceId(),
+                std::bind(&Collector::OnPacket, &collector, &sch,
+                          std::placeholders::_1, std::placeholders::_2,
+                          std::placeholders::_3),
+                false, subscription_id);
+  // The clock of the second input is 1% faster
+  for (int i = 0; i < 50; ++i) {
+    SubmitFrames(sch, first, 1, i * 100, 100, (Scheduler::Time)i * 100000);
+    SubmitFrames(sch, second, 1, i * 101, 101, (Scheduler::Time)i * 100000);
+    sch.WaitForIdle();
+  }
+  double drift = merger.GetDriftPpm(1);
+  EXPECT(drift > 9900.0 && drift < 10100.0);
+  EXPECT(merger.GetDriftPpm(0) == 0.0);
+  EXPECT(merger.GetCorrection(1) > 0);
+  // The newest frames are in step again
+  size_t frames = collector.samples.size() / 2;
+  ASSERT(frames > 4000);
+  const SourceMerger::Sample* last = &collector.samples[(frames - 1) * 2];
+  EXPECT(std::abs(last[1] - last[0] * 101 / 100) <= 2);
+  merger.Stop();
+  sch.Shutdown();
+}
+
+void BurstKeepsPacketOrder() {
+  Scheduler sch(4);
+  Scheduler::SourceId mono = sch.RegisterSource("mono", 10 * 1 * 2, 64);
+  Scheduler::SourceId stereo = sch.RegisterSource("stereo", 10 * 2 * 2, 64);
+  SourceMerger merger(&sch, {{mono, 1}, {stereo, 2}}, sample_rate, "merged",
+                      10, 64);
+  Collector collector;
+  int subscription_id;
+  sch.SubscribeInOrder(merger.GetSourceId(),
+                       std::bind(&Collector::OnPacket, &collector, &sch,
+                                 std::placeholders::_1, std::placeholders::_2,
+                                 std::placeholders::_3),
+                       subscription_id);
+  // No waiting between the packets, so the workers take them in parallel
+  for (int i = 0; i < 50; ++i) {
+    SubmitFrames(sch, mono, 1, i * 10, 10, (Scheduler::Time)i * 10000);
+    SubmitFrames(sch, stereo, 2, i * 10, 10, (Scheduler::Time)i * 10000);
+  }
+  sch.WaitForIdle();
+  ASSERT(collector.timestamps.size() >= 45);
+  for (size_t i = 0; i < collector.timestamps.size(); ++i)
+    EXPECT(collector.timestamps[i] == (Scheduler::Time)i * 10000);
+  for (size_t frame = 0; frame < collector.samples.size() / 3; ++frame) {
+    const SourceMerger::Sample* samples = &collector.samples[frame * 3];
+    EXPECT(samples[0] == (SourceMerger::Sample)frame);
+    EXPECT(samples[1] == (SourceMerger::Sample)frame);
+    EXPECT(samples[2] == (SourceMerger::Sample)frame);
+  }
+  EXPECT(merger.GetCorrection(1) == 0);
+  merger.Stop();
+  sch.Shutdown();
+}
+
+TEST_BEGIN() {
+  InputsAreAlignedByTimestamp();
+  DriftIsFollowed();
+  BurstKeepsPacketOrder();
+}
+TEST_END()
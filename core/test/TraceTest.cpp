@@ -0,0 +1,101 @@
+// Trace points are tested even if the build does not compile them in
+#ifndef ZAMT_TRACE
+#define ZAMT_TRACE
+#endif
+
+#include "zamt/core/TestSuite.h"
+#include "zamt/core/Trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace zamt;
+
+std::string ReadFile(const char* path) {
+  std::string content;
+  FILE* file = fopen(path, "r");
+  if (!file) return content;
+  char buffer[4096];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    content.append(buffer, length);
+  fclose(file);
+  return content;
+}
+
+int CountOccurrences(const std::string& text, const char* pattern) {
+  int count = 0;
+  for (size_t pos = text.find(pattern); pos != std::string::npos;
+       pos = text.find(pattern, pos + 1))
+    count++;
+  return count;
+}
+
+void RecordPackets(int packets) {
+  for (int i = 0; i < packets; ++i) {
+    ZAMT_TRACE_SCOPE("TestWork", 7, i);
+  }
+}
+
+void EventsAreRecordedOnlyWhileRecording() {
+  ZAMT_TRACE_INSTANT("TestBefore");
+  Trace::Start();
+  EXPECT(Trace::IsRecording());
+  std::thread first(RecordPackets, 100);
+  std::thread second(RecordPackets, 50);
+  first.join();
+  second.join();
+  ZAMT_TRACE_INSTANT("TestMark", 7);
+  const char* path = "/tmp/zamt_tracetest.json";
+  ASSERT(Trace::ExportChromeJSON(path));
+  EXPECT(!Trace::IsRecording());
+  ZAMT_TRACE_INSTANT("TestAfter");
+  std::string json = ReadFile(path);
+  EXPECT(json.compare(0, 1, "{") == 0);
+  EXPECT(json.find("\"traceEvents\":[") != std::string::npos);
+  EXPECT(CountOccurrences(json, "\"name\":\"TestWork\"") == 150);
+  EXPECT(CountOccurrences(json, "\"ph\":\"X\"") == 150);
+  EXPECT(CountOccurrences(json, "\"name\":\"TestMark\"") == 1);
+  EXPECT(CountOccurrences(json, "\"TestBefore\"") == 0);
+  EXPECT(CountOccurrences(json, "\"TestAfter\"") == 0);
+  EXPECT(json.find("\"args\":{\"source\":7,\"packet\":99}") !=
+         std::string::npos);
+  EXPECT(json.find("\"args\":{\"source\":7}") != std::string::npos);
+}
+
+void FullBufferDropsEvents() {
+  Trace::Start();
+  std::thread thread(RecordPackets, Trace::kEventsPerThread + 10);
+  thread.join();
+  const char* path = "/tmp/zamt_tracetest_full.json";
+  ASSERT(Trace::ExportChromeJSON(path));
+  std::string json = ReadFile(path);
+  EXPECT(CountOccurrences(json, "\"name\":\"TestWork\"") ==
+         Trace::kEventsPerThread);
+  EXPECT(json.find("\"name\":\"dropped events\"") != std::string::npos);
+  EXPECT(json.find("\"count\":10}") != std::string::npos);
+}
+
+void RestartGetsEmptyBuffers() {
+  // The thread of the test keeps its buffer between the recordings
+  Trace::Start();
+  RecordPackets(Trace::kEventsPerThread + 10);
+  const char* path = "/tmp/zamt_tracetest_restart.json";
+  ASSERT(Trace::ExportChromeJSON(path));
+  Trace::Start();
+  RecordPackets(20);
+  ASSERT(Trace::ExportChromeJSON(path));
+  std::string json = ReadFile(path);
+  EXPECT(CountOccurrences(json, "\"name\":\"TestWork\"") == 20);
+  EXPECT(json.find("\"name\":\"dropped events\"") == std::string::npos);
+}
+
+TEST_BEGIN() {
+  EventsAreRecordedOnlyWhileRecording();
+  FullBufferDropsEvents();
+  RestartGetsEmptyBuffers();
+}
+TEST_END()
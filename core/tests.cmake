@@ -24,3 +24,22 @@ set(test_cpps
 )
 AddTest(SchedulerTest ${this_module} "${other_modules}" "${test_cpps}")
 
+set(test_cpps
+  LogTest.cpp
+)
+AddTest(LogTest ${this_module} "${other_modules}" "${test_cpps}")
+
+set(test_cpps
+  TraceTest.cpp
+)
+AddTest(TraceTest ${this_module} "${other_modules}" "${test_cpps}")
+
+set(test_cpps
+  LatencyTunerTest.cpp
+)
+AddTest(LatencyTunerTest ${this_module} "${other_modules}" "${test_cpps}")
+
+set(test_cpps
+  SourceMergerTest.cpp
+)
+AddTest(SourceMergerTest ${this_module} "${other_modules}" "${test_cpps}")
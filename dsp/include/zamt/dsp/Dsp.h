@@ -0,0 +1,120 @@
+#ifndef ZAMT_DSP_DSP_H_
+#define ZAMT_DSP_DSP_H_
+
+/// Vectorized numeric primitives shared by the processing stages.
+/**
+ * Every primitive has a scalar, an SSE4.2, an AVX2 and an AVX-512 variant.
+ * The build flags stay at the baseline of the platform: the variants are
+ * compiled for their instruction set alone and Get() selects the best one
+ * the CPU reports (by CPUID) on the first use. Other variants can be
+ * created explicitly to compare or measure them.
+ *
+ * Counts can be anything, the part not filling a whole register is done
+ * by the scalar code. Results of floating point sums can differ from the
+ * scalar ones by rounding, integer results are exactly the same.
+ */
+
+#include <cstdint>
+
+namespace zamt_dsp_internal {
+
+using Sample = int16_t;
+
+/// Dispatch table of the variants of an instruction set.
+struct Kernels {
+  void (*convert_to_float)(const Sample* in, float scale, float* out,
+                           int count);
+  void (*deinterleave)(const Sample* in, int channels, float scale,
+                       float* const* out, int frames);
+  void (*mid_side)(const Sample* stereo, Sample* mid, Sample* side,
+                   int frames);
+  float (*dot)(const float* a, const float* b, int count);
+  void (*complex_multiply)(const float* a, const float* b, float* out,
+                           int count);
+  void (*apply_window)(const float* in, const float* window, float* out,
+                       int count);
+  void (*measure_levels)(const Sample* in, int count, uint64_t* square_sum,
+                         int* peak);
+};
+
+// Null if the instruction set is not compiled for the platform
+const Kernels* GetScalarKernels();
+const Kernels* GetSSE42Kernels();
+const Kernels* GetAVX2Kernels();
+const Kernels* GetAVX512Kernels();
+
+}  // namespace zamt_dsp_internal
+
+namespace zamt {
+
+class Dsp {
+ public:
+  using Sample = zamt_dsp_internal::Sample;
+  enum class Isa { kScalar, kSSE42, kAVX2, kAVX512 };
+
+  struct Levels {
+    uint64_t square_sum;
+    int peak;  // of the absolute value
+  };
+
+  /// Variants of the best instruction set of the CPU.
+  static const Dsp& Get();
+  static bool IsSupported(Isa isa);
+  static Isa GetBestIsa();
+  static const char* GetIsaName(Isa isa);
+
+  /// Variants of the given instruction set, it has to be supported.
+  explicit Dsp(Isa isa);
+
+  Isa isa() const { return isa_; }
+
+  /// out[i] = in[i] * scale
+  void ConvertToFloat(const Sample* in, float scale, float* out,
+                      int count) const {
+    kernels_->convert_to_float(in, scale, out, count);
+  }
+
+  /// Splits interleaved frames into one array per channel while converting
+  /// them like ConvertToFloat(). Mono and stereo are vectorized.
+  void Deinterleave(const Sample* in, int channels, float scale,
+                    float* const* out, int frames) const {
+    kernels_->deinterleave(in, channels, scale, out, frames);
+  }
+
+  /// mid = (left + right) >> 1, side = (left - right) >> 1
+  void MidSide(const Sample* stereo, Sample* mid, Sample* side,
+               int frames) const {
+    kernels_->mid_side(stereo, mid, side, frames);
+  }
+
+  float Dot(const float* a, const float* b, int count) const {
+    return kernels_->dot(a, b, count);
+  }
+
+  /// Multiplies count complex numbers stored as (real, imaginary) pairs.
+  void ComplexMultiply(const float* a, const float* b, float* out,
+                       int count) const {
+    kernels_->complex_multiply(a, b, out, count);
+  }
+
+  /// out[i] = in[i] * window[i], out can be the same as in.
+  void ApplyWindow(const float* in, const float* window, float* out,
+                   int count) const {
+    kernels_->apply_window(in, window, out, count);
+  }
+
+  /// Sum of squares (the RMS is its mean's root) and peak of samples.
+  Levels MeasureLevels(const Sample* in, int count) const {
+    Levels levels;
+    kernels_->measure_levels(in, count, &levels.square_sum, &levels.peak);
+    return levels;
+  }
+
+ private:
+  Isa isa_;
+  const zamt_dsp_internal::Kernels* kernels_;
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_DSP_DSP_H_
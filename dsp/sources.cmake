@@ -0,0 +1,16 @@
+set(module_cpps
+  Dsp.cpp
+  DspAVX2.cpp
+  DspAVX512.cpp
+  DspSSE42.cpp
+  DspScalar.cpp
+)
+
+
+# 3rd party configuration
+
+set(module_includes
+)
+
+set(module_libs
+)
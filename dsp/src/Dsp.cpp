@@ -0,0 +1,83 @@
+#include "zamt/dsp/Dsp.h"
+
+#include <cassert>
+#include <initializer_list>
+
+namespace {
+
+using zamt::Dsp;
+using zamt_dsp_internal::Kernels;
+
+const Kernels* GetKernels(Dsp::Isa isa) {
+  switch (isa) {
+    case Dsp::Isa::kScalar:
+      return zamt_dsp_internal::GetScalarKernels();
+    case Dsp::Isa::kSSE42:
+      return zamt_dsp_internal::GetSSE42Kernels();
+    case Dsp::Isa::kAVX2:
+      return zamt_dsp_internal::GetAVX2Kernels();
+    case Dsp::Isa::kAVX512:
+      return zamt_dsp_internal::GetAVX512Kernels();
+  }
+  return nullptr;
+}
+
+bool HasCpuFeatures(Dsp::Isa isa) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  switch (isa) {
+    case Dsp::Isa::kScalar:
+      return true;
+    case Dsp::Isa::kSSE42:
+      return __builtin_cpu_supports("sse4.2");
+    case Dsp::Isa::kAVX2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case Dsp::Isa::kAVX512:
+      return __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512bw");
+  }
+  return false;
+#else
+  return isa == Dsp::Isa::kScalar;
+#endif
+}
+
+}  // namespace
+
+namespace zamt {
+
+const Dsp& Dsp::Get() {
+  // Thread safe initialization on the first use
+  static const Dsp best(GetBestIsa());
+  return best;
+}
+
+bool Dsp::IsSupported(Isa isa) {
+  return GetKernels(isa) != nullptr && HasCpuFeatures(isa);
+}
+
+Dsp::Isa Dsp::GetBestIsa() {
+  for (Isa isa : {Isa::kAVX512, Isa::kAVX2, Isa::kSSE42})
+    if (IsSupported(isa)) return isa;
+  return Isa::kScalar;
+}
+
+const char* Dsp::GetIsaName(Isa isa) {
+  switch (isa) {
+    case Isa::kScalar:
+      return "scalar";
+    case Isa::kSSE42:
+      return "SSE4.2";
+    case Isa::kAVX2:
+      return "AVX2";
+    case Isa::kAVX512:
+      return "AVX-512";
+  }
+  return "";
+}
+
+Dsp::Dsp(Isa isa) : isa_(isa), kernels_(GetKernels(isa)) {
+  assert(IsSupported(isa));
+}
+
+}  // namespace zamt
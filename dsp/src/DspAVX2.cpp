@@ -0,0 +1,193 @@
+#include "zamt/dsp/Dsp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <algorithm>
+
+#include <immintrin.h>
+
+#define ZAMT_DSP_TARGET __attribute__((target("avx2,fma")))
+
+namespace {
+
+using zamt_dsp_internal::Sample;
+
+// The part not filling a whole register
+const zamt_dsp_internal::Kernels& Scalar() {
+  return *zamt_dsp_internal::GetScalarKernels();
+}
+
+ZAMT_DSP_TARGET float Sum(__m256 v) {
+  __m128 half =
+      _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+  return _mm_cvtss_f32(half);
+}
+
+ZAMT_DSP_TARGET __m256 ToFloat(__m128i samples, __m256 factor) {
+  return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(samples)),
+                       factor);
+}
+
+ZAMT_DSP_TARGET void ConvertToFloat(const Sample* in, float scale, float* out,
+                                    int count) {
+  const __m256 factor = _mm256_set1_ps(scale);
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i low = _mm_loadu_si128((const __m128i*)(in + i));
+    __m128i high = _mm_loadu_si128((const __m128i*)(in + i + 8));
+    _mm256_storeu_ps(out + i, ToFloat(low, factor));
+    _mm256_storeu_ps(out + i + 8, ToFloat(high, factor));
+  }
+  Scalar().convert_to_float(in + i, scale, out + i, count - i);
+}
+
+ZAMT_DSP_TARGET void Deinterleave(const Sample* in, int channels, float scale,
+                                  float* const* out, int frames) {
+  if (channels == 1) {
+    ConvertToFloat(in, scale, out[0], frames);
+    return;
+  }
+  if (channels != 2) {
+    Scalar().deinterleave(in, channels, scale, out, frames);
+    return;
+  }
+  const __m256 factor = _mm256_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    __m256i samples = _mm256_loadu_si256((const __m256i*)(in + i * 2));
+    // Sign extended halves of the 32 bit frames
+    __m256i left = _mm256_srai_epi32(_mm256_slli_epi32(samples, 16), 16);
+    __m256i right = _mm256_srai_epi32(samples, 16);
+    _mm256_storeu_ps(out[0] + i,
+                     _mm256_mul_ps(_mm256_cvtepi32_ps(left), factor));
+    _mm256_storeu_ps(out[1] + i,
+                     _mm256_mul_ps(_mm256_cvtepi32_ps(right), factor));
+  }
+  float* rest[2] = {out[0] + i, out[1] + i};
+  Scalar().deinterleave(in + i * 2, 2, scale, rest, frames - i);
+}
+
+// Packs (x0 + x1) >> 1 of the sample pairs of two registers in their order
+ZAMT_DSP_TARGET __m256i HalvePairSums(__m256i first, __m256i second,
+                                      __m256i weights) {
+  __m256i packed = _mm256_packs_epi32(
+      _mm256_srai_epi32(_mm256_madd_epi16(first, weights), 1),
+      _mm256_srai_epi32(_mm256_madd_epi16(second, weights), 1));
+  // Packing works within the 128 bit lanes
+  return _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+ZAMT_DSP_TARGET void MidSide(const Sample* stereo, Sample* mid, Sample* side,
+                             int frames) {
+  const __m256i ones = _mm256_set1_epi16(1);
+  // Pairs of 1 and -1 as 16 bit values
+  const __m256i one_minus_one = _mm256_set1_epi32(-65535);
+  int i = 0;
+  for (; i + 16 <= frames; i += 16) {
+    __m256i first = _mm256_loadu_si256((const __m256i*)(stereo + i * 2));
+    __m256i second =
+        _mm256_loadu_si256((const __m256i*)(stereo + i * 2 + 16));
+    _mm256_storeu_si256((__m256i*)(mid + i),
+                        HalvePairSums(first, second, ones));
+    _mm256_storeu_si256((__m256i*)(side + i),
+                        HalvePairSums(first, second, one_minus_one));
+  }
+  Scalar().mid_side(stereo + i * 2, mid + i, side + i, frames - i);
+}
+
+ZAMT_DSP_TARGET float Dot(const float* a, const float* b, int count) {
+  __m256 first = _mm256_setzero_ps();
+  __m256 second = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    first = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i),
+                            first);
+    second = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),
+                             _mm256_loadu_ps(b + i + 8), second);
+  }
+  for (; i + 8 <= count; i += 8)
+    first = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i),
+                            first);
+  float sum = Sum(_mm256_add_ps(first, second));
+  return sum + Scalar().dot(a + i, b + i, count - i);
+}
+
+ZAMT_DSP_TARGET void ComplexMultiply(const float* a, const float* b,
+                                     float* out, int count) {
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256 first = _mm256_loadu_ps(a + i * 2);
+    __m256 second = _mm256_loadu_ps(b + i * 2);
+    // (ar * br - ai * bi, ai * br + ar * bi)
+    __m256 swapped = _mm256_permute_ps(first, _MM_SHUFFLE(2, 3, 0, 1));
+    __m256 product = _mm256_fmaddsub_ps(
+        first, _mm256_moveldup_ps(second),
+        _mm256_mul_ps(swapped, _mm256_movehdup_ps(second)));
+    _mm256_storeu_ps(out + i * 2, product);
+  }
+  Scalar().complex_multiply(a + i * 2, b + i * 2, out + i * 2, count - i);
+}
+
+ZAMT_DSP_TARGET void ApplyWindow(const float* in, const float* window,
+                                 float* out, int count) {
+  int i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i),
+                                            _mm256_loadu_ps(window + i)));
+  Scalar().apply_window(in + i, window + i, out + i, count - i);
+}
+
+ZAMT_DSP_TARGET void MeasureLevels(const Sample* in, int count,
+                                   uint64_t* square_sum, int* peak) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i squares = zero;
+  __m256i max_samples = zero;
+  __m256i min_samples = zero;
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i samples = _mm256_loadu_si256((const __m256i*)(in + i));
+    max_samples = _mm256_max_epi16(max_samples, samples);
+    min_samples = _mm256_min_epi16(min_samples, samples);
+    // Two squares of 16 bit values fit into 32 bits only as unsigned
+    __m256i square_pairs = _mm256_madd_epi16(samples, samples);
+    squares =
+        _mm256_add_epi64(squares, _mm256_unpacklo_epi32(square_pairs, zero));
+    squares =
+        _mm256_add_epi64(squares, _mm256_unpackhi_epi32(square_pairs, zero));
+  }
+  alignas(32) int16_t max_lanes[16];
+  alignas(32) int16_t min_lanes[16];
+  alignas(32) uint64_t square_lanes[4];
+  _mm256_store_si256((__m256i*)max_lanes, max_samples);
+  _mm256_store_si256((__m256i*)min_lanes, min_samples);
+  _mm256_store_si256((__m256i*)square_lanes, squares);
+  Scalar().measure_levels(in + i, count - i, square_sum, peak);
+  for (int lane = 0; lane < 4; ++lane) *square_sum += square_lanes[lane];
+  for (int lane = 0; lane < 16; ++lane)
+    *peak = std::max(*peak, std::max((int)max_lanes[lane],
+                                     -(int)min_lanes[lane]));
+}
+
+const zamt_dsp_internal::Kernels kKernels = {
+    ConvertToFloat, Deinterleave, MidSide, Dot, ComplexMultiply, ApplyWindow,
+    MeasureLevels};
+
+}  // namespace
+
+namespace zamt_dsp_internal {
+
+const Kernels* GetAVX2Kernels() { return &kKernels; }
+
+}  // namespace zamt_dsp_internal
+
+#else
+
+namespace zamt_dsp_internal {
+
+const Kernels* GetAVX2Kernels() { return nullptr; }
+
+}  // namespace zamt_dsp_internal
+
+#endif
@@ -0,0 +1,194 @@
+#include "zamt/dsp/Dsp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <algorithm>
+
+#include <immintrin.h>
+
+#define ZAMT_DSP_TARGET __attribute__((target("avx512f,avx512bw")))
+
+namespace {
+
+using zamt_dsp_internal::Sample;
+
+// The part not filling a whole register
+const zamt_dsp_internal::Kernels& Scalar() {
+  return *zamt_dsp_internal::GetScalarKernels();
+}
+
+// The shuffles and reductions of some compilers warn about their own
+// undefined values, so the lanes are added in memory
+ZAMT_DSP_TARGET float Sum(__m512 v) {
+  alignas(64) float lanes[16];
+  _mm512_store_ps(lanes, v);
+  float sum = 0.0f;
+  for (float lane : lanes) sum += lane;
+  return sum;
+}
+
+ZAMT_DSP_TARGET __m512 ToFloat(__m256i samples, __m512 factor) {
+  return _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(samples)),
+                       factor);
+}
+
+ZAMT_DSP_TARGET void ConvertToFloat(const Sample* in, float scale, float* out,
+                                    int count) {
+  const __m512 factor = _mm512_set1_ps(scale);
+  int i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i low = _mm256_loadu_si256((const __m256i*)(in + i));
+    __m256i high = _mm256_loadu_si256((const __m256i*)(in + i + 16));
+    _mm512_storeu_ps(out + i, ToFloat(low, factor));
+    _mm512_storeu_ps(out + i + 16, ToFloat(high, factor));
+  }
+  Scalar().convert_to_float(in + i, scale, out + i, count - i);
+}
+
+ZAMT_DSP_TARGET void Deinterleave(const Sample* in, int channels, float scale,
+                                  float* const* out, int frames) {
+  if (channels == 1) {
+    ConvertToFloat(in, scale, out[0], frames);
+    return;
+  }
+  if (channels != 2) {
+    Scalar().deinterleave(in, channels, scale, out, frames);
+    return;
+  }
+  const __m512 factor = _mm512_set1_ps(scale);
+  int i = 0;
+  for (; i + 16 <= frames; i += 16) {
+    __m512i samples = _mm512_loadu_si512((const void*)(in + i * 2));
+    // Sign extended halves of the 32 bit frames
+    __m512i left = _mm512_srai_epi32(_mm512_slli_epi32(samples, 16), 16);
+    __m512i right = _mm512_srai_epi32(samples, 16);
+    _mm512_storeu_ps(out[0] + i,
+                     _mm512_mul_ps(_mm512_cvtepi32_ps(left), factor));
+    _mm512_storeu_ps(out[1] + i,
+                     _mm512_mul_ps(_mm512_cvtepi32_ps(right), factor));
+  }
+  float* rest[2] = {out[0] + i, out[1] + i};
+  Scalar().deinterleave(in + i * 2, 2, scale, rest, frames - i);
+}
+
+// Packs (x0 + x1) >> 1 of the sample pairs of two registers in their order
+ZAMT_DSP_TARGET __m512i HalvePairSums(__m512i first, __m512i second,
+                                      __m512i weights) {
+  __m512i packed = _mm512_packs_epi32(
+      _mm512_srai_epi32(_mm512_madd_epi16(first, weights), 1),
+      _mm512_srai_epi32(_mm512_madd_epi16(second, weights), 1));
+  // Packing works within the 128 bit lanes
+  const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+  return _mm512_permutexvar_epi64(order, packed);
+}
+
+ZAMT_DSP_TARGET void MidSide(const Sample* stereo, Sample* mid, Sample* side,
+                             int frames) {
+  const __m512i ones = _mm512_set1_epi16(1);
+  // Pairs of 1 and -1 as 16 bit values
+  const __m512i one_minus_one = _mm512_set1_epi32(-65535);
+  int i = 0;
+  for (; i + 32 <= frames; i += 32) {
+    __m512i first = _mm512_loadu_si512((const void*)(stereo + i * 2));
+    __m512i second = _mm512_loadu_si512((const void*)(stereo + i * 2 + 32));
+    _mm512_storeu_si512((void*)(mid + i), HalvePairSums(first, second, ones));
+    _mm512_storeu_si512((void*)(side + i),
+                        HalvePairSums(first, second, one_minus_one));
+  }
+  Scalar().mid_side(stereo + i * 2, mid + i, side + i, frames - i);
+}
+
+ZAMT_DSP_TARGET float Dot(const float* a, const float* b, int count) {
+  __m512 first = _mm512_setzero_ps();
+  __m512 second = _mm512_setzero_ps();
+  int i = 0;
+  for (; i + 32 <= count; i += 32) {
+    first = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i),
+                            first);
+    second = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16),
+                             _mm512_loadu_ps(b + i + 16), second);
+  }
+  for (; i + 16 <= count; i += 16)
+    first = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i),
+                            first);
+  float sum = Sum(_mm512_add_ps(first, second));
+  return sum + Scalar().dot(a + i, b + i, count - i);
+}
+
+ZAMT_DSP_TARGET void ComplexMultiply(const float* a, const float* b,
+                                     float* out, int count) {
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m512 first = _mm512_loadu_ps(a + i * 2);
+    __m512 second = _mm512_loadu_ps(b + i * 2);
+    // (ar * br - ai * bi, ai * br + ar * bi)
+    __m512 swapped = _mm512_permute_ps(first, _MM_SHUFFLE(2, 3, 0, 1));
+    __m512 product = _mm512_fmaddsub_ps(
+        first, _mm512_moveldup_ps(second),
+        _mm512_mul_ps(swapped, _mm512_movehdup_ps(second)));
+    _mm512_storeu_ps(out + i * 2, product);
+  }
+  Scalar().complex_multiply(a + i * 2, b + i * 2, out + i * 2, count - i);
+}
+
+ZAMT_DSP_TARGET void ApplyWindow(const float* in, const float* window,
+                                 float* out, int count) {
+  int i = 0;
+  for (; i + 16 <= count; i += 16)
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(in + i),
+                                            _mm512_loadu_ps(window + i)));
+  Scalar().apply_window(in + i, window + i, out + i, count - i);
+}
+
+ZAMT_DSP_TARGET void MeasureLevels(const Sample* in, int count,
+                                   uint64_t* square_sum, int* peak) {
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i squares = zero;
+  __m512i max_samples = zero;
+  __m512i min_samples = zero;
+  int i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m512i samples = _mm512_loadu_si512((const void*)(in + i));
+    max_samples = _mm512_max_epi16(max_samples, samples);
+    min_samples = _mm512_min_epi16(min_samples, samples);
+    // Two squares of 16 bit values fit into 32 bits only as unsigned
+    __m512i square_pairs = _mm512_madd_epi16(samples, samples);
+    squares =
+        _mm512_add_epi64(squares, _mm512_unpacklo_epi32(square_pairs, zero));
+    squares =
+        _mm512_add_epi64(squares, _mm512_unpackhi_epi32(square_pairs, zero));
+  }
+  alignas(64) int16_t max_lanes[32];
+  alignas(64) int16_t min_lanes[32];
+  alignas(64) uint64_t square_lanes[8];
+  _mm512_store_si512((void*)max_lanes, max_samples);
+  _mm512_store_si512((void*)min_lanes, min_samples);
+  _mm512_store_si512((void*)square_lanes, squares);
+  Scalar().measure_levels(in + i, count - i, square_sum, peak);
+  for (int lane = 0; lane < 8; ++lane) *square_sum += square_lanes[lane];
+  for (int lane = 0; lane < 32; ++lane)
+    *peak = std::max(*peak, std::max((int)max_lanes[lane],
+                                     -(int)min_lanes[lane]));
+}
+
+const zamt_dsp_internal::Kernels kKernels = {
+    ConvertToFloat, Deinterleave, MidSide, Dot, ComplexMultiply, ApplyWindow,
+    MeasureLevels};
+
+}  // namespace
+
+namespace zamt_dsp_internal {
+
+const Kernels* GetAVX512Kernels() { return &kKernels; }
+
+}  // namespace zamt_dsp_internal
+
+#else
+
+namespace zamt_dsp_internal {
+
+const Kernels* GetAVX512Kernels() { return nullptr; }
+
+}  // namespace zamt_dsp_internal
+
+#endif
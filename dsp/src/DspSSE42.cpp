@@ -0,0 +1,173 @@
+#include "zamt/dsp/Dsp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <algorithm>
+
+#include <nmmintrin.h>
+
+#define ZAMT_DSP_TARGET __attribute__((target("sse4.2")))
+
+namespace {
+
+using zamt_dsp_internal::Sample;
+
+// The part not filling a whole register
+const zamt_dsp_internal::Kernels& Scalar() {
+  return *zamt_dsp_internal::GetScalarKernels();
+}
+
+ZAMT_DSP_TARGET float Sum(__m128 v) {
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+ZAMT_DSP_TARGET void ConvertToFloat(const Sample* in, float scale, float* out,
+                                    int count) {
+  const __m128 factor = _mm_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i samples = _mm_loadu_si128((const __m128i*)(in + i));
+    __m128i low = _mm_cvtepi16_epi32(samples);
+    __m128i high = _mm_cvtepi16_epi32(_mm_srli_si128(samples, 8));
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), factor));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), factor));
+  }
+  Scalar().convert_to_float(in + i, scale, out + i, count - i);
+}
+
+ZAMT_DSP_TARGET void Deinterleave(const Sample* in, int channels, float scale,
+                                  float* const* out, int frames) {
+  if (channels == 1) {
+    ConvertToFloat(in, scale, out[0], frames);
+    return;
+  }
+  if (channels != 2) {
+    Scalar().deinterleave(in, channels, scale, out, frames);
+    return;
+  }
+  const __m128 factor = _mm_set1_ps(scale);
+  int i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    __m128i samples = _mm_loadu_si128((const __m128i*)(in + i * 2));
+    // Sign extended halves of the 32 bit frames
+    __m128i left = _mm_srai_epi32(_mm_slli_epi32(samples, 16), 16);
+    __m128i right = _mm_srai_epi32(samples, 16);
+    _mm_storeu_ps(out[0] + i, _mm_mul_ps(_mm_cvtepi32_ps(left), factor));
+    _mm_storeu_ps(out[1] + i, _mm_mul_ps(_mm_cvtepi32_ps(right), factor));
+  }
+  float* rest[2] = {out[0] + i, out[1] + i};
+  Scalar().deinterleave(in + i * 2, 2, scale, rest, frames - i);
+}
+
+ZAMT_DSP_TARGET void MidSide(const Sample* stereo, Sample* mid, Sample* side,
+                             int frames) {
+  const __m128i ones = _mm_set1_epi16(1);
+  // Pairs of 1 and -1 as 16 bit values
+  const __m128i one_minus_one = _mm_set1_epi32(-65535);
+  int i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    __m128i first = _mm_loadu_si128((const __m128i*)(stereo + i * 2));
+    __m128i second = _mm_loadu_si128((const __m128i*)(stereo + i * 2 + 8));
+    __m128i sums =
+        _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(first, ones), 1),
+                        _mm_srai_epi32(_mm_madd_epi16(second, ones), 1));
+    __m128i differences = _mm_packs_epi32(
+        _mm_srai_epi32(_mm_madd_epi16(first, one_minus_one), 1),
+        _mm_srai_epi32(_mm_madd_epi16(second, one_minus_one), 1));
+    _mm_storeu_si128((__m128i*)(mid + i), sums);
+    _mm_storeu_si128((__m128i*)(side + i), differences);
+  }
+  Scalar().mid_side(stereo + i * 2, mid + i, side + i, frames - i);
+}
+
+ZAMT_DSP_TARGET float Dot(const float* a, const float* b, int count) {
+  __m128 first = _mm_setzero_ps();
+  __m128 second = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    first = _mm_add_ps(first,
+                       _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    second = _mm_add_ps(
+        second, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  float sum = Sum(_mm_add_ps(first, second));
+  return sum + Scalar().dot(a + i, b + i, count - i);
+}
+
+ZAMT_DSP_TARGET void ComplexMultiply(const float* a, const float* b,
+                                     float* out, int count) {
+  int i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128 first = _mm_loadu_ps(a + i * 2);
+    __m128 second = _mm_loadu_ps(b + i * 2);
+    // (ar * br - ai * bi, ai * br + ar * bi)
+    __m128 swapped = _mm_shuffle_ps(first, first, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 product =
+        _mm_addsub_ps(_mm_mul_ps(first, _mm_moveldup_ps(second)),
+                      _mm_mul_ps(swapped, _mm_movehdup_ps(second)));
+    _mm_storeu_ps(out + i * 2, product);
+  }
+  Scalar().complex_multiply(a + i * 2, b + i * 2, out + i * 2, count - i);
+}
+
+ZAMT_DSP_TARGET void ApplyWindow(const float* in, const float* window,
+                                 float* out, int count) {
+  int i = 0;
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(out + i,
+                  _mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(window + i)));
+  Scalar().apply_window(in + i, window + i, out + i, count - i);
+}
+
+ZAMT_DSP_TARGET void MeasureLevels(const Sample* in, int count,
+                                   uint64_t* square_sum, int* peak) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i squares = zero;
+  __m128i max_samples = zero;
+  __m128i min_samples = zero;
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i samples = _mm_loadu_si128((const __m128i*)(in + i));
+    max_samples = _mm_max_epi16(max_samples, samples);
+    min_samples = _mm_min_epi16(min_samples, samples);
+    // Two squares of 16 bit values fit into 32 bits only as unsigned
+    __m128i square_pairs = _mm_madd_epi16(samples, samples);
+    squares = _mm_add_epi64(squares, _mm_unpacklo_epi32(square_pairs, zero));
+    squares = _mm_add_epi64(squares, _mm_unpackhi_epi32(square_pairs, zero));
+  }
+  alignas(16) int16_t max_lanes[8];
+  alignas(16) int16_t min_lanes[8];
+  alignas(16) uint64_t square_lanes[2];
+  _mm_store_si128((__m128i*)max_lanes, max_samples);
+  _mm_store_si128((__m128i*)min_lanes, min_samples);
+  _mm_store_si128((__m128i*)square_lanes, squares);
+  Scalar().measure_levels(in + i, count - i, square_sum, peak);
+  *square_sum += square_lanes[0] + square_lanes[1];
+  for (int lane = 0; lane < 8; ++lane)
+    *peak = std::max(*peak, std::max((int)max_lanes[lane],
+                                     -(int)min_lanes[lane]));
+}
+
+const zamt_dsp_internal::Kernels kKernels = {
+    ConvertToFloat, Deinterleave, MidSide, Dot, ComplexMultiply, ApplyWindow,
+    MeasureLevels};
+
+}  // namespace
+
+namespace zamt_dsp_internal {
+
+const Kernels* GetSSE42Kernels() { return &kKernels; }
+
+}  // namespace zamt_dsp_internal
+
+#else
+
+namespace zamt_dsp_internal {
+
+const Kernels* GetSSE42Kernels() { return nullptr; }
+
+}  // namespace zamt_dsp_internal
+
+#endif
@@ -0,0 +1,74 @@
+#include "zamt/dsp/Dsp.h"
+
+#include <algorithm>
+
+namespace {
+
+using zamt_dsp_internal::Sample;
+
+void ConvertToFloat(const Sample* in, float scale, float* out, int count) {
+  for (int i = 0; i < count; ++i) out[i] = (float)in[i] * scale;
+}
+
+void Deinterleave(const Sample* in, int channels, float scale,
+                  float* const* out, int frames) {
+  for (int frame = 0; frame < frames; ++frame)
+    for (int channel = 0; channel < channels; ++channel)
+      out[channel][frame] = (float)in[frame * channels + channel] * scale;
+}
+
+void MidSide(const Sample* stereo, Sample* mid, Sample* side, int frames) {
+  for (int i = 0; i < frames; ++i) {
+    int left = stereo[i * 2];
+    int right = stereo[i * 2 + 1];
+    mid[i] = (Sample)((left + right) >> 1);
+    side[i] = (Sample)((left - right) >> 1);
+  }
+}
+
+float Dot(const float* a, const float* b, int count) {
+  float sum = 0.0f;
+  for (int i = 0; i < count; ++i) sum += a[i] * b[i];
+  return sum;
+}
+
+void ComplexMultiply(const float* a, const float* b, float* out, int count) {
+  for (int i = 0; i < count * 2; i += 2) {
+    float real = a[i] * b[i] - a[i + 1] * b[i + 1];
+    float imaginary = a[i] * b[i + 1] + a[i + 1] * b[i];
+    out[i] = real;
+    out[i + 1] = imaginary;
+  }
+}
+
+void ApplyWindow(const float* in, const float* window, float* out,
+                 int count) {
+  for (int i = 0; i < count; ++i) out[i] = in[i] * window[i];
+}
+
+void MeasureLevels(const Sample* in, int count, uint64_t* square_sum,
+                   int* peak) {
+  uint64_t squares = 0;
+  int max_sample = 0;
+  int min_sample = 0;
+  for (int i = 0; i < count; ++i) {
+    int sample = in[i];
+    squares += (uint64_t)(sample * sample);
+    max_sample = std::max(max_sample, sample);
+    min_sample = std::min(min_sample, sample);
+  }
+  *square_sum = squares;
+  *peak = std::max(max_sample, -min_sample);
+}
+
+const zamt_dsp_internal::Kernels kKernels = {
+    ConvertToFloat, Deinterleave, MidSide, Dot, ComplexMultiply, ApplyWindow,
+    MeasureLevels};
+
+}  // namespace
+
+namespace zamt_dsp_internal {
+
+const Kernels* GetScalarKernels() { return &kKernels; }
+
+}  // namespace zamt_dsp_internal
@@ -0,0 +1,138 @@
+#include "zamt/core/TestSuite.h"
+#include "zamt/dsp/Dsp.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace zamt;
+
+// Odd, so every variant has a scalar tail
+static const int count = 1013;
+
+// Deterministic noise over the whole 16 bit range
+std::vector<Dsp::Sample> MakeSamples(int samples) {
+  std::vector<Dsp::Sample> result;
+  uint32_t state = 12345;
+  for (int i = 0; i < samples; ++i) {
+    state = state * 1103515245u + 12345u;
+    result.push_back((Dsp::Sample)(state >> 16));
+  }
+  // The extremes are special cases
+  result[0] = INT16_MIN;
+  result[1] = INT16_MAX;
+  return result;
+}
+
+std::vector<float> MakeFloats(int floats) {
+  std::vector<Dsp::Sample> samples = MakeSamples(floats);
+  std::vector<float> result;
+  for (Dsp::Sample sample : samples) result.push_back(sample / 32768.0f);
+  return result;
+}
+
+bool IsClose(float value, float expected, float tolerance) {
+  return std::fabs(value - expected) <= tolerance;
+}
+
+void ScalarGivesExactResults() {
+  Dsp scalar(Dsp::Isa::kScalar);
+  EXPECT(scalar.isa() == Dsp::Isa::kScalar);
+  const Dsp::Sample stereo[] = {3, -1, INT16_MIN, INT16_MAX};
+  Dsp::Sample mid[2];
+  Dsp::Sample side[2];
+  scalar.MidSide(stereo, mid, side, 2);
+  EXPECT(mid[0] == 1 && side[0] == 2);
+  EXPECT(mid[1] == -1 && side[1] == INT16_MIN);
+  Dsp::Levels levels = scalar.MeasureLevels(stereo, 4);
+  EXPECT(levels.peak == 32768);
+  EXPECT(levels.square_sum == 9u + 1u + 32768u * 32768u + 32767u * 32767u);
+  const float a[] = {1.0f, 2.0f, 3.0f, -1.0f};
+  const float b[] = {3.0f, -1.0f, 0.5f, 2.0f};
+  float product[4];
+  scalar.ComplexMultiply(a, b, product, 2);
+  EXPECT(product[0] == 5.0f && product[1] == 5.0f);
+  EXPECT(product[2] == 3.5f && product[3] == 5.5f);
+  EXPECT(scalar.Dot(a, b, 4) == 0.5f);
+}
+
+void VariantsMatchScalar(Dsp::Isa isa) {
+  Dsp scalar(Dsp::Isa::kScalar);
+  Dsp dsp(isa);
+  std::vector<Dsp::Sample> samples = MakeSamples(count * 3);
+  std::vector<float> a = MakeFloats(count * 2);
+  std::vector<float> b(a.rbegin(), a.rend());
+  for (int size : {0, 5, count}) {
+    std::vector<float> expected((size_t)count * 2, -1.0f);
+    std::vector<float> output((size_t)count * 2, -1.0f);
+    scalar.ConvertToFloat(&samples[0], 0.5f, &expected[0], size * 2);
+    dsp.ConvertToFloat(&samples[0], 0.5f, &output[0], size * 2);
+    EXPECT(output == expected);
+
+    for (int channels = 1; channels <= 3; ++channels) {
+      std::vector<float> lines[2][3];
+      float* expected_lines[3];
+      float* output_lines[3];
+      for (int channel = 0; channel < channels; ++channel) {
+        lines[0][channel].assign((size_t)size + 1, -1.0f);
+        lines[1][channel].assign((size_t)size + 1, -1.0f);
+        expected_lines[channel] = &lines[0][channel][0];
+        output_lines[channel] = &lines[1][channel][0];
+      }
+      scalar.Deinterleave(&samples[0], channels, 2.0f, expected_lines, size);
+      dsp.Deinterleave(&samples[0], channels, 2.0f, output_lines, size);
+      for (int channel = 0; channel < channels; ++channel)
+        EXPECT(lines[1][channel] == lines[0][channel]);
+    }
+
+    std::vector<Dsp::Sample> mids[2];
+    std::vector<Dsp::Sample> sides[2];
+    for (int i = 0; i < 2; ++i) {
+      mids[i].assign((size_t)size + 1, 0);
+      sides[i].assign((size_t)size + 1, 0);
+    }
+    scalar.MidSide(&samples[0], &mids[0][0], &sides[0][0], size);
+    dsp.MidSide(&samples[0], &mids[1][0], &sides[1][0], size);
+    EXPECT(mids[1] == mids[0]);
+    EXPECT(sides[1] == sides[0]);
+
+    scalar.ApplyWindow(&a[0], &b[0], &expected[0], size);
+    dsp.ApplyWindow(&a[0], &b[0], &output[0], size);
+    EXPECT(output == expected);
+
+    // Fused multiply-adds round differently
+    scalar.ComplexMultiply(&a[0], &b[0], &expected[0], size);
+    dsp.ComplexMultiply(&a[0], &b[0], &output[0], size);
+    for (size_t i = 0; i < output.size(); ++i)
+      EXPECT(IsClose(output[i], expected[i], 1e-6f));
+
+    // The order of the sum differs
+    float dot = dsp.Dot(&a[0], &b[0], size);
+    EXPECT(IsClose(dot, scalar.Dot(&a[0], &b[0], size), 1e-3f));
+
+    Dsp::Levels expected_levels = scalar.MeasureLevels(&samples[0], size);
+    Dsp::Levels levels = dsp.MeasureLevels(&samples[0], size);
+    EXPECT(levels.square_sum == expected_levels.square_sum);
+    EXPECT(levels.peak == expected_levels.peak);
+  }
+}
+
+void BestVariantIsSelected() {
+  EXPECT(Dsp::IsSupported(Dsp::Isa::kScalar));
+  EXPECT(Dsp::IsSupported(Dsp::GetBestIsa()));
+  EXPECT(Dsp::Get().isa() == Dsp::GetBestIsa());
+  EXPECT(&Dsp::Get() == &Dsp::Get());
+}
+
+TEST_BEGIN() {
+  ScalarGivesExactResults();
+  for (Dsp::Isa isa :
+       {Dsp::Isa::kSSE42, Dsp::Isa::kAVX2, Dsp::Isa::kAVX512}) {
+    if (!Dsp::IsSupported(isa)) {
+      printf("%s is not supported, skipped.\n", Dsp::GetIsaName(isa));
+      continue;
+    }
+    VariantsMatchScalar(isa);
+  }
+  BestVariantIsSelected();
+}
+TEST_END()
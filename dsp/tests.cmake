@@ -0,0 +1,11 @@
+set(this_module dsp)
+
+
+set(other_modules
+  core
+)
+
+set(test_cpps
+  DspTest.cpp
+)
+AddTest(DspTest ${this_module} "${other_modules}" "${test_cpps}")
@@ -1,6 +1,7 @@
 # global configuration
 
 set(USE_ADDRESS_SANITIZER ON CACHE BOOL "Use -fsanitize=address for leak checking.")
+set(USE_TRACE OFF CACHE BOOL "Compile in trace points, record them with -trace.")
 
 if(${CMAKE_CXX_COMPILER_ID} STREQUAL "GNU")
   set(CMAKE_AR gcc-ar)
@@ -22,6 +23,9 @@ function(SetupTarget target_name target_modules)
     target_compile_definitions(${target_name} PRIVATE ZAMT_MODULE_${modupper})
   endforeach(mod)
   set_property(TARGET ${target_name} PROPERTY CXX_STANDARD 11)
+  if(USE_TRACE)
+    target_compile_definitions(${target_name} PRIVATE ZAMT_TRACE)
+  endif()
   if(MSVC)
     target_compile_options(${target_name} PRIVATE /W3 /WX)
     target_compile_options(${target_name} PRIVATE $<$<CONFIG:Debug>:/RTC>)
@@ -112,7 +116,7 @@ function(GetLibForTests used_modules)
 endfunction(GetLibForTests)
 
 function(AddTest test_name test_module other_modules test_sources)
-  set(used_modules ${test_module} ${other_nodules})
+  set(used_modules ${test_module} ${other_modules})
   GetLibForTests("${used_modules}")
   unset(cpp_sources)
   foreach(cpp ${test_sources})
@@ -0,0 +1,73 @@
+#ifndef ZAMT_IPC_SHM_SHMEXPORT_H_
+#define ZAMT_IPC_SHM_SHMEXPORT_H_
+
+/// Mirrors Scheduler sources into shared memory for other processes.
+/**
+ * Every exported source gets a ShmRing named by the exporter. The module
+ * subscribes to the source and copies each packet once into the ring in
+ * submission order, then any number of processes can read it from there
+ * without copying (see ShmImport for turning a ring back into a Scheduler
+ * source).
+ * Timestamps are kept as they are, so processes using the wall clock
+ * share the same timebase.
+ */
+
+#include "zamt/core/CLIParameters.h"
+#include "zamt/core/Module.h"
+#include "zamt/core/Scheduler.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+
+namespace zamt {
+
+class Log;
+class ShmRing;
+
+class ShmExport : public Module {
+ public:
+  const static char* kModuleLabel;
+  const static int kDefaultSlots = 64;
+
+  static void DeclareDependencies(ModuleDependencies& dependencies);
+  ShmExport(int argc, const char* const* argv);
+  ~ShmExport();
+  void Initialize(const ModuleCenter* mc);
+  void Shutdown(int exit_code);
+
+  /**
+   * Starts mirroring all packets of a registered source into a new shared
+   * memory ring of the given name (starting with /, kept as a pointer)
+   * having the given number of packet slots. It can be called before this
+   * module is initialized, then exporting starts at initialization.
+   * Returns false if the ring could not be created.
+   */
+  bool ExportSource(Scheduler::SourceId source_id, const char* shm_name,
+                    int slots = kDefaultSlots);
+
+ private:
+  struct Export {
+    Scheduler::SourceId source_id;
+    const char* shm_name;
+    int slots;
+    int subscription_id = -1;
+    std::unique_ptr<ShmRing> ring;
+    uint64_t packets_exported = 0;
+  };
+
+  bool StartExport(Export& exp);
+  void OnPacket(Export* exp, Scheduler::SourceId source_id,
+                const Scheduler::Byte* packet, Scheduler::Time timestamp);
+
+  CLIParameters cli_;
+  std::unique_ptr<Log> log_;
+  const ModuleCenter* mc_ = nullptr;
+  Scheduler* scheduler_ = nullptr;
+  std::atomic<bool> shutdown_initiated_;
+  std::deque<Export> exports_;
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_IPC_SHM_SHMEXPORT_H_
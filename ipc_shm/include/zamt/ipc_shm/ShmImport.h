@@ -0,0 +1,88 @@
+#ifndef ZAMT_IPC_SHM_SHMIMPORT_H_
+#define ZAMT_IPC_SHM_SHMIMPORT_H_
+
+/// Turns shared memory rings of other processes into local Scheduler sources.
+/**
+ * The rings are created by ShmExport in another process. Own thread polls
+ * all imported rings and submits every new packet to the local source.
+ * A ring can be imported from the command line, then its packets appear
+ * on the source named after the ring (see Scheduler::FindSource()).
+ * Packets are polled, so they arrive with kPollIntervalInUs extra latency
+ * at most. A ring recreated by a restarted producer is opened again when
+ * it stays idle for kReplaceCheckIntervalInMs.
+ */
+
+#include "zamt/core/CLIParameters.h"
+#include "zamt/core/Module.h"
+#include "zamt/core/Scheduler.h"
+#include "zamt/ipc_shm/ShmRing.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace zamt {
+
+class Log;
+
+class ShmImport : public Module {
+ public:
+  const static char* kModuleLabel;
+  const static char* kImportParamStr;
+  const static int kDefaultPacketsInQueue = 16;
+  const static int kPollIntervalInUs = 500;
+  const static int kReplaceCheckIntervalInMs = 1000;
+  const static int kMaxSpinCyclesBeforeYield = 256;
+
+  static void DeclareDependencies(ModuleDependencies& dependencies);
+  ShmImport(int argc, const char* const* argv);
+  ~ShmImport();
+  void Initialize(const ModuleCenter* mc);
+  void Shutdown(int exit_code);
+
+  /**
+   * Opens the shared memory ring of the given name and registers a source
+   * with its packet size, named after the ring. Packets written into the
+   * ring from now on are submitted to this source. Returns the ID of the
+   * source or Scheduler::kInvalidSourceId if there is no such ring.
+   * It is a slow operation done in configuration time.
+   */
+  Scheduler::SourceId ImportSource(
+      const char* shm_name, int packets_in_queue = kDefaultPacketsInQueue);
+
+ private:
+  struct Import {
+    Scheduler::SourceId source_id;
+    std::string shm_name;
+    std::unique_ptr<ShmRing> ring;
+    ShmRing::Cursor cursor;  // used only by the import thread after setup
+    uint64_t packets_imported = 0;
+    uint64_t packets_dropped = 0;
+    std::chrono::steady_clock::time_point next_replace_check;
+    uint64_t rejected_epoch = 0;  // a replacement of another packet size
+  };
+
+  void RunImportLoop();
+  bool ImportPackets(Import& imp);
+  void ReopenIfReplaced(Import& imp);
+  static void Lock(std::atomic_flag& mutex);  // yields while it spins
+  static void Unlock(std::atomic_flag& mutex);
+  void PrintHelp();
+
+  CLIParameters cli_;
+  std::unique_ptr<Log> log_;
+  const ModuleCenter* mc_ = nullptr;
+  Scheduler* scheduler_ = nullptr;
+  std::atomic<bool> import_loop_should_run_;
+  std::unique_ptr<std::thread> import_loop_;
+  int shutdown_participant_ = -1;
+  std::deque<Import> imports_;
+  std::atomic_flag imports_mutex_ = ATOMIC_FLAG_INIT;
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_IPC_SHM_SHMIMPORT_H_
@@ -0,0 +1,127 @@
+#ifndef ZAMT_IPC_SHM_SHMRING_H_
+#define ZAMT_IPC_SHM_SHMRING_H_
+
+/// Ring of fixed size packets in POSIX shared memory.
+/**
+ * One producer process writes packets into the ring, any number of consumer
+ * processes can read them without locks. The producer never waits for
+ * consumers: a consumer falling behind more than the ring size loses the
+ * oldest packets. Every slot is protected by a sequence number, a consumer
+ * checks it before and after reading a slot to detect overwrites.
+ * Consumers can read the data in place (zero-copy) between BeginRead() and
+ * EndRead() or copy it out with Read().
+ * A producer always creates a new ring, so consumers still mapping the ring
+ * of a crashed or restarted producer keep their memory. Each ring has its
+ * own epoch, consumers use IsReplaced() to find out when to open it again.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace zamt {
+
+class ShmRing {
+ public:
+  using Byte = uint8_t;
+  using Time = uint64_t;
+
+  /// Consumers keep their own position in the ring.
+  struct Cursor {
+    uint64_t next_packet = 0;
+    uint64_t packets_lost = 0;
+  };
+
+  /**
+   * Producer side: creates the shared memory object (name starts with /).
+   * A leftover object of the same name is unlinked first, it stays mapped
+   * by its consumers until they open the new one.
+   */
+  ShmRing(const char* name, int packet_size, int slots);
+  /// Consumer side: opens an existing shared memory object read-only.
+  ShmRing(const char* name);
+  /**
+   * Producer removes the shared memory object unless it was replaced by a
+   * newer producer, consumers only detach.
+   */
+  ~ShmRing();
+
+  ShmRing(const ShmRing&) = delete;
+  ShmRing(ShmRing&&) = delete;
+  ShmRing& operator=(const ShmRing&) = delete;
+  ShmRing& operator=(ShmRing&&) = delete;
+
+  bool IsOpen() const { return header_ != nullptr; }
+  int packet_size() const { return packet_size_; }
+  int slots() const { return slots_; }
+  /// Differs for every ring created under the same name.
+  uint64_t epoch() const;
+
+  /// Producer gets the memory of the next slot to be filled with data.
+  Byte* BeginWrite();
+  /// Producer publishes the slot got by BeginWrite().
+  void CommitWrite(Time timestamp);
+
+  /// Consumer cursor pointing to the next packet to be written.
+  Cursor GetCursorToNewest() const;
+  /// Returns true if the producer has written the packet the cursor needs.
+  bool HasData(const Cursor& cursor) const;
+  /// False if the cursor is ahead of the producer, then it belongs elsewhere.
+  bool IsValid(const Cursor& cursor) const;
+  /**
+   * Consumer checks if a ring of another epoch took the name over.
+   * It is a slow operation opening the shared memory object again.
+   */
+  bool IsReplaced() const;
+  /**
+   * Consumer gets the next packet in place or nullptr if there is none.
+   * If the consumer lagged behind, the cursor skips the overwritten packets.
+   * The data can only be trusted if EndRead() returns true afterwards.
+   */
+  const Byte* BeginRead(Cursor& cursor, Time& timestamp) const;
+  /// Finishes reading and steps the cursor. False means data was overwritten.
+  bool EndRead(Cursor& cursor) const;
+  /// Copies the next packet into dest, returns false if there is none.
+  bool Read(Cursor& cursor, Byte* dest, Time& timestamp) const;
+
+ private:
+  const static uint32_t kMagic = 0x5a414d54;  // "ZAMT"
+  const static uint32_t kVersion = 2;
+  const static size_t kAlignment = 64;
+
+  struct Header {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    int32_t packet_size;
+    int32_t slots;
+    uint64_t slot_stride;
+    uint64_t epoch;
+    alignas(kAlignment) std::atomic<uint64_t> packets_written;
+  };
+
+  struct SlotHeader {
+    // 2n+1 while packet n is being written, 2n+2 after it is committed
+    std::atomic<uint64_t> sequence;
+    Time timestamp;
+  };
+
+  static size_t GetSlotStride(int packet_size);
+  SlotHeader* GetSlot(uint64_t packet_num) const;
+  static Byte* GetSlotData(SlotHeader* slot);
+  void Map(int fd, size_t size, bool writable);
+  // Epoch of the valid ring having the name or 0 if there is none
+  static uint64_t ReadEpoch(const char* name);
+
+  char name_[256];
+  bool producer_;
+  int packet_size_ = 0;
+  int slots_ = 0;
+  size_t slot_stride_ = 0;
+  size_t mapped_size_ = 0;
+  Header* header_ = nullptr;
+  Byte* slot_area_ = nullptr;
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_IPC_SHM_SHMRING_H_
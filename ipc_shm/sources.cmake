@@ -0,0 +1,15 @@
+set(module_cpps
+  ShmExport.cpp
+  ShmImport.cpp
+  ShmRing.cpp
+)
+
+
+# 3rd party configuration
+
+set(module_includes
+)
+
+set(module_libs
+  rt
+)
@@ -0,0 +1,101 @@
+#include "zamt/ipc_shm/ShmExport.h"
+
+#include "zamt/core/Core.h"
+#include "zamt/core/Log.h"
+#include "zamt/core/ModuleCenter.h"
+#include "zamt/ipc_shm/ShmRing.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace zamt {
+
+const char* ShmExport::kModuleLabel = "ipc_shm_export";
+
+void ShmExport::DeclareDependencies(ModuleDependencies& dependencies) {
+  dependencies.Add<Core>();
+}
+
+ShmExport::ShmExport(int argc, const char* const* argv)
+    : cli_(argc, argv), shutdown_initiated_(false) {
+  log_.reset(new Log(kModuleLabel, cli_));
+}
+
+ShmExport::~ShmExport() {
+  for (Export& exp : exports_) {
+    log_->LogMessage("Packets exported: ", (int)exp.packets_exported);
+  }
+}
+
+void ShmExport::Initialize(const ModuleCenter* mc) {
+  mc_ = mc;
+  if (cli_.HasParam(Core::kHelpParamStr)) return;
+  Core& core = mc_->Get<Core>();
+  core.RegisterForQuitEvent(
+      std::bind(&ShmExport::Shutdown, this, std::placeholders::_1));
+  scheduler_ = &core.scheduler();
+  for (Export& exp : exports_) {
+    StartExport(exp);
+  }
+}
+
+void ShmExport::Shutdown(int /*exit_code*/) {
+  log_->LogMessage("Stopping...");
+  shutdown_initiated_.store(true, std::memory_order_release);
+  assert(scheduler_);
+  for (Export& exp : exports_) {
+    if (exp.ring) scheduler_->Unsubscribe(exp.source_id, exp.subscription_id);
+  }
+}
+
+bool ShmExport::ExportSource(Scheduler::SourceId source_id,
+                             const char* shm_name, int slots) {
+  assert(shm_name);
+  if (shm_name[0] != '/') {
+    log_->LogMessage("Shared memory name should start with /");
+    return false;
+  }
+  exports_.emplace_back();
+  Export& exp = exports_.back();
+  exp.source_id = source_id;
+  exp.shm_name = shm_name;
+  exp.slots = slots;
+  if (!scheduler_) return true;
+  return StartExport(exp);
+}
+
+bool ShmExport::StartExport(Export& exp) {
+  assert(scheduler_ && !exp.ring);
+  int packet_size = scheduler_->GetPacketSize(exp.source_id);
+  std::unique_ptr<ShmRing> ring(
+      new ShmRing(exp.shm_name, packet_size, exp.slots));
+  if (!ring->IsOpen()) {
+    log_->LogMessage("Could not create shared memory:");
+    log_->LogMessage(exp.shm_name);
+    return false;
+  }
+  exp.ring = std::move(ring);
+  // The ring has a single producer and readers expect growing timestamps
+  scheduler_->SubscribeInOrder(
+      exp.source_id,
+      std::bind(&ShmExport::OnPacket, this, &exp, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3),
+      exp.subscription_id);
+  log_->LogMessage("Exporting source to shared memory:");
+  log_->LogMessage(exp.shm_name);
+  return true;
+}
+
+void ShmExport::OnPacket(Export* exp, Scheduler::SourceId source_id,
+                         const Scheduler::Byte* packet,
+                         Scheduler::Time timestamp) {
+  if (!shutdown_initiated_.load(std::memory_order_acquire)) {
+    ShmRing& ring = *exp->ring;
+    memcpy(ring.BeginWrite(), packet, (size_t)ring.packet_size());
+    ring.CommitWrite(timestamp);
+    exp->packets_exported++;
+  }
+  scheduler_->ReleasePacket(source_id, packet);
+}
+
+}  // namespace zamt
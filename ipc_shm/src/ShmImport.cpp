@@ -0,0 +1,185 @@
+#include "zamt/ipc_shm/ShmImport.h"
+
+#include "zamt/core/Core.h"
+#include "zamt/core/Log.h"
+#include "zamt/core/ModuleCenter.h"
+
+#include <cassert>
+#include <chrono>
+
+namespace zamt {
+
+const char* ShmImport::kModuleLabel = "ipc_shm_import";
+const char* ShmImport::kImportParamStr = "-shmin";
+const int ShmImport::kPollIntervalInUs;
+const int ShmImport::kReplaceCheckIntervalInMs;
+const int ShmImport::kMaxSpinCyclesBeforeYield;
+
+void ShmImport::DeclareDependencies(ModuleDependencies& dependencies) {
+  dependencies.Add<Core>();
+}
+
+ShmImport::ShmImport(int argc, const char* const* argv)
+    : cli_(argc, argv), import_loop_should_run_(false) {
+  log_.reset(new Log(kModuleLabel, cli_));
+  if (cli_.HasParam(Core::kHelpParamStr)) {
+    PrintHelp();
+  }
+}
+
+ShmImport::~ShmImport() {
+  if (import_loop_) {
+    import_loop_->join();
+    log_->LogMessage("Import thread stopped.");
+  }
+  for (Import& imp : imports_) {
+    log_->LogMessage("Packets imported: ", (int)imp.packets_imported);
+    log_->LogMessage("Packets dropped: ", (int)imp.packets_dropped);
+  }
+}
+
+void ShmImport::Initialize(const ModuleCenter* mc) {
+  mc_ = mc;
+  if (cli_.HasParam(Core::kHelpParamStr)) return;
+  Core& core = mc_->Get<Core>();
+  core.RegisterForQuitEvent(
+      std::bind(&ShmImport::Shutdown, this, std::placeholders::_1));
+  scheduler_ = &core.scheduler();
+  const char* shm_name = cli_.GetParam(kImportParamStr);
+  if (shm_name && ImportSource(shm_name) == Scheduler::kInvalidSourceId) {
+    core.Quit(Core::kExitCodeIPCProblem);
+  }
+}
+
+void ShmImport::Shutdown(int /*exit_code*/) {
+  log_->LogMessage("Stopping...");
+  import_loop_should_run_.store(false, std::memory_order_release);
+}
+
+Scheduler::SourceId ShmImport::ImportSource(const char* shm_name,
+                                            int packets_in_queue) {
+  assert(scheduler_);
+  if (shm_name[0] != '/') {
+    log_->LogMessage("Shared memory name should start with /");
+    return Scheduler::kInvalidSourceId;
+  }
+  std::unique_ptr<ShmRing> ring(new ShmRing(shm_name));
+  if (!ring->IsOpen()) {
+    log_->LogMessage("Could not open shared memory:");
+    log_->LogMessage(shm_name);
+    return Scheduler::kInvalidSourceId;
+  }
+  Scheduler::SourceId source_id = scheduler_->RegisterSource(
+      shm_name, ring->packet_size(), packets_in_queue);
+  Lock(imports_mutex_);
+  imports_.emplace_back();
+  Import& imp = imports_.back();
+  imp.source_id = source_id;
+  imp.shm_name = shm_name;
+  imp.cursor = ring->GetCursorToNewest();
+  imp.ring = std::move(ring);
+  Unlock(imports_mutex_);
+  log_->LogMessage("Importing source from shared memory:");
+  log_->LogMessage(shm_name);
+  if (!import_loop_) {
+    shutdown_participant_ =
+        mc_->Get<Core>().AddShutdownParticipant(kModuleLabel);
+    import_loop_should_run_.store(true, std::memory_order_release);
+    import_loop_.reset(new std::thread(&ShmImport::RunImportLoop, this));
+  }
+  return source_id;
+}
+
+void ShmImport::RunImportLoop() {
+  log_->LogMessage("Import loop starting up...");
+  while (import_loop_should_run_.load(std::memory_order_acquire)) {
+    bool had_data = false;
+    Lock(imports_mutex_);
+    for (Import& imp : imports_) {
+      if (ImportPackets(imp)) had_data = true;
+    }
+    Unlock(imports_mutex_);
+    if (!had_data) {
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(kPollIntervalInUs));
+    }
+  }
+  log_->LogMessage("Import loop stopping...");
+  mc_->Get<Core>().ReportReadyForShutdown(shutdown_participant_);
+}
+
+bool ShmImport::ImportPackets(Import& imp) {
+  ShmRing::Cursor& cursor = imp.cursor;
+  if (!imp.ring->IsValid(cursor)) {
+    // The producer started counting again, nothing would arrive
+    cursor = imp.ring->GetCursorToNewest();
+  }
+  bool had_data = false;
+  while (imp.ring->HasData(cursor)) {
+    had_data = true;
+    Scheduler::Byte* packet = scheduler_->GetPacketForSubmission(imp.source_id);
+    if (!packet) {
+      // local sinks are too slow, skip what is in the ring now
+      uint64_t newest = imp.ring->GetCursorToNewest().next_packet;
+      imp.packets_dropped += newest - cursor.next_packet;
+      cursor.next_packet = newest;
+      break;
+    }
+    Scheduler::Time timestamp = 0;
+    if (!imp.ring->Read(cursor, packet, timestamp)) {
+      // The producer overwrote the slots while they were read, the cursor
+      // is past them already
+      scheduler_->CancelPacket(imp.source_id, packet);
+      imp.packets_dropped++;
+      break;
+    }
+    scheduler_->SubmitPacket(imp.source_id, packet, timestamp);
+    imp.packets_imported++;
+  }
+  if (!had_data) ReopenIfReplaced(imp);
+  return had_data;
+}
+
+void ShmImport::ReopenIfReplaced(Import& imp) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (now < imp.next_replace_check) return;
+  imp.next_replace_check =
+      now + std::chrono::milliseconds(kReplaceCheckIntervalInMs);
+  if (!imp.ring->IsReplaced()) return;
+  std::unique_ptr<ShmRing> ring(new ShmRing(imp.shm_name.c_str()));
+  if (!ring->IsOpen() || ring->epoch() == imp.rejected_epoch) return;
+  if (ring->packet_size() != imp.ring->packet_size()) {
+    imp.rejected_epoch = ring->epoch();
+    log_->LogMessage("Recreated shared memory has another packet size:");
+    log_->LogMessage(imp.shm_name.c_str());
+    return;
+  }
+  imp.ring = std::move(ring);
+  // Everything the new producer wrote is still to be imported
+  imp.cursor = ShmRing::Cursor();
+  log_->LogMessage("Reopened recreated shared memory:");
+  log_->LogMessage(imp.shm_name.c_str());
+}
+
+void ShmImport::Lock(std::atomic_flag& mutex) {
+  int cycles_left = kMaxSpinCyclesBeforeYield;
+  while (mutex.test_and_set(std::memory_order_acquire)) {
+    if (--cycles_left == 0) {
+      std::this_thread::yield();
+      cycles_left = kMaxSpinCyclesBeforeYield;
+    }
+  }
+}
+
+void ShmImport::Unlock(std::atomic_flag& mutex) {
+  mutex.clear(std::memory_order_release);
+}
+
+void ShmImport::PrintHelp() {
+  Log::Print("ZAMT Shared Memory Import Module");
+  Log::Print(
+      " -shmin/Name    Import packets from shared memory ring /Name"
+      " exported by another process.");
+}
+
+}  // namespace zamt
@@ -0,0 +1,225 @@
+#include "zamt/ipc_shm/ShmRing.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+
+namespace zamt {
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "Atomics in shared memory must be lock-free.");
+
+ShmRing::ShmRing(const char* name, int packet_size, int slots)
+    : producer_(true) {
+  assert(name && name[0] == '/');
+  assert(strlen(name) < sizeof(name_));
+  assert(packet_size > 0 && slots > 1);
+  strcpy(name_, name);
+  packet_size_ = packet_size;
+  slots_ = slots;
+  slot_stride_ = GetSlotStride(packet_size);
+  // Truncating a ring still mapped by consumers would crash them
+  uint64_t epoch = std::max(
+      (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count(),
+      ReadEpoch(name_) + 1);
+  shm_unlink(name_);
+  int fd = shm_open(name_, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) return;
+  size_t size = sizeof(Header) + slot_stride_ * (size_t)slots;
+  if (ftruncate(fd, (off_t)size) != 0) {
+    close(fd);
+    shm_unlink(name_);
+    return;
+  }
+  Map(fd, size, true);
+  close(fd);
+  if (!header_) {
+    shm_unlink(name_);
+    return;
+  }
+  // ftruncate zeroed the memory, so all sequences are 0 (never written)
+  header_->version = kVersion;
+  header_->packet_size = packet_size_;
+  header_->slots = slots_;
+  header_->slot_stride = slot_stride_;
+  header_->epoch = epoch;
+  header_->packets_written.store(0, std::memory_order_relaxed);
+  header_->magic.store(kMagic, std::memory_order_release);
+}
+
+ShmRing::ShmRing(const char* name) : producer_(false) {
+  assert(name && name[0] == '/');
+  assert(strlen(name) < sizeof(name_));
+  strcpy(name_, name);
+  int fd = shm_open(name_, O_RDONLY, 0);
+  if (fd < 0) return;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+    close(fd);
+    return;
+  }
+  Map(fd, (size_t)st.st_size, false);
+  close(fd);
+  if (!header_) return;
+  if (header_->magic.load(std::memory_order_acquire) != kMagic ||
+      header_->version != kVersion ||
+      sizeof(Header) + header_->slot_stride * (size_t)header_->slots >
+          mapped_size_) {
+    munmap(header_, mapped_size_);
+    header_ = nullptr;
+    return;
+  }
+  packet_size_ = header_->packet_size;
+  slots_ = header_->slots;
+  slot_stride_ = header_->slot_stride;
+}
+
+ShmRing::~ShmRing() {
+  if (!header_) return;
+  if (producer_ && ReadEpoch(name_) == header_->epoch) shm_unlink(name_);
+  munmap(header_, mapped_size_);
+}
+
+uint64_t ShmRing::epoch() const {
+  assert(header_);
+  return header_->epoch;
+}
+
+ShmRing::Byte* ShmRing::BeginWrite() {
+  assert(producer_ && header_);
+  uint64_t packet_num =
+      header_->packets_written.load(std::memory_order_relaxed);
+  SlotHeader* slot = GetSlot(packet_num);
+  slot->sequence.store(2 * packet_num + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return GetSlotData(slot);
+}
+
+void ShmRing::CommitWrite(Time timestamp) {
+  assert(producer_ && header_);
+  uint64_t packet_num =
+      header_->packets_written.load(std::memory_order_relaxed);
+  SlotHeader* slot = GetSlot(packet_num);
+  assert(slot->sequence.load(std::memory_order_relaxed) == 2 * packet_num + 1);
+  slot->timestamp = timestamp;
+  slot->sequence.store(2 * packet_num + 2, std::memory_order_release);
+  header_->packets_written.store(packet_num + 1, std::memory_order_release);
+}
+
+ShmRing::Cursor ShmRing::GetCursorToNewest() const {
+  assert(header_);
+  Cursor cursor;
+  cursor.next_packet = header_->packets_written.load(std::memory_order_acquire);
+  return cursor;
+}
+
+bool ShmRing::HasData(const Cursor& cursor) const {
+  assert(header_);
+  return cursor.next_packet <
+         header_->packets_written.load(std::memory_order_acquire);
+}
+
+bool ShmRing::IsValid(const Cursor& cursor) const {
+  assert(header_);
+  return cursor.next_packet <=
+         header_->packets_written.load(std::memory_order_acquire);
+}
+
+bool ShmRing::IsReplaced() const {
+  assert(!producer_ && header_);
+  uint64_t epoch = ReadEpoch(name_);
+  return epoch != 0 && epoch != header_->epoch;
+}
+
+const ShmRing::Byte* ShmRing::BeginRead(Cursor& cursor,
+                                        Time& timestamp) const {
+  assert(header_);
+  uint64_t written = header_->packets_written.load(std::memory_order_acquire);
+  if (cursor.next_packet >= written) return nullptr;
+  if (written - cursor.next_packet > (uint64_t)slots_ - 1) {
+    // The oldest slot may be rewritten at any time, keep a slot of distance
+    uint64_t oldest_safe = written - ((uint64_t)slots_ - 1);
+    cursor.packets_lost += oldest_safe - cursor.next_packet;
+    cursor.next_packet = oldest_safe;
+  }
+  SlotHeader* slot = GetSlot(cursor.next_packet);
+  if (slot->sequence.load(std::memory_order_acquire) !=
+      2 * cursor.next_packet + 2)
+    return nullptr;
+  timestamp = slot->timestamp;
+  return GetSlotData(slot);
+}
+
+bool ShmRing::EndRead(Cursor& cursor) const {
+  assert(header_);
+  SlotHeader* slot = GetSlot(cursor.next_packet);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  bool intact = slot->sequence.load(std::memory_order_relaxed) ==
+                2 * cursor.next_packet + 2;
+  if (!intact) cursor.packets_lost++;
+  cursor.next_packet++;
+  return intact;
+}
+
+bool ShmRing::Read(Cursor& cursor, Byte* dest, Time& timestamp) const {
+  while (HasData(cursor)) {
+    const Byte* data = BeginRead(cursor, timestamp);
+    if (!data) continue;  // slot was overwritten, cursor skips ahead
+    memcpy(dest, data, (size_t)packet_size_);
+    if (EndRead(cursor)) return true;
+  }
+  return false;
+}
+
+size_t ShmRing::GetSlotStride(int packet_size) {
+  size_t stride = sizeof(SlotHeader) + (size_t)packet_size;
+  return (stride + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+ShmRing::SlotHeader* ShmRing::GetSlot(uint64_t packet_num) const {
+  size_t slot_num = (size_t)(packet_num % (uint64_t)slots_);
+  return reinterpret_cast<SlotHeader*>(slot_area_ + slot_num * slot_stride_);
+}
+
+ShmRing::Byte* ShmRing::GetSlotData(SlotHeader* slot) {
+  return reinterpret_cast<Byte*>(slot) + sizeof(SlotHeader);
+}
+
+void ShmRing::Map(int fd, size_t size, bool writable) {
+  int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* mem = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) return;
+  mapped_size_ = size;
+  header_ = static_cast<Header*>(mem);
+  slot_area_ = static_cast<Byte*>(mem) + sizeof(Header);
+}
+
+uint64_t ShmRing::ReadEpoch(const char* name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) return 0;
+  struct stat st;
+  // A ring being created may not have its size yet
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+    close(fd);
+    return 0;
+  }
+  void* mem = mmap(nullptr, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) return 0;
+  const Header* header = static_cast<const Header*>(mem);
+  uint64_t epoch = 0;
+  if (header->magic.load(std::memory_order_acquire) == kMagic &&
+      header->version == kVersion)
+    epoch = header->epoch;
+  munmap(mem, sizeof(Header));
+  return epoch;
+}
+
+}  // namespace zamt
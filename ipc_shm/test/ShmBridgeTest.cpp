@@ -0,0 +1,66 @@
+#include "zamt/core/Core.h"
+#include "zamt/core/ModuleCenter.h"
+#include "zamt/core/Scheduler.h"
+#include "zamt/core/TestSuite.h"
+#include "zamt/ipc_shm/ShmExport.h"
+#include "zamt/ipc_shm/ShmImport.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace zamt;
+
+const char* params[] = {"exec"};
+const int kPacketsToSend = 20;
+static Scheduler::SourceId imported_source;
+
+static std::atomic<int> packets_arrived;
+
+void CheckPacket(Scheduler* sch, Scheduler::SourceId source_id,
+                 const Scheduler::Byte* packet, Scheduler::Time timestamp) {
+  EXPECT(source_id == imported_source);
+  EXPECT(timestamp == (Scheduler::Time)packet[0] * 1000);
+  // Both sides keep the order of submission
+  EXPECT(packet[0] == packets_arrived);
+  packets_arrived++;
+  sch->ReleasePacket(source_id, packet);
+}
+
+void PacketsGoThroughSharedMemory() {
+  packets_arrived = 0;
+  ModuleCenter mc(sizeof(params) / sizeof(char*), params);
+  Core& core = mc.Get<Core>();
+  Core::ReInitExitCode();
+  Scheduler& sch = core.scheduler();
+  Scheduler::SourceId exported_source = sch.RegisterSource("exported", 64, 8);
+  ASSERT(mc.Get<ShmExport>().ExportSource(exported_source,
+                                          "/zamt_shmbridgetest"));
+  imported_source = mc.Get<ShmImport>().ImportSource("/zamt_shmbridgetest");
+  ASSERT(imported_source != Scheduler::kInvalidSourceId);
+  EXPECT(sch.FindSource("/zamt_shmbridgetest") == imported_source);
+  EXPECT(sch.GetPacketSize(imported_source) == 64);
+  int subscription_id;
+  sch.SubscribeInOrder(imported_source,
+                       std::bind(&CheckPacket, &sch, std::placeholders::_1,
+                                 std::placeholders::_2, std::placeholders::_3),
+                       subscription_id);
+  for (int i = 0; i < kPacketsToSend; ++i) {
+    Scheduler::Byte* p = nullptr;
+    while (!p) {
+      p = sch.GetPacketForSubmission(exported_source);
+      std::this_thread::yield();
+    }
+    p[0] = (Scheduler::Byte)i;
+    sch.SubmitPacket(exported_source, p, (Scheduler::Time)i * 1000);
+    // do not overrun the ring, it would drop packets
+    while (packets_arrived < i - 4) std::this_thread::yield();
+  }
+  while (packets_arrived < kPacketsToSend) std::this_thread::yield();
+  core.Quit(0);
+  EXPECT(core.WaitForQuit() == 0);
+}
+
+TEST_BEGIN() {
+  PacketsGoThroughSharedMemory();
+}
+TEST_END()
@@ -0,0 +1,131 @@
+#include "zamt/core/TestSuite.h"
+#include "zamt/ipc_shm/ShmRing.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+using namespace zamt;
+
+const char* kRingName = "/zamt_shmringtest";
+
+void MissingRingIsNotOpen() {
+  ShmRing consumer("/zamt_shmringtest_missing");
+  EXPECT(!consumer.IsOpen());
+}
+
+void ConsumerSeesProducerGeometry() {
+  ShmRing producer(kRingName, 100, 8);
+  ASSERT(producer.IsOpen());
+  ShmRing consumer(kRingName);
+  ASSERT(consumer.IsOpen());
+  EXPECT(consumer.packet_size() == 100);
+  EXPECT(consumer.slots() == 8);
+}
+
+void PacketsArriveInOrder() {
+  ShmRing producer(kRingName, 16, 8);
+  ShmRing consumer(kRingName);
+  ShmRing::Cursor cursor = consumer.GetCursorToNewest();
+  EXPECT(!consumer.HasData(cursor));
+  for (int i = 0; i < 5; ++i) {
+    ShmRing::Byte* data = producer.BeginWrite();
+    memset(data, i, 16);
+    producer.CommitWrite((ShmRing::Time)i * 1000);
+  }
+  ShmRing::Byte packet[16];
+  ShmRing::Time timestamp;
+  for (int i = 0; i < 5; ++i) {
+    ASSERT(consumer.Read(cursor, packet, timestamp));
+    EXPECT(packet[0] == i && packet[15] == i);
+    EXPECT(timestamp == (ShmRing::Time)i * 1000);
+  }
+  EXPECT(!consumer.Read(cursor, packet, timestamp));
+  EXPECT(cursor.packets_lost == 0);
+}
+
+void SlowConsumerLosesOldest() {
+  ShmRing producer(kRingName, 16, 4);
+  ShmRing consumer(kRingName);
+  ShmRing::Cursor cursor = consumer.GetCursorToNewest();
+  for (int i = 0; i < 10; ++i) {
+    producer.BeginWrite()[0] = (ShmRing::Byte)i;
+    producer.CommitWrite((ShmRing::Time)i);
+  }
+  ShmRing::Byte packet[16];
+  ShmRing::Time timestamp;
+  ASSERT(consumer.Read(cursor, packet, timestamp));
+  EXPECT(packet[0] == 7);
+  EXPECT(cursor.packets_lost == 7);
+}
+
+void ReadsInPlace() {
+  ShmRing producer(kRingName, 16, 4);
+  ShmRing consumer(kRingName);
+  ShmRing::Cursor cursor = consumer.GetCursorToNewest();
+  producer.BeginWrite()[0] = 42;
+  producer.CommitWrite(7);
+  ShmRing::Time timestamp;
+  const ShmRing::Byte* data = consumer.BeginRead(cursor, timestamp);
+  ASSERT(data);
+  EXPECT(data[0] == 42 && timestamp == 7);
+  EXPECT(consumer.EndRead(cursor));
+  EXPECT(!consumer.BeginRead(cursor, timestamp));
+}
+
+void MultipleConsumersGetAllPackets() {
+  ShmRing producer(kRingName, 16, 4);
+  ShmRing consumer1(kRingName);
+  ShmRing consumer2(kRingName);
+  ShmRing::Cursor cursor1 = consumer1.GetCursorToNewest();
+  ShmRing::Cursor cursor2 = consumer2.GetCursorToNewest();
+  producer.BeginWrite()[0] = 1;
+  producer.CommitWrite(1);
+  ShmRing::Byte packet[16];
+  ShmRing::Time timestamp;
+  ASSERT(consumer1.Read(cursor1, packet, timestamp));
+  EXPECT(packet[0] == 1);
+  ASSERT(consumer2.Read(cursor2, packet, timestamp));
+  EXPECT(packet[0] == 1);
+}
+
+void RestartedProducerCreatesNewRing() {
+  // The first producer is left behind as if it crashed
+  std::unique_ptr<ShmRing> old_producer(new ShmRing(kRingName, 16, 4));
+  ShmRing old_consumer(kRingName);
+  ShmRing::Cursor cursor = old_consumer.GetCursorToNewest();
+  for (int i = 0; i < 3; ++i) {
+    old_producer->BeginWrite()[0] = (ShmRing::Byte)i;
+    old_producer->CommitWrite((ShmRing::Time)i);
+  }
+  EXPECT(!old_consumer.IsReplaced());
+  ShmRing producer(kRingName, 16, 4);
+  ASSERT(producer.IsOpen());
+  EXPECT(producer.epoch() != old_producer->epoch());
+  EXPECT(old_consumer.IsReplaced());
+  // The old ring is intact for its consumers
+  ShmRing::Byte packet[16];
+  ShmRing::Time timestamp;
+  ASSERT(old_consumer.Read(cursor, packet, timestamp));
+  EXPECT(packet[0] == 0);
+  ShmRing consumer(kRingName);
+  ASSERT(consumer.IsOpen());
+  EXPECT(consumer.epoch() == producer.epoch());
+  EXPECT(!consumer.IsReplaced());
+  EXPECT(!consumer.IsValid(cursor));
+  // The old producer leaves the name to the new one
+  old_producer.reset();
+  ShmRing late_consumer(kRingName);
+  EXPECT(late_consumer.IsOpen());
+}
+
+TEST_BEGIN() {
+  MissingRingIsNotOpen();
+  ConsumerSeesProducerGeometry();
+  PacketsArriveInOrder();
+  SlowConsumerLosesOldest();
+  ReadsInPlace();
+  MultipleConsumersGetAllPackets();
+  RestartedProducerCreatesNewRing();
+}
+TEST_END()
@@ -0,0 +1,16 @@
+set(this_module ipc_shm)
+
+
+set(other_modules
+  core
+)
+
+set(test_cpps
+  ShmRingTest.cpp
+)
+AddTest(ShmRingTest ${this_module} "${other_modules}" "${test_cpps}")
+
+set(test_cpps
+  ShmBridgeTest.cpp
+)
+AddTest(ShmBridgeTest ${this_module} "${other_modules}" "${test_cpps}")
@@ -6,6 +6,9 @@
 /// is also supported so other software generated input can also be used live.
 /// The idea is to test how the system works in a realistic environment.
 /// Own thread is used to interact with audio library for skipless recording.
+/// Several devices can be captured at once, each one is a source of its own
+/// timestamped on the common clock of the Scheduler. Their channels are also
+/// merged into one source, aligned and following the drift of the devices.
 
 #include "zamt/core/CLIParameters.h"
 #include "zamt/core/Module.h"
@@ -16,6 +19,7 @@
 #include <cstdint>
 #include <memory>
 #include <thread>
+#include <vector>
 
 struct pa_proplist;
 struct pa_context;
@@ -26,18 +30,25 @@ struct pa_stream;
 namespace zamt_liveaudio_internal {
 
 void context_notify_callback(pa_context* c, void* userdata);
+void source_list_callback(pa_context* c, const pa_source_info* srci, int eol,
+                          void* userdata);
 void source_info_callback(pa_context* c, const pa_source_info* srci, int eol,
                           void* userdata);
 void stream_notify_callback(pa_stream* p, void* userdata);
 void stream_read_callback(pa_stream* p, size_t nbytes, void* userdata);
+void buffer_attr_callback(pa_stream* p, int success, void* userdata);
 
 }  // namespace zamt_liveaudio_internal
 
 namespace zamt {
 
+class LatencyTuner;
 class Log;
 class RawAudioVisualizer;
+class ResampleStage;
 class Scheduler;
+class SourceMerger;
+class WaveformOverview;
 
 class LiveAudio : public Module {
  public:
@@ -56,13 +67,26 @@ class LiveAudio : public Module {
   const static char* kLatencyParamStr;
   const static char* kSampleRateParamStr;
   const static char* kVisualizeRawAudioStr;
+  const static char* kWaveformOverviewStr;
+  const static char* kExportRawAudioStr;
+  const static char* kDefaultExportName;
+  const static char* kStreamRawAudioStr;
+  const static char* kAutoLatencyParamStr;
+  const static char* kResampleParamStr;
   const static int kChannels = 2;  // stereo
   const static int kMaxLatencyForHardwareBufferInMs = 200;
+  const static int kInitialQueueLatencyInMs = 50;
   const static int kOverallLatencyInMs = 10;
   const static int kDefaultSampleRate = 44100;
+  const static int kReconfigureTimeoutInMs = 100;
+  const static int kMinTunedLatencyInMs = 2;
+  const static int kTuningPeriodInMs = 500;
+  const static int kDriftReportPeriodInMs = 10000;
+  const static int kMaxDevices = 8;
 
   static_assert(sizeof(Sample) * kChannels == sizeof(StereoSample), "");
 
+  static void DeclareDependencies(ModuleDependencies& dependencies);
   LiveAudio(int argc, const char* const* argv);
   ~LiveAudio();
 
@@ -70,16 +94,64 @@ class LiveAudio : public Module {
   void Shutdown(int exit_code);
   bool WasStarted() const { return (bool)audio_loop_; }
   int sample_rate() const { return sample_rate_; }
-  int requested_overall_latency() const { return requested_overall_latency_; }
+
+  /// Devices captured, their sources are named liveaudio_pulse/0, /1...
+  /// in the order of -ad. Sinks of a single device use the first one.
+  int GetDeviceCount() const { return (int)devices_.size(); }
+  Scheduler::SourceId GetDeviceSourceId(int device) const;
+
+  /// The merged source of all devices exists if there are more of them.
+  /// Its frames have the channels of every device in the order of -ad.
+  /// It is named liveaudio_pulse/merged.
+  bool HasMergedSource() const { return (bool)merger_; }
+  Scheduler::SourceId GetMergedSourceId() const;
+
+  /// The first device resampled to the rate given by -ac, if it was given.
+  /// It is named liveaudio_pulse/resampled.
+  bool HasResampledSource() const { return (bool)resample_stage_; }
+  Scheduler::SourceId GetResampledSourceId() const;
+
+  /// The overall latency in effect (in samples). The audio thread changes it
+  /// when latency is tuned, it can be read from any thread.
+  int requested_overall_latency() const {
+    return requested_overall_latency_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Asks for a new overall latency (in samples) without reopening the
+   * stream. It can be called from any thread, the audio thread carries it
+   * out: the hardware buffer is changed on the fly and the packets of the
+   * source get the new size once the sinks released the old ones. Packets
+   * keep their size while they are exported or streamed.
+   */
+  void SetRequestedLatency(int samples);
 
  private:
   const static int kWatchDogSeconds = 3;
   const static int kDefaultDeviceSelected = -1;
-  const static int kDeviceListSelected = -2;
   const static int kUSecPerSampleShift = 8;
 
+  /// One captured PulseAudio source and its Scheduler source.
+  struct Device {
+    LiveAudio* live_audio;
+    int selected;  // index of the PulseAudio source
+    Scheduler::SourceId scheduler_id = Scheduler::kInvalidSourceId;
+    pa_stream* stream = nullptr;
+    int submit_buffer_size = 0;  // stereo samples
+    int hw_fragment_size = 0;    // stereo samples
+    int sample_rate = 0;
+    unsigned int usec_per_sample_shl = 0;
+    Scheduler::Time last_timestamp = 0;  // in microseconds
+    uint64_t captured_samples = 0;
+    int hw_latency_in_us = 0;
+    std::unique_ptr<StereoSample[]> sample_buffer;
+    int sample_buffer_filled = 0;
+  };
+
   friend void zamt_liveaudio_internal::context_notify_callback(pa_context* c,
                                                                void* userdata);
+  friend void zamt_liveaudio_internal::source_list_callback(
+      pa_context* c, const pa_source_info* srci, int eol, void* userdata);
   friend void zamt_liveaudio_internal::source_info_callback(
       pa_context* c, const pa_source_info* srci, int eol, void* userdata);
   friend void zamt_liveaudio_internal::stream_notify_callback(pa_stream* p,
@@ -87,39 +159,51 @@ class LiveAudio : public Module {
   friend void zamt_liveaudio_internal::stream_read_callback(pa_stream* p,
                                                             size_t nbytes,
                                                             void* userdata);
+  friend void zamt_liveaudio_internal::buffer_attr_callback(pa_stream* p,
+                                                            int success,
+                                                            void* userdata);
 
   bool HadNormalOpen() const { return sample_rate_ != 0; }
   void RunMainLoop();
-  void OpenStream(const char* source_name);
-  void ProcessFragment(StereoSample* buffer, int samples);
+  void ParseDevices();
+  void OpenStream(Device& device, const char* source_name);
+  void SetupBufferSizes();
+  int GetQueueCapacity(int latency_in_ms) const;
+  void ApplyLatency(int overall_latency);
+  bool ResizePackets(Device& device);
+  void TuneLatency();
+  void ReportDrift();
+  void ProcessFragment(Device& device, StereoSample* buffer, int samples);
   void PrintHelp();
 
   CLIParameters cli_;
   std::unique_ptr<Log> log_;
   const ModuleCenter* mc_ = nullptr;
   Scheduler* scheduler_ = nullptr;
-  Scheduler::SourceId scheduler_id_;
-  int selected_device_ = kDefaultDeviceSelected;
-  int requested_overall_latency_;
+  bool list_devices_ = false;
+  std::vector<std::unique_ptr<Device>> devices_;  // never moved in memory
+  std::atomic<int> requested_overall_latency_{0};  // audio thread writes
   int requested_sample_rate_ = kDefaultSampleRate;
-  int submit_buffer_size_ = 0;  // stereo samples
-  int hw_fragment_size_ = 0;    // stereo samples
-  int sample_rate_ = 0;
-  unsigned int usec_per_sample_shl_ = 0;
-  Scheduler::Time last_timestamp_ = 0;  // in microseconds
-  int hw_latency_in_us_ = 0;
-
-  StereoSample* sample_buffer_ = nullptr;
-  int sample_buffer_filled_ = 0;
+  int submit_buffer_size_ = 0;  // stereo samples, requested for devices
+  int hw_fragment_size_ = 0;    // stereo samples, requested for devices
+  int sample_rate_ = 0;         // of the first device
+  bool packet_size_fixed_ = false;  // sinks outside the process need it
+  std::atomic<int> pending_latency_;  // 0 if there is no request
+  std::unique_ptr<LatencyTuner> latency_tuner_;
+  int64_t next_tuning_in_us_ = 0;  // steady clock
+  std::unique_ptr<SourceMerger> merger_;
+  int64_t next_drift_report_in_us_ = 0;  // steady clock
+  std::unique_ptr<ResampleStage> resample_stage_;
 
   std::atomic<bool> audio_loop_should_run_;
   std::unique_ptr<std::thread> audio_loop_;
+  int shutdown_participant_ = -1;
   pa_proplist* proplist_ = nullptr;
-  pa_mainloop* mainloop_ = nullptr;
+  pa_mainloop* mainloop_ = nullptr;  // lives until the audio thread joined
   pa_context* context_ = nullptr;
-  pa_stream* stream_ = nullptr;
 
   std::unique_ptr<RawAudioVisualizer> visualizer_;
+  std::unique_ptr<WaveformOverview> waveform_overview_;
 };
 
 }  // namespace zamt
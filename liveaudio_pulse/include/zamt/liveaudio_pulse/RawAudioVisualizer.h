@@ -4,10 +4,12 @@
 #ifdef ZAMT_MODULE_VIS_GTK
 
 #include <atomic>
+#include <cstdint>
 #include <vector>
 
 #include "zamt/core/Scheduler.h"
 #include "zamt/liveaudio_pulse/LiveAudio.h"
+#include "zamt/vis_gtk/RenderSnapshot.h"
 #include "zamt/vis_gtk/Visualization.h"
 
 namespace zamt {
@@ -15,6 +17,12 @@ namespace zamt {
 class ModuleCenter;
 class Visualization;
 
+/// Shows the captured audio and its statistics in a window.
+/**
+ * It is an UI sink of the LiveAudio source, so the capture thread only
+ * submits packets. The state drawn is published to the renderer through
+ * a RenderSnapshot.
+ */
 class RawAudioVisualizer {
  public:
   const static char* kVisualizationTitle;
@@ -22,35 +30,73 @@ class RawAudioVisualizer {
   const static int kVisualizationHeight = 480;
   const static int kVisualizationBufferSize = 512;
 
-  RawAudioVisualizer(const ModuleCenter* mc);
+  /// Subscribes to the registered source, packets can change their size.
+  RawAudioVisualizer(const ModuleCenter* mc, Scheduler::SourceId source_id);
   ~RawAudioVisualizer();
 
-  void Show(LiveAudio::StereoSample* packet, int stereo_samples,
-            Scheduler::Time timestamp);
+  /// Unsubscribes and closes the window. Call it on the quit event.
+  void Stop();
 
  private:
-  void UpdateStatistics(LiveAudio::StereoSample* packet, int stereo_samples,
-                        Scheduler::Time timestamp);
-  void ClearStatistics(int& max_latency_us, int& min_latency_us,
-                       int& avg_latency_us, int& buffers, int& samples,
-                       float& rms_db);
-  void UpdateBuffer(LiveAudio::StereoSample* packet, int stereo_samples);
+  /// State passed to the renderer. Statistics are running totals, the
+  /// renderer shows their change since the previous frame it has drawn.
+  struct Frame {
+    LiveAudio::Sample center[kVisualizationBufferSize];  // oldest first
+    LiveAudio::Sample side[kVisualizationBufferSize];
+    uint64_t buffers;
+    uint64_t samples;
+    int64_t sum_latency_us;
+    double sample_square_sum;
+    // Collected since the renderer acknowledged the previous range
+    int max_latency_us;
+    int min_latency_us;
+    int peak;
+    uint32_t latency_range_num;
+  };
+
+  void OnPacket(Scheduler::SourceId source_id, const Scheduler::Byte* packet,
+                Scheduler::Time timestamp);
+  void UpdateStatistics(int stereo_samples, Scheduler::Time timestamp);
+  void UpdateBuffer(int stereo_samples);
+  void PublishFrame();
+  void TakeStatistics(const Frame& frame);
   void Draw(const Cairo::RefPtr<Cairo::Context>& cctx, int width, int height);
 
   const ModuleCenter* mc_;
-  int window_id_;
+  Scheduler* scheduler_;
+  Scheduler::SourceId source_id_;
+  int subscription_id_ = -1;
+  int window_id_ = -1;
+  RenderSnapshot<Frame> snapshot_;
+  std::atomic<uint32_t> latency_range_shown_;
+
+  // Used by the producer only
+  std::vector<LiveAudio::Sample> packet_center_;  // of the last packet
+  std::vector<LiveAudio::Sample> packet_side_;
   int buffer_position_;
-  std::atomic_flag buffer_mutex_ = ATOMIC_FLAG_INIT;
   std::vector<LiveAudio::Sample> center_buffer_;
   std::vector<LiveAudio::Sample> side_buffer_;
-
-  std::atomic_flag statistics_mutex_ = ATOMIC_FLAG_INIT;
-  int max_latency_us_ = -99999999;
-  int min_latency_us_ = 99999999;
-  int buffers_in_stat_ = 0;
-  int samples_in_stat_ = 0;
+  uint64_t buffers_ = 0;
+  uint64_t samples_ = 0;
   int64_t sum_latency_us_ = 0;
   double sample_square_sum_ = 0.0;
+  int max_latency_us_ = -99999999;
+  int min_latency_us_ = 99999999;
+  int peak_ = 0;
+  uint32_t latency_range_num_ = 0;
+
+  // Used by the renderer only
+  uint64_t previous_buffers_ = 0;
+  uint64_t previous_samples_ = 0;
+  int64_t previous_sum_latency_us_ = 0;
+  double previous_sample_square_sum_ = 0.0;
+  int shown_max_latency_us_ = 0;
+  int shown_min_latency_us_ = 0;
+  int shown_peak_ = 0;
+  int shown_avg_latency_us_ = 0;
+  int shown_buffers_ = 0;
+  int shown_samples_ = 0;
+  float shown_rms_db_ = 0.0f;
 };
 
 }  // namespace zamt
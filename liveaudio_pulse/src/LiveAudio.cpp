@@ -2,10 +2,28 @@
 
 #include "zamt/core/CLIParameters.h"
 #include "zamt/core/Core.h"
+#include "zamt/core/LatencyTuner.h"
 #include "zamt/core/Log.h"
 #include "zamt/core/ModuleCenter.h"
+#include "zamt/core/SourceMerger.h"
+#include "zamt/core/Trace.h"
 #include "zamt/liveaudio_pulse/RawAudioVisualizer.h"
 
+#ifdef ZAMT_MODULE_VIS_GTK
+#include "zamt/vis_gtk/Visualization.h"
+#include "zamt/vis_gtk/WaveformOverview.h"
+#endif
+
+#ifdef ZAMT_MODULE_IPC_SHM
+#include "zamt/ipc_shm/ShmExport.h"
+#endif
+#ifdef ZAMT_MODULE_RESAMPLE
+#include "zamt/resample/ResampleStage.h"
+#endif
+#ifdef ZAMT_MODULE_STREAM_UNIX
+#include "zamt/stream_unix/SocketStreamer.h"
+#endif
+
 #include <pulse/context.h>
 #include <pulse/def.h>
 #include <pulse/error.h>
@@ -16,11 +34,23 @@
 #include <pulse/stream.h>
 #include <pulse/timeval.h>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+namespace {
+
+int64_t GetSteadyTimeInUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
 namespace zamt_liveaudio_internal {
 
 void context_notify_callback(pa_context* c, void* userdata) {
@@ -40,63 +70,72 @@ void context_notify_callback(pa_context* c, void* userdata) {
   if (ctxst == PA_CONTEXT_READY) {
     la->log_->LogMessage("PulseAudio context opened.");
     pa_operation* op = nullptr;
-    if (la->selected_device_ == zamt::LiveAudio::kDeviceListSelected) {
+    if (la->list_devices_) {
       zamt::Log::Print("List of PulseAudio sources:");
-      op = pa_context_get_source_info_list(la->context_, source_info_callback,
+      op = pa_context_get_source_info_list(la->context_, source_list_callback,
                                            la);
       assert(op);
       pa_operation_unref(op);
       la->sample_rate_ = 1;  // fake normal init for normal exit
-    } else if (la->selected_device_ !=
-               zamt::LiveAudio::kDefaultDeviceSelected) {
-      op = pa_context_get_source_info_by_index(la->context_,
-                                               (uint32_t)la->selected_device_,
-                                               source_info_callback, la);
-      assert(op);
-      pa_operation_unref(op);
-    } else {
-      source_info_callback(la->context_, nullptr, 0, la);
+      return;
+    }
+    for (auto& device : la->devices_) {
+      if (device->selected != zamt::LiveAudio::kDefaultDeviceSelected) {
+        op = pa_context_get_source_info_by_index(
+            la->context_, (uint32_t)device->selected, source_info_callback,
+            device.get());
+        assert(op);
+        pa_operation_unref(op);
+      } else {
+        source_info_callback(la->context_, nullptr, 0, device.get());
+      }
     }
   }
 }
 
-void source_info_callback(pa_context* c, const pa_source_info* srci, int eol,
+void source_list_callback(pa_context* c, const pa_source_info* srci, int eol,
                           void* userdata) {
   const int kStrBufLength = 64;
   zamt::LiveAudio* la = (zamt::LiveAudio*)userdata;
   assert(c == la->context_);
   (void)c;
-  if (la->selected_device_ == zamt::LiveAudio::kDeviceListSelected) {
-    if (eol != 0) {
-      zamt::Log::Print("End of PulseAudio sources.");
-      la->audio_loop_should_run_.store(false, std::memory_order_release);
-      pa_mainloop_quit(la->mainloop_, 2);
-      la->mc_->Get<zamt::Core>().Quit(zamt::Core::kExitCodeAudioProblem);
-      return;
-    }
-    assert(srci);
-    char s[kStrBufLength];
-    sprintf(s, "  %d. ", (int)srci->index);
-    strncat(s, srci->description, kStrBufLength - 8);
-    zamt::Log::Print(s);
+  if (eol != 0) {
+    zamt::Log::Print("End of PulseAudio sources.");
+    la->audio_loop_should_run_.store(false, std::memory_order_release);
+    pa_mainloop_quit(la->mainloop_, 2);
+    la->mc_->Get<zamt::Core>().Quit(zamt::Core::kExitCodeAudioProblem);
     return;
   }
-  if (la->stream_) return;  // OpenStream was already called
+  assert(srci);
+  char s[kStrBufLength];
+  sprintf(s, "  %d. ", (int)srci->index);
+  strncat(s, srci->description, kStrBufLength - 8);
+  zamt::Log::Print(s);
+}
+
+void source_info_callback(pa_context* c, const pa_source_info* srci, int eol,
+                          void* userdata) {
+  zamt::LiveAudio::Device* device = (zamt::LiveAudio::Device*)userdata;
+  zamt::LiveAudio* la = device->live_audio;
+  assert(c == la->context_);
+  (void)c;
+  if (device->stream) return;  // OpenStream was already called
   const char* selected_device_name = nullptr;
-  if (la->selected_device_ != zamt::LiveAudio::kDefaultDeviceSelected &&
+  if (device->selected != zamt::LiveAudio::kDefaultDeviceSelected &&
       eol == 0) {
     assert(srci);
     selected_device_name = srci->name;
   }
-  la->OpenStream(selected_device_name);
+  la->OpenStream(*device, selected_device_name);
 }
 
 void stream_notify_callback(pa_stream* p, void* userdata) {
-  zamt::LiveAudio* la = (zamt::LiveAudio*)userdata;
-  assert(p == la->stream_);
+  zamt::LiveAudio::Device* device = (zamt::LiveAudio::Device*)userdata;
+  zamt::LiveAudio* la = device->live_audio;
+  assert(p == device->stream);
   (void)p;
-  if (la->HadNormalOpen()) return;
-  pa_stream_state_t strst = pa_stream_get_state(la->stream_);
+  if (device->sample_rate != 0) return;
+  pa_stream_state_t strst = pa_stream_get_state(device->stream);
   if (strst == PA_STREAM_FAILED || strst == PA_STREAM_TERMINATED) {
     la->log_->LogMessage("PulseAudio stream opening failed.");
     la->audio_loop_should_run_.store(false, std::memory_order_release);
@@ -106,52 +145,76 @@ void stream_notify_callback(pa_stream* p, void* userdata) {
   }
   if (strst == PA_STREAM_READY) {
     la->log_->LogMessage("Stream connected to source:");
-    la->log_->LogMessage(pa_stream_get_device_name(la->stream_));
-    const pa_sample_spec* sample_spec = pa_stream_get_sample_spec(la->stream_);
+    la->log_->LogMessage(pa_stream_get_device_name(device->stream));
+    const pa_sample_spec* sample_spec =
+        pa_stream_get_sample_spec(device->stream);
     assert(sample_spec);
     assert(sample_spec->channels == zamt::LiveAudio::kChannels);
     assert(sample_spec->format == PA_SAMPLE_S16LE);
-    la->sample_rate_ = (int)sample_spec->rate;
-    la->usec_per_sample_shl_ =
+    device->sample_rate = (int)sample_spec->rate;
+    if (device == la->devices_[0].get()) la->sample_rate_ = device->sample_rate;
+    device->usec_per_sample_shl =
         (1000000u << zamt::LiveAudio::kUSecPerSampleShift) /
-        (unsigned)la->sample_rate_;
-    const pa_buffer_attr* buffer_attr = pa_stream_get_buffer_attr(la->stream_);
+        (unsigned)device->sample_rate;
+    const pa_buffer_attr* buffer_attr =
+        pa_stream_get_buffer_attr(device->stream);
     assert(buffer_attr);
-    la->hw_fragment_size_ =
+    device->hw_fragment_size =
         (int)buffer_attr->fragsize / zamt::LiveAudio::kChannels;
-    la->log_->LogMessage("Sample rate: ", la->sample_rate_, "Hz");
+    la->log_->LogMessage("Sample rate: ", device->sample_rate, "Hz");
     la->log_->LogMessage(
         "Total hardware buffer size: ",
         (int)buffer_attr->maxlength / zamt::LiveAudio::kChannels, " samples");
-    la->log_->LogMessage(
-        "Average hardware fragment size: ", la->hw_fragment_size_, " samples");
-    la->hw_latency_in_us_ = 1000000 * la->hw_fragment_size_ / la->sample_rate_;
+    la->log_->LogMessage("Average hardware fragment size: ",
+                         device->hw_fragment_size, " samples");
+    device->hw_latency_in_us =
+        1000000 * device->hw_fragment_size / device->sample_rate;
   }
 }
 
 void stream_read_callback(pa_stream* p, size_t nbytes, void* userdata) {
-  zamt::LiveAudio* la = (zamt::LiveAudio*)userdata;
-  assert(p == la->stream_);
+  zamt::LiveAudio::Device* device = (zamt::LiveAudio::Device*)userdata;
+  assert(p == device->stream);
   (void)p;
   assert(nbytes > 0);
+  ZAMT_TRACE_SCOPE("PulseRead", (int64_t)device->scheduler_id);
   const void* data = nullptr;
   size_t bytes_in_buf = 0;
   int err;
   while (nbytes > 0) {
-    err = pa_stream_peek(la->stream_, &data, &bytes_in_buf);
+    err = pa_stream_peek(device->stream, &data, &bytes_in_buf);
     assert(err == 0);
     nbytes -= bytes_in_buf;
     if (bytes_in_buf == 0) return;
     assert((int)bytes_in_buf % (int)sizeof(zamt::LiveAudio::StereoSample) == 0);
-    la->ProcessFragment(
-        (zamt::LiveAudio::StereoSample*)data,
+    device->live_audio->ProcessFragment(
+        *device, (zamt::LiveAudio::StereoSample*)data,
         (int)bytes_in_buf / (int)sizeof(zamt::LiveAudio::StereoSample));
-    err = pa_stream_drop(la->stream_);
+    err = pa_stream_drop(device->stream);
     assert(err == 0);
   }
   (void)err;
 }
 
+void buffer_attr_callback(pa_stream* p, int success, void* userdata) {
+  zamt::LiveAudio::Device* device = (zamt::LiveAudio::Device*)userdata;
+  zamt::LiveAudio* la = device->live_audio;
+  assert(p == device->stream);
+  (void)p;
+  if (!success) {
+    la->log_->LogMessage("Hardware buffer could not be changed.");
+    return;
+  }
+  const pa_buffer_attr* buffer_attr = pa_stream_get_buffer_attr(device->stream);
+  assert(buffer_attr);
+  device->hw_fragment_size =
+      (int)buffer_attr->fragsize / zamt::LiveAudio::kChannels;
+  device->hw_latency_in_us =
+      1000000 * device->hw_fragment_size / device->sample_rate;
+  la->log_->LogMessage("Average hardware fragment size: ",
+                       device->hw_fragment_size, " samples");
+}
+
 }  // namespace zamt_liveaudio_internal
 
 namespace zamt {
@@ -165,32 +228,45 @@ const char* LiveAudio::kDeviceSelectParamStr = "-ad";
 const char* LiveAudio::kLatencyParamStr = "-at";
 const char* LiveAudio::kSampleRateParamStr = "-ar";
 const char* LiveAudio::kVisualizeRawAudioStr = "-sLiveAudio";
+const char* LiveAudio::kWaveformOverviewStr = "-wLiveAudio";
+const char* LiveAudio::kExportRawAudioStr = "-xLiveAudio";
+const char* LiveAudio::kDefaultExportName = "/zamt_liveaudio";
+const char* LiveAudio::kStreamRawAudioStr = "-uLiveAudio";
+const char* LiveAudio::kAutoLatencyParamStr = "-aa";
+const char* LiveAudio::kResampleParamStr = "-ac";
+
+void LiveAudio::DeclareDependencies(ModuleDependencies& dependencies) {
+  dependencies.Add<Core>();
+#ifdef ZAMT_MODULE_IPC_SHM
+  dependencies.Add<ShmExport>();
+#endif
+#ifdef ZAMT_MODULE_STREAM_UNIX
+  dependencies.Add<SocketStreamer>();
+#endif
+#ifdef ZAMT_MODULE_VIS_GTK
+  dependencies.Add<Visualization>();
+#endif
+}
 
 LiveAudio::LiveAudio(int argc, const char* const* argv)
-    : cli_(argc, argv), audio_loop_should_run_(false) {
+    : cli_(argc, argv), pending_latency_(0), audio_loop_should_run_(false) {
   log_.reset(new Log(kModuleLabel, cli_));
   log_->LogMessage("Starting...");
   if (cli_.HasParam(Core::kHelpParamStr)) {
     PrintHelp();
     return;
   }
-  scheduler_id_ = ModuleCenter::GetId<LiveAudio>();
-  if (cli_.HasParam(kDeviceListParamStr))
-    selected_device_ = kDeviceListSelected;
-  else {
-    int selected_dev = cli_.GetNumParam(kDeviceSelectParamStr);
-    if (selected_dev != CLIParameters::kNotFound)
-      selected_device_ = selected_dev;
-  }
+  list_devices_ = cli_.HasParam(kDeviceListParamStr);
+  ParseDevices();
   int req_sample_rate = cli_.GetNumParam(kSampleRateParamStr);
   if (req_sample_rate != CLIParameters::kNotFound)
     requested_sample_rate_ = req_sample_rate;
   int req_latency = cli_.GetNumParam(kLatencyParamStr);
   if (req_latency != CLIParameters::kNotFound) {
-    requested_overall_latency_ = req_latency;
+    requested_overall_latency_.store(req_latency, std::memory_order_relaxed);
   } else {
     int exact_latency = requested_sample_rate_ * kOverallLatencyInMs / 1000;
-    requested_overall_latency_ = exact_latency;
+    requested_overall_latency_.store(exact_latency, std::memory_order_relaxed);
   }
   audio_loop_should_run_.store(true, std::memory_order_release);
 }
@@ -200,49 +276,152 @@ LiveAudio::~LiveAudio() {
   log_->LogMessage("Waiting for audio thread to stop...");
   audio_loop_->join();
   log_->LogMessage("Audio thread stopped.");
-  if (sample_buffer_) delete[] sample_buffer_;
+  pa_mainloop_free(mainloop_);
+  visualizer_.reset(nullptr);
+  waveform_overview_.reset(nullptr);
+  merger_.reset(nullptr);
+  resample_stage_.reset(nullptr);
+}
+
+Scheduler::SourceId LiveAudio::GetDeviceSourceId(int device) const {
+  assert(device >= 0 && device < GetDeviceCount());
+  return devices_[(size_t)device]->scheduler_id;
+}
+
+Scheduler::SourceId LiveAudio::GetMergedSourceId() const {
+  assert(merger_);
+  return merger_->GetSourceId();
+}
+
+Scheduler::SourceId LiveAudio::GetResampledSourceId() const {
+  assert(resample_stage_);
+  return resample_stage_->GetSourceId();
 }
 
 void LiveAudio::Initialize(const ModuleCenter* mc) {
   mc_ = mc;
   if (!audio_loop_should_run_.load(std::memory_order_acquire)) return;
 
-  // Heuristic to find power of 2 submit buffer size and hw latency so overall
-  // stays below limit and hw buffer is preferably larger
-  log_->LogMessage("Requested overall latency: ", requested_overall_latency_,
-                   " samples");
-  submit_buffer_size_ = 65536;
-  while (submit_buffer_size_ > requested_overall_latency_ >> 1)
-    submit_buffer_size_ >>= 1;
-  hw_fragment_size_ = requested_overall_latency_ - submit_buffer_size_;
-  assert(hw_fragment_size_ >= submit_buffer_size_);
-  log_->LogMessage("Requested hardware latency: ", hw_fragment_size_,
-                   " samples");
-  log_->LogMessage("Submit buffer size: ", submit_buffer_size_, " samples");
-  int queue_capacity = requested_sample_rate_ *
-                           kMaxLatencyForHardwareBufferInMs / 1000 /
-                           submit_buffer_size_ +
-                       1;
+  SetupBufferSizes();
+  if (cli_.HasParam(kAutoLatencyParamStr)) {
+    int min_latency = requested_sample_rate_ * kMinTunedLatencyInMs / 1000;
+    // The hardware buffer should hold at least two fragments
+    int max_latency =
+        requested_sample_rate_ * kMaxLatencyForHardwareBufferInMs / 2 / 1000;
+    int start_latency = std::min(
+        std::max(requested_overall_latency(), min_latency), max_latency);
+    latency_tuner_.reset(
+        new LatencyTuner(min_latency, max_latency, start_latency));
+    log_->LogMessage("Latency is tuned automatically.");
+  }
+  // The queue starts small and grows under load
+  int queue_capacity = GetQueueCapacity(kInitialQueueLatencyInMs);
+  int max_queue_capacity = GetQueueCapacity(kMaxLatencyForHardwareBufferInMs);
   log_->LogMessage("Queue capacity: ", queue_capacity, " packets");
-
-  sample_buffer_ = new StereoSample[submit_buffer_size_];
-  assert(sample_buffer_);
+  log_->LogMessage("Max queue capacity: ", max_queue_capacity, " packets");
 
   Core& core = mc_->Get<Core>();
   core.RegisterForQuitEvent(
       std::bind(&LiveAudio::Shutdown, this, std::placeholders::_1));
   scheduler_ = &core.scheduler();
-  scheduler_->RegisterSource(scheduler_id_,
-                             submit_buffer_size_ * (int)sizeof(StereoSample),
-                             queue_capacity);
+  char source_name[64];
+  for (size_t i = 0; i < devices_.size(); ++i) {
+    Device* device = devices_[i].get();
+    device->submit_buffer_size = submit_buffer_size_;
+    device->sample_buffer.reset(new StereoSample[submit_buffer_size_]);
+    snprintf(source_name, sizeof(source_name), "%s/%d", kModuleLabel, (int)i);
+    // Fresh audio is worth more than audio no sink has started to process
+    device->scheduler_id = scheduler_->RegisterSource(
+        source_name, submit_buffer_size_ * (int)sizeof(StereoSample),
+        queue_capacity, Scheduler::BackpressurePolicy::kOverwriteOldest);
+    scheduler_->SetElasticPool(device->scheduler_id, max_queue_capacity);
+    scheduler_->SetLowWatermarkCallback(
+        device->scheduler_id, 0, [this](Scheduler::SourceId, int) {
+          log_->LogMessage("Queue is full, oldest packets are overwritten!");
+        });
+  }
+  Scheduler::SourceId scheduler_id = devices_[0]->scheduler_id;
+  if (devices_.size() > 1) {
+    std::vector<SourceMerger::Input> inputs;
+    for (auto& device : devices_)
+      inputs.push_back({device->scheduler_id, kChannels});
+    snprintf(source_name, sizeof(source_name), "%s/merged", kModuleLabel);
+    merger_.reset(new SourceMerger(scheduler_, inputs, requested_sample_rate_,
+                                   source_name, submit_buffer_size_,
+                                   max_queue_capacity));
+    log_->LogMessage("Devices merged, channels: ", merger_->GetChannels(), "");
+  }
+#ifdef ZAMT_MODULE_RESAMPLE
+  int resampled_rate = cli_.GetNumParam(kResampleParamStr);
+  if (resampled_rate != CLIParameters::kNotFound && resampled_rate > 0) {
+    snprintf(source_name, sizeof(source_name), "%s/resampled", kModuleLabel);
+    resample_stage_.reset(new ResampleStage(
+        scheduler_, scheduler_id, kChannels, requested_sample_rate_,
+        resampled_rate, source_name,
+        resampled_rate * kOverallLatencyInMs / 1000, max_queue_capacity));
+    log_->LogMessage("Resampled to ", resampled_rate, "Hz");
+  }
+#endif
+#ifdef ZAMT_MODULE_IPC_SHM
+  const char* export_name = cli_.GetParam(kExportRawAudioStr);
+  if (export_name) {
+    if (export_name[0] == '\0') export_name = kDefaultExportName;
+    mc_->Get<ShmExport>().ExportSource(scheduler_id, export_name);
+    packet_size_fixed_ = true;
+  }
+#endif
+#ifdef ZAMT_MODULE_STREAM_UNIX
+  if (cli_.HasParam(kStreamRawAudioStr)) {
+    SocketStreamer& streamer = mc_->Get<SocketStreamer>();
+    streamer.StreamSource(scheduler_id);
+    if (merger_) streamer.StreamSource(GetMergedSourceId());
+    packet_size_fixed_ = true;
+  }
+#endif
+#ifdef ZAMT_MODULE_VIS_GTK
+  if (cli_.HasParam(kVisualizeRawAudioStr)) {
+    visualizer_.reset(new RawAudioVisualizer(mc_, scheduler_id));
+  }
+  if (cli_.HasParam(kWaveformOverviewStr)) {
+    waveform_overview_.reset(new WaveformOverview(mc_, scheduler_id, kChannels,
+                                                  requested_sample_rate_,
+                                                  "Audio In Overview"));
+  }
+#endif
+  shutdown_participant_ = core.AddShutdownParticipant(kModuleLabel);
+  // Created here, so Shutdown() can always wake it up
+  mainloop_ = pa_mainloop_new();
+  assert(mainloop_);
   log_->LogMessage("Launching audio thread...");
   audio_loop_.reset(new std::thread(&LiveAudio::RunMainLoop, this));
 }
 
+void LiveAudio::SetRequestedLatency(int samples) {
+  assert(samples >= 2);
+  if (!WasStarted()) return;
+  pending_latency_.store(samples, std::memory_order_release);
+  pa_mainloop_wakeup(mainloop_);
+}
+
 void LiveAudio::Shutdown(int /*exit_code*/) {
   log_->LogMessage("Stopping...");
   if (!WasStarted()) return;
   audio_loop_should_run_.store(false, std::memory_order_release);
+  // Do not wait for the next audio fragment or the watchdog timeout
+  pa_mainloop_wakeup(mainloop_);
+#ifdef ZAMT_MODULE_VIS_GTK
+  if (visualizer_) visualizer_->Stop();
+  if (waveform_overview_) waveform_overview_->Stop();
+#endif
+  if (merger_) merger_->Stop();
+#ifdef ZAMT_MODULE_RESAMPLE
+  if (resample_stage_) resample_stage_->Stop();
+#endif
+  for (auto& device : devices_) {
+    Scheduler::PoolStats stats = scheduler_->GetPoolStats(device->scheduler_id);
+    log_->LogMessage("Queue high-water mark: ", stats.high_water, " packets");
+    log_->LogMessage("Queue grown: ", stats.grows, " times");
+  }
 }
 
 void LiveAudio::RunMainLoop() {
@@ -255,8 +434,6 @@ void LiveAudio::RunMainLoop() {
   assert(err == 0);
   err = pa_proplist_sets(proplist_, PA_PROP_MEDIA_ROLE, kMediaRole);
   assert(err == 0);
-  mainloop_ = pa_mainloop_new();
-  assert(mainloop_);
   context_ = pa_context_new_with_proplist(pa_mainloop_get_api(mainloop_),
                                           kApplicationName, proplist_);
   assert(context_);
@@ -265,37 +442,64 @@ void LiveAudio::RunMainLoop() {
   err = pa_context_connect(context_, nullptr, PA_CONTEXT_NOFAIL, nullptr);
   assert(err >= 0);
 
-#ifdef ZAMT_MODULE_VIS_GTK
-  if (cli_.HasParam(kVisualizeRawAudioStr)) {
-    visualizer_.reset(new RawAudioVisualizer(mc_));
-  }
-#endif
-
   while (audio_loop_should_run_.load(std::memory_order_acquire)) {
     err = pa_mainloop_prepare(mainloop_, PA_MSEC_PER_SEC * kWatchDogSeconds);
     assert(err >= 0);
     err = pa_mainloop_poll(mainloop_);
     assert(err >= 0);
     pa_mainloop_dispatch(mainloop_);
+    int latency = pending_latency_.exchange(0, std::memory_order_acq_rel);
+    if (latency) ApplyLatency(latency);
+    if (latency_tuner_) TuneLatency();
+    if (merger_) ReportDrift();
   }
 
   log_->LogMessage("Audio mainloop stopping...");
-  visualizer_.reset(nullptr);
 
-  if (stream_) {
-    pa_stream_disconnect(stream_);
-    pa_stream_unref(stream_);
+  for (auto& device : devices_) {
+    if (!device->stream) continue;
+    pa_stream_disconnect(device->stream);
+    pa_stream_unref(device->stream);
   }
   if (context_) {
     pa_context_disconnect(context_);
     pa_context_unref(context_);
   }
-  if (mainloop_) pa_mainloop_free(mainloop_);
   if (proplist_) pa_proplist_free(proplist_);
+  // No more packets are submitted
+  mc_->Get<Core>().ReportReadyForShutdown(shutdown_participant_);
   (void)err;
 }
 
-void LiveAudio::OpenStream(const char* source_name) {
+void LiveAudio::ParseDevices() {
+  // A comma separated list of source numbers, the default device if empty
+  const char* list = cli_.GetParam(kDeviceSelectParamStr);
+  std::vector<int> selected;
+  while (list && *list) {
+    char* end;
+    long index = strtol(list, &end, 10);
+    if (end == list || index < 0 || (*end != ',' && *end != '\0')) {
+      log_->LogMessage("Invalid list of audio sources, default is used.");
+      selected.clear();
+      break;
+    }
+    selected.push_back((int)index);
+    list = *end == ',' ? end + 1 : end;
+  }
+  if (selected.empty()) selected.push_back(kDefaultDeviceSelected);
+  if (selected.size() > (size_t)kMaxDevices) {
+    log_->LogMessage("Audio sources captured at most: ", kMaxDevices, "");
+    selected.resize((size_t)kMaxDevices);
+  }
+  for (int index : selected) {
+    Device* device = new Device();
+    device->live_audio = this;
+    device->selected = index;
+    devices_.emplace_back(device);
+  }
+}
+
+void LiveAudio::OpenStream(Device& device, const char* source_name) {
   log_->LogMessage("Opening source stream...");
   pa_sample_spec sample_spec;
   sample_spec.format = PA_SAMPLE_S16LE;
@@ -305,13 +509,13 @@ void LiveAudio::OpenStream(const char* source_name) {
   // pa_channel_map_init_mono(&channel_map);
   pa_channel_map_init_stereo(&channel_map);
   assert(pa_channel_map_valid(&channel_map));
-  stream_ = pa_stream_new_with_proplist(context_, kApplicationID, &sample_spec,
-                                        &channel_map, proplist_);
-  assert(stream_);
+  device.stream = pa_stream_new_with_proplist(
+      context_, kApplicationID, &sample_spec, &channel_map, proplist_);
+  assert(device.stream);
   pa_stream_set_state_callback(
-      stream_, zamt_liveaudio_internal::stream_notify_callback, this);
+      device.stream, zamt_liveaudio_internal::stream_notify_callback, &device);
   pa_stream_set_read_callback(
-      stream_, zamt_liveaudio_internal::stream_read_callback, this);
+      device.stream, zamt_liveaudio_internal::stream_read_callback, &device);
 
   pa_buffer_attr buffer_attr;
   int hw_buffer_size =
@@ -325,61 +529,186 @@ void LiveAudio::OpenStream(const char* source_name) {
       PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_INTERPOLATE_TIMING |
       PA_STREAM_NOT_MONOTONIC | PA_STREAM_ADJUST_LATENCY);
   int err;
-  err = pa_stream_connect_record(stream_, source_name, &buffer_attr, flags);
+  err =
+      pa_stream_connect_record(device.stream, source_name, &buffer_attr, flags);
   assert(err == 0);
   (void)err;
 }
 
-void LiveAudio::ProcessFragment(StereoSample* buffer, int samples) {
-  Scheduler::Time current_time =
-      (Scheduler::Time)std::chrono::duration_cast<std::chrono::microseconds>(
-          std::chrono::high_resolution_clock::now().time_since_epoch())
-          .count();
-  assert(sample_buffer_);
-  assert(sample_buffer_filled_ >= 0 &&
-         sample_buffer_filled_ < submit_buffer_size_);
+void LiveAudio::SetupBufferSizes() {
+  // Heuristic to find power of 2 submit buffer size and hw latency so overall
+  // stays below limit and hw buffer is preferably larger
+  int overall_latency = requested_overall_latency();
+  log_->LogMessage("Requested overall latency: ", overall_latency, " samples");
+  submit_buffer_size_ = 65536;
+  while (submit_buffer_size_ > overall_latency >> 1) submit_buffer_size_ >>= 1;
+  hw_fragment_size_ = overall_latency - submit_buffer_size_;
+  assert(hw_fragment_size_ >= submit_buffer_size_);
+  log_->LogMessage("Requested hardware latency: ", hw_fragment_size_,
+                   " samples");
+  log_->LogMessage("Submit buffer size: ", submit_buffer_size_, " samples");
+}
+
+int LiveAudio::GetQueueCapacity(int latency_in_ms) const {
+  return requested_sample_rate_ * latency_in_ms / 1000 / submit_buffer_size_ +
+         1;
+}
+
+void LiveAudio::ApplyLatency(int overall_latency) {
+  requested_overall_latency_.store(overall_latency, std::memory_order_relaxed);
+  SetupBufferSizes();
+  for (auto& device_ptr : devices_) {
+    Device& device = *device_ptr;
+    int hw_fragment_size = hw_fragment_size_;
+    if (device.submit_buffer_size != submit_buffer_size_ &&
+        !ResizePackets(device)) {
+      hw_fragment_size = std::max(overall_latency - device.submit_buffer_size,
+                                  device.submit_buffer_size);
+      log_->LogMessage("Requested hardware latency: ", hw_fragment_size,
+                       " samples");
+    }
+    // A stream not opened yet is opened with the new size
+    if (!device.stream || pa_stream_get_state(device.stream) != PA_STREAM_READY)
+      continue;
+    pa_buffer_attr buffer_attr = *pa_stream_get_buffer_attr(device.stream);
+    buffer_attr.fragsize = (uint32_t)hw_fragment_size * kChannels;
+    pa_operation* op = pa_stream_set_buffer_attr(
+        device.stream, &buffer_attr,
+        zamt_liveaudio_internal::buffer_attr_callback, &device);
+    assert(op);
+    pa_operation_unref(op);
+  }
+}
+
+bool LiveAudio::ResizePackets(Device& device) {
+  if (packet_size_fixed_) {
+    log_->LogMessage("Submit buffer size is kept for exported audio.");
+    return false;
+  }
+  // Sinks still working on old packets hold the audio thread up for a
+  // while, the hardware buffer keeps the audio meanwhile
+  if (!scheduler_->ReconfigureSource(
+          device.scheduler_id, submit_buffer_size_ * (int)sizeof(StereoSample),
+          GetQueueCapacity(kInitialQueueLatencyInMs),
+          (Scheduler::Time)kReconfigureTimeoutInMs * 1000)) {
+    log_->LogMessage("Old packets are still in use, size is kept.");
+    return false;
+  }
+  scheduler_->SetElasticPool(
+      device.scheduler_id, GetQueueCapacity(kMaxLatencyForHardwareBufferInMs));
+  // The newest samples collected so far go into the next packet
+  StereoSample* sample_buffer = new StereoSample[submit_buffer_size_];
+  int filled = device.sample_buffer_filled;
+  int kept = std::min(filled, submit_buffer_size_ - 1);
+  if (kept < filled)
+    log_->LogMessage("Samples dropped on reconfiguration: ", filled - kept,
+                     "");
+  memcpy(sample_buffer, device.sample_buffer.get() + filled - kept,
+         (size_t)kept * sizeof(StereoSample));
+  device.sample_buffer.reset(sample_buffer);
+  device.sample_buffer_filled = kept;
+  device.submit_buffer_size = submit_buffer_size_;
+  return true;
+}
+
+void LiveAudio::TuneLatency() {
+  int64_t now = GetSteadyTimeInUs();
+  if (now < next_tuning_in_us_ || !HadNormalOpen()) return;
+  next_tuning_in_us_ = now + (int64_t)kTuningPeriodInMs * 1000;
+  // The load of all devices counts. A device may have kept its old packet
+  // size, so its turnaround is scaled to the requested size: it is measured
+  // against the duration of its own packets.
+  Scheduler::PoolStats stats = Scheduler::PoolStats();
+  for (auto& device : devices_) {
+    Scheduler::PoolStats device_stats =
+        scheduler_->GetPoolStats(device->scheduler_id);
+    stats.drops += device_stats.drops;
+    stats.released += device_stats.released;
+    stats.turnaround_in_us += device_stats.turnaround_in_us *
+                              (Scheduler::Time)submit_buffer_size_ /
+                              (Scheduler::Time)device->submit_buffer_size;
+  }
+  Scheduler::Time packet_duration =
+      Scheduler::SamplesToTime((uint64_t)submit_buffer_size_, sample_rate_);
+  int latency = latency_tuner_->Update(stats, packet_duration);
+  if (latency == requested_overall_latency()) return;
+  log_->LogMessage("Latency tuned to: ", latency, " samples");
+  ApplyLatency(latency);
+}
+
+void LiveAudio::ReportDrift() {
+  int64_t now = GetSteadyTimeInUs();
+  if (next_drift_report_in_us_ == 0)
+    next_drift_report_in_us_ = now + (int64_t)kDriftReportPeriodInMs * 1000;
+  if (now < next_drift_report_in_us_) return;
+  next_drift_report_in_us_ = now + (int64_t)kDriftReportPeriodInMs * 1000;
+  for (size_t i = 1; i < devices_.size(); ++i) {
+    char msg[Log::kMaxMessageLength];
+    snprintf(msg, sizeof(msg),
+             "Clock drift of source %d: %.1f ppm, %d frames corrected",
+             devices_[i]->selected, merger_->GetDriftPpm(i),
+             (int)merger_->GetCorrection(i));
+    log_->LogMessage(msg);
+  }
+}
+
+void LiveAudio::ProcessFragment(Device& device, StereoSample* buffer,
+                                int samples) {
+  assert(scheduler_);
+  Scheduler::Time current_time = scheduler_->GetCurrentTime();
+  assert(device.sample_buffer);
+  assert(device.sample_buffer_filled >= 0 &&
+         device.sample_buffer_filled < device.submit_buffer_size);
   assert(samples > 0);
   if (!audio_loop_should_run_.load(std::memory_order_acquire)) return;
-  pa_usec_t latency;
-  int is_negative;
-  int err = pa_stream_get_latency(stream_, &latency, &is_negative);
-  if (err) {
-    // fake it (this may be the 1st buffer and no timing update was done)
-    assert(hw_latency_in_us_ > 0);
-    latency = (pa_usec_t)hw_latency_in_us_;
-    is_negative = 0;
-  }
   Scheduler::Time buffer_timestamp;
-  if (is_negative)
-    buffer_timestamp = current_time + latency;
-  else
-    buffer_timestamp = current_time - latency;
-  assert(usec_per_sample_shl_ > 0);
+  if (scheduler_->IsVirtualTime()) {
+    // Clock is driven by the number of samples captured so far
+    buffer_timestamp =
+        Scheduler::SamplesToTime(device.captured_samples, device.sample_rate);
+    scheduler_->AdvanceVirtualTime(Scheduler::SamplesToTime(
+        device.captured_samples + (uint64_t)samples, device.sample_rate));
+  } else {
+    pa_usec_t latency;
+    int is_negative;
+    int err = pa_stream_get_latency(device.stream, &latency, &is_negative);
+    if (err) {
+      // fake it (this may be the 1st buffer and no timing update was done)
+      assert(device.hw_latency_in_us > 0);
+      latency = (pa_usec_t)device.hw_latency_in_us;
+      is_negative = 0;
+    }
+    if (is_negative)
+      buffer_timestamp = current_time + latency;
+    else
+      buffer_timestamp = current_time - latency;
+  }
+  device.captured_samples += (uint64_t)samples;
+  assert(device.usec_per_sample_shl > 0);
 
-  assert(scheduler_);
   while (samples > 0) {
-    int free_left_in_buffer = submit_buffer_size_ - sample_buffer_filled_;
+    int free_left_in_buffer =
+        device.submit_buffer_size - device.sample_buffer_filled;
     assert(free_left_in_buffer > 0);
 
     if (samples >= free_left_in_buffer) {
-      StereoSample* packet =
-          (StereoSample*)scheduler_->GetPacketForSubmission(scheduler_id_);
-      assert(packet);
+      StereoSample* packet = (StereoSample*)scheduler_->GetPacketForSubmission(
+          device.scheduler_id);
       if (packet == nullptr) {
-        // drop buffer and signal error
+        // all packets are being processed by sinks, drop buffer
         log_->LogMessage("Buffer overrun, data lost!!!");
         return;
       }
 
-      if (sample_buffer_filled_ > 0) {
-        memcpy(packet, sample_buffer_,
-               (size_t)sample_buffer_filled_ * sizeof(StereoSample));
+      if (device.sample_buffer_filled > 0) {
+        memcpy(packet, device.sample_buffer.get(),
+               (size_t)device.sample_buffer_filled * sizeof(StereoSample));
       }
       if (buffer)
-        memcpy(packet + sample_buffer_filled_, buffer,
+        memcpy(packet + device.sample_buffer_filled, buffer,
                (size_t)free_left_in_buffer * sizeof(StereoSample));
       else
-        memset(packet + sample_buffer_filled_, 0,
+        memset(packet + device.sample_buffer_filled, 0,
                (size_t)free_left_in_buffer * sizeof(StereoSample));
       samples -= free_left_in_buffer;
       assert(samples >= 0);
@@ -387,33 +716,29 @@ void LiveAudio::ProcessFragment(StereoSample* buffer, int samples) {
 
       Scheduler::Time timestamp =
           buffer_timestamp -
-          ((Scheduler::Time)sample_buffer_filled_ * usec_per_sample_shl_ >>
+          ((Scheduler::Time)device.sample_buffer_filled *
+               device.usec_per_sample_shl >>
            kUSecPerSampleShift);
-      if (timestamp <= last_timestamp_) timestamp = last_timestamp_ + 1;
-      last_timestamp_ = timestamp;
-
-#ifdef ZAMT_MODULE_VIS_GTK
-      if (visualizer_) {
-        visualizer_->Show(packet, submit_buffer_size_, timestamp);
-      }
-#endif
+      if (timestamp <= device.last_timestamp)
+        timestamp = device.last_timestamp + 1;
+      device.last_timestamp = timestamp;
 
-      scheduler_->SubmitPacket(scheduler_id_, (Scheduler::Byte*)packet,
+      scheduler_->SubmitPacket(device.scheduler_id, (Scheduler::Byte*)packet,
                                timestamp);
 
       buffer_timestamp +=
-          ((Scheduler::Time)free_left_in_buffer * usec_per_sample_shl_ >>
+          ((Scheduler::Time)free_left_in_buffer * device.usec_per_sample_shl >>
            kUSecPerSampleShift);
-      sample_buffer_filled_ = 0;
+      device.sample_buffer_filled = 0;
     } else {
       if (buffer)
-        memcpy(sample_buffer_ + sample_buffer_filled_, buffer,
+        memcpy(device.sample_buffer.get() + device.sample_buffer_filled, buffer,
                (size_t)samples * sizeof(StereoSample));
       else
-        memset(sample_buffer_ + sample_buffer_filled_, 0,
+        memset(device.sample_buffer.get() + device.sample_buffer_filled, 0,
                (size_t)samples * sizeof(StereoSample));
-      sample_buffer_filled_ += samples;
-      assert(sample_buffer_filled_ < submit_buffer_size_);
+      device.sample_buffer_filled += samples;
+      assert(device.sample_buffer_filled < device.submit_buffer_size);
       break;
     }
   }
@@ -427,13 +752,35 @@ void LiveAudio::PrintHelp() {
   Log::Print(
       " -atNum         Set requested latency to Num samples instead of the"
       " automatic setting putting latency to 10ms.");
+  Log::Print(
+      " -aa            Tune latency automatically to the lowest one the sinks"
+      " can keep up with (starting from -at).");
   Log::Print(" -al            List all available audio sources.");
   Log::Print(
       " -adSrcNumber   Use SrcNumber audio source from the list of sources"
-      " instead of the default one.");
+      " instead of the default one. More sources can be captured at once"
+      " (like -ad1,3), their channels are also merged into one source.");
+#ifdef ZAMT_MODULE_RESAMPLE
+  Log::Print(
+      " -acNum         Resample the first audio source to Num Hz as a source"
+      " of its own (like -ac22050).");
+#endif
 #ifdef ZAMT_MODULE_VIS_GTK
   Log::Print(
       " -sLiveAudio    Show raw audio data coming in from the live input.");
+  Log::Print(
+      " -wLiveAudio    Show the waveform of everything captured from the live"
+      " input.");
+#endif
+#ifdef ZAMT_MODULE_IPC_SHM
+  Log::Print(
+      " -xLiveAudio    Export live input to shared memory /zamt_liveaudio"
+      " (or to the name given after the switch, like -xLiveAudio/name).");
+#endif
+#ifdef ZAMT_MODULE_STREAM_UNIX
+  Log::Print(
+      " -uLiveAudio    Stream live input to the clients of the Unix socket"
+      " given by -us.");
 #endif
 }
 
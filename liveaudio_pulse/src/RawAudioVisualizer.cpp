@@ -2,123 +2,161 @@
 
 #ifdef ZAMT_MODULE_VIS_GTK
 
+#include "zamt/core/Core.h"
 #include "zamt/core/ModuleCenter.h"
+#include "zamt/dsp/Dsp.h"
 
+#include <algorithm>
 #include <cassert>
-#include <chrono>
 #include <cmath>
 
 namespace zamt {
 
 const char* RawAudioVisualizer::kVisualizationTitle = "Audio In";
 
-RawAudioVisualizer::RawAudioVisualizer(const ModuleCenter* mc)
+RawAudioVisualizer::RawAudioVisualizer(const ModuleCenter* mc,
+                                       Scheduler::SourceId source_id)
     : mc_(mc),
+      scheduler_(&mc->Get<Core>().scheduler()),
+      source_id_(source_id),
+      latency_range_shown_(UINT32_MAX),
       center_buffer_(kVisualizationBufferSize, 0),
       side_buffer_(kVisualizationBufferSize, 0) {
   assert(mc_);
   buffer_position_ = 0;
+  PublishFrame();
   Visualization& vis = mc_->Get<Visualization>();
   vis.OpenWindow(kVisualizationTitle, kVisualizationWidth, kVisualizationHeight,
                  window_id_);
+  vis.SetRenderCallback(
+      window_id_,
+      std::bind(&RawAudioVisualizer::Draw, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3));
+  scheduler_->Subscribe(
+      source_id_,
+      std::bind(&RawAudioVisualizer::OnPacket, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3),
+      true, subscription_id_);
 }
 
-RawAudioVisualizer::~RawAudioVisualizer() {
-  assert(mc_);
+RawAudioVisualizer::~RawAudioVisualizer() { assert(subscription_id_ < 0); }
+
+void RawAudioVisualizer::Stop() {
+  if (subscription_id_ < 0) return;
+  scheduler_->Unsubscribe(source_id_, subscription_id_);
+  subscription_id_ = -1;
   Visualization& vis = mc_->Get<Visualization>();
   vis.CloseWindow(window_id_);
 }
 
-void RawAudioVisualizer::Show(LiveAudio::StereoSample* packet,
-                              int stereo_samples, Scheduler::Time timestamp) {
-  UpdateStatistics(packet, stereo_samples, timestamp);
-  UpdateBuffer(packet, stereo_samples);
+void RawAudioVisualizer::OnPacket(Scheduler::SourceId source_id,
+                                  const Scheduler::Byte* packet,
+                                  Scheduler::Time timestamp) {
+  const LiveAudio::StereoSample* samples =
+      (const LiveAudio::StereoSample*)packet;
+  // The source may have been reconfigured since the last packet
+  int stereo_samples = Scheduler::GetSizeOfPacket(packet) /
+                       (int)sizeof(LiveAudio::StereoSample);
+  packet_center_.resize((size_t)stereo_samples);
+  packet_side_.resize((size_t)stereo_samples);
+  Dsp::Get().MidSide((const LiveAudio::Sample*)samples, packet_center_.data(),
+                     packet_side_.data(), stereo_samples);
+  scheduler_->ReleasePacket(source_id, packet);
+  UpdateStatistics(stereo_samples, timestamp);
+  UpdateBuffer(stereo_samples);
+  PublishFrame();
   Visualization& vis = mc_->Get<Visualization>();
-  vis.QueryRender(
-      window_id_,
-      std::bind(&RawAudioVisualizer::Draw, this, std::placeholders::_1,
-                std::placeholders::_2, std::placeholders::_3));
+  vis.QueryRender(window_id_);
 }
 
-void RawAudioVisualizer::UpdateStatistics(LiveAudio::StereoSample* packet,
-                                          int stereo_samples,
+void RawAudioVisualizer::UpdateStatistics(int stereo_samples,
                                           Scheduler::Time timestamp) {
-  while (statistics_mutex_.test_and_set(std::memory_order_acquire))
-    ;
-  buffers_in_stat_++;
-  Scheduler::Time current_time =
-      (Scheduler::Time)std::chrono::duration_cast<std::chrono::microseconds>(
-          std::chrono::high_resolution_clock::now().time_since_epoch())
-          .count();
+  // The renderer has shown the current range, a new one is started
+  if (latency_range_shown_.load(std::memory_order_acquire) ==
+      latency_range_num_) {
+    max_latency_us_ = -99999999;
+    min_latency_us_ = 99999999;
+    peak_ = 0;
+    latency_range_num_++;
+  }
+  buffers_++;
+  // Includes the time spent in the queue of the Scheduler
+  Scheduler::Time current_time = scheduler_->GetCurrentTime();
   int64_t latency = (int64_t)(current_time - timestamp);
   sum_latency_us_ += latency;
   if (latency < (int64_t)min_latency_us_) min_latency_us_ = (int)latency;
   if (latency > (int64_t)max_latency_us_) max_latency_us_ = (int)latency;
-  for (int i = 0; i < stereo_samples; ++i) {
-    int mono_sample = (packet[i].left + packet[i].right) >> 1;
-    sample_square_sum_ += mono_sample * mono_sample;
-    samples_in_stat_++;
-  }
-  statistics_mutex_.clear(std::memory_order_release);
+  Dsp::Levels levels =
+      Dsp::Get().MeasureLevels(packet_center_.data(), stereo_samples);
+  sample_square_sum_ += (double)levels.square_sum;
+  samples_ += (uint64_t)stereo_samples;
+  if (levels.peak > peak_) peak_ = levels.peak;
 }
 
-void RawAudioVisualizer::ClearStatistics(int& max_latency_us,
-                                         int& min_latency_us,
-                                         int& avg_latency_us, int& buffers,
-                                         int& samples, float& rms_db) {
-  while (statistics_mutex_.test_and_set(std::memory_order_acquire))
-    ;
-  max_latency_us = max_latency_us_;
-  max_latency_us_ = -99999999;
-  min_latency_us = min_latency_us_;
-  min_latency_us_ = 99999999;
-  buffers = buffers_in_stat_;
-  buffers_in_stat_ = 0;
-  samples = samples_in_stat_;
-  samples_in_stat_ = 0;
-  avg_latency_us = (int)(sum_latency_us_ / (buffers ? buffers : 1));
-  sum_latency_us_ = 0;
-  rms_db =
-      (float)log10(sqrt(sample_square_sum_ / (samples ? samples : 1))) * 20.0f;
-  sample_square_sum_ = 0.0;
-  statistics_mutex_.clear(std::memory_order_release);
+void RawAudioVisualizer::UpdateBuffer(int stereo_samples) {
+  // Only the newest ones stay in the buffer
+  int first = std::max(stereo_samples - kVisualizationBufferSize, 0);
+  for (int i = first; i < stereo_samples; ++i) {
+    center_buffer_[(size_t)buffer_position_] = packet_center_[(size_t)i];
+    side_buffer_[(size_t)buffer_position_] = packet_side_[(size_t)i];
+    if (++buffer_position_ >= kVisualizationBufferSize) buffer_position_ = 0;
+  }
 }
 
-void RawAudioVisualizer::UpdateBuffer(LiveAudio::StereoSample* packet,
-                                      int stereo_samples) {
-  while (buffer_mutex_.test_and_set(std::memory_order_acquire))
-    ;
-  for (int i = 0; i < stereo_samples; ++i) {
-    LiveAudio::Sample center =
-        (LiveAudio::Sample)((packet[i].left + packet[i].right) >> 1);
-    LiveAudio::Sample side =
-        (LiveAudio::Sample)((packet[i].left - packet[i].right) >> 1);
-    center_buffer_[(size_t)buffer_position_] = center;
-    side_buffer_[(size_t)buffer_position_] = side;
-    if (++buffer_position_ >= kVisualizationBufferSize) buffer_position_ = 0;
+void RawAudioVisualizer::PublishFrame() {
+  Frame& frame = snapshot_.GetBackBuffer();
+  int pos = buffer_position_;
+  for (int i = 0; i < kVisualizationBufferSize; ++i) {
+    frame.center[i] = center_buffer_[(size_t)pos];
+    frame.side[i] = side_buffer_[(size_t)pos];
+    if (++pos >= kVisualizationBufferSize) pos = 0;
   }
-  buffer_mutex_.clear(std::memory_order_release);
+  frame.buffers = buffers_;
+  frame.samples = samples_;
+  frame.sum_latency_us = sum_latency_us_;
+  frame.sample_square_sum = sample_square_sum_;
+  frame.max_latency_us = max_latency_us_;
+  frame.min_latency_us = min_latency_us_;
+  frame.peak = peak_;
+  frame.latency_range_num = latency_range_num_;
+  snapshot_.Publish();
+}
+
+void RawAudioVisualizer::TakeStatistics(const Frame& frame) {
+  int buffers = (int)(frame.buffers - previous_buffers_);
+  int samples = (int)(frame.samples - previous_samples_);
+  int64_t sum_latency_us = frame.sum_latency_us - previous_sum_latency_us_;
+  double sample_square_sum =
+      frame.sample_square_sum - previous_sample_square_sum_;
+  previous_buffers_ = frame.buffers;
+  previous_samples_ = frame.samples;
+  previous_sum_latency_us_ = frame.sum_latency_us;
+  previous_sample_square_sum_ = frame.sample_square_sum;
+  shown_max_latency_us_ = frame.max_latency_us;
+  shown_min_latency_us_ = frame.min_latency_us;
+  shown_peak_ = frame.peak;
+  shown_avg_latency_us_ = (int)(sum_latency_us / (buffers ? buffers : 1));
+  shown_buffers_ = buffers;
+  shown_samples_ = samples;
+  shown_rms_db_ =
+      (float)log10(sqrt(sample_square_sum / (samples ? samples : 1))) * 20.0f;
+  latency_range_shown_.store(frame.latency_range_num,
+                             std::memory_order_release);
 }
 
 void RawAudioVisualizer::Draw(const Cairo::RefPtr<Cairo::Context>& cctx,
                               int width, int height) {
+  // Redraws without a new frame show the previous statistics
+  if (snapshot_.Acquire()) TakeStatistics(snapshot_.GetFrontBuffer());
+  const Frame& frame = snapshot_.GetFrontBuffer();
   float middle = (float)(height >> 1);
   float value_coef = (float)height / 65536.0f;
   float center[kVisualizationBufferSize];
   float side[kVisualizationBufferSize];
-  while (buffer_mutex_.test_and_set(std::memory_order_acquire))
-    ;
-  int pos = buffer_position_;
   for (int i = 0; i < kVisualizationBufferSize; ++i) {
-    center[(size_t)i] = middle + center_buffer_[(size_t)pos] * value_coef;
-    side[(size_t)i] = middle + side_buffer_[(size_t)pos] * value_coef;
-    if (++pos >= kVisualizationBufferSize) pos = 0;
+    center[(size_t)i] = middle + frame.center[i] * value_coef;
+    side[(size_t)i] = middle + frame.side[i] * value_coef;
   }
-  buffer_mutex_.clear(std::memory_order_release);
-
-  int max_latency, min_latency, avg_latency, buffers, samples;
-  float rms;
-  ClearStatistics(max_latency, min_latency, avg_latency, buffers, samples, rms);
 
   cctx->save();
   cctx->set_source_rgb(0.0, 0.0, 0.0);
@@ -142,31 +180,34 @@ void RawAudioVisualizer::Draw(const Cairo::RefPtr<Cairo::Context>& cctx,
     cctx->line_to(x, center[(size_t)i]);
   cctx->stroke();
 
-  float rms_bar = rms / 100 * (float)(height >> 1);
+  float rms_bar = shown_rms_db_ / 100 * (float)(height >> 1);
   cctx->set_source_rgba(1.0, 1.0, 0.0, 0.75);
   cctx->rectangle(4, middle - rms_bar, 40, rms_bar * 2);
   cctx->fill();
 
   char str[128];
   cctx->set_source_rgb(0.0, 1.0, 0.0);
-  sprintf(str, "Min latency %.3f ms", min_latency / 1000.0);
+  sprintf(str, "Min latency %.3f ms", shown_min_latency_us_ / 1000.0);
   cctx->move_to(64, 20);
   cctx->show_text(str);
-  sprintf(str, "Max latency %.3f ms", max_latency / 1000.0);
+  sprintf(str, "Max latency %.3f ms", shown_max_latency_us_ / 1000.0);
   cctx->move_to(64, 40);
   cctx->show_text(str);
-  sprintf(str, "Avg latency %.3f ms", avg_latency / 1000.0);
+  sprintf(str, "Avg latency %.3f ms", shown_avg_latency_us_ / 1000.0);
   cctx->move_to(64, 60);
   cctx->show_text(str);
-  sprintf(str, "Buffers %d", buffers);
+  sprintf(str, "Buffers %d", shown_buffers_);
   cctx->move_to(64, 80);
   cctx->show_text(str);
-  sprintf(str, "Samples %d", samples);
+  sprintf(str, "Samples %d", shown_samples_);
   cctx->move_to(64, 100);
   cctx->show_text(str);
-  sprintf(str, "SPL %.2f db", (double)rms);
+  sprintf(str, "SPL %.2f db", (double)shown_rms_db_);
   cctx->move_to(64, 120);
   cctx->show_text(str);
+  sprintf(str, "Peak %.2f db", log10(shown_peak_ ? shown_peak_ : 1) * 20.0);
+  cctx->move_to(64, 140);
+  cctx->show_text(str);
 
   cctx->restore();
 }
@@ -0,0 +1,78 @@
+#ifndef ZAMT_RESAMPLE_RESAMPLESTAGE_H_
+#define ZAMT_RESAMPLE_RESAMPLESTAGE_H_
+
+/// Resamples a source of audio into a new source of another sample rate.
+/**
+ * The stage is a sink of packets of interleaved 16 bit frames and the
+ * source of the same channels at the output rate, so analysis can work on
+ * a canonical rate whatever rate the capture negotiated. Packets of the
+ * input can have any size, output packets have a fixed number of frames.
+ * An output packet is timestamped with the time its first frame belongs
+ * to, interpolated from the timestamps of the input packets.
+ * The output lags the input by the lookahead of the Resampler.
+ */
+
+#include "zamt/core/Scheduler.h"
+#include "zamt/resample/Resampler.h"
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace zamt {
+
+class ResampleStage {
+ public:
+  using Sample = Resampler::Sample;
+
+  /**
+   * Registers the output source of the given name with packets of the given
+   * number of frames and subscribes to the input, which has to be
+   * registered already.
+   * It is a slow operation done in configuration time.
+   */
+  ResampleStage(Scheduler* scheduler, Scheduler::SourceId input_id,
+                int channels, int in_rate, int out_rate, const char* name,
+                int frames_per_packet, int packets_in_queue);
+  ~ResampleStage();
+
+  /// Unsubscribes from the input. Call it on the quit event.
+  void Stop();
+
+  /// The source publishing the resampled frames.
+  Scheduler::SourceId GetSourceId() const { return output_id_; }
+
+  int GetOutputRate() const { return out_rate_; }
+
+  /// Tells which Dsp variants the resampler runs on.
+  Dsp::Isa GetIsa();
+
+ private:
+  void OnPacket(Scheduler::SourceId source_id, const Scheduler::Byte* packet,
+                Scheduler::Time timestamp);
+  Scheduler::Time GetOutputTime(int64_t output_frame);
+  bool EmitPacket();
+
+  Scheduler* scheduler_;
+  const Scheduler::SourceId input_id_;
+  Scheduler::SourceId output_id_;
+  const int channels_;
+  const int in_rate_;
+  const int out_rate_;
+  const int frames_per_packet_;
+  int subscription_id_ = -1;
+  std::mutex mutex_;  // packets are processed by different workers
+  Resampler resampler_;
+  std::vector<Sample> buffer_;  // interleaved output frames from head on
+  size_t head_ = 0;             // in samples
+  int64_t input_frames_ = 0;
+  int64_t emitted_frames_ = 0;
+  // (first frame, timestamp) of the input packets still needed for timing
+  std::deque<std::pair<int64_t, Scheduler::Time>> packet_times_;
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_RESAMPLE_RESAMPLESTAGE_H_
@@ -0,0 +1,88 @@
+#ifndef ZAMT_RESAMPLE_RESAMPLER_H_
+#define ZAMT_RESAMPLE_RESAMPLER_H_
+
+/// Converts interleaved 16 bit audio between sample rates of rational ratio.
+/**
+ * The ratio out_rate / in_rate is reduced to L / M: input is conceptually
+ * upsampled by L, lowpass filtered and decimated by M. Only the output
+ * samples are computed, each one is a dot product of the last input
+ * samples with one of the L phases of a precomputed polyphase filter bank
+ * (a Kaiser windowed sinc cutting at 90% of the lower Nyquist rate).
+ *
+ * The state is kept between calls, so a stream can be processed in
+ * packets of any size, giving the same output as processing it at once.
+ * Output frame t belongs to input time t * M / L exactly: the delay of the
+ * filter is compensated by holding back GetLookahead() input frames.
+ *
+ * The dot products run on the Dsp variants of the CPU by default.
+ */
+
+#include "zamt/dsp/Dsp.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace zamt {
+
+class Resampler {
+ public:
+  using Sample = Dsp::Sample;
+
+  const static int kZeroCrossings = 16;  // of the sinc on each side
+  const static int kMaxPhases = 4096;
+  const static int kTapAlignment = 16;  // a whole AVX-512 register of floats
+
+  /**
+   * Builds the filter bank for the given rates, its size is L * taps
+   * floats. The reduced L has to be at most kMaxPhases.
+   * It is a slow operation done in configuration time.
+   */
+  Resampler(int channels, int in_rate, int out_rate);
+
+  int GetChannels() const { return channels_; }
+  int GetInterpolation() const { return interpolation_; }  // L
+  int GetDecimation() const { return decimation_; }        // M
+  int GetTapsPerPhase() const { return taps_; }
+  /// Input frames needed after the time of an output frame.
+  int GetLookahead() const { return lookahead_; }
+
+  /// The instruction set has to be supported by the CPU.
+  void SetIsa(Dsp::Isa isa) { dsp_ = Dsp(isa); }
+  Dsp::Isa GetIsa() const { return dsp_.isa(); }
+
+  /**
+   * Consumes the given interleaved frames and appends the output frames
+   * which became computable to the end of output. Returns their number.
+   */
+  int Process(const Sample* frames, int frame_count,
+              std::vector<Sample>& output);
+
+  /// Forgets the stream, the next frame processed is the first one again.
+  void Reset();
+
+  /// Frames produced since the first one.
+  int64_t GetOutputFrames() const { return output_frames_; }
+
+ private:
+  void BuildFilterBank();
+
+  const int channels_;
+  int interpolation_;
+  int decimation_;
+  int taps_;
+  int lookahead_;
+  Dsp dsp_;
+  // Phase after phase, each one reversed to match the order of samples
+  std::vector<float> coefs_;
+  // Samples of every channel from line_start_ on, in the order of time
+  std::vector<std::vector<float>> lines_;
+  std::vector<float*> line_ends_;  // where the lines are appended
+  int64_t line_start_;   // input frame of the first sample of the lines
+  int64_t next_input_;   // newest input frame of the next output frame
+  int phase_;            // filter phase of the next output frame
+  int64_t output_frames_;
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_RESAMPLE_RESAMPLER_H_
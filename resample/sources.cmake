@@ -0,0 +1,13 @@
+set(module_cpps
+  Resampler.cpp
+  ResampleStage.cpp
+)
+
+
+# 3rd party configuration
+
+set(module_includes
+)
+
+set(module_libs
+)
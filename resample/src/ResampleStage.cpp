@@ -0,0 +1,92 @@
+#include "zamt/resample/ResampleStage.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace zamt {
+
+ResampleStage::ResampleStage(Scheduler* scheduler,
+                             Scheduler::SourceId input_id, int channels,
+                             int in_rate, int out_rate, const char* name,
+                             int frames_per_packet, int packets_in_queue)
+    : scheduler_(scheduler),
+      input_id_(input_id),
+      channels_(channels),
+      in_rate_(in_rate),
+      out_rate_(out_rate),
+      frames_per_packet_(frames_per_packet),
+      resampler_(channels, in_rate, out_rate) {
+  assert(scheduler_ && frames_per_packet_ > 0);
+  output_id_ = scheduler_->RegisterSource(
+      name, frames_per_packet_ * channels_ * (int)sizeof(Sample),
+      packets_in_queue);
+  // The filter state carries over from one packet to the next
+  scheduler_->SubscribeInOrder(
+      input_id_,
+      std::bind(&ResampleStage::OnPacket, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3),
+      subscription_id_);
+}
+
+ResampleStage::~ResampleStage() { assert(subscription_id_ < 0); }
+
+void ResampleStage::Stop() {
+  if (subscription_id_ < 0) return;
+  scheduler_->Unsubscribe(input_id_, subscription_id_);
+  subscription_id_ = -1;
+}
+
+Dsp::Isa ResampleStage::GetIsa() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return resampler_.GetIsa();
+}
+
+void ResampleStage::OnPacket(Scheduler::SourceId source_id,
+                             const Scheduler::Byte* packet,
+                             Scheduler::Time timestamp) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int frames = Scheduler::GetSizeOfPacket(packet) /
+               (channels_ * (int)sizeof(Sample));
+  packet_times_.emplace_back(input_frames_, timestamp);
+  input_frames_ += frames;
+  // The consumed part is given back once it is the bigger part
+  if (head_ > buffer_.size() / 2) {
+    buffer_.erase(buffer_.begin(), buffer_.begin() + (ptrdiff_t)head_);
+    head_ = 0;
+  }
+  resampler_.Process((const Sample*)packet, frames, buffer_);
+  scheduler_->ReleasePacket(source_id, packet);
+  while (EmitPacket()) {
+  }
+}
+
+Scheduler::Time ResampleStage::GetOutputTime(int64_t output_frame) {
+  // Output frame n is at input frame n * M / L, counted in 1/L frames here
+  int64_t interpolation = resampler_.GetInterpolation();
+  int64_t position = output_frame * resampler_.GetDecimation();
+  while (packet_times_.size() > 1 &&
+         packet_times_[1].first * interpolation <= position)
+    packet_times_.pop_front();
+  assert(!packet_times_.empty());
+  const std::pair<int64_t, Scheduler::Time>& packet = packet_times_.front();
+  double offset = (double)(position - packet.first * interpolation) *
+                  1000000.0 / ((double)interpolation * in_rate_);
+  return packet.second + (Scheduler::Time)offset;
+}
+
+bool ResampleStage::EmitPacket() {
+  size_t packet_samples = (size_t)frames_per_packet_ * (size_t)channels_;
+  if (buffer_.size() - head_ < packet_samples) return false;
+  Scheduler::Time timestamp = GetOutputTime(emitted_frames_);
+  Scheduler::Byte* packet = scheduler_->GetPacketForSubmission(output_id_);
+  // A lost output packet still moves the stream on
+  if (packet) {
+    memcpy(packet, &buffer_[head_], packet_samples * sizeof(Sample));
+    scheduler_->SubmitPacket(output_id_, packet, timestamp);
+  }
+  head_ += packet_samples;
+  emitted_frames_ += frames_per_packet_;
+  return true;
+}
+
+}  // namespace zamt
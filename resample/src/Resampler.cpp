@@ -0,0 +1,140 @@
+#include "zamt/resample/Resampler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace {
+
+const double kCutoff = 0.9;  // of the lower Nyquist rate
+const double kKaiserBeta = 8.0;
+const double kPi = 3.14159265358979323846;
+
+int GreatestCommonDivisor(int a, int b) {
+  while (b != 0) {
+    int rest = a % b;
+    a = b;
+    b = rest;
+  }
+  return a;
+}
+
+// Modified Bessel function of the first kind, order 0
+double BesselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; term > sum * 1e-12; ++k) {
+    double factor = x / (2.0 * k);
+    term *= factor * factor;
+    sum += term;
+  }
+  return sum;
+}
+
+zamt::Resampler::Sample ToSample(float value) {
+  long rounded = lrintf(value);
+  if (rounded > INT16_MAX) rounded = INT16_MAX;
+  if (rounded < INT16_MIN) rounded = INT16_MIN;
+  return (zamt::Resampler::Sample)rounded;
+}
+
+}  // namespace
+
+namespace zamt {
+
+Resampler::Resampler(int channels, int in_rate, int out_rate)
+    : channels_(channels), dsp_(Dsp::Get()) {
+  assert(channels_ > 0 && in_rate > 0 && out_rate > 0);
+  int divisor = GreatestCommonDivisor(in_rate, out_rate);
+  interpolation_ = out_rate / divisor;
+  decimation_ = in_rate / divisor;
+  assert(interpolation_ <= kMaxPhases);
+  // Zero crossings of the sinc are max(L, M) / kCutoff upsampled samples
+  // apart, a phase covers L of them
+  double span = 2.0 * kZeroCrossings *
+                std::max(interpolation_, decimation_) /
+                (kCutoff * interpolation_);
+  taps_ = (int)std::ceil(span);
+  taps_ = (taps_ + kTapAlignment - 1) / kTapAlignment * kTapAlignment;
+  lookahead_ = taps_ / 2;
+  BuildFilterBank();
+  lines_.resize((size_t)channels_);
+  line_ends_.resize((size_t)channels_);
+  Reset();
+}
+
+int Resampler::Process(const Sample* frames, int frame_count,
+                       std::vector<Sample>& output) {
+  assert(frame_count >= 0);
+  size_t filled = lines_[0].size();
+  for (size_t channel = 0; channel < lines_.size(); ++channel) {
+    lines_[channel].resize(filled + (size_t)frame_count);
+    line_ends_[channel] = lines_[channel].data() + filled;
+  }
+  dsp_.Deinterleave(frames, channels_, 1.0f, line_ends_.data(), frame_count);
+  int64_t line_end = line_start_ + (int64_t)lines_[0].size();
+  int produced = 0;
+  while (next_input_ < line_end) {
+    size_t first = (size_t)(next_input_ - (taps_ - 1) - line_start_);
+    const float* coefs = &coefs_[(size_t)phase_ * (size_t)taps_];
+    for (int channel = 0; channel < channels_; ++channel)
+      output.push_back(
+          ToSample(dsp_.Dot(coefs, &lines_[(size_t)channel][first], taps_)));
+    phase_ += decimation_;
+    next_input_ += phase_ / interpolation_;
+    phase_ %= interpolation_;
+    ++produced;
+  }
+  output_frames_ += produced;
+  // Samples older than the first tap of the next output frame are not needed
+  int64_t keep_from = std::min(next_input_ - (taps_ - 1), line_end);
+  if (keep_from > line_start_) {
+    for (std::vector<float>& line : lines_)
+      line.erase(line.begin(), line.begin() + (keep_from - line_start_));
+    line_start_ = keep_from;
+  }
+  return produced;
+}
+
+void Resampler::Reset() {
+  // The history before the first frame is silence
+  for (std::vector<float>& line : lines_)
+    line.assign((size_t)(taps_ - 1), 0.0f);
+  line_start_ = -(taps_ - 1);
+  next_input_ = lookahead_;
+  phase_ = 0;
+  output_frames_ = 0;
+}
+
+void Resampler::BuildFilterBank() {
+  // Prototype lowpass at the upsampled rate, centered on a multiple of L so
+  // the first output frame is at the first input frame
+  int length = taps_ * interpolation_;
+  double center = length / 2;
+  double cutoff = 0.5 * kCutoff / std::max(interpolation_, decimation_);
+  double window_scale = 1.0 / BesselI0(kKaiserBeta);
+  std::vector<double> prototype((size_t)length);
+  for (int k = 0; k < length; ++k) {
+    double offset = k - center;
+    double sinc = 2.0 * cutoff;
+    if (offset != 0.0)
+      sinc = std::sin(2.0 * kPi * cutoff * offset) / (kPi * offset);
+    double ratio = offset / center;
+    double window =
+        BesselI0(kKaiserBeta * std::sqrt(std::max(0.0, 1.0 - ratio * ratio)));
+    prototype[(size_t)k] = sinc * window * window_scale;
+  }
+  coefs_.resize((size_t)length);
+  for (int phase = 0; phase < interpolation_; ++phase) {
+    // Every phase passes DC unchanged
+    double sum = 0.0;
+    for (int tap = 0; tap < taps_; ++tap)
+      sum += prototype[(size_t)(phase + tap * interpolation_)];
+    for (int tap = 0; tap < taps_; ++tap) {
+      double coef = prototype[(size_t)(phase + tap * interpolation_)] / sum;
+      coefs_[(size_t)(phase * taps_ + taps_ - 1 - tap)] = (float)coef;
+    }
+  }
+}
+
+}  // namespace zamt
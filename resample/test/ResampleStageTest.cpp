@@ -0,0 +1,159 @@
+#include "zamt/core/TestSuite.h"
+#include "zamt/resample/ResampleStage.h"
+
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+using namespace zamt;
+
+static const int in_rate = 44100;
+static const int out_rate = 22050;
+static const int in_frames = 441;  // 10 ms
+static const int out_frames = 256;
+
+struct Collector {
+  std::mutex mutex;
+  std::vector<ResampleStage::Sample> samples;
+  std::vector<Scheduler::Time> timestamps;
+
+  void OnPacket(Scheduler* sch, Scheduler::SourceId source_id,
+                const Scheduler::Byte* packet, Scheduler::Time timestamp) {
+    const ResampleStage::Sample* data = (const ResampleStage::Sample*)packet;
+    size_t size = (size_t)Scheduler::GetSizeOfPacket(packet) /
+                  sizeof(ResampleStage::Sample);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      samples.insert(samples.end(), data, data + size);
+      timestamps.push_back(timestamp);
+    }
+    sch->ReleasePacket(source_id, packet);
+  }
+};
+
+void SubmitConstant(Scheduler& sch, Scheduler::SourceId source_id,
+                    ResampleStage::Sample left, ResampleStage::Sample right,
+                    Scheduler::Time timestamp) {
+  Scheduler::Byte* packet = sch.GetPacketForSubmission(source_id);
+  ASSERT(packet);
+  ResampleStage::Sample* samples = (ResampleStage::Sample*)packet;
+  for (int frame = 0; frame < in_frames; ++frame) {
+    samples[frame * 2] = left;
+    samples[frame * 2 + 1] = right;
+  }
+  sch.SubmitPacket(source_id, packet, timestamp);
+}
+
+void PacketsAreResampledAndTimed() {
+  Scheduler sch(2);
+  Scheduler::SourceId input =
+      sch.RegisterSource("input", in_frames * 2 * 2, 8);
+  ResampleStage stage(&sch, input, 2, in_rate, out_rate, "resampled",
+                      out_frames, 8);
+  EXPECT(sch.FindSource("resampled") == stage.GetSourceId());
+  EXPECT(sch.GetPacketSize(stage.GetSourceId()) == out_frames * 2 * 2);
+  EXPECT(stage.GetOutputRate() == out_rate);
+  Collector collector;
+  int subscription_id;
+  sch.Subscribe(stage.GetSourceId(),
+                std::bind(&Collector::OnPacket, &collector, &sch,
+                          std::placeholders::_1, std::placeholders::_2,
+                          std::placeholders::_3),
+                false, subscription_id);
+  const Scheduler::Time start = 1000000;
+  for (int i = 0; i < 50; ++i) {
+    SubmitConstant(sch, input, 1000, -2000, start + (Scheduler::Time)i * 10000);
+    sch.WaitForIdle();
+  }
+  // Half a second at the output rate held back by 40 input frames
+  ASSERT(collector.timestamps.size() == 42);
+  for (size_t i = 0; i < collector.timestamps.size(); ++i) {
+    Scheduler::Time expected =
+        start + (Scheduler::Time)(i * out_frames * 1000000u / out_rate);
+    EXPECT(collector.timestamps[i] == expected);
+  }
+  // Constants pass after the fade in from silence
+  for (size_t frame = out_frames; frame < collector.samples.size() / 2;
+       ++frame) {
+    EXPECT(std::abs(collector.samples[frame * 2] - 1000) <= 1);
+    EXPECT(std::abs(collector.samples[frame * 2 + 1] + 2000) <= 1);
+  }
+  stage.Stop();
+  sch.Shutdown();
+}
+
+void TimestampsFollowTheInputPackets() {
+  Scheduler sch(1);
+  Scheduler::SourceId input =
+      sch.RegisterSource("input", in_frames * 2 * 2, 8);
+  ResampleStage stage(&sch, input, 2, in_rate, out_rate, "resampled",
+                      out_frames, 8);
+  Collector collector;
+  int subscription_id;
+  sch.Subscribe(stage.GetSourceId(),
+                std::bind(&Collector::OnPacket, &collector, &sch,
+                          std::placeholders::_1, std::placeholders::_2,
+                          std::placeholders::_3),
+                false, subscription_id);
+  // The capture paused for a second after 20 packets
+  for (int i = 0; i < 40; ++i) {
+    Scheduler::Time timestamp = (Scheduler::Time)i * 10000;
+    if (i >= 20) timestamp += 1000000;
+    SubmitConstant(sch, input, 0, 0, timestamp);
+    sch.WaitForIdle();
+  }
+  ASSERT(collector.timestamps.size() > 20);
+  // Packet 18 is the first one starting after the pause
+  EXPECT(collector.timestamps[17] < 200000);
+  EXPECT(collector.timestamps[18] ==
+         1000000 + (Scheduler::Time)18 * out_frames * 1000000 / out_rate);
+  stage.Stop();
+  sch.Shutdown();
+}
+
+void BurstMatchesWholeStream() {
+  Scheduler sch(4);
+  Scheduler::SourceId input =
+      sch.RegisterSource("input", in_frames * 2 * 2, 64);
+  ResampleStage stage(&sch, input, 2, in_rate, out_rate, "resampled",
+                      out_frames, 64);
+  Collector collector;
+  int subscription_id;
+  sch.SubscribeInOrder(stage.GetSourceId(),
+                       std::bind(&Collector::OnPacket, &collector, &sch,
+                                 std::placeholders::_1, std::placeholders::_2,
+                                 std::placeholders::_3),
+                       subscription_id);
+  // Every packet is different, so a swapped pair shows in the output
+  std::vector<ResampleStage::Sample> stream;
+  srand(1);
+  for (int i = 0; i < 50; ++i) {
+    Scheduler::Byte* packet = sch.GetPacketForSubmission(input);
+    ASSERT(packet);
+    ResampleStage::Sample* samples = (ResampleStage::Sample*)packet;
+    for (int sample = 0; sample < in_frames * 2; ++sample)
+      samples[sample] = (ResampleStage::Sample)(rand() % 20000 - 10000);
+    stream.insert(stream.end(), samples, samples + in_frames * 2);
+    sch.SubmitPacket(input, packet, (Scheduler::Time)i * 10000);
+  }
+  sch.WaitForIdle();
+  Resampler resampler(2, in_rate, out_rate);
+  resampler.SetIsa(stage.GetIsa());
+  std::vector<ResampleStage::Sample> expected;
+  resampler.Process(stream.data(), (int)stream.size() / 2, expected);
+  ASSERT(collector.timestamps.size() == 42);
+  ASSERT(expected.size() >= collector.samples.size());
+  for (size_t i = 0; i < collector.samples.size(); ++i)
+    EXPECT(collector.samples[i] == expected[i]);
+  for (size_t i = 1; i < collector.timestamps.size(); ++i)
+    EXPECT(collector.timestamps[i - 1] < collector.timestamps[i]);
+  stage.Stop();
+  sch.Shutdown();
+}
+
+TEST_BEGIN() {
+  PacketsAreResampledAndTimed();
+  TimestampsFollowTheInputPackets();
+  BurstMatchesWholeStream();
+}
+TEST_END()
@@ -0,0 +1,124 @@
+#include "zamt/core/TestSuite.h"
+#include "zamt/resample/Resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+using namespace zamt;
+
+static const double pi = 3.14159265358979323846;
+static const double amplitude = 10000.0;
+
+// Every channel gets a sine of its own frequency
+std::vector<Resampler::Sample> MakeSines(const std::vector<double>& frequencies,
+                                         int sample_rate, int frames) {
+  std::vector<Resampler::Sample> samples;
+  for (int frame = 0; frame < frames; ++frame)
+    for (double frequency : frequencies)
+      samples.push_back((Resampler::Sample)std::lrint(
+          amplitude * std::sin(2.0 * pi * frequency * frame / sample_rate)));
+  return samples;
+}
+
+void RatioIsReduced() {
+  Resampler halving(1, 44100, 22050);
+  EXPECT(halving.GetInterpolation() == 1);
+  EXPECT(halving.GetDecimation() == 2);
+  Resampler resampler(2, 48000, 44100);
+  EXPECT(resampler.GetInterpolation() == 147);
+  EXPECT(resampler.GetDecimation() == 160);
+  EXPECT(resampler.GetTapsPerPhase() % Resampler::kTapAlignment == 0);
+  EXPECT(resampler.GetLookahead() == resampler.GetTapsPerPhase() / 2);
+}
+
+void SinesKeepFrequencyAndAmplitude() {
+  const int in_rate = 48000;
+  const int out_rate = 44100;
+  std::vector<double> frequencies = {1000.0, 5000.0};
+  Resampler resampler(2, in_rate, out_rate);
+  std::vector<Resampler::Sample> output;
+  int produced = resampler.Process(&MakeSines(frequencies, in_rate, in_rate)[0],
+                                   in_rate, output);
+  // Frames up to the lookahead before the end of the input
+  EXPECT(produced == (in_rate - resampler.GetLookahead()) * 147 / 160 + 1);
+  EXPECT(output.size() == (size_t)produced * 2);
+  EXPECT(resampler.GetOutputFrames() == produced);
+  // The start is faded in by the silence before the first frame
+  int settled = resampler.GetTapsPerPhase();
+  std::vector<Resampler::Sample> expected =
+      MakeSines(frequencies, out_rate, produced);
+  int max_error = 0;
+  for (size_t i = (size_t)settled * 2; i < output.size(); ++i)
+    max_error = std::max(max_error, std::abs(output[i] - expected[i]));
+  EXPECT(max_error <= 4);
+}
+
+void AliasesAreFilteredOut() {
+  const int in_rate = 44100;
+  Resampler resampler(1, in_rate, 22050);
+  std::vector<Resampler::Sample> output;
+  // Above the Nyquist rate of the output
+  resampler.Process(&MakeSines({15000.0}, in_rate, in_rate)[0], in_rate,
+                    output);
+  // Only the fade in from silence has energy below it
+  int peak = 0;
+  for (size_t i = (size_t)resampler.GetTapsPerPhase(); i < output.size(); ++i)
+    peak = std::max(peak, std::abs((int)output[i]));
+  EXPECT(peak <= (int)(amplitude / 1000.0));
+}
+
+void ChunksGiveTheSameOutput() {
+  const int in_rate = 44100;
+  std::vector<Resampler::Sample> input =
+      MakeSines({440.0, 3000.0}, in_rate, in_rate / 2);
+  Resampler whole(2, in_rate, 48000);
+  std::vector<Resampler::Sample> expected;
+  whole.Process(&input[0], in_rate / 2, expected);
+  Resampler chunked(2, in_rate, 48000);
+  std::vector<Resampler::Sample> output;
+  int frame = 0;
+  for (int chunk = 0; frame < in_rate / 2; ++chunk) {
+    int frames = std::min(chunk * 37 % 500, in_rate / 2 - frame);
+    chunked.Process(&input[(size_t)frame * 2], frames, output);
+    frame += frames;
+  }
+  EXPECT(output == expected);
+  // It starts over from silence
+  chunked.Reset();
+  output.clear();
+  chunked.Process(&input[0], in_rate / 2, output);
+  EXPECT(output == expected);
+}
+
+void VariantsAgreeWithScalar() {
+  const int in_rate = 44100;
+  std::vector<Resampler::Sample> input =
+      MakeSines({440.0, 7000.0}, in_rate, in_rate / 4);
+  Resampler resampler(2, in_rate, 32000);
+  EXPECT(resampler.GetIsa() == Dsp::GetBestIsa());
+  resampler.SetIsa(Dsp::Isa::kScalar);
+  std::vector<Resampler::Sample> expected;
+  resampler.Process(&input[0], in_rate / 4, expected);
+  for (Dsp::Isa isa :
+       {Dsp::Isa::kSSE42, Dsp::Isa::kAVX2, Dsp::Isa::kAVX512}) {
+    if (!Dsp::IsSupported(isa)) continue;
+    resampler.Reset();
+    resampler.SetIsa(isa);
+    std::vector<Resampler::Sample> output;
+    resampler.Process(&input[0], in_rate / 4, output);
+    ASSERT(output.size() == expected.size());
+    for (size_t i = 0; i < output.size(); ++i)
+      EXPECT(std::abs(output[i] - expected[i]) <= 1);
+  }
+}
+
+TEST_BEGIN() {
+  RatioIsReduced();
+  SinesKeepFrequencyAndAmplitude();
+  AliasesAreFilteredOut();
+  ChunksGiveTheSameOutput();
+  VariantsAgreeWithScalar();
+}
+TEST_END()
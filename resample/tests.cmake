@@ -0,0 +1,17 @@
+set(this_module resample)
+
+
+set(other_modules
+  core
+  dsp
+)
+
+set(test_cpps
+  ResamplerTest.cpp
+)
+AddTest(ResamplerTest ${this_module} "${other_modules}" "${test_cpps}")
+
+set(test_cpps
+  ResampleStageTest.cpp
+)
+AddTest(ResampleStageTest ${this_module} "${other_modules}" "${test_cpps}")
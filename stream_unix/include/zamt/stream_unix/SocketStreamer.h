@@ -0,0 +1,130 @@
+#ifndef ZAMT_STREAM_UNIX_SOCKETSTREAMER_H_
+#define ZAMT_STREAM_UNIX_SOCKETSTREAMER_H_
+
+/// Streams packets of Scheduler sources to local clients over Unix sockets.
+/**
+ * Sinks subscribed to the streamed sources only copy the packet into a ring
+ * of frames in submission order, they never wait for clients. Own thread
+ * moves new frames into a bounded queue for every connected client and
+ * sends as many queued frames as possible with one vectored write. If a
+ * client is too slow and its queue is full, its oldest frames are dropped.
+ *
+ * Every frame is a FrameHeader followed by the packet data. Streams are
+ * numbered in the order they were added with StreamSource().
+ */
+
+#include "zamt/core/CLIParameters.h"
+#include "zamt/core/Module.h"
+#include "zamt/core/Scheduler.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace zamt {
+
+class Log;
+
+class SocketStreamer : public Module {
+ public:
+  const static char* kModuleLabel;
+  const static char* kSocketPathParamStr;
+  const static int kDefaultRingFrames = 32;
+  const static int kDefaultClientQueueFrames = 16;
+  const static int kMaxFramesPerWrite = 32;
+  const static int kMaxSpinCyclesBeforeYield = 256;
+
+  struct FrameHeader {
+    uint32_t stream_index;
+    uint32_t size;  // bytes of data following the header
+    uint64_t timestamp;
+    uint32_t frames_dropped;  // lost for this client since the previous frame
+    uint32_t reserved;
+  };
+
+  static void DeclareDependencies(ModuleDependencies& dependencies);
+  SocketStreamer(int argc, const char* const* argv);
+  ~SocketStreamer();
+  void Initialize(const ModuleCenter* mc);
+  void Shutdown(int exit_code);
+
+  /**
+   * Starts streaming the packets of a registered source to all clients.
+   * The sink keeps the given number of frames until the streaming thread
+   * picks them up. It can be called before this module is initialized.
+   * It is a slow operation done in configuration time.
+   */
+  void StreamSource(Scheduler::SourceId source_id,
+                    int ring_frames = kDefaultRingFrames);
+
+  /**
+   * Starts accepting clients on a Unix socket at the given path (kept as a
+   * pointer). Returns false if listening is not possible.
+   */
+  bool Listen(const char* socket_path);
+
+ private:
+  struct Stream {
+    bool IsStarted() const { return subscription_id >= 0; }
+    Scheduler::SourceId source_id;
+    int ring_frames;
+    int subscription_id = -1;
+    int packet_size = 0;
+    std::vector<Scheduler::Byte> frames;  // ring of packets
+    std::vector<Scheduler::Time> timestamps;
+    // 2n+1 while frame n is written into its slot, 2n+2 after that
+    std::unique_ptr<std::atomic<uint64_t>[]> sequences;
+    std::atomic<uint64_t> frames_written{0};
+  };
+
+  struct Client {
+    int fd;
+    std::vector<uint64_t> next_frames;  // position in every stream's ring
+    std::vector<Scheduler::Byte> queue;  // ring of slots (header and data)
+    std::vector<size_t> frame_sizes;
+    size_t slot_size = 0;
+    int queue_head = 0;
+    int queue_length = 0;
+    size_t head_sent = 0;  // bytes of the head frame already sent
+    uint32_t frames_dropped = 0;
+  };
+
+  void StartStream(Stream& stream);
+  void OnPacket(Stream* stream, Scheduler::SourceId source_id,
+                const Scheduler::Byte* packet, Scheduler::Time timestamp);
+  void WakeUpStreaming();
+  void RunStreamingLoop();
+  void AcceptClient();
+  void CollectFrames(Client& client);
+  bool CopyFrame(Client& client, uint32_t stream_index, const Stream& stream,
+                 uint64_t frame_num);
+  Scheduler::Byte* GetQueueSlot(Client& client, int position);
+  void DropOldest(Client& client);
+  bool SendQueued(Client& client);
+  void PrintHelp();
+
+  static void Lock(std::atomic_flag& mutex);  // yields while it spins
+  static void Unlock(std::atomic_flag& mutex);
+
+  CLIParameters cli_;
+  std::unique_ptr<Log> log_;
+  const ModuleCenter* mc_ = nullptr;
+  Scheduler* scheduler_ = nullptr;
+  const char* socket_path_ = nullptr;
+  int listen_fd_ = -1;
+  int wakeup_fd_ = -1;
+  std::atomic<bool> wakeup_pending_;
+  std::atomic<bool> streaming_should_run_;
+  std::unique_ptr<std::thread> streaming_loop_;
+  std::deque<Stream> streams_;
+  std::atomic_flag streams_mutex_ = ATOMIC_FLAG_INIT;
+  size_t max_packet_size_ = 0;
+  std::vector<Client> clients_;  // streaming thread only
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_STREAM_UNIX_SOCKETSTREAMER_H_
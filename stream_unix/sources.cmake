@@ -0,0 +1,12 @@
+set(module_cpps
+  SocketStreamer.cpp
+)
+
+
+# 3rd party configuration
+
+set(module_includes
+)
+
+set(module_libs
+)
@@ -0,0 +1,396 @@
+#include "zamt/stream_unix/SocketStreamer.h"
+
+#include "zamt/core/Core.h"
+#include "zamt/core/Log.h"
+#include "zamt/core/ModuleCenter.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+namespace zamt {
+
+static_assert(sizeof(SocketStreamer::FrameHeader) == 24,
+              "Frame header is part of the protocol, it should not change.");
+
+const char* SocketStreamer::kModuleLabel = "stream_unix";
+const char* SocketStreamer::kSocketPathParamStr = "-us";
+
+void SocketStreamer::DeclareDependencies(ModuleDependencies& dependencies) {
+  dependencies.Add<Core>();
+}
+
+SocketStreamer::SocketStreamer(int argc, const char* const* argv)
+    : cli_(argc, argv), wakeup_pending_(false), streaming_should_run_(false) {
+  log_.reset(new Log(kModuleLabel, cli_));
+  if (cli_.HasParam(Core::kHelpParamStr)) {
+    PrintHelp();
+    return;
+  }
+  wakeup_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  assert(wakeup_fd_ >= 0);
+}
+
+SocketStreamer::~SocketStreamer() {
+  if (streaming_loop_) {
+    streaming_loop_->join();
+    log_->LogMessage("Streaming thread stopped.");
+  }
+  for (Client& client : clients_) close(client.fd);
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(socket_path_);
+  }
+  if (wakeup_fd_ >= 0) close(wakeup_fd_);
+}
+
+void SocketStreamer::Initialize(const ModuleCenter* mc) {
+  mc_ = mc;
+  if (cli_.HasParam(Core::kHelpParamStr)) return;
+  Core& core = mc_->Get<Core>();
+  core.RegisterForQuitEvent(
+      std::bind(&SocketStreamer::Shutdown, this, std::placeholders::_1));
+  scheduler_ = &core.scheduler();
+  for (Stream& stream : streams_) {
+    StartStream(stream);
+  }
+  const char* socket_path = cli_.GetParam(kSocketPathParamStr);
+  if (socket_path && !Listen(socket_path)) {
+    core.Quit(Core::kExitCodeIPCProblem);
+  }
+}
+
+void SocketStreamer::Shutdown(int /*exit_code*/) {
+  log_->LogMessage("Stopping...");
+  assert(scheduler_);
+  Lock(streams_mutex_);
+  for (Stream& stream : streams_) {
+    if (stream.IsStarted())
+      scheduler_->Unsubscribe(stream.source_id, stream.subscription_id);
+  }
+  Unlock(streams_mutex_);
+  streaming_should_run_.store(false, std::memory_order_release);
+  WakeUpStreaming();
+}
+
+void SocketStreamer::StreamSource(Scheduler::SourceId source_id,
+                                  int ring_frames) {
+  assert(ring_frames > 1);
+  Lock(streams_mutex_);
+  streams_.emplace_back();
+  Stream& stream = streams_.back();
+  stream.source_id = source_id;
+  stream.ring_frames = ring_frames;
+  Unlock(streams_mutex_);
+  if (scheduler_) StartStream(stream);
+}
+
+bool SocketStreamer::Listen(const char* socket_path) {
+  assert(socket_path && !streaming_loop_ && listen_fd_ < 0);
+  sockaddr_un address;
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    log_->LogMessage("Socket path is too long.");
+    return false;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+  struct stat st;
+  if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(socket_path);  // left behind by an earlier run
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    if (fd >= 0) close(fd);
+    log_->LogMessage("Could not listen on socket:");
+    log_->LogMessage(socket_path);
+    return false;
+  }
+  listen_fd_ = fd;
+  socket_path_ = socket_path;
+  log_->LogMessage("Listening on socket:");
+  log_->LogMessage(socket_path);
+  streaming_should_run_.store(true, std::memory_order_release);
+  streaming_loop_.reset(
+      new std::thread(&SocketStreamer::RunStreamingLoop, this));
+  return true;
+}
+
+void SocketStreamer::StartStream(Stream& stream) {
+  assert(scheduler_ && !stream.IsStarted());
+  int packet_size = scheduler_->GetPacketSize(stream.source_id);
+  size_t ring_frames = (size_t)stream.ring_frames;
+  Lock(streams_mutex_);
+  stream.packet_size = packet_size;
+  stream.frames.resize(ring_frames * (size_t)packet_size);
+  stream.timestamps.resize(ring_frames);
+  stream.sequences.reset(new std::atomic<uint64_t>[ring_frames]);
+  for (size_t i = 0; i < ring_frames; ++i) stream.sequences[i].store(0);
+  max_packet_size_ = std::max(max_packet_size_, (size_t)packet_size);
+  // The ring has a single writer and clients expect growing timestamps
+  scheduler_->SubscribeInOrder(
+      stream.source_id,
+      std::bind(&SocketStreamer::OnPacket, this, &stream,
+                std::placeholders::_1, std::placeholders::_2,
+                std::placeholders::_3),
+      stream.subscription_id);
+  Unlock(streams_mutex_);
+}
+
+void SocketStreamer::OnPacket(Stream* stream, Scheduler::SourceId source_id,
+                              const Scheduler::Byte* packet,
+                              Scheduler::Time timestamp) {
+  uint64_t frame_num = stream->frames_written.load(std::memory_order_relaxed);
+  size_t slot = (size_t)(frame_num % (uint64_t)stream->ring_frames);
+  std::atomic<uint64_t>& sequence = stream->sequences[slot];
+  sequence.store(2 * frame_num + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&stream->frames[slot * (size_t)stream->packet_size], packet,
+         (size_t)stream->packet_size);
+  stream->timestamps[slot] = timestamp;
+  sequence.store(2 * frame_num + 2, std::memory_order_release);
+  stream->frames_written.store(frame_num + 1);
+  scheduler_->ReleasePacket(source_id, packet);
+  WakeUpStreaming();
+}
+
+void SocketStreamer::WakeUpStreaming() {
+  // Only the first one calls the kernel until the streaming thread wakes up
+  if (wakeup_fd_ < 0 || wakeup_pending_.exchange(true)) return;
+  uint64_t one = 1;
+  ssize_t written = write(wakeup_fd_, &one, sizeof(one));
+  (void)written;
+}
+
+void SocketStreamer::RunStreamingLoop() {
+  log_->LogMessage("Streaming loop starting up...");
+  std::vector<pollfd> poll_fds;
+  while (streaming_should_run_.load(std::memory_order_acquire)) {
+    poll_fds.clear();
+    poll_fds.push_back({wakeup_fd_, POLLIN, 0});
+    poll_fds.push_back({listen_fd_, POLLIN, 0});
+    for (Client& client : clients_) {
+      short events = client.queue_length > 0 ? (short)(POLLIN | POLLOUT)
+                                             : (short)POLLIN;
+      poll_fds.push_back({client.fd, events, 0});
+    }
+    if (poll(&poll_fds[0], (nfds_t)poll_fds.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      log_->LogMessage("Polling sockets failed.");
+      break;
+    }
+    if (poll_fds[0].revents & POLLIN) {
+      uint64_t wakeups;
+      ssize_t got = read(wakeup_fd_, &wakeups, sizeof(wakeups));
+      (void)got;
+      wakeup_pending_.store(false);
+    }
+    // Going backwards, so disconnected clients can be removed in place
+    for (size_t i = clients_.size(); i-- > 0;) {
+      Client& client = clients_[i];
+      short revents = poll_fds[i + 2].revents;
+      bool alive = !(revents & (POLLERR | POLLHUP | POLLNVAL));
+      if (alive && (revents & POLLIN)) {
+        char ignored[256];
+        ssize_t got = recv(client.fd, ignored, sizeof(ignored), MSG_DONTWAIT);
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+          alive = false;
+      }
+      if (alive) {
+        CollectFrames(client);
+        alive = SendQueued(client);
+      }
+      if (!alive) {
+        close(client.fd);
+        clients_.erase(clients_.begin() + (long)i);
+        log_->LogMessage("Client disconnected.");
+      }
+    }
+    if (poll_fds[1].revents & POLLIN) AcceptClient();
+  }
+  log_->LogMessage("Streaming loop stopping...");
+}
+
+void SocketStreamer::AcceptClient() {
+  int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) return;
+  clients_.emplace_back();
+  Client& client = clients_.back();
+  client.fd = fd;
+  // Clients get the frames written after they connected
+  Lock(streams_mutex_);
+  for (const Stream& stream : streams_) {
+    client.next_frames.push_back(stream.frames_written.load());
+  }
+  Unlock(streams_mutex_);
+  log_->LogMessage("Client connected.");
+}
+
+void SocketStreamer::CollectFrames(Client& client) {
+  Lock(streams_mutex_);
+  size_t slot_size = sizeof(FrameHeader) + max_packet_size_;
+  if (client.slot_size != slot_size) {
+    if (client.head_sent > 0) {
+      // Larger packets came, but the partially sent frame goes first
+      Unlock(streams_mutex_);
+      return;
+    }
+    client.frames_dropped += (uint32_t)client.queue_length;
+    client.queue.assign(slot_size * kDefaultClientQueueFrames, 0);
+    client.frame_sizes.assign(kDefaultClientQueueFrames, 0);
+    client.slot_size = slot_size;
+    client.queue_head = 0;
+    client.queue_length = 0;
+  }
+  while (client.next_frames.size() < streams_.size()) {
+    client.next_frames.push_back(0);
+  }
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    const Stream& stream = streams_[i];
+    if (!stream.IsStarted()) continue;
+    uint64_t written = stream.frames_written.load();
+    uint64_t& next = client.next_frames[i];
+    // The oldest slot may be rewritten at any time, keep a slot of distance
+    uint64_t safe_distance = (uint64_t)stream.ring_frames - 1;
+    if (written - next > safe_distance) {
+      client.frames_dropped += (uint32_t)(written - safe_distance - next);
+      next = written - safe_distance;
+    }
+    for (; next < written; ++next) {
+      if (!CopyFrame(client, (uint32_t)i, stream, next))
+        client.frames_dropped++;
+    }
+  }
+  Unlock(streams_mutex_);
+}
+
+bool SocketStreamer::CopyFrame(Client& client, uint32_t stream_index,
+                               const Stream& stream, uint64_t frame_num) {
+  if (client.queue_length == kDefaultClientQueueFrames) DropOldest(client);
+  if (client.queue_length == kDefaultClientQueueFrames) return false;
+  size_t ring_slot = (size_t)(frame_num % (uint64_t)stream.ring_frames);
+  uint64_t sequence =
+      stream.sequences[ring_slot].load(std::memory_order_acquire);
+  if (sequence != 2 * frame_num + 2) return false;
+  FrameHeader header;
+  header.stream_index = stream_index;
+  header.size = (uint32_t)stream.packet_size;
+  header.timestamp = stream.timestamps[ring_slot];
+  header.reserved = 0;
+  Scheduler::Byte* slot = GetQueueSlot(client, client.queue_length);
+  memcpy(slot + sizeof(FrameHeader),
+         &stream.frames[ring_slot * (size_t)stream.packet_size],
+         (size_t)stream.packet_size);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (stream.sequences[ring_slot].load(std::memory_order_relaxed) != sequence)
+    return false;
+  header.frames_dropped = client.frames_dropped;
+  client.frames_dropped = 0;
+  memcpy(slot, &header, sizeof(header));
+  size_t index = (size_t)((client.queue_head + client.queue_length) %
+                          kDefaultClientQueueFrames);
+  client.frame_sizes[index] = sizeof(FrameHeader) + (size_t)stream.packet_size;
+  client.queue_length++;
+  return true;
+}
+
+Scheduler::Byte* SocketStreamer::GetQueueSlot(Client& client, int position) {
+  size_t index =
+      (size_t)((client.queue_head + position) % kDefaultClientQueueFrames);
+  return &client.queue[index * client.slot_size];
+}
+
+void SocketStreamer::DropOldest(Client& client) {
+  // A partially sent frame has to be finished, the next one is dropped then
+  int victim = client.head_sent > 0 ? 1 : 0;
+  if (victim >= client.queue_length) return;
+  FrameHeader header;
+  memcpy(&header, GetQueueSlot(client, victim), sizeof(header));
+  uint32_t lost = header.frames_dropped + 1;
+  if (victim == 1) {
+    size_t head = (size_t)client.queue_head;
+    size_t second = (head + 1) % kDefaultClientQueueFrames;
+    memcpy(GetQueueSlot(client, 1), GetQueueSlot(client, 0), client.slot_size);
+    client.frame_sizes[second] = client.frame_sizes[head];
+  }
+  client.queue_head = (client.queue_head + 1) % kDefaultClientQueueFrames;
+  client.queue_length--;
+  // The frame following the dropped one reports the loss
+  if (victim < client.queue_length) {
+    Scheduler::Byte* slot = GetQueueSlot(client, victim);
+    memcpy(&header, slot, sizeof(header));
+    header.frames_dropped += lost;
+    memcpy(slot, &header, sizeof(header));
+  } else {
+    client.frames_dropped += lost;
+  }
+}
+
+bool SocketStreamer::SendQueued(Client& client) {
+  while (client.queue_length > 0) {
+    iovec iov[kMaxFramesPerWrite];
+    int frames = std::min(client.queue_length, (int)kMaxFramesPerWrite);
+    for (int i = 0; i < frames; ++i) {
+      size_t index =
+          (size_t)((client.queue_head + i) % kDefaultClientQueueFrames);
+      size_t offset = (i == 0) ? client.head_sent : 0;
+      iov[i].iov_base = &client.queue[index * client.slot_size + offset];
+      iov[i].iov_len = client.frame_sizes[index] - offset;
+    }
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = (size_t)frames;
+    ssize_t sent = sendmsg(client.fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    size_t left = (size_t)sent;
+    while (left > 0) {
+      size_t head = (size_t)client.queue_head;
+      size_t remaining = client.frame_sizes[head] - client.head_sent;
+      if (left < remaining) {
+        client.head_sent += left;
+        break;
+      }
+      left -= remaining;
+      client.head_sent = 0;
+      client.queue_head = (client.queue_head + 1) % kDefaultClientQueueFrames;
+      client.queue_length--;
+    }
+    if (client.head_sent > 0) return true;  // socket buffer is full
+  }
+  return true;
+}
+
+void SocketStreamer::PrintHelp() {
+  Log::Print("ZAMT Unix Socket Streaming Module");
+  Log::Print(
+      " -usPath        Stream results to clients connecting to the Unix"
+      " socket at Path.");
+}
+
+void SocketStreamer::Lock(std::atomic_flag& mutex) {
+  int cycles_left = kMaxSpinCyclesBeforeYield;
+  while (mutex.test_and_set(std::memory_order_acquire)) {
+    if (--cycles_left == 0) {
+      std::this_thread::yield();
+      cycles_left = kMaxSpinCyclesBeforeYield;
+    }
+  }
+}
+
+void SocketStreamer::Unlock(std::atomic_flag& mutex) {
+  mutex.clear(std::memory_order_release);
+}
+
+}  // namespace zamt
@@ -0,0 +1,157 @@
+#include "zamt/core/Core.h"
+#include "zamt/core/ModuleCenter.h"
+#include "zamt/core/Scheduler.h"
+#include "zamt/core/TestSuite.h"
+#include "zamt/stream_unix/SocketStreamer.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace zamt;
+
+const char* params[] = {"exec"};
+const char* kSocketPath = "/tmp/zamt_socketstreamertest";
+static Scheduler::SourceId streamed_source;
+
+void SubmitNumbered(Scheduler& sch, int packet_size, uint32_t number) {
+  Scheduler::Byte* p = nullptr;
+  while (!p) {
+    p = sch.GetPacketForSubmission(streamed_source);
+    std::this_thread::yield();
+  }
+  memset(p, 0, (size_t)packet_size);
+  memcpy(p, &number, sizeof(number));
+  sch.SubmitPacket(streamed_source, p, (Scheduler::Time)number * 1000);
+}
+
+int Connect() {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, kSocketPath);
+  if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool ReadFully(int fd, void* dest, size_t size) {
+  char* p = static_cast<char*>(dest);
+  while (size > 0) {
+    ssize_t got = recv(fd, p, size, 0);
+    if (got <= 0) return false;
+    p += got;
+    size -= (size_t)got;
+  }
+  return true;
+}
+
+bool ReadFrame(int fd, int packet_size, SocketStreamer::FrameHeader& header,
+               uint32_t& number) {
+  std::vector<char> data((size_t)packet_size);
+  if (!ReadFully(fd, &header, sizeof(header))) return false;
+  EXPECT(header.stream_index == 0);
+  EXPECT(header.size == (uint32_t)packet_size);
+  if (!ReadFully(fd, &data[0], data.size())) return false;
+  memcpy(&number, &data[0], sizeof(number));
+  EXPECT(header.timestamp == (Scheduler::Time)number * 1000);
+  return true;
+}
+
+// The streamer accepts clients asynchronously, so numbered packets are sent
+// one by one until the first one arrives. Its number is returned.
+uint32_t WaitForStreaming(Scheduler& sch, int fd, int packet_size,
+                          uint32_t& next_number) {
+  pollfd readable = {fd, POLLIN, 0};
+  do {
+    SubmitNumbered(sch, packet_size, next_number++);
+  } while (poll(&readable, 1, 10) == 0);
+  SocketStreamer::FrameHeader header;
+  uint32_t number = 0;
+  ASSERT(ReadFrame(fd, packet_size, header, number));
+  return number;
+}
+
+void FramesArriveInOrder() {
+  const int kPacketSize = 256;
+  ModuleCenter mc(sizeof(params) / sizeof(char*), params);
+  Core& core = mc.Get<Core>();
+  Core::ReInitExitCode();
+  Scheduler& sch = core.scheduler();
+  streamed_source = sch.RegisterSource("streamed", kPacketSize, 8);
+  SocketStreamer& streamer = mc.Get<SocketStreamer>();
+  streamer.StreamSource(streamed_source);
+  ASSERT(streamer.Listen(kSocketPath));
+  int fd = Connect();
+  ASSERT(fd >= 0);
+  uint32_t next_number = 0;
+  uint32_t expected = WaitForStreaming(sch, fd, kPacketSize, next_number) + 1;
+  // Bursts, so the workers have more packets of the stream at once
+  for (int i = 0; i < 25; ++i) {
+    for (int burst = 0; burst < 4; ++burst)
+      SubmitNumbered(sch, kPacketSize, next_number++);
+    while (expected < next_number) {
+      SocketStreamer::FrameHeader header;
+      uint32_t number = 0;
+      ASSERT(ReadFrame(fd, kPacketSize, header, number));
+      EXPECT(number == expected);
+      EXPECT(header.frames_dropped == 0);
+      expected++;
+    }
+  }
+  core.Quit(0);
+  EXPECT(core.WaitForQuit() == 0);
+  close(fd);
+}
+
+void SlowClientLosesOldestFrames() {
+  const int kPacketSize = 64 * 1024;
+  const uint32_t kPacketsToSend = 200;
+  ModuleCenter mc(sizeof(params) / sizeof(char*), params);
+  Core& core = mc.Get<Core>();
+  Core::ReInitExitCode();
+  Scheduler& sch = core.scheduler();
+  streamed_source = sch.RegisterSource("streamed", kPacketSize, 8);
+  SocketStreamer& streamer = mc.Get<SocketStreamer>();
+  ASSERT(streamer.Listen(kSocketPath));
+  streamer.StreamSource(streamed_source);
+  int fd = Connect();
+  ASSERT(fd >= 0);
+  uint32_t next_number = 0;
+  uint32_t first = WaitForStreaming(sch, fd, kPacketSize, next_number);
+  uint32_t last = next_number + kPacketsToSend - 1;
+  // not reading, the socket and the queue of the client fill up
+  while (next_number <= last) SubmitNumbered(sch, kPacketSize, next_number++);
+  uint32_t received = 0;
+  uint32_t dropped = 0;
+  uint32_t previous = first;
+  for (;;) {
+    SocketStreamer::FrameHeader header;
+    uint32_t number = 0;
+    ASSERT(ReadFrame(fd, kPacketSize, header, number));
+    EXPECT(number > previous);
+    EXPECT(number - previous - 1 == header.frames_dropped);
+    previous = number;
+    received++;
+    dropped += header.frames_dropped;
+    if (number == last) break;
+  }
+  EXPECT(received + dropped == last - first);
+  EXPECT(dropped > 0);
+  core.Quit(0);
+  EXPECT(core.WaitForQuit() == 0);
+  close(fd);
+}
+
+TEST_BEGIN() {
+  FramesArriveInOrder();
+  SlowClientLosesOldestFrames();
+}
+TEST_END()
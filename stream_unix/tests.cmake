@@ -0,0 +1,11 @@
+set(this_module stream_unix)
+
+
+set(other_modules
+  core
+)
+
+set(test_cpps
+  SocketStreamerTest.cpp
+)
+AddTest(SocketStreamerTest ${this_module} "${other_modules}" "${test_cpps}")
@@ -2,7 +2,11 @@
 
 set(modules
   core
+  dsp
+  ipc_shm
   liveaudio_pulse
+  resample
+  stream_unix
   vis_gtk
 )
 AddExe(zamtdemo "${modules}")
@@ -0,0 +1,59 @@
+#ifndef ZAMT_VIS_GTK_MINMAXPYRAMID_H_
+#define ZAMT_VIS_GTK_MINMAXPYRAMID_H_
+
+/// Multi-level min/max summary of a growing audio signal.
+/**
+ * Level 0 keeps the minimum and maximum of every kBaseBlock samples, every
+ * further level combines kFanout ranges of the level below. Ranges are
+ * appended as the samples arrive, so the cost of adding samples does not
+ * depend on the length of the signal. Any part of the signal can be
+ * summarized into columns from the level having ranges just finer than a
+ * column, reading only a few ranges per column at any zoom.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace zamt {
+
+class MinMaxPyramid {
+ public:
+  const static int kBaseBlock = 64;  // samples
+  const static int kFanout = 4;
+
+  struct Range {
+    int16_t min;
+    int16_t max;
+  };
+
+  /// Adds interleaved frames of the given number of channels, their mean is
+  /// summarized.
+  void Append(const int16_t* samples, int frames, int channels);
+
+  /// Number of samples summarized (only complete blocks count).
+  int64_t GetSamples() const;
+
+  /**
+   * Fills columns with the ranges of consecutive parts of the signal, each
+   * having the given number of samples, starting from first_sample.
+   * Returns the number of columns filled, it is less than asked if the
+   * signal ends earlier.
+   */
+  int GetColumns(int64_t first_sample, double samples_per_column, int columns,
+                 Range* ranges) const;
+
+ private:
+  static int64_t GetBlockSize(size_t level);
+  static void Merge(Range& range, Range other);
+  void AddRange(size_t level, Range range);
+  Range Summarize(size_t level, int64_t begin, int64_t end) const;
+
+  std::vector<std::vector<Range>> levels_;
+  Range block_ = {INT16_MAX, INT16_MIN};
+  int block_samples_ = 0;
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_VIS_GTK_MINMAXPYRAMID_H_
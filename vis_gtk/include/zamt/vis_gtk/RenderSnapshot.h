@@ -0,0 +1,60 @@
+#ifndef ZAMT_VIS_GTK_RENDERSNAPSHOT_H_
+#define ZAMT_VIS_GTK_RENDERSNAPSHOT_H_
+
+/// Lock-free triple buffer passing render state from a producer to a renderer.
+/**
+ * The producer fills the back buffer and publishes it, the renderer picks
+ * up the latest published state as its front buffer. Neither side waits for
+ * the other, nothing is allocated after construction and the renderer never
+ * sees a partially written state. States published in between two renders
+ * are skipped. There can be only one producer and one rendering thread.
+ *
+ * The back buffer holds an earlier state when it is handed out, so the
+ * producer has to write all of it.
+ */
+
+#include <atomic>
+
+namespace zamt {
+
+template <typename State>
+class RenderSnapshot {
+ public:
+  RenderSnapshot() : middle_(1) {}
+  RenderSnapshot(const RenderSnapshot&) = delete;
+  RenderSnapshot& operator=(const RenderSnapshot&) = delete;
+
+  /// Producer side: the state to be written before Publish().
+  State& GetBackBuffer() { return buffers_[back_]; }
+
+  /// Producer side: makes the back buffer the latest state.
+  void Publish() {
+    int previous = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel);
+    back_ = previous & kIndexMask;
+  }
+
+  /// Renderer side: takes the latest state if a new one was published since
+  /// the last call. Returns true if the front buffer changed.
+  bool Acquire() {
+    if (!(middle_.load(std::memory_order_relaxed) & kFresh)) return false;
+    int previous = middle_.exchange(front_, std::memory_order_acq_rel);
+    front_ = previous & kIndexMask;
+    return true;
+  }
+
+  /// Renderer side: the state taken by the last Acquire().
+  const State& GetFrontBuffer() const { return buffers_[front_]; }
+
+ private:
+  const static int kIndexMask = 3;
+  const static int kFresh = 4;
+
+  State buffers_[3];
+  std::atomic<int> middle_;  // index of the spare buffer and the fresh bit
+  int back_ = 2;             // producer only
+  int front_ = 0;            // renderer only
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_VIS_GTK_RENDERSNAPSHOT_H_
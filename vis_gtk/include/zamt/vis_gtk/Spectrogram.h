@@ -0,0 +1,53 @@
+#ifndef ZAMT_VIS_GTK_SPECTROGRAM_H_
+#define ZAMT_VIS_GTK_SPECTROGRAM_H_
+
+/// Scrolling spectrogram of a source producing spectral frames.
+/**
+ * Every packet of the source is one frame: an array of float magnitudes
+ * in decibels, the lowest frequency bin first. Spectrogram is an UI sink of
+ * the source, so frames arrive on the rendering thread. They are kept in a
+ * SpectrogramHistory.
+ */
+
+#include "zamt/core/Scheduler.h"
+#include "zamt/vis_gtk/SpectrogramHistory.h"
+
+#include <cairomm/context.h>
+
+namespace zamt {
+
+class ModuleCenter;
+
+class Spectrogram {
+ public:
+  const static int kDefaultColumns = 512;  // frames kept in the history
+  const static int kWindowWidth = 640;
+  const static int kWindowHeight = 480;
+
+  /// Opens a window and subscribes to a registered source having packets
+  /// of the given number of float bins. Magnitudes below min_db are black,
+  /// the ones above max_db have the brightest color.
+  Spectrogram(const ModuleCenter* mc, Scheduler::SourceId source_id,
+              int bins, const char* window_title, float min_db = -100.0f,
+              float max_db = 0.0f, int columns = kDefaultColumns);
+  ~Spectrogram();
+
+  /// Unsubscribes and closes the window. Call it on the quit event.
+  void Stop();
+
+ private:
+  void OnFrame(Scheduler::SourceId source_id, const Scheduler::Byte* packet,
+               Scheduler::Time timestamp);
+  void Draw(const Cairo::RefPtr<Cairo::Context>& cctx, int width, int height);
+
+  const ModuleCenter* mc_;
+  Scheduler* scheduler_;
+  Scheduler::SourceId source_id_;
+  int subscription_id_ = -1;
+  int window_id_ = -1;
+  SpectrogramHistory history_;  // used by the rendering thread only
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_VIS_GTK_SPECTROGRAM_H_
@@ -0,0 +1,62 @@
+#ifndef ZAMT_VIS_GTK_SPECTROGRAMHISTORY_H_
+#define ZAMT_VIS_GTK_SPECTROGRAMHISTORY_H_
+
+/// Pixels of the latest spectral frames in a ring of columns.
+/**
+ * The history is kept in an image surface used as a ring of pixel columns.
+ * A new frame only writes its own column through a colormap lookup table,
+ * drawing blits the ring in two parts to put the oldest column on the left.
+ * So the cost of a frame does not depend on the size of the window.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include <cairomm/context.h>
+#include <cairomm/pattern.h>
+#include <cairomm/surface.h>
+
+namespace zamt {
+
+class SpectrogramHistory {
+ public:
+  const static int kColormapSize = 256;
+
+  /// Magnitudes below min_db are black, the ones above max_db have the
+  /// brightest color.
+  SpectrogramHistory(int bins, int columns, float min_db, float max_db);
+
+  int GetBins() const { return bins_; }
+  int GetColumns() const { return columns_; }
+  int GetColorIndex(float magnitude) const;
+  uint32_t GetColor(int index) const { return colormap_[(size_t)index]; }
+
+  /// Overwrites the oldest column with a frame of bins magnitudes in
+  /// decibels, the lowest frequency bin first.
+  void AddFrame(const float* magnitudes);
+
+  /// Draws the columns from the oldest to the newest over the given area.
+  void Draw(const Cairo::RefPtr<Cairo::Context>& cctx, int width, int height);
+
+  int GetNextColumn() const { return next_column_; }
+  /// Pixels are in the format of the colormap, the lowest bin at the bottom.
+  const Cairo::RefPtr<Cairo::ImageSurface>& GetSurface() const {
+    return history_;
+  }
+
+ private:
+  void BuildColormap();
+
+  int bins_;
+  int columns_;
+  float min_db_;
+  float colormap_scale_;  // colormap entries per decibel
+  std::vector<uint32_t> colormap_;  // in the pixel format of the surface
+  Cairo::RefPtr<Cairo::ImageSurface> history_;
+  Cairo::RefPtr<Cairo::SurfacePattern> history_pattern_;
+  int next_column_ = 0;  // the oldest one, overwritten by the next frame
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_VIS_GTK_SPECTROGRAMHISTORY_H_
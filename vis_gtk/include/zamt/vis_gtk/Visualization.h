@@ -6,8 +6,22 @@
  * This module uses gtkmm to start a main loop using its own rendering thread.
  * Clients can get a new window for drawing using cairomm library.
  * Visualization takes care of Gtk::Application and Gtk::Window creation.
- * One can schedule rendering on the next frame by asking for a callback to the
- * given rendering code on the rendering thread.
+ * Every window has a render callback run on the rendering thread. Producers
+ * only flag that the window needs a new frame, the state to draw is passed
+ * to the renderer through a RenderSnapshot without locks.
+ * Rendering is driven by the frame clock of GTK: a window asked for
+ * rendering ticks with the display until it has nothing new to draw, at
+ * most -fps times per second, so the rendering thread has no periodic
+ * wakeups. Other threads never call GTK or GLib: they flag their requests
+ * (window changes, rendering) and wake the rendering thread up by an
+ * eventfd, which carries them out.
+ * The rendering thread is the UI thread of the Scheduler: the same eventfd
+ * tells it when UI tasks arrive, they are done within a part of the frame
+ * time, so UI sinks can draw without polling.
+ *
+ * With -headless there is no display needed: windows are image surfaces
+ * rendered at the given fps and an encoder thread writes every frame into
+ * PNG files or into a raw video file per window. The API is the same.
  *
  * Leak checkers like address sanitizer can show static allocations as leaks
  * coming from libglib.so (1 alloc) and libfontconfig.so (several alloc)
@@ -16,16 +30,25 @@
 
 #include "zamt/core/CLIParameters.h"
 #include "zamt/core/Module.h"
+#include "zamt/core/Scheduler.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <deque>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
+#include <cairomm/surface.h>
+#include <glibmm/main.h>
 #include <gtkmm/application.h>
 #include <gtkmm/drawingarea.h>
 #include <gtkmm/window.h>
+#include <gtk/gtk.h>
 
 namespace zamt {
 
@@ -36,13 +59,20 @@ class Visualization : public Module {
   const static char* kModuleLabel;
   const static char* kGTKApplicationID;
   const static char* kActivationsPerSecondParamStr;
+  const static char* kHeadlessParamStr;
+  const static char* kHeadlessOutputParamStr;
+  const static char* kHeadlessRawParamStr;
+  const static char* kDefaultHeadlessOutput;
   const static int kActivationsPerSecond = 25;
+  const static int kUITaskBudgetPercent = 50;  // of the frame time
+  const static int kEncoderQueueFrames = 8;
 
   /// This callback is run on rendering thread giving it the context for
   /// drawing and the current width and height of the window (0,0 is top-left).
   using RenderCallback =
       std::function<void(const Cairo::RefPtr<Cairo::Context>&, int, int)>;
 
+  static void DeclareDependencies(ModuleDependencies& dependencies);
   Visualization(int argc, const char* const* argv);
   ~Visualization();
   void Initialize(const ModuleCenter* mc);
@@ -55,29 +85,72 @@ class Visualization : public Module {
   /// Close an opened window.
   void CloseWindow(int window_id);
 
-  /// Ask for a callback from the rendering thread on the next frame.
-  /// There can be only one query in the queue for one window. A second query
-  /// removes the previous one if the previous render have not started yet.
-  void QueryRender(int window_id, RenderCallback render_callback);
+  /// Set the callback drawing the window. It is kept until the window is
+  /// closed and it is also used when the window needs a redraw on its own.
+  /// It is a slow operation done in configuration time.
+  void SetRenderCallback(int window_id, RenderCallback render_callback);
+
+  /// Ask for rendering the window on the next frame. It only sets a flag,
+  /// so it can be called from any thread without waiting. Queries arriving
+  /// before the render starts are merged into one.
+  void QueryRender(int window_id);
 
  private:
   struct Window {
     bool IsEmpty() { return !window_title_; }
-    bool IsInitialized() { return (bool)canvas_; }
-    void OpenWindow(Glib::RefPtr<Gtk::Application>& application);
+    bool IsInitialized() { return canvas_ || surface_; }
+    void OpenWindow(Glib::RefPtr<Gtk::Application>& application,
+                    int64_t min_render_interval_in_us);
+    void OpenHeadless();
     void CloseWindow(Glib::RefPtr<Gtk::Application>& application);
     bool OnDraw(const Cairo::RefPtr<Cairo::Context>& cr);
+    void Render(const Cairo::RefPtr<Cairo::Context>& cr, int width,
+                int height);
+    void StartTicks();
+    static gboolean OnTick(GtkWidget* widget, GdkFrameClock* frame_clock,
+                           gpointer window);
     const char* window_title_ = nullptr;
     int width_;
     int height_;
     std::unique_ptr<Gtk::Window> window_;
     std::unique_ptr<Gtk::DrawingArea> canvas_;
-    RenderCallback queried_callback_;
+    Cairo::RefPtr<Cairo::ImageSurface> surface_;  // in headless mode
+    std::atomic<bool> tick_requested_{false};
+    guint tick_id_ = 0;
+    int64_t min_render_interval_in_us_ = 0;
+    gint64 last_render_time_ = 0;
+    gint64 last_frame_counter_ = 0;
+    uint64_t frames_rendered_ = 0;
+    uint64_t frames_dropped_ = 0;  // frame clock ticks missed while ticking
+    int64_t render_time_sum_in_us_ = 0;
+    int64_t max_render_time_in_us_ = 0;
+    RenderCallback render_callback_;
     std::atomic_flag callback_mutex_ = ATOMIC_FLAG_INIT;
+    std::atomic<bool> render_queried_{false};
+  };
+
+  /// A rendered frame of a headless window waiting for the encoder.
+  struct EncodedFrame {
+    int window_id;
+    int width;
+    int height;
+    int stride;
+    uint64_t frame_num;
+    std::vector<unsigned char> pixels;
   };
 
+  void RequestWindowManagement();
+  void ManageWindows();
+  void StartRequestedTicks();
+  void LogRenderStats(const Window& win, int window_id);
   bool OnTimeout();
+  void WakeUp();
+  bool OnWakeUp(Glib::IOCondition condition);
   void RunMainLoop();
+  void RunHeadlessLoop();
+  void RenderHeadless(Window& win, int window_id);
+  void RunEncoder();
+  void EncodeFrame(const EncodedFrame& frame);
   void PrintHelp();
 
   static std::atomic<bool> shutdown_initiated_;
@@ -87,9 +160,27 @@ class Visualization : public Module {
   std::unique_ptr<Log> log_;
   std::unique_ptr<std::thread> visualization_loop_;
   int activations_per_second_;
+  std::atomic<Scheduler*> scheduler_;
+  int wakeup_fd_ = -1;  // eventfd of requests and UI tasks
   Glib::RefPtr<Gtk::Application> application_;
+  bool headless_ = false;
+  const char* headless_output_ = nullptr;
+  bool headless_raw_ = false;
+  Glib::RefPtr<Glib::MainLoop> headless_loop_;
+  std::unique_ptr<std::thread> encoder_;
+  std::mutex encoder_mutex_;
+  std::condition_variable encoder_cv_;
+  bool encoder_should_run_ = false;
+  std::vector<EncodedFrame> encoder_queue_;  // ring of frames
+  int encoder_queue_head_ = 0;
+  int encoder_queue_length_ = 0;
+  uint64_t frames_dropped_ = 0;
+  std::vector<FILE*> raw_outputs_;  // by window id, encoder thread only
+  bool encoder_failed_ = false;     // encoder thread only
   std::deque<Window> windows_;
   std::atomic_flag windows_mutex_ = ATOMIC_FLAG_INIT;
+  std::atomic<bool> window_management_requested_{false};
+  std::atomic<bool> ticks_requested_{false};
 };
 
 }  // namespace zamt
@@ -0,0 +1,63 @@
+#ifndef ZAMT_VIS_GTK_WAVEFORMOVERVIEW_H_
+#define ZAMT_VIS_GTK_WAVEFORMOVERVIEW_H_
+
+/// Waveform of a whole recording or of its last part, at any length.
+/**
+ * It is an UI sink of a source of interleaved 16 bit audio frames. Every
+ * packet is added to a MinMaxPyramid, so drawing reads only a few ranges
+ * per pixel column and strokes one vertical segment per column, whether
+ * the window shows seconds or hours of audio.
+ */
+
+#include "zamt/core/Scheduler.h"
+#include "zamt/vis_gtk/MinMaxPyramid.h"
+
+#include <atomic>
+#include <vector>
+
+#include <cairomm/context.h>
+
+namespace zamt {
+
+class ModuleCenter;
+
+class WaveformOverview {
+ public:
+  const static int kWindowWidth = 800;
+  const static int kWindowHeight = 240;
+
+  /// Opens a window and subscribes to a registered source. Packets can hold
+  /// any number of frames, even a different number from packet to packet.
+  WaveformOverview(const ModuleCenter* mc, Scheduler::SourceId source_id,
+                   int channels, int sample_rate, const char* window_title);
+  ~WaveformOverview();
+
+  /// Unsubscribes and closes the window. Call it on the quit event.
+  void Stop();
+
+  /// Shows only the last given seconds instead of the whole recording
+  /// (0 means the whole recording). It can be called from any thread.
+  void SetVisibleDuration(int seconds);
+
+ private:
+  void OnPacket(Scheduler::SourceId source_id, const Scheduler::Byte* packet,
+                Scheduler::Time timestamp);
+  void Draw(const Cairo::RefPtr<Cairo::Context>& cctx, int width, int height);
+
+  const ModuleCenter* mc_;
+  Scheduler* scheduler_;
+  Scheduler::SourceId source_id_;
+  int channels_;
+  int sample_rate_;
+  int subscription_id_ = -1;
+  int window_id_ = -1;
+  std::atomic<int> visible_seconds_;
+
+  // Used by the rendering thread only
+  MinMaxPyramid pyramid_;
+  std::vector<MinMaxPyramid::Range> columns_;
+};
+
+}  // namespace zamt
+
+#endif  // ZAMT_VIS_GTK_WAVEFORMOVERVIEW_H_
@@ -1,5 +1,9 @@
 set(module_cpps
+  MinMaxPyramid.cpp
+  Spectrogram.cpp
+  SpectrogramHistory.cpp
   Visualization.cpp
+  WaveformOverview.cpp
 )
 
 
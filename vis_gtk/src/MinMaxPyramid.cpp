@@ -0,0 +1,88 @@
+#include "zamt/vis_gtk/MinMaxPyramid.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace zamt {
+
+void MinMaxPyramid::Append(const int16_t* samples, int frames, int channels) {
+  assert(samples && frames >= 0 && channels > 0);
+  for (int frame = 0; frame < frames; ++frame, samples += channels) {
+    int sum = 0;
+    for (int channel = 0; channel < channels; ++channel)
+      sum += samples[channel];
+    int16_t mean = (int16_t)(sum / channels);
+    if (mean < block_.min) block_.min = mean;
+    if (mean > block_.max) block_.max = mean;
+    if (++block_samples_ < kBaseBlock) continue;
+    AddRange(0, block_);
+    block_.min = INT16_MAX;
+    block_.max = INT16_MIN;
+    block_samples_ = 0;
+  }
+}
+
+int64_t MinMaxPyramid::GetSamples() const {
+  if (levels_.empty()) return 0;
+  return (int64_t)levels_[0].size() * kBaseBlock;
+}
+
+int MinMaxPyramid::GetColumns(int64_t first_sample, double samples_per_column,
+                              int columns, Range* ranges) const {
+  assert(first_sample >= 0 && samples_per_column > 0.0 && ranges);
+  int64_t samples = GetSamples();
+  // The coarsest level still having more ranges than columns
+  size_t level = 0;
+  while (level + 1 < levels_.size() &&
+         (double)GetBlockSize(level + 1) <= samples_per_column)
+    level++;
+  int filled = 0;
+  for (; filled < columns; ++filled) {
+    int64_t begin = first_sample + (int64_t)(filled * samples_per_column);
+    int64_t end = first_sample + (int64_t)((filled + 1) * samples_per_column);
+    if (begin >= samples) break;
+    ranges[filled] = Summarize(level, begin, std::max(end, begin + 1));
+  }
+  return filled;
+}
+
+int64_t MinMaxPyramid::GetBlockSize(size_t level) {
+  int64_t block = kBaseBlock;
+  for (size_t i = 0; i < level; ++i) block *= kFanout;
+  return block;
+}
+
+void MinMaxPyramid::Merge(Range& range, Range other) {
+  if (other.min < range.min) range.min = other.min;
+  if (other.max > range.max) range.max = other.max;
+}
+
+void MinMaxPyramid::AddRange(size_t level, Range range) {
+  if (level >= levels_.size()) levels_.emplace_back();
+  std::vector<Range>& ranges = levels_[level];
+  ranges.push_back(range);
+  if (ranges.size() % kFanout != 0) return;
+  Range combined = ranges[ranges.size() - kFanout];
+  for (size_t i = ranges.size() - kFanout + 1; i < ranges.size(); ++i)
+    Merge(combined, ranges[i]);
+  AddRange(level + 1, combined);
+}
+
+MinMaxPyramid::Range MinMaxPyramid::Summarize(size_t level, int64_t begin,
+                                              int64_t end) const {
+  Range range = {INT16_MAX, INT16_MIN};
+  // Upper levels lag behind, their missing tail is read from lower levels
+  for (;;) {
+    int64_t block = GetBlockSize(level);
+    const std::vector<Range>& ranges = levels_[level];
+    int64_t covered = std::min(end, (int64_t)ranges.size() * block);
+    for (int64_t i = begin / block; i * block < covered; ++i)
+      Merge(range, ranges[(size_t)i]);
+    if (covered >= end || level == 0) break;
+    begin = std::max(begin, covered);
+    level--;
+  }
+  return range;
+}
+
+}  // namespace zamt
@@ -0,0 +1,58 @@
+#include "zamt/vis_gtk/Spectrogram.h"
+
+#include "zamt/core/Core.h"
+#include "zamt/core/ModuleCenter.h"
+#include "zamt/vis_gtk/Visualization.h"
+
+#include <cassert>
+
+namespace zamt {
+
+Spectrogram::Spectrogram(const ModuleCenter* mc, Scheduler::SourceId source_id,
+                         int bins, const char* window_title, float min_db,
+                         float max_db, int columns)
+    : mc_(mc),
+      scheduler_(&mc->Get<Core>().scheduler()),
+      source_id_(source_id),
+      history_(bins, columns, min_db, max_db) {
+  assert(mc_);
+  // OnFrame() reads a magnitude for every bin from each packet
+  assert(scheduler_->GetPacketSize(source_id_) == bins * (int)sizeof(float));
+  Visualization& vis = mc_->Get<Visualization>();
+  vis.OpenWindow(window_title, kWindowWidth, kWindowHeight, window_id_);
+  vis.SetRenderCallback(
+      window_id_, std::bind(&Spectrogram::Draw, this, std::placeholders::_1,
+                            std::placeholders::_2, std::placeholders::_3));
+  scheduler_->Subscribe(
+      source_id_, std::bind(&Spectrogram::OnFrame, this, std::placeholders::_1,
+                            std::placeholders::_2, std::placeholders::_3),
+      true, subscription_id_);
+}
+
+Spectrogram::~Spectrogram() { assert(subscription_id_ < 0); }
+
+void Spectrogram::Stop() {
+  if (subscription_id_ < 0) return;
+  scheduler_->Unsubscribe(source_id_, subscription_id_);
+  subscription_id_ = -1;
+  Visualization& vis = mc_->Get<Visualization>();
+  vis.CloseWindow(window_id_);
+}
+
+void Spectrogram::OnFrame(Scheduler::SourceId source_id,
+                          const Scheduler::Byte* packet,
+                          Scheduler::Time /*timestamp*/) {
+  assert(Scheduler::GetSizeOfPacket(packet) ==
+         history_.GetBins() * (int)sizeof(float));
+  history_.AddFrame((const float*)packet);
+  scheduler_->ReleasePacket(source_id, packet);
+  Visualization& vis = mc_->Get<Visualization>();
+  vis.QueryRender(window_id_);
+}
+
+void Spectrogram::Draw(const Cairo::RefPtr<Cairo::Context>& cctx, int width,
+                       int height) {
+  history_.Draw(cctx, width, height);
+}
+
+}  // namespace zamt
@@ -0,0 +1,93 @@
+#include "zamt/vis_gtk/SpectrogramHistory.h"
+
+#include <cassert>
+
+namespace zamt {
+
+SpectrogramHistory::SpectrogramHistory(int bins, int columns, float min_db,
+                                       float max_db)
+    : bins_(bins),
+      columns_(columns),
+      min_db_(min_db),
+      colormap_scale_((float)(kColormapSize - 1) / (max_db - min_db)) {
+  assert(bins_ > 0 && columns_ > 0 && max_db > min_db);
+  BuildColormap();
+  history_ = Cairo::ImageSurface::create(Cairo::FORMAT_RGB24, columns_, bins_);
+  unsigned char* data = history_->get_data();
+  size_t stride = (size_t)history_->get_stride();
+  for (int y = 0; y < bins_; ++y) {
+    uint32_t* row = (uint32_t*)(data + (size_t)y * stride);
+    for (int x = 0; x < columns_; ++x) row[x] = colormap_[0];
+  }
+  history_->mark_dirty();
+  history_pattern_ = Cairo::SurfacePattern::create(history_);
+  // Columns are stretched to the window, blurring them is not worth it
+  history_pattern_->set_filter(Cairo::FILTER_FAST);
+}
+
+void SpectrogramHistory::BuildColormap() {
+  // Black through purple, red and orange to pale yellow
+  const float kStops[][3] = {{0.0f, 0.0f, 0.0f},
+                             {0.35f, 0.05f, 0.5f},
+                             {0.85f, 0.2f, 0.15f},
+                             {0.98f, 0.6f, 0.05f},
+                             {1.0f, 1.0f, 0.75f}};
+  const int kSegments = sizeof(kStops) / sizeof(kStops[0]) - 1;
+  colormap_.resize(kColormapSize);
+  for (int i = 0; i < kColormapSize; ++i) {
+    float position = (float)i / (kColormapSize - 1) * kSegments;
+    int segment = (int)position;
+    if (segment >= kSegments) segment = kSegments - 1;
+    float ratio = position - (float)segment;
+    uint32_t pixel = 0;
+    for (int channel = 0; channel < 3; ++channel) {
+      float value = kStops[segment][channel] +
+                    (kStops[segment + 1][channel] - kStops[segment][channel]) *
+                        ratio;
+      pixel = (pixel << 8) | (uint32_t)(value * 255.0f + 0.5f);
+    }
+    colormap_[(size_t)i] = pixel;  // 0x00RRGGBB as in FORMAT_RGB24
+  }
+}
+
+int SpectrogramHistory::GetColorIndex(float magnitude) const {
+  float position = (magnitude - min_db_) * colormap_scale_;
+  if (!(position > 0.0f)) return 0;  // NaN is also the lowest
+  if (position >= (float)(kColormapSize - 1)) return kColormapSize - 1;
+  return (int)position;
+}
+
+void SpectrogramHistory::AddFrame(const float* magnitudes) {
+  history_->flush();
+  int stride = history_->get_stride();
+  // The lowest bin is at the bottom
+  unsigned char* pixel = history_->get_data() +
+                         (size_t)(bins_ - 1) * (size_t)stride +
+                         (size_t)next_column_ * sizeof(uint32_t);
+  for (int bin = 0; bin < bins_; ++bin, pixel -= stride) {
+    *(uint32_t*)pixel = colormap_[(size_t)GetColorIndex(magnitudes[bin])];
+  }
+  history_->mark_dirty(next_column_, 0, 1, bins_);
+  if (++next_column_ >= columns_) next_column_ = 0;
+}
+
+void SpectrogramHistory::Draw(const Cairo::RefPtr<Cairo::Context>& cctx,
+                              int width, int height) {
+  cctx->save();
+  cctx->scale((double)width / columns_, (double)height / bins_);
+  // Oldest columns from next_column_ to the end go to the left side
+  int older = columns_ - next_column_;
+  history_pattern_->set_matrix(Cairo::translation_matrix(next_column_, 0.0));
+  cctx->set_source(history_pattern_);
+  cctx->rectangle(0.0, 0.0, older, bins_);
+  cctx->fill();
+  if (next_column_ > 0) {
+    history_pattern_->set_matrix(Cairo::translation_matrix(-older, 0.0));
+    cctx->set_source(history_pattern_);
+    cctx->rectangle(older, 0.0, next_column_, bins_);
+    cctx->fill();
+  }
+  cctx->restore();
+}
+
+}  // namespace zamt
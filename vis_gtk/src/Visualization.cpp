@@ -3,9 +3,14 @@
 #include "zamt/core/Core.h"
 #include "zamt/core/Log.h"
 #include "zamt/core/ModuleCenter.h"
+#include "zamt/core/Trace.h"
 
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <exception>
 
 #include <glibmm/main.h>
 
@@ -14,9 +19,17 @@ namespace zamt {
 const char* Visualization::kModuleLabel = "vis_gtk";
 const char* Visualization::kGTKApplicationID = "hu.lib.zamt";
 const char* Visualization::kActivationsPerSecondParamStr = "-fps";
+const char* Visualization::kHeadlessParamStr = "-headless";
+const char* Visualization::kHeadlessOutputParamStr = "-ho";
+const char* Visualization::kHeadlessRawParamStr = "-hraw";
+const char* Visualization::kDefaultHeadlessOutput = "zamt_vis";
+
+void Visualization::DeclareDependencies(ModuleDependencies& dependencies) {
+  dependencies.Add<Core>();
+}
 
 Visualization::Visualization(int argc, const char* const* argv)
-    : cli_(argc, argv) {
+    : cli_(argc, argv), scheduler_(nullptr) {
   log_.reset(new Log(kModuleLabel, cli_));
   if (cli_.HasParam(Core::kHelpParamStr)) {
     PrintHelp();
@@ -25,6 +38,16 @@ Visualization::Visualization(int argc, const char* const* argv)
   int fps = cli_.GetNumParam(kActivationsPerSecondParamStr);
   activations_per_second_ =
       (fps == CLIParameters::kNotFound) ? kActivationsPerSecond : fps;
+  headless_ = cli_.HasParam(kHeadlessParamStr);
+  if (headless_) {
+    headless_output_ = cli_.GetParam(kHeadlessOutputParamStr);
+    if (!headless_output_ || headless_output_[0] == '\0')
+      headless_output_ = kDefaultHeadlessOutput;
+    headless_raw_ = cli_.HasParam(kHeadlessRawParamStr);
+    encoder_queue_.resize(kEncoderQueueFrames);
+  }
+  wakeup_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  assert(wakeup_fd_ >= 0);
   log_->LogMessage("Starting...");
   visualization_loop_.reset(new std::thread(&Visualization::RunMainLoop, this));
 }
@@ -32,6 +55,7 @@ Visualization::Visualization(int argc, const char* const* argv)
 Visualization::~Visualization() {
   if (!visualization_loop_) return;
   visualization_loop_->join();
+  close(wakeup_fd_);
   log_->LogMessage("Visualization thread stopped.");
 }
 
@@ -40,11 +64,18 @@ void Visualization::Initialize(const ModuleCenter* mc) {
   Core& core = mc_->Get<Core>();
   core.RegisterForQuitEvent(
       std::bind(&Visualization::Shutdown, this, std::placeholders::_1));
+  if (!visualization_loop_) return;
+  scheduler_ = &core.scheduler();
+  scheduler_.load()->SetUITaskNotifier(
+      std::bind(&Visualization::WakeUp, this));
 }
 
 void Visualization::Shutdown(int /*exit_code*/) {
   shutdown_initiated_ = true;
   log_->LogMessage("Stopping...");
+  Scheduler* scheduler = scheduler_.load();
+  if (scheduler) scheduler->SetUITaskNotifier(nullptr);
+  RequestWindowManagement();
 }
 
 void Visualization::OpenWindow(const char* window_title, int width, int height,
@@ -64,31 +95,52 @@ void Visualization::OpenWindow(const char* window_title, int width, int height,
   assert(!windows_[id].IsEmpty() && !windows_[id].IsInitialized());
   window_id = (int)id;
   windows_mutex_.clear(std::memory_order_release);
+  RequestWindowManagement();
 }
 
 void Visualization::CloseWindow(int window_id) {
   while (windows_mutex_.test_and_set(std::memory_order_acquire))
     ;
   size_t id = (size_t)window_id;
-  assert(id < windows_.size() && !windows_[id].IsEmpty() &&
-         windows_[id].IsInitialized());
+  assert(id < windows_.size());
+  // All windows are closed by the rendering thread on shutdown
+  if (shutdown_initiated_ &&
+      (windows_[id].IsEmpty() || !windows_[id].IsInitialized())) {
+    windows_mutex_.clear(std::memory_order_release);
+    return;
+  }
+  assert(!windows_[id].IsEmpty() && windows_[id].IsInitialized());
   windows_[id].window_title_ = nullptr;
   assert(windows_[id].IsEmpty() && windows_[id].IsInitialized());
   windows_mutex_.clear(std::memory_order_release);
+  RequestWindowManagement();
 }
 
-void Visualization::QueryRender(int window_id, RenderCallback render_callback) {
-  assert(render_callback);
+void Visualization::SetRenderCallback(int window_id,
+                                      RenderCallback render_callback) {
   size_t id = (size_t)window_id;
   assert(id < windows_.size() && !windows_[id].IsEmpty());
   while (windows_[id].callback_mutex_.test_and_set(std::memory_order_acquire))
     ;
-  windows_[id].queried_callback_ = render_callback;
+  windows_[id].render_callback_ = render_callback;
   windows_[id].callback_mutex_.clear(std::memory_order_release);
 }
 
+void Visualization::QueryRender(int window_id) {
+  size_t id = (size_t)window_id;
+  assert(id < windows_.size() && !windows_[id].IsEmpty());
+  Window& win = windows_[id];
+  win.render_queried_.store(true);
+  // Frame clock ticks are only requested if they are not running already
+  if (!headless_ && !win.tick_requested_.exchange(true)) {
+    ticks_requested_.store(true);
+    WakeUp();
+  }
+}
+
 void Visualization::Window::OpenWindow(
-    Glib::RefPtr<Gtk::Application>& application) {
+    Glib::RefPtr<Gtk::Application>& application,
+    int64_t min_render_interval_in_us) {
   assert(window_title_ && width_ && height_ && !window_ && !canvas_);
   window_.reset(new Gtk::Window());
   window_->set_title(window_title_);
@@ -100,69 +152,221 @@ void Visualization::Window::OpenWindow(
   canvas_->show();
   canvas_->signal_draw().connect(
       sigc::mem_fun(this, &Visualization::Window::OnDraw), false);
+  min_render_interval_in_us_ = min_render_interval_in_us;
+  frames_rendered_ = 0;
+  frames_dropped_ = 0;
+  render_time_sum_in_us_ = 0;
+  max_render_time_in_us_ = 0;
+  // Queries arrived before opening could not start the ticks
+  if (render_queried_) {
+    tick_requested_ = true;
+    StartTicks();
+  }
+}
+
+void Visualization::Window::StartTicks() {
+  if (!canvas_ || tick_id_) return;
+  last_frame_counter_ = 0;
+  tick_id_ = gtk_widget_add_tick_callback(GTK_WIDGET(canvas_->gobj()),
+                                          &Visualization::Window::OnTick,
+                                          this, nullptr);
+}
+
+gboolean Visualization::Window::OnTick(GtkWidget* /*widget*/,
+                                       GdkFrameClock* frame_clock,
+                                       gpointer window) {
+  Window* win = static_cast<Window*>(window);
+  gint64 frame_counter = gdk_frame_clock_get_frame_counter(frame_clock);
+  if (win->last_frame_counter_ > 0 &&
+      frame_counter > win->last_frame_counter_ + 1)
+    win->frames_dropped_ +=
+        (uint64_t)(frame_counter - win->last_frame_counter_ - 1);
+  win->last_frame_counter_ = frame_counter;
+  if (!win->render_queried_) {
+    // Nothing to render, the frame clock is let to stop. A query arriving
+    // meanwhile either sees the ticks stopped or keeps them running here.
+    win->tick_requested_ = false;
+    if (!win->render_queried_ || win->tick_requested_.exchange(true)) {
+      win->tick_id_ = 0;
+      return G_SOURCE_REMOVE;
+    }
+  }
+  gint64 frame_time = gdk_frame_clock_get_frame_time(frame_clock);
+  if (frame_time - win->last_render_time_ < win->min_render_interval_in_us_)
+    return G_SOURCE_CONTINUE;
+  win->last_render_time_ = frame_time;
+  win->canvas_->queue_draw();
+  return G_SOURCE_CONTINUE;
+}
+
+void Visualization::Window::OpenHeadless() {
+  assert(window_title_ && width_ && height_ && !surface_);
+  surface_ = Cairo::ImageSurface::create(Cairo::FORMAT_RGB24, width_, height_);
+  frames_rendered_ = 0;
 }
 
 void Visualization::Window::CloseWindow(
     Glib::RefPtr<Gtk::Application>& /*application*/) {
-  assert(window_ && window_ && canvas_);
-  window_->unset_application();
+  assert((window_ && canvas_) || surface_);
+  if (tick_id_) {
+    gtk_widget_remove_tick_callback(GTK_WIDGET(canvas_->gobj()), tick_id_);
+    tick_id_ = 0;
+  }
+  tick_requested_ = false;
+  if (window_) window_->unset_application();
   window_.reset(nullptr);
   canvas_.reset(nullptr);
-  queried_callback_ = nullptr;
+  surface_.clear();
+  while (callback_mutex_.test_and_set(std::memory_order_acquire))
+    ;
+  render_callback_ = nullptr;
+  callback_mutex_.clear(std::memory_order_release);
+  render_queried_ = false;
 }
 
 bool Visualization::Window::OnDraw(const Cairo::RefPtr<Cairo::Context>& cr) {
-  if (shutdown_initiated_ || !window_ || !canvas_ || !queried_callback_)
-    return true;
+  if (shutdown_initiated_ || !window_ || !canvas_) return true;
+  auto start = std::chrono::steady_clock::now();
+  Render(cr, canvas_->get_allocated_width(), canvas_->get_allocated_height());
+  int64_t render_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  frames_rendered_++;
+  render_time_sum_in_us_ += render_time;
+  if (render_time > max_render_time_in_us_)
+    max_render_time_in_us_ = render_time;
+  return true;
+}
+
+void Visualization::Window::Render(const Cairo::RefPtr<Cairo::Context>& cr,
+                                   int width, int height) {
+  ZAMT_TRACE_SCOPE("Draw");
+  render_queried_.store(false, std::memory_order_relaxed);
+  // Only contended when the callback is changed in configuration time
   while (callback_mutex_.test_and_set(std::memory_order_acquire))
     ;
-  RenderCallback callback = queried_callback_;
-  queried_callback_ = nullptr;
+  if (render_callback_) render_callback_(cr, width, height);
   callback_mutex_.clear(std::memory_order_release);
-  int width = canvas_->get_allocated_width();
-  int height = canvas_->get_allocated_height();
-  callback(cr, width, height);
-  return true;
 }
 
-bool Visualization::OnTimeout() {
+// Only flags and a write, so it is safe on any thread and in signal handlers
+void Visualization::RequestWindowManagement() {
+  if (window_management_requested_.exchange(true)) return;
+  WakeUp();
+}
+
+void Visualization::StartRequestedTicks() {
+  while (windows_mutex_.test_and_set(std::memory_order_acquire))
+    ;
+  // Not opened yet windows start ticking when they are opened
+  for (Window& win : windows_) {
+    if (!win.IsEmpty() && win.IsInitialized() && win.tick_requested_)
+      win.StartTicks();
+  }
+  windows_mutex_.clear(std::memory_order_release);
+}
+
+void Visualization::ManageWindows() {
   if (shutdown_initiated_) {
-    assert(application_);
-    application_->quit();
-    for (size_t id = 0; id < windows_.size(); ++id) {
-      if (!windows_[id].IsEmpty() && windows_[id].IsInitialized())
-        CloseWindow((int)id);
+    if (headless_) {
+      headless_loop_->quit();
+    } else if (application_) {
+      application_->quit();
     }
+    while (windows_mutex_.test_and_set(std::memory_order_acquire))
+      ;
+    for (Window& win : windows_) win.window_title_ = nullptr;
+    windows_mutex_.clear(std::memory_order_release);
   }
+  int64_t min_render_interval = 1000000 / activations_per_second_;
   for (size_t id = 0; id < windows_.size(); ++id) {
     Window& win = windows_[id];
     while (windows_mutex_.test_and_set(std::memory_order_acquire))
       ;
     if (win.IsEmpty() && win.IsInitialized()) {
+      if (!headless_) LogRenderStats(win, (int)id);
       win.CloseWindow(application_);
       assert(win.IsEmpty() && !win.IsInitialized());
     }
     if (!win.IsEmpty() && !win.IsInitialized()) {
-      win.OpenWindow(application_);
+      if (headless_)
+        win.OpenHeadless();
+      else
+        win.OpenWindow(application_, min_render_interval);
       assert(!win.IsEmpty() && win.IsInitialized());
     }
-    if (win.IsInitialized() && win.queried_callback_) {
-      win.canvas_->queue_draw();
-    }
     windows_mutex_.clear(std::memory_order_release);
   }
-  return !shutdown_initiated_;
+}
+
+void Visualization::LogRenderStats(const Window& win, int window_id) {
+  char message[512];
+  snprintf(message, sizeof(message),
+           "Window %d rendered %llu frames in %lld us on average (max %lld "
+           "us), frame clock ticks dropped: %llu",
+           window_id,
+           (unsigned long long)win.frames_rendered_,
+           (long long)(win.render_time_sum_in_us_ /
+                       (int64_t)(win.frames_rendered_ ? win.frames_rendered_
+                                                      : 1)),
+           (long long)win.max_render_time_in_us_,
+           (unsigned long long)win.frames_dropped_);
+  log_->LogMessage(message);
+}
+
+// Headless windows have no frame clock, they are rendered on a timer
+bool Visualization::OnTimeout() {
+  ManageWindows();
+  if (shutdown_initiated_) return false;
+  for (size_t id = 0; id < windows_.size(); ++id) {
+    Window& win = windows_[id];
+    while (windows_mutex_.test_and_set(std::memory_order_acquire))
+      ;
+    bool is_open = !win.IsEmpty() && win.IsInitialized();
+    windows_mutex_.clear(std::memory_order_release);
+    // Surfaces are only changed on this thread, no need for the lock
+    if (is_open) RenderHeadless(win, (int)id);
+  }
+  return true;
+}
+
+void Visualization::WakeUp() {
+  uint64_t one = 1;
+  ssize_t written = write(wakeup_fd_, &one, sizeof(one));
+  (void)written;
+}
+
+bool Visualization::OnWakeUp(Glib::IOCondition /*condition*/) {
+  uint64_t signals;
+  ssize_t got = read(wakeup_fd_, &signals, sizeof(signals));
+  (void)got;
+  // Other threads only flag their requests, GTK is touched here
+  if (window_management_requested_.exchange(false)) ManageWindows();
+  if (ticks_requested_.exchange(false)) StartRequestedTicks();
+  Scheduler* scheduler = scheduler_.load();
+  if (shutdown_initiated_ || !scheduler) return true;
+  Scheduler::Time budget = 1000000u / (Scheduler::Time)activations_per_second_ *
+                           kUITaskBudgetPercent / 100;
+  // Tasks left are done after the pending events and redraws
+  if (scheduler->DoUITasks(budget)) WakeUp();
+  return true;
 }
 
 void Visualization::RunMainLoop() {
+  if (headless_) {
+    RunHeadlessLoop();
+    return;
+  }
   log_->LogMessage("Visualization mainloop starting up...");
   // int argc = cli_.argc();
   // char** argv = (char**)cli_.argv();
   application_ = Gtk::Application::create(Glib::ustring(kGTKApplicationID));
-  log_->LogMessage("Setting mainloop timer to ", activations_per_second_,
-                   " fps");
-  Glib::signal_timeout().connect(sigc::mem_fun(this, &Visualization::OnTimeout),
-                                 1000 / (unsigned)activations_per_second_);
+  log_->LogMessage("Rendering on the frame clock, capped at ",
+                   activations_per_second_, " fps");
+  // Lower priority than redraws, so UI tasks never starve the frames
+  Glib::signal_io().connect(sigc::mem_fun(this, &Visualization::OnWakeUp),
+                            wakeup_fd_, Glib::IO_IN,
+                            Glib::PRIORITY_DEFAULT_IDLE);
   Gtk::Window about_window;
   about_window.add_label("\n   ZAMT is running...   \n", false,
                          Gtk::ALIGN_CENTER, Gtk::ALIGN_CENTER);
@@ -171,11 +375,162 @@ void Visualization::RunMainLoop() {
   log_->LogMessage("Visualization mainloop stopping...");
 }
 
+void Visualization::RunHeadlessLoop() {
+  char message[1024];
+  snprintf(message, sizeof(message),
+           "Headless visualization loop starting up, output: %s-*%s",
+           headless_output_, headless_raw_ ? ".raw" : ".png");
+  log_->LogMessage(message);
+  Glib::init();
+  headless_loop_ = Glib::MainLoop::create();
+  encoder_should_run_ = true;
+  encoder_.reset(new std::thread(&Visualization::RunEncoder, this));
+  log_->LogMessage("Setting frame timer to ", activations_per_second_, " fps");
+  Glib::signal_timeout().connect(sigc::mem_fun(this, &Visualization::OnTimeout),
+                                 1000 / (unsigned)activations_per_second_);
+  Glib::signal_io().connect(sigc::mem_fun(this, &Visualization::OnWakeUp),
+                            wakeup_fd_, Glib::IO_IN,
+                            Glib::PRIORITY_DEFAULT_IDLE);
+  headless_loop_->run();
+  {
+    std::lock_guard<std::mutex> lock(encoder_mutex_);
+    encoder_should_run_ = false;
+  }
+  encoder_cv_.notify_one();
+  encoder_->join();
+  if (frames_dropped_ > 0)
+    log_->LogMessage("Encoder was late, frames dropped: ",
+                     (int)frames_dropped_);
+  log_->LogMessage("Headless visualization loop stopping...");
+}
+
+void Visualization::RenderHeadless(Window& win, int window_id) {
+  // Not queried windows repeat their previous frame, so the rate is fixed
+  if (win.frames_rendered_ == 0 ||
+      win.render_queried_.load(std::memory_order_acquire)) {
+    Cairo::RefPtr<Cairo::Context> cr = Cairo::Context::create(win.surface_);
+    win.Render(cr, win.width_, win.height_);
+    win.surface_->flush();
+  }
+  uint64_t frame_num = win.frames_rendered_++;
+  std::unique_lock<std::mutex> lock(encoder_mutex_);
+  if (encoder_queue_length_ == kEncoderQueueFrames) {
+    frames_dropped_++;
+    return;
+  }
+  // The slot after the queued ones is not touched by the encoder
+  EncodedFrame& frame =
+      encoder_queue_[(size_t)((encoder_queue_head_ + encoder_queue_length_) %
+                              kEncoderQueueFrames)];
+  lock.unlock();
+  frame.window_id = window_id;
+  frame.width = win.surface_->get_width();
+  frame.height = win.surface_->get_height();
+  frame.stride = win.surface_->get_stride();
+  frame.frame_num = frame_num;
+  const unsigned char* data = win.surface_->get_data();
+  frame.pixels.assign(data, data + (size_t)frame.stride * (size_t)frame.height);
+  lock.lock();
+  encoder_queue_length_++;
+  lock.unlock();
+  encoder_cv_.notify_one();
+}
+
+void Visualization::RunEncoder() {
+  std::unique_lock<std::mutex> lock(encoder_mutex_);
+  for (;;) {
+    encoder_cv_.wait(lock, [this] {
+      return encoder_queue_length_ > 0 || !encoder_should_run_;
+    });
+    // Frames still queued are written before stopping
+    if (encoder_queue_length_ == 0) break;
+    const EncodedFrame& frame = encoder_queue_[(size_t)encoder_queue_head_];
+    lock.unlock();
+    EncodeFrame(frame);
+    lock.lock();
+    encoder_queue_head_ = (encoder_queue_head_ + 1) % kEncoderQueueFrames;
+    encoder_queue_length_--;
+  }
+  lock.unlock();
+  // Buffered rows are written at closing
+  for (FILE* output : raw_outputs_) {
+    if (output && fclose(output) != 0 && !encoder_failed_) {
+      log_->LogMessage("Cannot finish writing raw frames.");
+      encoder_failed_ = true;
+    }
+  }
+  raw_outputs_.clear();
+}
+
+void Visualization::EncodeFrame(const EncodedFrame& frame) {
+  if (encoder_failed_) return;
+  char file_name[1024];
+  char message[1200];
+  if (!headless_raw_) {
+    snprintf(file_name, sizeof(file_name), "%s-%d-%06llu.png",
+             headless_output_, frame.window_id,
+             (unsigned long long)frame.frame_num);
+    Cairo::RefPtr<Cairo::ImageSurface> surface = Cairo::ImageSurface::create(
+        const_cast<unsigned char*>(&frame.pixels[0]), Cairo::FORMAT_RGB24,
+        frame.width, frame.height, frame.stride);
+    // Cairo reports a file it cannot write by throwing
+    try {
+      surface->write_to_png(file_name);
+    } catch (const std::exception& e) {
+      snprintf(message, sizeof(message),
+               "Cannot write %s (%s), encoding stopped.", file_name, e.what());
+      log_->LogMessage(message);
+      encoder_failed_ = true;
+    }
+    return;
+  }
+  if ((size_t)frame.window_id >= raw_outputs_.size())
+    raw_outputs_.resize((size_t)frame.window_id + 1, nullptr);
+  FILE*& output = raw_outputs_[(size_t)frame.window_id];
+  snprintf(file_name, sizeof(file_name), "%s-%d.raw", headless_output_,
+           frame.window_id);
+  if (!output) {
+    output = fopen(file_name, "wb");
+    if (!output) {
+      snprintf(message, sizeof(message), "Cannot open %s, encoding stopped.",
+               file_name);
+      log_->LogMessage(message);
+      encoder_failed_ = true;
+      return;
+    }
+    snprintf(message, sizeof(message),
+             "Writing %dx%d frames of native endian 0x00RRGGBB pixels to %s",
+             frame.width, frame.height, file_name);
+    log_->LogMessage(message);
+  }
+  // Rows are written without the padding of the stride
+  for (int y = 0; y < frame.height; ++y) {
+    if (fwrite(&frame.pixels[(size_t)y * (size_t)frame.stride],
+               sizeof(uint32_t), (size_t)frame.width,
+               output) != (size_t)frame.width) {
+      snprintf(message, sizeof(message), "Cannot write %s, encoding stopped.",
+               file_name);
+      log_->LogMessage(message);
+      encoder_failed_ = true;
+      return;
+    }
+  }
+}
+
 void Visualization::PrintHelp() {
   Log::Print("ZAMT Visualization Module using GTK");
   Log::Print(
-      " -fpsNum        Sets target rendering FPS to Num per seconds instead "
-      "of the default 25.");
+      " -fpsNum        Caps rendering at Num frames per seconds instead of "
+      "the default 25 (fixed frame rate in headless mode).");
+  Log::Print(
+      " -headless      Render windows offscreen without a display and write"
+      " their frames to files.");
+  Log::Print(
+      " -hoPrefix      Start the names of headless output files with Prefix"
+      " (default zamt_vis).");
+  Log::Print(
+      " -hraw          Write a raw video file per window instead of PNG"
+      " files in headless mode.");
 }
 
 std::atomic<bool> Visualization::shutdown_initiated_(false);
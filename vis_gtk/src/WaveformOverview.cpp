@@ -0,0 +1,101 @@
+#include "zamt/vis_gtk/WaveformOverview.h"
+
+#include "zamt/core/Core.h"
+#include "zamt/core/ModuleCenter.h"
+#include "zamt/vis_gtk/Visualization.h"
+
+#include <cassert>
+#include <cstdio>
+
+namespace zamt {
+
+WaveformOverview::WaveformOverview(const ModuleCenter* mc,
+                                   Scheduler::SourceId source_id,
+                                   int channels, int sample_rate,
+                                   const char* window_title)
+    : mc_(mc),
+      scheduler_(&mc->Get<Core>().scheduler()),
+      source_id_(source_id),
+      channels_(channels),
+      sample_rate_(sample_rate),
+      visible_seconds_(0) {
+  assert(mc_ && channels_ > 0 && sample_rate_ > 0);
+  Visualization& vis = mc_->Get<Visualization>();
+  vis.OpenWindow(window_title, kWindowWidth, kWindowHeight, window_id_);
+  vis.SetRenderCallback(
+      window_id_,
+      std::bind(&WaveformOverview::Draw, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3));
+  scheduler_->Subscribe(
+      source_id_,
+      std::bind(&WaveformOverview::OnPacket, this, std::placeholders::_1,
+                std::placeholders::_2, std::placeholders::_3),
+      true, subscription_id_);
+}
+
+WaveformOverview::~WaveformOverview() { assert(subscription_id_ < 0); }
+
+void WaveformOverview::Stop() {
+  if (subscription_id_ < 0) return;
+  scheduler_->Unsubscribe(source_id_, subscription_id_);
+  subscription_id_ = -1;
+  Visualization& vis = mc_->Get<Visualization>();
+  vis.CloseWindow(window_id_);
+}
+
+void WaveformOverview::SetVisibleDuration(int seconds) {
+  assert(seconds >= 0);
+  visible_seconds_.store(seconds, std::memory_order_relaxed);
+  Visualization& vis = mc_->Get<Visualization>();
+  vis.QueryRender(window_id_);
+}
+
+void WaveformOverview::OnPacket(Scheduler::SourceId source_id,
+                                const Scheduler::Byte* packet,
+                                Scheduler::Time /*timestamp*/) {
+  int frames = Scheduler::GetSizeOfPacket(packet) /
+               (channels_ * (int)sizeof(int16_t));
+  pyramid_.Append((const int16_t*)packet, frames, channels_);
+  scheduler_->ReleasePacket(source_id, packet);
+  Visualization& vis = mc_->Get<Visualization>();
+  vis.QueryRender(window_id_);
+}
+
+void WaveformOverview::Draw(const Cairo::RefPtr<Cairo::Context>& cctx,
+                            int width, int height) {
+  cctx->save();
+  cctx->set_source_rgb(0.0, 0.0, 0.0);
+  cctx->paint();
+
+  int64_t samples = pyramid_.GetSamples();
+  int64_t visible = (int64_t)visible_seconds_.load(std::memory_order_relaxed) *
+                    sample_rate_;
+  if (visible == 0 || visible > samples) visible = samples;
+  if (width > 0 && visible > 0) {
+    columns_.resize((size_t)width);
+    double samples_per_column = (double)visible / width;
+    int filled = pyramid_.GetColumns(samples - visible, samples_per_column,
+                                     width, &columns_[0]);
+    double middle = height * 0.5;
+    double value_coef = height / 65536.0;
+    cctx->set_line_width(1.0);
+    cctx->set_source_rgb(0.5, 0.8, 1.0);
+    for (int x = 0; x < filled; ++x) {
+      const MinMaxPyramid::Range& range = columns_[(size_t)x];
+      // Lines in the middle of the pixels, at least one pixel long
+      cctx->move_to(x + 0.5, middle - range.max * value_coef - 0.5);
+      cctx->line_to(x + 0.5, middle - range.min * value_coef + 0.5);
+    }
+    cctx->stroke();
+  }
+
+  char str[128];
+  cctx->set_source_rgb(0.0, 1.0, 0.0);
+  sprintf(str, "%.1f s of %.1f s", (double)visible / sample_rate_,
+          (double)samples / sample_rate_);
+  cctx->move_to(8, 20);
+  cctx->show_text(str);
+  cctx->restore();
+}
+
+}  // namespace zamt
@@ -0,0 +1,162 @@
+#include "zamt/core/TestSuite.h"
+#include "zamt/vis_gtk/MinMaxPyramid.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace zamt;
+
+using Range = MinMaxPyramid::Range;
+
+// Deterministic noise with a slow drift, so ranges differ at every level
+std::vector<int16_t> MakeSignal(int samples) {
+  std::vector<int16_t> signal;
+  uint32_t state = 4321;
+  for (int i = 0; i < samples; ++i) {
+    state = state * 1103515245u + 12345u;
+    int noise = (int)(state >> 16) % 2001 - 1000;
+    int drift = (i / 700) % 40 * 500 - 10000;
+    signal.push_back((int16_t)(noise + drift));
+  }
+  return signal;
+}
+
+// Appends in uneven chunks
+MinMaxPyramid MakePyramid(const std::vector<int16_t>& signal) {
+  MinMaxPyramid pyramid;
+  int appended = 0;
+  for (int chunk = 1; appended < (int)signal.size(); ++chunk) {
+    int frames = std::min(chunk * 97 % 1000, (int)signal.size() - appended);
+    pyramid.Append(&signal[(size_t)appended], frames, 1);
+    appended += frames;
+  }
+  return pyramid;
+}
+
+Range BruteForce(const std::vector<int16_t>& signal, int64_t begin,
+                 int64_t end) {
+  Range range = {INT16_MAX, INT16_MIN};
+  end = std::min(end, (int64_t)signal.size());
+  for (int64_t i = begin; i < end; ++i) {
+    range.min = std::min(range.min, signal[(size_t)i]);
+    range.max = std::max(range.max, signal[(size_t)i]);
+  }
+  return range;
+}
+
+// Block size of the level expected to serve the columns
+int64_t GetBlockFor(double samples_per_column) {
+  int64_t block = MinMaxPyramid::kBaseBlock;
+  while ((double)(block * MinMaxPyramid::kFanout) <= samples_per_column)
+    block *= MinMaxPyramid::kFanout;
+  return block;
+}
+
+/**
+ * Every column holds all of its samples and nothing beyond the blocks of
+ * the expected level it touches. Returns the number of columns got.
+ */
+int CheckColumns(const MinMaxPyramid& pyramid,
+                 const std::vector<int16_t>& signal, int64_t first_sample,
+                 double samples_per_column, int columns) {
+  int64_t samples = pyramid.GetSamples();
+  int64_t block = GetBlockFor(samples_per_column);
+  std::vector<Range> ranges((size_t)columns);
+  int filled = pyramid.GetColumns(first_sample, samples_per_column, columns,
+                                  &ranges[0]);
+  EXPECT(filled >= 0 && filled <= columns);
+  for (int column = 0; column < filled; ++column) {
+    int64_t begin = first_sample + (int64_t)(column * samples_per_column);
+    int64_t end = first_sample + (int64_t)((column + 1) * samples_per_column);
+    end = std::max(end, begin + 1);
+    EXPECT(begin < samples);
+    Range inner = BruteForce(signal, begin, std::min(end, samples));
+    Range outer = BruteForce(signal, begin / block * block,
+                             std::min((end + block - 1) / block * block,
+                                      samples));
+    const Range& range = ranges[(size_t)column];
+    EXPECT(range.min <= inner.min && range.max >= inner.max);
+    EXPECT(range.min >= outer.min && range.max <= outer.max);
+  }
+  // Columns stop only at the end of the signal
+  if (filled < columns) {
+    EXPECT(first_sample + (int64_t)(filled * samples_per_column) >= samples);
+  }
+  return filled;
+}
+
+void CountsOnlyCompleteBlocks() {
+  MinMaxPyramid pyramid;
+  EXPECT(pyramid.GetSamples() == 0);
+  Range range;
+  EXPECT(pyramid.GetColumns(0, 64.0, 1, &range) == 0);
+  std::vector<int16_t> signal = MakeSignal(100);
+  pyramid.Append(&signal[0], 100, 1);
+  EXPECT(pyramid.GetSamples() == MinMaxPyramid::kBaseBlock);
+  EXPECT(pyramid.GetColumns(0, 1000.0, 1, &range) == 1);
+  Range expected = BruteForce(signal, 0, MinMaxPyramid::kBaseBlock);
+  EXPECT(range.min == expected.min && range.max == expected.max);
+}
+
+void ChannelsAreAveraged() {
+  MinMaxPyramid pyramid;
+  std::vector<int16_t> stereo;
+  for (int i = 0; i < MinMaxPyramid::kBaseBlock; ++i) {
+    stereo.push_back((int16_t)(i * 100));
+    stereo.push_back((int16_t)(-i * 50));
+  }
+  pyramid.Append(&stereo[0], MinMaxPyramid::kBaseBlock, 2);
+  Range range;
+  ASSERT(pyramid.GetColumns(0, 64.0, 1, &range) == 1);
+  EXPECT(range.min == 0);
+  EXPECT(range.max == 63 * 25);
+}
+
+void AlignedColumnsAreExact() {
+  // Upper levels lag behind with a partial group at every level
+  const int samples = 64 * 256 * 5 + 64 * 16 * 3 + 64 * 2 + 13;
+  std::vector<int16_t> signal = MakeSignal(samples);
+  MinMaxPyramid pyramid = MakePyramid(signal);
+  int64_t counted = pyramid.GetSamples();
+  EXPECT(counted == samples / 64 * 64);
+  for (int64_t block = 64; block <= 64 * 1024; block *= 4) {
+    std::vector<Range> ranges(100);
+    int filled = pyramid.GetColumns(block, (double)block, 100, &ranges[0]);
+    EXPECT(filled == (int)std::min<int64_t>(100, (counted - 1) / block));
+    for (int column = 0; column < filled; ++column) {
+      int64_t begin = block * (column + 1);
+      Range expected =
+          BruteForce(signal, begin, std::min(begin + block, counted));
+      EXPECT(ranges[(size_t)column].min == expected.min);
+      EXPECT(ranges[(size_t)column].max == expected.max);
+    }
+  }
+}
+
+void ColumnsCoverTheirSamples() {
+  for (int samples : {64 * 4 * 4 * 4 * 4 - 1, 100000, 64 * 1000 + 17}) {
+    std::vector<int16_t> signal = MakeSignal(samples);
+    MinMaxPyramid pyramid = MakePyramid(signal);
+    int64_t counted = pyramid.GetSamples();
+    // Zoomed in below a block per column
+    EXPECT(CheckColumns(pyramid, signal, 5, 0.7, 300) == 300);
+    EXPECT(CheckColumns(pyramid, signal, 1000, 13.5, 200) == 200);
+    // Zoomed out between the block sizes of the levels
+    CheckColumns(pyramid, signal, 0, 100.0, 500);
+    CheckColumns(pyramid, signal, 777, 1500.25, 80);
+    CheckColumns(pyramid, signal, 333, 5000.0, 40);
+    // The whole signal in a few columns, then past its end
+    EXPECT(CheckColumns(pyramid, signal, 0, (double)counted / 7.0, 7) == 7);
+    EXPECT(CheckColumns(pyramid, signal, counted - 100, 64.0, 10) == 2);
+    EXPECT(CheckColumns(pyramid, signal, counted, 64.0, 10) == 0);
+  }
+}
+
+TEST_BEGIN() {
+  CountsOnlyCompleteBlocks();
+  ChannelsAreAveraged();
+  AlignedColumnsAreExact();
+  ColumnsCoverTheirSamples();
+}
+TEST_END()
@@ -0,0 +1,80 @@
+#include "zamt/core/TestSuite.h"
+#include "zamt/vis_gtk/RenderSnapshot.h"
+
+#include <cstdint>
+#include <thread>
+
+using namespace zamt;
+
+// Consistent if all values are the same
+struct State {
+  uint64_t values[64];
+
+  void Fill(uint64_t value) {
+    for (uint64_t& v : values) v = value;
+  }
+  bool IsConsistent() const {
+    for (uint64_t v : values) {
+      if (v != values[0]) return false;
+    }
+    return true;
+  }
+};
+
+void NothingNewIsNotAcquired() {
+  RenderSnapshot<State> snapshot;
+  EXPECT(!snapshot.Acquire());
+  snapshot.GetBackBuffer().Fill(1);
+  snapshot.Publish();
+  EXPECT(snapshot.Acquire());
+  EXPECT(snapshot.GetFrontBuffer().values[0] == 1);
+  EXPECT(!snapshot.Acquire());
+  EXPECT(snapshot.GetFrontBuffer().values[0] == 1);
+}
+
+void LatestStateWins() {
+  RenderSnapshot<State> snapshot;
+  for (uint64_t i = 1; i <= 5; ++i) {
+    snapshot.GetBackBuffer().Fill(i);
+    snapshot.Publish();
+  }
+  EXPECT(snapshot.Acquire());
+  EXPECT(snapshot.GetFrontBuffer().IsConsistent());
+  EXPECT(snapshot.GetFrontBuffer().values[0] == 5);
+  snapshot.GetBackBuffer().Fill(6);
+  snapshot.Publish();
+  EXPECT(snapshot.Acquire());
+  EXPECT(snapshot.GetFrontBuffer().values[0] == 6);
+}
+
+void ReaderNeverSeesTornStates() {
+  const uint64_t kStates = 200000;
+  RenderSnapshot<State> snapshot;
+  std::thread producer([&snapshot, kStates]() {
+    for (uint64_t i = 1; i <= kStates; ++i) {
+      snapshot.GetBackBuffer().Fill(i);
+      snapshot.Publish();
+    }
+  });
+  uint64_t last = 0;
+  int torn = 0;
+  int went_back = 0;
+  while (last < kStates) {
+    if (!snapshot.Acquire()) continue;
+    const State& state = snapshot.GetFrontBuffer();
+    if (!state.IsConsistent()) torn++;
+    if (state.values[0] <= last) went_back++;
+    last = state.values[0];
+  }
+  producer.join();
+  EXPECT(torn == 0);
+  EXPECT(went_back == 0);
+  EXPECT(!snapshot.Acquire());
+}
+
+TEST_BEGIN() {
+  NothingNewIsNotAcquired();
+  LatestStateWins();
+  ReaderNeverSeesTornStates();
+}
+TEST_END()
@@ -0,0 +1,92 @@
+#include "zamt/core/TestSuite.h"
+#include "zamt/vis_gtk/SpectrogramHistory.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace zamt;
+
+static const int bins = 3;
+static const int columns = 4;
+
+// The top byte of FORMAT_RGB24 pixels is unused
+uint32_t GetPixel(const Cairo::RefPtr<Cairo::ImageSurface>& surface, int x,
+                  int y) {
+  surface->flush();
+  const unsigned char* row =
+      surface->get_data() + (size_t)y * (size_t)surface->get_stride();
+  return ((const uint32_t*)row)[x] & 0xffffffu;
+}
+
+// Every frame and bin has its own level
+float GetMagnitude(int frame, int bin) {
+  return -100.0f + (float)frame * 10.0f + (float)bin * 3.0f;
+}
+
+uint32_t GetExpectedColor(const SpectrogramHistory& history, int frame,
+                          int bin) {
+  return history.GetColor(history.GetColorIndex(GetMagnitude(frame, bin)));
+}
+
+void AddFrames(SpectrogramHistory& history, int frames) {
+  std::vector<float> magnitudes((size_t)bins);
+  for (int frame = 0; frame < frames; ++frame) {
+    for (int bin = 0; bin < bins; ++bin)
+      magnitudes[(size_t)bin] = GetMagnitude(frame, bin);
+    history.AddFrame(&magnitudes[0]);
+  }
+}
+
+void ColorIndexIsClamped() {
+  SpectrogramHistory history(bins, columns, -100.0f, 0.0f);
+  const int last = SpectrogramHistory::kColormapSize - 1;
+  EXPECT(history.GetColorIndex(-200.0f) == 0);
+  EXPECT(history.GetColorIndex(-100.0f) == 0);
+  EXPECT(history.GetColorIndex(std::nanf("")) == 0);
+  EXPECT(history.GetColorIndex(-50.0f) == last / 2);
+  EXPECT(history.GetColorIndex(0.0f) == last);
+  EXPECT(history.GetColorIndex(10.0f) == last);
+  EXPECT(history.GetColor(0) == 0x000000u);
+  EXPECT(history.GetColor(last) == 0xffffbfu);
+}
+
+void ColumnsWrapAround() {
+  SpectrogramHistory history(bins, columns, -100.0f, 0.0f);
+  for (int x = 0; x < columns; ++x)
+    for (int y = 0; y < bins; ++y)
+      EXPECT(GetPixel(history.GetSurface(), x, y) == history.GetColor(0));
+  AddFrames(history, 6);
+  EXPECT(history.GetNextColumn() == 2);
+  // Frames 4 and 5 overwrote the columns of frames 0 and 1
+  const int frames_in_columns[] = {4, 5, 2, 3};
+  for (int x = 0; x < columns; ++x) {
+    for (int bin = 0; bin < bins; ++bin) {
+      // The lowest bin is at the bottom
+      EXPECT(GetPixel(history.GetSurface(), x, bins - 1 - bin) ==
+             GetExpectedColor(history, frames_in_columns[x], bin));
+    }
+  }
+}
+
+void DrawPutsOldestColumnLeft() {
+  SpectrogramHistory history(bins, columns, -100.0f, 0.0f);
+  AddFrames(history, 6);
+  Cairo::RefPtr<Cairo::ImageSurface> target =
+      Cairo::ImageSurface::create(Cairo::FORMAT_RGB24, columns, bins);
+  Cairo::RefPtr<Cairo::Context> cctx = Cairo::Context::create(target);
+  history.Draw(cctx, columns, bins);
+  for (int x = 0; x < columns; ++x) {
+    for (int bin = 0; bin < bins; ++bin) {
+      EXPECT(GetPixel(target, x, bins - 1 - bin) ==
+             GetExpectedColor(history, x + 2, bin));
+    }
+  }
+}
+
+TEST_BEGIN() {
+  ColorIndexIsClamped();
+  ColumnsWrapAround();
+  DrawPutsOldestColumnLeft();
+}
+TEST_END()
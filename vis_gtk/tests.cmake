@@ -2,9 +2,20 @@ set(this_module vis_gtk)
 
 
 set(other_modules
+  core
 )
 
 set(test_cpps
+  RenderSnapshotTest.cpp
 )
-#AddTest(SomeTest ${this_module} "${other_modules}" "${test_cpps}")
+AddTest(RenderSnapshotTest ${this_module} "${other_modules}" "${test_cpps}")
 
+set(test_cpps
+  MinMaxPyramidTest.cpp
+)
+AddTest(MinMaxPyramidTest ${this_module} "${other_modules}" "${test_cpps}")
+
+set(test_cpps
+  SpectrogramHistoryTest.cpp
+)
+AddTest(SpectrogramHistoryTest ${this_module} "${other_modules}" "${test_cpps}")